@@ -0,0 +1,315 @@
+// Copyright (c) 2018 The Bitcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "addrindex.h"
+
+#include "chain.h"
+#include "config.h"
+#include "crypto/sha256.h"
+#include "indexbackfill.h"
+#include "primitives/block.h"
+#include "undo.h"
+#include "util.h"
+#include "validation.h"
+
+#include <map>
+
+static const char DB_ADDRESS_HISTORY = 'h';
+static const char DB_ADDRESS_UNSPENT = 'u';
+static const char DB_BEST_BLOCK = 'B';
+
+//! Write size at which Wipe flushes its batch of erasures.
+static const size_t WIPE_BATCH_SIZE = 16 << 20;
+
+CAddressIndex *paddressindex = nullptr;
+
+uint256 GetScriptHash(const CScript &script) {
+    uint256 hash;
+    CSHA256().Write(script.data(), script.size()).Finalize(hash.begin());
+    return hash;
+}
+
+bool CAddressIndexUpdate::Build(const CBlock &block,
+                                const CBlockUndo &blockundo, int nHeight) {
+    if (block.vtx.empty() ||
+        blockundo.vtxundo.size() != block.vtx.size() - 1) {
+        return false;
+    }
+
+    for (size_t i = 0; i < block.vtx.size(); i++) {
+        const CTransaction &tx = *block.vtx[i];
+        const uint256 &txid = tx.GetId();
+        std::map<uint256, Amount> mapDelta;
+
+        if (i > 0) {
+            const CTxUndo &txundo = blockundo.vtxundo[i - 1];
+            if (txundo.vprevout.size() != tx.vin.size()) {
+                return false;
+            }
+            for (size_t j = 0; j < tx.vin.size(); j++) {
+                const Coin &coin = txundo.vprevout[j];
+                const CTxOut &txout = coin.GetTxOut();
+                uint256 scripthash = GetScriptHash(txout.scriptPubKey);
+                mapDelta[scripthash] -= txout.nValue;
+                vInputs.emplace_back(
+                    CAddressUnspentKey(scripthash, tx.vin[j].prevout),
+                    CAddressUnspentValue(txout.nValue, coin.GetHeight()));
+            }
+        }
+
+        for (size_t j = 0; j < tx.vout.size(); j++) {
+            const CTxOut &txout = tx.vout[j];
+            uint256 scripthash = GetScriptHash(txout.scriptPubKey);
+            mapDelta[scripthash] += txout.nValue;
+            if (txout.scriptPubKey.IsUnspendable()) {
+                continue;
+            }
+            vOutputs.emplace_back(
+                CAddressUnspentKey(scripthash, COutPoint(txid, j)),
+                CAddressUnspentValue(txout.nValue, nHeight));
+        }
+
+        for (const auto &delta : mapDelta) {
+            vHistory.emplace_back(
+                CAddressHistoryKey(delta.first, nHeight, txid), delta.second);
+        }
+    }
+
+    return true;
+}
+
+bool CAddressIndexUpdate::ConnectBlock(const CBlock &block,
+                                       const CBlockUndo &blockundo,
+                                       int nHeight) {
+    fConnect = true;
+    return Build(block, blockundo, nHeight);
+}
+
+bool CAddressIndexUpdate::DisconnectBlock(const CBlock &block,
+                                          const CBlockUndo &blockundo,
+                                          int nHeight) {
+    fConnect = false;
+    return Build(block, blockundo, nHeight);
+}
+
+CAddressIndex::CAddressIndex(size_t nCacheSize, bool fMemory, bool fWipe)
+    : db(GetDataDir() / "indexes" / "address", nCacheSize, fMemory, fWipe) {
+    if (!db.Read(DB_BEST_BLOCK, hashBestBlock)) {
+        hashBestBlock.SetNull();
+    }
+}
+
+void CAddressIndex::AddToBatch(CDBBatch &batch,
+                               const CAddressIndexUpdate &update) const {
+    // Outputs spent by the same block they were created in must end up
+    // removed, whichever way the block is applied.
+    if (update.fConnect) {
+        for (const auto &entry : update.vHistory) {
+            batch.Write(std::make_pair(DB_ADDRESS_HISTORY, entry.first),
+                        entry.second);
+        }
+        for (const auto &entry : update.vOutputs) {
+            batch.Write(std::make_pair(DB_ADDRESS_UNSPENT, entry.first),
+                        entry.second);
+        }
+        for (const auto &entry : update.vInputs) {
+            batch.Erase(std::make_pair(DB_ADDRESS_UNSPENT, entry.first));
+        }
+    } else {
+        for (const auto &entry : update.vHistory) {
+            batch.Erase(std::make_pair(DB_ADDRESS_HISTORY, entry.first));
+        }
+        for (const auto &entry : update.vInputs) {
+            batch.Write(std::make_pair(DB_ADDRESS_UNSPENT, entry.first),
+                        entry.second);
+        }
+        for (const auto &entry : update.vOutputs) {
+            batch.Erase(std::make_pair(DB_ADDRESS_UNSPENT, entry.first));
+        }
+    }
+}
+
+bool CAddressIndex::WriteUpdates(
+    const std::vector<CAddressIndexUpdate> &updates,
+    const uint256 &hashBlock) {
+    CDBBatch batch(db);
+    for (const CAddressIndexUpdate &update : updates) {
+        AddToBatch(batch, update);
+    }
+    if (hashBlock.IsNull()) {
+        batch.Erase(DB_BEST_BLOCK);
+    } else {
+        batch.Write(DB_BEST_BLOCK, hashBlock);
+    }
+    if (!db.WriteBatch(batch)) {
+        return false;
+    }
+    hashBestBlock = hashBlock;
+    return true;
+}
+
+bool CAddressIndex::ConnectBlock(const CBlock &block,
+                                 const CBlockUndo &blockundo,
+                                 const CBlockIndex *pindex) {
+    std::vector<CAddressIndexUpdate> updates(1);
+    if (pindex->pprev &&
+        !updates[0].ConnectBlock(block, blockundo, pindex->nHeight)) {
+        return error("%s: undo data does not match block %s", __func__,
+                     pindex->GetBlockHash().ToString());
+    }
+    return WriteUpdates(updates, pindex->GetBlockHash());
+}
+
+bool CAddressIndex::DisconnectBlock(const CBlock &block,
+                                    const CBlockUndo &blockundo,
+                                    const CBlockIndex *pindex) {
+    std::vector<CAddressIndexUpdate> updates(1);
+    if (pindex->pprev &&
+        !updates[0].DisconnectBlock(block, blockundo, pindex->nHeight)) {
+        return error("%s: undo data does not match block %s", __func__,
+                     pindex->GetBlockHash().ToString());
+    }
+    return WriteUpdates(updates, pindex->pprev ? pindex->pprev->GetBlockHash()
+                                               : uint256());
+}
+
+template <typename K>
+static bool EraseRange(CDBWrapper &db, char prefix, const K &start) {
+    std::unique_ptr<CDBIterator> pcursor(db.NewIterator());
+    CDBBatch batch(db);
+    for (pcursor->Seek(std::make_pair(prefix, start)); pcursor->Valid();
+         pcursor->Next()) {
+        std::pair<char, K> key;
+        if (!pcursor->GetKey(key) || key.first != prefix) {
+            break;
+        }
+        batch.Erase(key);
+        if (batch.SizeEstimate() > WIPE_BATCH_SIZE) {
+            if (!db.WriteBatch(batch)) {
+                return false;
+            }
+            batch.Clear();
+        }
+    }
+    return db.WriteBatch(batch);
+}
+
+bool CAddressIndex::Wipe() {
+    if (!EraseRange(db, DB_ADDRESS_HISTORY, CAddressHistoryKey()) ||
+        !EraseRange(db, DB_ADDRESS_UNSPENT, CAddressUnspentKey()) ||
+        !db.Erase(DB_BEST_BLOCK, true)) {
+        return false;
+    }
+    hashBestBlock.SetNull();
+    return true;
+}
+
+bool CAddressIndex::ReadHistory(
+    const uint256 &scripthash,
+    std::vector<std::pair<CAddressHistoryKey, Amount>> &history) const {
+    std::unique_ptr<CDBIterator> pcursor(
+        const_cast<CDBWrapper &>(db).NewIterator());
+    pcursor->Seek(std::make_pair(DB_ADDRESS_HISTORY,
+                                 CAddressHistoryKey(scripthash, 0, uint256())));
+    for (; pcursor->Valid(); pcursor->Next()) {
+        std::pair<char, CAddressHistoryKey> key;
+        if (!pcursor->GetKey(key) || key.first != DB_ADDRESS_HISTORY ||
+            key.second.scripthash != scripthash) {
+            break;
+        }
+        Amount delta;
+        if (!pcursor->GetValue(delta)) {
+            return error("%s: failed to read address history", __func__);
+        }
+        history.emplace_back(key.second, delta);
+    }
+    return true;
+}
+
+bool CAddressIndex::ReadUnspent(
+    const uint256 &scripthash,
+    std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue>> &unspent)
+    const {
+    std::unique_ptr<CDBIterator> pcursor(
+        const_cast<CDBWrapper &>(db).NewIterator());
+    pcursor->Seek(std::make_pair(
+        DB_ADDRESS_UNSPENT,
+        CAddressUnspentKey(scripthash, COutPoint(uint256(), 0))));
+    for (; pcursor->Valid(); pcursor->Next()) {
+        std::pair<char, CAddressUnspentKey> key;
+        if (!pcursor->GetKey(key) || key.first != DB_ADDRESS_UNSPENT ||
+            key.second.scripthash != scripthash) {
+            break;
+        }
+        CAddressUnspentValue value;
+        if (!pcursor->GetValue(value)) {
+            return error("%s: failed to read address unspent outputs",
+                         __func__);
+        }
+        unspent.emplace_back(key.second, value);
+    }
+    return true;
+}
+
+namespace {
+/** Backfill hooks of the address index. */
+class CAddressIndexBackfill : public CIndexBackfill {
+public:
+    explicit CAddressIndexBackfill(const Config &configIn)
+        : CIndexBackfill("Address index", true), config(configIn) {}
+
+    uint256 GetBestBlock() const override {
+        return paddressindex->GetBestBlock();
+    }
+
+    bool Rewind(const CBlockIndex *pindexBest,
+                const CBlockIndex *pindexFork) override {
+        // Disconnect the blocks the index has that are not in the active
+        // chain.
+        for (const CBlockIndex *pindex = pindexBest; pindex != pindexFork;
+             pindex = pindex->pprev) {
+            CBlock block;
+            CBlockUndo blockundo;
+            if (!ReadBlockFromDisk(block, pindex, config) ||
+                !UndoReadFromDisk(blockundo, pindex->GetUndoPos(),
+                                  pindex->pprev->GetBlockHash()) ||
+                !paddressindex->DisconnectBlock(block, blockundo, pindex)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool Wipe() override { return paddressindex->Wipe(); }
+
+    void BeginBatch(size_t nBlocks) override {
+        updates.clear();
+        updates.resize(nBlocks);
+    }
+
+    bool ProcessBlock(size_t i, const CBackfillBlock &entry,
+                      const CBlock &block,
+                      const CBlockUndo &blockundo) override {
+        // The genesis block outputs are not spendable.
+        return entry.hashPrev.IsNull() ||
+               updates[i].ConnectBlock(block, blockundo, entry.nHeight);
+    }
+
+    bool WriteBatch(const CBlockIndex *pindexLast) override {
+        return paddressindex->WriteUpdates(updates,
+                                           pindexLast->GetBlockHash());
+    }
+
+private:
+    const Config &config;
+    std::vector<CAddressIndexUpdate> updates;
+};
+} // namespace
+
+void ThreadAddressIndexBackfill(const Config &config) {
+    RenameThread("bitcoin-addrindex");
+
+    CAddressIndexBackfill backfill(config);
+    ThreadIndexBackfill(config, backfill);
+}
@@ -0,0 +1,190 @@
+// Copyright (c) 2018 The Bitcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_ADDRINDEX_H
+#define BITCOIN_ADDRINDEX_H
+
+#include "amount.h"
+#include "dbwrapper.h"
+#include "primitives/transaction.h"
+#include "serialize.h"
+#include "uint256.h"
+
+#include <utility>
+#include <vector>
+
+class CBlock;
+class CBlockIndex;
+class CBlockUndo;
+class CScript;
+class Config;
+
+//! -addressindex default
+static const bool DEFAULT_ADDRESSINDEX = false;
+//! Max memory allocated to the address index database cache (MiB)
+static const int64_t nMaxAddressIndexCache = 1024;
+
+/**
+ * Identify a scriptPubKey in the address index by its SHA256, so that any
+ * script can be looked up, not only the ones with an address form.
+ */
+uint256 GetScriptHash(const CScript &script);
+
+/** Net change a transaction made to the coins a script can spend. */
+struct CAddressHistoryKey {
+    uint256 scripthash;
+    int nHeight;
+    uint256 txid;
+
+    CAddressHistoryKey() : nHeight(0) {}
+    CAddressHistoryKey(const uint256 &scripthashIn, int nHeightIn,
+                       const uint256 &txidIn)
+        : scripthash(scripthashIn), nHeight(nHeightIn), txid(txidIn) {}
+
+    // Heights are big endian so that history is iterated in height order.
+    template <typename Stream> void Serialize(Stream &s) const {
+        s << scripthash;
+        ser_writedata32be(s, nHeight);
+        s << txid;
+    }
+
+    template <typename Stream> void Unserialize(Stream &s) {
+        s >> scripthash;
+        nHeight = ser_readdata32be(s);
+        s >> txid;
+    }
+
+    friend bool operator<(const CAddressHistoryKey &a,
+                          const CAddressHistoryKey &b) {
+        if (a.scripthash != b.scripthash) {
+            return a.scripthash < b.scripthash;
+        }
+        if (a.nHeight != b.nHeight) {
+            return a.nHeight < b.nHeight;
+        }
+        return a.txid < b.txid;
+    }
+};
+
+/** An output a script can spend. */
+struct CAddressUnspentKey {
+    uint256 scripthash;
+    COutPoint outpoint;
+
+    CAddressUnspentKey() {}
+    CAddressUnspentKey(const uint256 &scripthashIn, const COutPoint &outpointIn)
+        : scripthash(scripthashIn), outpoint(outpointIn) {}
+
+    template <typename Stream> void Serialize(Stream &s) const {
+        s << scripthash;
+        s << outpoint.hash;
+        ser_writedata32be(s, outpoint.n);
+    }
+
+    template <typename Stream> void Unserialize(Stream &s) {
+        s >> scripthash;
+        s >> outpoint.hash;
+        outpoint.n = ser_readdata32be(s);
+    }
+};
+
+struct CAddressUnspentValue {
+    Amount nValue;
+    int nHeight;
+
+    CAddressUnspentValue() : nValue(0), nHeight(0) {}
+    CAddressUnspentValue(Amount nValueIn, int nHeightIn)
+        : nValue(nValueIn), nHeight(nHeightIn) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream &s, Operation ser_action) {
+        READWRITE(nValue);
+        READWRITE(nHeight);
+    }
+};
+
+/**
+ * Changes a block makes to the address index when it is connected or
+ * disconnected. Building them only needs the block and its undo data, so it
+ * can be done concurrently for many blocks before they are written in order.
+ */
+class CAddressIndexUpdate {
+public:
+    //! Return false if the undo data does not match the block.
+    bool ConnectBlock(const CBlock &block, const CBlockUndo &blockundo,
+                      int nHeight);
+    bool DisconnectBlock(const CBlock &block, const CBlockUndo &blockundo,
+                         int nHeight);
+
+private:
+    bool fConnect = true;
+    std::vector<std::pair<CAddressHistoryKey, Amount>> vHistory;
+    //! Outputs created by the block.
+    std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue>> vOutputs;
+    //! Outputs spent by the block.
+    std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue>> vInputs;
+
+    bool Build(const CBlock &block, const CBlockUndo &blockundo, int nHeight);
+
+    friend class CAddressIndex;
+};
+
+/**
+ * Index from script hashes to the transactions that touched them and the
+ * outputs they can spend, kept in its own database (indexes/address/).
+ *
+ * The index records the block it is synced to. ConnectBlock and
+ * DisconnectBlock only apply to the index while it is synced to the tip; it
+ * is otherwise brought up to date by ThreadAddressIndexBackfill. All methods
+ * but the reads must be called with cs_main held.
+ */
+class CAddressIndex {
+public:
+    CAddressIndex(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+
+    //! Block the index is synced to, null if the index is empty.
+    const uint256 &GetBestBlock() const { return hashBestBlock; }
+
+    //! Apply the block connected on top of the best block.
+    bool ConnectBlock(const CBlock &block, const CBlockUndo &blockundo,
+                      const CBlockIndex *pindex);
+    //! Remove the best block, which is being disconnected.
+    bool DisconnectBlock(const CBlock &block, const CBlockUndo &blockundo,
+                         const CBlockIndex *pindex);
+    //! Apply updates in order in a single batch, ending at hashBlock.
+    bool WriteUpdates(const std::vector<CAddressIndexUpdate> &updates,
+                      const uint256 &hashBlock);
+    //! Remove everything from the index.
+    bool Wipe();
+
+    //! History of a script, in height order.
+    bool ReadHistory(
+        const uint256 &scripthash,
+        std::vector<std::pair<CAddressHistoryKey, Amount>> &history) const;
+    //! Outputs a script can spend.
+    bool ReadUnspent(const uint256 &scripthash,
+                     std::vector<std::pair<CAddressUnspentKey,
+                                           CAddressUnspentValue>> &unspent)
+        const;
+
+private:
+    CDBWrapper db;
+    uint256 hashBestBlock;
+
+    void AddToBatch(CDBBatch &batch, const CAddressIndexUpdate &update) const;
+};
+
+/** The address index, or nullptr unless -addressindex is set. */
+extern CAddressIndex *paddressindex;
+
+/**
+ * Bring the address index up to the active chain tip, first rewinding any
+ * blocks it has that left the active chain. Blocks and their undo data are
+ * read and turned into updates from several threads, a batch at a time.
+ */
+void ThreadAddressIndexBackfill(const Config &config);
+
+#endif // BITCOIN_ADDRINDEX_H
@@ -80,24 +80,95 @@ double CAddrInfo::GetChance(int64_t nNow) const {
     return fChance;
 }
 
+size_t CAddrMan::FindAddrPos(const CNetAddr &addr) const {
+    struct in6_addr ip;
+    addr.GetIn6Addr(&ip);
+    size_t nMask = vAddrTable.size() - 1;
+    size_t nPos = CSipHasher(nAddrSalt0, nAddrSalt1)
+                      .Write((const uint8_t *)&ip, sizeof(ip))
+                      .Finalize() &
+                  nMask;
+    while (vAddrTable[nPos] != -1 &&
+           (const CNetAddr &)vInfo[vAddrTable[nPos]] != addr) {
+        nPos = (nPos + 1) & nMask;
+    }
+    return nPos;
+}
+
+void CAddrMan::InsertAddr(const CNetAddr &addr, int nId) {
+    size_t nPos = FindAddrPos(addr);
+    if (vAddrTable[nPos] == -1) {
+        // Keep the load factor at most 3/4 so that probe sequences stay short.
+        if ((nAddrTableCount + 1) * 4 > vAddrTable.size() * 3) {
+            ResizeAddrTable(nAddrTableCount + 1);
+            nPos = FindAddrPos(addr);
+        }
+        nAddrTableCount++;
+    }
+    vAddrTable[nPos] = nId;
+}
+
+void CAddrMan::EraseAddr(const CNetAddr &addr) {
+    size_t nPos = FindAddrPos(addr);
+    if (vAddrTable[nPos] == -1) return;
+    nAddrTableCount--;
+
+    // Move back the entries of the probe sequence that follows, so that no
+    // lookup hits the hole before reaching its entry.
+    size_t nMask = vAddrTable.size() - 1;
+    size_t nHole = nPos;
+    vAddrTable[nHole] = -1;
+    for (size_t n = (nHole + 1) & nMask; vAddrTable[n] != -1;
+         n = (n + 1) & nMask) {
+        int nId = vAddrTable[n];
+        vAddrTable[n] = -1;
+        size_t nNewPos = FindAddrPos(vInfo[nId]);
+        vAddrTable[nNewPos] = nId;
+    }
+}
+
+void CAddrMan::ResizeAddrTable(size_t nCount) {
+    size_t nSize = ADDRMAN_ADDR_TABLE_MIN_SIZE;
+    while (nCount * 4 > nSize * 3) {
+        nSize *= 2;
+    }
+    if (nSize <= vAddrTable.size()) return;
+
+    std::vector<int> vOld(nSize, -1);
+    vOld.swap(vAddrTable);
+    for (int nId : vOld) {
+        if (nId != -1) {
+            vAddrTable[FindAddrPos(vInfo[nId])] = nId;
+        }
+    }
+}
+
+int CAddrMan::AllocateId(const CAddrInfo &info) {
+    if (vFreeIds.empty()) {
+        vInfo.push_back(info);
+        return vInfo.size() - 1;
+    }
+    int nId = vFreeIds.back();
+    vFreeIds.pop_back();
+    vInfo[nId] = info;
+    return nId;
+}
+
 CAddrInfo *CAddrMan::Find(const CNetAddr &addr, int *pnId) {
-    std::map<CNetAddr, int>::iterator it = mapAddr.find(addr);
-    if (it == mapAddr.end()) return nullptr;
-    if (pnId) *pnId = (*it).second;
-    std::map<int, CAddrInfo>::iterator it2 = mapInfo.find((*it).second);
-    if (it2 != mapInfo.end()) return &(*it2).second;
-    return nullptr;
+    int nId = vAddrTable[FindAddrPos(addr)];
+    if (nId == -1) return nullptr;
+    if (pnId) *pnId = nId;
+    return &vInfo[nId];
 }
 
 CAddrInfo *CAddrMan::Create(const CAddress &addr, const CNetAddr &addrSource,
                             int *pnId) {
-    int nId = nIdCount++;
-    mapInfo[nId] = CAddrInfo(addr, addrSource);
-    mapAddr[addr] = nId;
-    mapInfo[nId].nRandomPos = vRandom.size();
+    int nId = AllocateId(CAddrInfo(addr, addrSource));
+    InsertAddr(addr, nId);
+    vInfo[nId].nRandomPos = vRandom.size();
     vRandom.push_back(nId);
     if (pnId) *pnId = nId;
-    return &mapInfo[nId];
+    return &vInfo[nId];
 }
 
 void CAddrMan::SwapRandom(unsigned int nRndPos1, unsigned int nRndPos2) {
@@ -108,26 +179,27 @@ void CAddrMan::SwapRandom(unsigned int nRndPos1, unsigned int nRndPos2) {
     int nId1 = vRandom[nRndPos1];
     int nId2 = vRandom[nRndPos2];
 
-    assert(mapInfo.count(nId1) == 1);
-    assert(mapInfo.count(nId2) == 1);
+    assert(vInfo[nId1].nRandomPos != -1);
+    assert(vInfo[nId2].nRandomPos != -1);
 
-    mapInfo[nId1].nRandomPos = nRndPos2;
-    mapInfo[nId2].nRandomPos = nRndPos1;
+    vInfo[nId1].nRandomPos = nRndPos2;
+    vInfo[nId2].nRandomPos = nRndPos1;
 
     vRandom[nRndPos1] = nId2;
     vRandom[nRndPos2] = nId1;
 }
 
 void CAddrMan::Delete(int nId) {
-    assert(mapInfo.count(nId) != 0);
-    CAddrInfo &info = mapInfo[nId];
+    CAddrInfo &info = vInfo[nId];
+    assert(info.nRandomPos != -1);
     assert(!info.fInTried);
     assert(info.nRefCount == 0);
 
     SwapRandom(info.nRandomPos, vRandom.size() - 1);
     vRandom.pop_back();
-    mapAddr.erase(info);
-    mapInfo.erase(nId);
+    EraseAddr(info);
+    info = CAddrInfo();
+    vFreeIds.push_back(nId);
     nNew--;
 }
 
@@ -135,7 +207,7 @@ void CAddrMan::ClearNew(int nUBucket, int nUBucketPos) {
     // if there is an entry in the specified bucket, delete it.
     if (vvNew[nUBucket][nUBucketPos] != -1) {
         int nIdDelete = vvNew[nUBucket][nUBucketPos];
-        CAddrInfo &infoDelete = mapInfo[nIdDelete];
+        CAddrInfo &infoDelete = vInfo[nIdDelete];
         assert(infoDelete.nRefCount > 0);
         infoDelete.nRefCount--;
         vvNew[nUBucket][nUBucketPos] = -1;
@@ -167,8 +239,8 @@ void CAddrMan::MakeTried(CAddrInfo &info, int nId) {
     if (vvTried[nKBucket][nKBucketPos] != -1) {
         // find an item to evict
         int nIdEvict = vvTried[nKBucket][nKBucketPos];
-        assert(mapInfo.count(nIdEvict) == 1);
-        CAddrInfo &infoOld = mapInfo[nIdEvict];
+        CAddrInfo &infoOld = vInfo[nIdEvict];
+        assert(infoOld.nRandomPos != -1);
 
         // Remove the to-be-evicted item from the tried set.
         infoOld.fInTried = false;
@@ -295,7 +367,7 @@ bool CAddrMan::Add_(const CAddress &addr, const CNetAddr &source,
     if (vvNew[nUBucket][nUBucketPos] != nId) {
         bool fInsert = vvNew[nUBucket][nUBucketPos] == -1;
         if (!fInsert) {
-            CAddrInfo &infoExisting = mapInfo[vvNew[nUBucket][nUBucketPos]];
+            CAddrInfo &infoExisting = vInfo[vvNew[nUBucket][nUBucketPos]];
             if (infoExisting.IsTerrible() ||
                 (infoExisting.nRefCount > 1 && pinfo->nRefCount == 0)) {
                 // Overwrite the existing new table entry.
@@ -359,8 +431,8 @@ CAddrInfo CAddrMan::Select_(bool newOnly) {
                     ADDRMAN_BUCKET_SIZE;
             }
             int nId = vvTried[nKBucket][nKBucketPos];
-            assert(mapInfo.count(nId) == 1);
-            CAddrInfo &info = mapInfo[nId];
+            CAddrInfo &info = vInfo[nId];
+            assert(info.nRandomPos != -1);
             if (RandomInt(1 << 30) <
                 fChanceFactor * info.GetChance() * (1 << 30)) {
                 return info;
@@ -384,8 +456,8 @@ CAddrInfo CAddrMan::Select_(bool newOnly) {
                     ADDRMAN_BUCKET_SIZE;
             }
             int nId = vvNew[nUBucket][nUBucketPos];
-            assert(mapInfo.count(nId) == 1);
-            CAddrInfo &info = mapInfo[nId];
+            CAddrInfo &info = vInfo[nId];
+            assert(info.nRandomPos != -1);
             if (RandomInt(1 << 30) <
                 fChanceFactor * info.GetChance() * (1 << 30))
                 return info;
@@ -401,10 +473,12 @@ int CAddrMan::Check_() {
 
     if (vRandom.size() != nTried + nNew) return -7;
 
-    for (std::map<int, CAddrInfo>::iterator it = mapInfo.begin();
-         it != mapInfo.end(); it++) {
-        int n = (*it).first;
-        CAddrInfo &info = (*it).second;
+    if (vInfo.size() != vRandom.size() + vFreeIds.size()) return -20;
+    if (nAddrTableCount != vRandom.size()) return -21;
+
+    for (int n = 0; n < int(vInfo.size()); n++) {
+        CAddrInfo &info = vInfo[n];
+        if (info.nRandomPos == -1) continue;
         if (info.fInTried) {
             if (!info.nLastSuccess) return -1;
             if (info.nRefCount) return -2;
@@ -416,7 +490,7 @@ int CAddrMan::Check_() {
             if (!info.nRefCount) return -4;
             mapNew[n] = info.nRefCount;
         }
-        if (mapAddr[info] != n) return -5;
+        if (vAddrTable[FindAddrPos(info)] != n) return -5;
         if (info.nRandomPos < 0 || info.nRandomPos >= vRandom.size() ||
             vRandom[info.nRandomPos] != n)
             return -14;
@@ -431,9 +505,9 @@ int CAddrMan::Check_() {
         for (int i = 0; i < ADDRMAN_BUCKET_SIZE; i++) {
             if (vvTried[n][i] != -1) {
                 if (!setTried.count(vvTried[n][i])) return -11;
-                if (mapInfo[vvTried[n][i]].GetTriedBucket(nKey) != n)
+                if (vInfo[vvTried[n][i]].GetTriedBucket(nKey) != n)
                     return -17;
-                if (mapInfo[vvTried[n][i]].GetBucketPosition(nKey, false, n) !=
+                if (vInfo[vvTried[n][i]].GetBucketPosition(nKey, false, n) !=
                     i)
                     return -18;
                 setTried.erase(vvTried[n][i]);
@@ -445,7 +519,7 @@ int CAddrMan::Check_() {
         for (int i = 0; i < ADDRMAN_BUCKET_SIZE; i++) {
             if (vvNew[n][i] != -1) {
                 if (!mapNew.count(vvNew[n][i])) return -12;
-                if (mapInfo[vvNew[n][i]].GetBucketPosition(nKey, true, n) != i)
+                if (vInfo[vvNew[n][i]].GetBucketPosition(nKey, true, n) != i)
                     return -19;
                 if (--mapNew[vvNew[n][i]] == 0) mapNew.erase(vvNew[n][i]);
             }
@@ -470,9 +544,8 @@ void CAddrMan::GetAddr_(std::vector<CAddress> &vAddr) {
 
         int nRndPos = RandomInt(vRandom.size() - n) + n;
         SwapRandom(n, nRndPos);
-        assert(mapInfo.count(vRandom[n]) == 1);
-
-        const CAddrInfo &ai = mapInfo[vRandom[n]];
+        const CAddrInfo &ai = vInfo[vRandom[n]];
+        assert(ai.nRandomPos != -1);
         if (!ai.IsTerrible()) vAddr.push_back(ai);
     }
 }
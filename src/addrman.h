@@ -14,7 +14,7 @@
 #include "util.h"
 
 #include <cstdint>
-#include <map>
+#include <limits>
 #include <set>
 #include <vector>
 
@@ -186,6 +186,9 @@ public:
 #define ADDRMAN_NEW_BUCKET_COUNT (1 << ADDRMAN_NEW_BUCKET_COUNT_LOG2)
 #define ADDRMAN_BUCKET_SIZE (1 << ADDRMAN_BUCKET_SIZE_LOG2)
 
+//! initial number of slots in the address lookup table (a power of two)
+#define ADDRMAN_ADDR_TABLE_MIN_SIZE 1024
+
 /**
  * Stochastical (IP) address manager
  */
@@ -194,14 +197,23 @@ private:
     //! critical section to protect the inner data structures
     mutable CCriticalSection cs;
 
-    //! last used nId
-    int nIdCount;
+    //! table with information about all nIds, indexed by nId. Unused entries
+    //! have nRandomPos == -1 and their nId is in vFreeIds.
+    std::vector<CAddrInfo> vInfo;
+
+    //! unused nIds, reused before vInfo is grown
+    std::vector<int> vFreeIds;
+
+    //! find an nId based on its network address: open addressing hash table
+    //! with linear probing, holding nIds or -1 for empty slots. Its size is a
+    //! power of two.
+    std::vector<int> vAddrTable;
 
-    //! table with information about all nIds
-    std::map<int, CAddrInfo> mapInfo;
+    //! number of nIds in vAddrTable
+    size_t nAddrTableCount;
 
-    //! find an nId based on its network address
-    std::map<CNetAddr, int> mapAddr;
+    //! salt for the vAddrTable hash
+    uint64_t nAddrSalt0, nAddrSalt1;
 
     //! randomly-ordered vector of all nIds
     std::vector<int> vRandom;
@@ -236,6 +248,22 @@ protected:
     CAddrInfo *Create(const CAddress &addr, const CNetAddr &addrSource,
                       int *pnId = nullptr);
 
+    //! Position of addr in vAddrTable, or of the empty slot where it would be
+    //! inserted.
+    size_t FindAddrPos(const CNetAddr &addr) const;
+
+    //! Map addr to nId in vAddrTable, replacing any previous mapping.
+    void InsertAddr(const CNetAddr &addr, int nId);
+
+    //! Remove addr from vAddrTable, if it is there.
+    void EraseAddr(const CNetAddr &addr);
+
+    //! Rebuild vAddrTable with room for nCount addresses.
+    void ResizeAddrTable(size_t nCount);
+
+    //! Store a new entry in vInfo and return its nId.
+    int AllocateId(const CAddrInfo &info);
+
     //! Swap two elements in vRandom.
     void SwapRandom(unsigned int nRandomPos1, unsigned int nRandomPos2);
 
@@ -300,7 +328,7 @@ public:
      * v0 detect it as incompatible. This is necessary because it did not check
      * the version number on deserialization.
      *
-     * Notice that vvTried, mapAddr and vVector are never encoded explicitly;
+     * Notice that vvTried, vAddrTable and vRandom are never encoded explicitly;
      * they are instead reconstructed from the other information.
      *
      * vvNew is serialized, but only used if ADDRMAN_UNKNOWN_BUCKET_COUNT didn't
@@ -325,12 +353,14 @@ public:
 
         int nUBuckets = ADDRMAN_NEW_BUCKET_COUNT ^ (1 << 30);
         s << nUBuckets;
-        std::map<int, int> mapUnkIds;
+        std::vector<int> vUnkIds(vInfo.size(), -1);
         int nIds = 0;
-        for (std::map<int, CAddrInfo>::const_iterator it = mapInfo.begin();
-             it != mapInfo.end(); it++) {
-            mapUnkIds[(*it).first] = nIds;
-            const CAddrInfo &info = (*it).second;
+        for (size_t n = 0; n < vInfo.size(); n++) {
+            const CAddrInfo &info = vInfo[n];
+            if (info.nRandomPos == -1) {
+                continue;
+            }
+            vUnkIds[n] = nIds;
             if (info.nRefCount) {
                 // this means nNew was wrong, oh ow
                 assert(nIds != nNew);
@@ -339,9 +369,10 @@ public:
             }
         }
         nIds = 0;
-        for (std::map<int, CAddrInfo>::const_iterator it = mapInfo.begin();
-             it != mapInfo.end(); it++) {
-            const CAddrInfo &info = (*it).second;
+        for (const CAddrInfo &info : vInfo) {
+            if (info.nRandomPos == -1) {
+                continue;
+            }
             if (info.fInTried) {
                 // this means nTried was wrong, oh ow
                 assert(nIds != nTried);
@@ -357,7 +388,7 @@ public:
             s << nSize;
             for (int i = 0; i < ADDRMAN_BUCKET_SIZE; i++) {
                 if (vvNew[bucket][i] != -1) {
-                    int nIndex = mapUnkIds[vvNew[bucket][i]];
+                    int nIndex = vUnkIds[vvNew[bucket][i]];
                     s << nIndex;
                 }
             }
@@ -395,11 +426,16 @@ public:
                 "Corrupt CAddrMan serialization, nTried exceeds limit.");
         }
 
+        // All entries are stored in place, without allocating for each.
+        vInfo.reserve(nNew + nTried);
+        vInfo.resize(nNew);
+        ResizeAddrTable(nNew + nTried);
+
         // Deserialize entries from the new table.
         for (int n = 0; n < nNew; n++) {
-            CAddrInfo &info = mapInfo[n];
+            CAddrInfo &info = vInfo[n];
             s >> info;
-            mapAddr[info] = n;
+            InsertAddr(info, n);
             info.nRandomPos = vRandom.size();
             vRandom.push_back(n);
             if (nVersion != 1 || nUBuckets != ADDRMAN_NEW_BUCKET_COUNT) {
@@ -414,7 +450,6 @@ public:
                 }
             }
         }
-        nIdCount = nNew;
 
         // Deserialize entries from the tried table.
         int nLost = 0;
@@ -424,13 +459,13 @@ public:
             int nKBucket = info.GetTriedBucket(nKey);
             int nKBucketPos = info.GetBucketPosition(nKey, false, nKBucket);
             if (vvTried[nKBucket][nKBucketPos] == -1) {
+                int nId = vInfo.size();
                 info.nRandomPos = vRandom.size();
                 info.fInTried = true;
-                vRandom.push_back(nIdCount);
-                mapInfo[nIdCount] = info;
-                mapAddr[info] = nIdCount;
-                vvTried[nKBucket][nKBucketPos] = nIdCount;
-                nIdCount++;
+                vRandom.push_back(nId);
+                vInfo.push_back(info);
+                InsertAddr(info, nId);
+                vvTried[nKBucket][nKBucketPos] = nId;
             } else {
                 nLost++;
             }
@@ -445,7 +480,7 @@ public:
                 int nIndex = 0;
                 s >> nIndex;
                 if (nIndex >= 0 && nIndex < nNew) {
-                    CAddrInfo &info = mapInfo[nIndex];
+                    CAddrInfo &info = vInfo[nIndex];
                     int nUBucketPos =
                         info.GetBucketPosition(nKey, true, bucket);
                     if (nVersion == 1 &&
@@ -461,14 +496,12 @@ public:
 
         // Prune new entries with refcount 0 (as a result of collisions).
         int nLostUnk = 0;
-        for (std::map<int, CAddrInfo>::const_iterator it = mapInfo.begin();
-             it != mapInfo.end();) {
-            if (it->second.fInTried == false && it->second.nRefCount == 0) {
-                std::map<int, CAddrInfo>::const_iterator itCopy = it++;
-                Delete(itCopy->first);
+        for (size_t n = 0; n < vInfo.size(); n++) {
+            const CAddrInfo &info = vInfo[n];
+            if (info.nRandomPos != -1 && info.fInTried == false &&
+                info.nRefCount == 0) {
+                Delete(n);
                 nLostUnk++;
-            } else {
-                it++;
             }
         }
         if (nLost + nLostUnk > 0) {
@@ -482,6 +515,12 @@ public:
 
     void Clear() {
         std::vector<int>().swap(vRandom);
+        std::vector<CAddrInfo>().swap(vInfo);
+        std::vector<int>().swap(vFreeIds);
+        nAddrSalt0 = GetRand(std::numeric_limits<uint64_t>::max());
+        nAddrSalt1 = GetRand(std::numeric_limits<uint64_t>::max());
+        vAddrTable.assign(ADDRMAN_ADDR_TABLE_MIN_SIZE, -1);
+        nAddrTableCount = 0;
         nKey = GetRandHash();
         for (size_t bucket = 0; bucket < ADDRMAN_NEW_BUCKET_COUNT; bucket++) {
             for (size_t entry = 0; entry < ADDRMAN_BUCKET_SIZE; entry++) {
@@ -494,7 +533,6 @@ public:
             }
         }
 
-        nIdCount = 0;
         nTried = 0;
         nNew = 0;
         // Initially at 1 so that "never" is strictly worse.
@@ -2,14 +2,106 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include <cmath>
 #include <iostream>
+#include <limits>
 
 #include "bench.h"
 #include "bloom.h"
+#include "crypto/common.h"
+#include "hash.h"
+#include "random.h"
+#include "uint256.h"
 #include "utiltime.h"
 
-static void RollingBloom(benchmark::State &state) {
-    CRollingBloomFilter filter(120000, 0.000001);
+namespace {
+/**
+ * The rolling bloom filter before it was blocked: one MurmurHash3 per hash
+ * function, each setting a position anywhere in the filter. Kept to compare
+ * against CRollingBloomFilter.
+ */
+class LegacyRollingBloomFilter {
+public:
+    LegacyRollingBloomFilter(unsigned int nElements, double fpRate) {
+        double logFpRate = log(fpRate);
+        nHashFuncs =
+            std::max(1, std::min((int)round(logFpRate / log(0.5)), 50));
+        nEntriesPerGeneration = (nElements + 1) / 2;
+        uint32_t nMaxElements = nEntriesPerGeneration * 3;
+        uint32_t nFilterBits =
+            (uint32_t)ceil(-1.0 * nHashFuncs * nMaxElements /
+                           log(1.0 - exp(logFpRate / nHashFuncs)));
+        data.resize(((nFilterBits + 63) / 64) << 1);
+        nTweak = GetRand(std::numeric_limits<unsigned int>::max());
+        nEntriesThisGeneration = 0;
+        nGeneration = 1;
+    }
+
+    void insert(const std::vector<uint8_t> &vKey) {
+        if (nEntriesThisGeneration == nEntriesPerGeneration) {
+            nEntriesThisGeneration = 0;
+            nGeneration++;
+            if (nGeneration == 4) {
+                nGeneration = 1;
+            }
+            uint64_t nGenerationMask1 = -(uint64_t)(nGeneration & 1);
+            uint64_t nGenerationMask2 = -(uint64_t)(nGeneration >> 1);
+            for (uint32_t p = 0; p < data.size(); p += 2) {
+                uint64_t p1 = data[p], p2 = data[p + 1];
+                uint64_t mask =
+                    (p1 ^ nGenerationMask1) | (p2 ^ nGenerationMask2);
+                data[p] = p1 & mask;
+                data[p + 1] = p2 & mask;
+            }
+        }
+        nEntriesThisGeneration++;
+
+        for (int n = 0; n < nHashFuncs; n++) {
+            uint32_t h = MurmurHash3(n * 0xFBA4C795 + nTweak, vKey);
+            int bit = h & 0x3F;
+            uint32_t pos = (h >> 6) % data.size();
+            data[pos & ~1] = (data[pos & ~1] & ~(((uint64_t)1) << bit)) |
+                             ((uint64_t)(nGeneration & 1)) << bit;
+            data[pos | 1] = (data[pos | 1] & ~(((uint64_t)1) << bit)) |
+                            ((uint64_t)(nGeneration >> 1)) << bit;
+        }
+    }
+
+    void insert(const uint256 &hash) {
+        std::vector<uint8_t> vData(hash.begin(), hash.end());
+        insert(vData);
+    }
+
+    bool contains(const std::vector<uint8_t> &vKey) const {
+        for (int n = 0; n < nHashFuncs; n++) {
+            uint32_t h = MurmurHash3(n * 0xFBA4C795 + nTweak, vKey);
+            int bit = h & 0x3F;
+            uint32_t pos = (h >> 6) % data.size();
+            if (!(((data[pos & ~1] | data[pos | 1]) >> bit) & 1)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool contains(const uint256 &hash) const {
+        std::vector<uint8_t> vData(hash.begin(), hash.end());
+        return contains(vData);
+    }
+
+private:
+    int nEntriesPerGeneration;
+    int nEntriesThisGeneration;
+    int nGeneration;
+    std::vector<uint64_t> data;
+    unsigned int nTweak;
+    int nHashFuncs;
+};
+} // namespace
+
+template <typename Filter>
+static void RollingBloomBench(benchmark::State &state, const char *name) {
+    Filter filter(120000, 0.000001);
     std::vector<uint8_t> data(32);
     uint32_t count = 0;
     uint32_t nEntriesPerGeneration = (120000 + 1) / 2;
@@ -25,7 +117,7 @@ static void RollingBloom(benchmark::State &state) {
             int64_t b = GetTimeMicros();
             filter.insert(data);
             int64_t e = GetTimeMicros();
-            std::cout << "RollingBloom-refresh,1," << (e - b) * 0.000001 << ","
+            std::cout << name << "-refresh,1," << (e - b) * 0.000001 << ","
                       << (e - b) * 0.000001 << "," << (e - b) * 0.000001
                       << "\n";
             countnow = 0;
@@ -41,4 +133,44 @@ static void RollingBloom(benchmark::State &state) {
     }
 }
 
+/**
+ * Inventory announcements, in a filter sized like filterInventoryKnown: each
+ * new hash is looked up and inserted, then a hash announced a little earlier
+ * is looked up again.
+ */
+template <typename Filter>
+static void RollingBloomInventoryBench(benchmark::State &state) {
+    Filter filter(50000, 0.000001);
+    uint256 hash = GetRandHash();
+    uint64_t count = 0;
+    uint64_t match = 0;
+    while (state.KeepRunning()) {
+        WriteLE64(hash.begin(), ++count);
+        if (!filter.contains(hash)) {
+            filter.insert(hash);
+        }
+        WriteLE64(hash.begin(), count - 1000);
+        match += filter.contains(hash);
+    }
+}
+
+static void RollingBloom(benchmark::State &state) {
+    RollingBloomBench<CRollingBloomFilter>(state, "RollingBloom");
+}
+
+static void RollingBloomLegacy(benchmark::State &state) {
+    RollingBloomBench<LegacyRollingBloomFilter>(state, "RollingBloomLegacy");
+}
+
+static void RollingBloomInventory(benchmark::State &state) {
+    RollingBloomInventoryBench<CRollingBloomFilter>(state);
+}
+
+static void RollingBloomInventoryLegacy(benchmark::State &state) {
+    RollingBloomInventoryBench<LegacyRollingBloomFilter>(state);
+}
+
 BENCHMARK(RollingBloom);
+BENCHMARK(RollingBloomLegacy);
+BENCHMARK(RollingBloomInventory);
+BENCHMARK(RollingBloomInventoryLegacy);
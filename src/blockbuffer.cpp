@@ -0,0 +1,79 @@
+// Copyright (c) 2018 The Bitcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockbuffer.h"
+
+#include "core_memusage.h"
+#include "memusage.h"
+#include "primitives/block.h"
+
+void CBlockBuffer::Erase(EntryMap::iterator it) {
+    auto range = mapByHeight.equal_range(it->second.nHeight);
+    for (auto itHeight = range.first; itHeight != range.second; ++itHeight) {
+        if (itHeight->second == it->first) {
+            mapByHeight.erase(itHeight);
+            break;
+        }
+    }
+    nUsage -= it->second.nUsage;
+    mapBlocks.erase(it);
+}
+
+bool CBlockBuffer::Add(const CBlockIndex *pindex,
+                       const std::shared_ptr<const CBlock> &pblock) {
+    const uint256 &hash = pindex->GetBlockHash();
+    if (mapBlocks.count(hash)) {
+        return true;
+    }
+
+    size_t nBlockUsage = RecursiveDynamicUsage(*pblock) +
+                         memusage::MallocUsage(sizeof(CBlock)) +
+                         memusage::MallocUsage(sizeof(Entry) + sizeof(hash));
+    if (nBlockUsage > nMaxUsage) {
+        return false;
+    }
+
+    // Make room by evicting blocks further away than this one.
+    while (nUsage + nBlockUsage > nMaxUsage) {
+        auto itHighest = std::prev(mapByHeight.end());
+        if (itHighest->first <= pindex->nHeight) {
+            return false;
+        }
+        Erase(mapBlocks.find(itHighest->second));
+    }
+
+    mapBlocks.emplace(hash, Entry{pblock, pindex->nHeight, nBlockUsage});
+    mapByHeight.emplace(pindex->nHeight, hash);
+    nUsage += nBlockUsage;
+    return true;
+}
+
+std::shared_ptr<const CBlock> CBlockBuffer::Take(const uint256 &hash) {
+    EntryMap::iterator it = mapBlocks.find(hash);
+    if (it == mapBlocks.end()) {
+        return nullptr;
+    }
+    std::shared_ptr<const CBlock> pblock = it->second.pblock;
+    Erase(it);
+    return pblock;
+}
+
+void CBlockBuffer::RemoveUpTo(int nHeight) {
+    while (!mapByHeight.empty() && mapByHeight.begin()->first <= nHeight) {
+        Erase(mapBlocks.find(mapByHeight.begin()->second));
+    }
+}
+
+void CBlockBuffer::Clear() {
+    mapBlocks.clear();
+    mapByHeight.clear();
+    nUsage = 0;
+}
+
+void CBlockBuffer::SetMaxUsage(size_t nMaxUsageIn) {
+    nMaxUsage = nMaxUsageIn;
+    while (nUsage > nMaxUsage) {
+        Erase(mapBlocks.find(std::prev(mapByHeight.end())->second));
+    }
+}
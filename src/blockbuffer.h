@@ -0,0 +1,69 @@
+// Copyright (c) 2018 The Bitcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKBUFFER_H
+#define BITCOIN_BLOCKBUFFER_H
+
+#include "chain.h"
+
+#include <map>
+#include <memory>
+#include <unordered_map>
+
+class CBlock;
+
+/**
+ * Bounded in-memory buffer of blocks that were received and written to disk,
+ * but not connected yet. During initial block download, blocks typically
+ * arrive ahead of the tip, and would otherwise have to be read back from disk
+ * and deserialized again when they finally get connected.
+ *
+ * When full, the blocks furthest away from the tip, i.e. with the greatest
+ * height, are evicted first, as they are the ones needed last. Evicted blocks
+ * are simply read from disk again.
+ */
+class CBlockBuffer {
+private:
+    struct Entry {
+        std::shared_ptr<const CBlock> pblock;
+        int nHeight;
+        size_t nUsage;
+    };
+
+    typedef std::unordered_map<uint256, Entry, BlockHasher> EntryMap;
+    EntryMap mapBlocks;
+    //! The same blocks, ordered by height, to pick eviction candidates.
+    std::multimap<int, uint256> mapByHeight;
+
+    size_t nMaxUsage;
+    size_t nUsage;
+
+    void Erase(EntryMap::iterator it);
+
+public:
+    explicit CBlockBuffer(size_t nMaxUsageIn)
+        : nMaxUsage(nMaxUsageIn), nUsage(0) {}
+
+    /**
+     * Buffer a block, evicting higher blocks if needed to make room. Returns
+     * false if the block does not fit.
+     */
+    bool Add(const CBlockIndex *pindex,
+             const std::shared_ptr<const CBlock> &pblock);
+    /** Remove a block from the buffer and return it, or nullptr if absent. */
+    std::shared_ptr<const CBlock> Take(const uint256 &hash);
+    /**
+     * Remove every block at or below the given height, which is either
+     * connected or on a fork we moved away from.
+     */
+    void RemoveUpTo(int nHeight);
+    void Clear();
+
+    void SetMaxUsage(size_t nMaxUsageIn);
+    size_t GetMaxUsage() const { return nMaxUsage; }
+    size_t DynamicMemoryUsage() const { return nUsage; }
+    size_t Count() const { return mapBlocks.size(); }
+};
+
+#endif // BITCOIN_BLOCKBUFFER_H
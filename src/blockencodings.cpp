@@ -14,8 +14,12 @@
 #include "util.h"
 #include "validation.h"
 
+#include <algorithm>
 #include <unordered_map>
 
+//! Position marker for short IDs shared by several transactions of a block.
+static const uint32_t SHORTID_COLLISION = std::numeric_limits<uint32_t>::max();
+
 CBlockHeaderAndShortTxIDs::CBlockHeaderAndShortTxIDs(const CBlock &block)
     : nonce(GetRand(std::numeric_limits<uint64_t>::max())),
       shorttxids(block.vtx.size() - 1), prefilledtxn(1), header(block) {
@@ -29,6 +33,15 @@ CBlockHeaderAndShortTxIDs::CBlockHeaderAndShortTxIDs(const CBlock &block)
     }
 }
 
+CBlockHeaderAndShortTxIDs::CBlockHeaderAndShortTxIDs(
+    const CBlockHeader &headerIn, uint64_t nonceIn,
+    std::vector<uint64_t> shorttxidsIn,
+    std::vector<PrefilledTransaction> prefilledtxnIn)
+    : nonce(nonceIn), shorttxids(std::move(shorttxidsIn)),
+      prefilledtxn(std::move(prefilledtxnIn)), header(headerIn) {
+    FillShortTxIDSelector();
+}
+
 void CBlockHeaderAndShortTxIDs::FillShortTxIDSelector() const {
     CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
     stream << header << nonce;
@@ -41,9 +54,14 @@ void CBlockHeaderAndShortTxIDs::FillShortTxIDSelector() const {
 }
 
 uint64_t CBlockHeaderAndShortTxIDs::GetShortID(const uint256 &txhash) const {
+    return GetShortID(shorttxidk0, shorttxidk1, txhash);
+}
+
+uint64_t CBlockHeaderAndShortTxIDs::GetShortID(uint64_t k0, uint64_t k1,
+                                               const uint256 &txhash) {
     static_assert(SHORTTXIDS_LENGTH == 6,
                   "shorttxids calculation assumes 6-byte shorttxids");
-    return SipHashUint256(shorttxidk0, shorttxidk1, txhash) & 0xffffffffffffL;
+    return SipHashUint256(k0, k1, txhash) & 0xffffffffffffL;
 }
 
 ReadStatus PartiallyDownloadedBlock::InitData(
@@ -60,15 +78,15 @@ ReadStatus PartiallyDownloadedBlock::InitData(
     header = cmpctblock.header;
     txn_available.resize(cmpctblock.BlockTxCount());
 
-    int32_t lastprefilledindex = -1;
+    int64_t lastprefilledindex = -1;
     for (size_t i = 0; i < cmpctblock.prefilledtxn.size(); i++) {
         if (cmpctblock.prefilledtxn[i].tx->IsNull()) return READ_STATUS_INVALID;
 
-        // index is a uint16_t, so can't overflow here.
+        // index is a uint32_t, so can't overflow here.
         lastprefilledindex += cmpctblock.prefilledtxn[i].index + 1;
-        if (lastprefilledindex > std::numeric_limits<uint16_t>::max())
+        if (lastprefilledindex > std::numeric_limits<uint32_t>::max())
             return READ_STATUS_INVALID;
-        if ((uint32_t)lastprefilledindex > cmpctblock.shorttxids.size() + i) {
+        if ((uint64_t)lastprefilledindex > cmpctblock.shorttxids.size() + i) {
             // If we are inserting a tx at an index greater than our full list
             // of shorttxids plus the number of prefilled txn we've inserted,
             // then we have txn for which we have neither a prefilled txn or a
@@ -83,13 +101,25 @@ ReadStatus PartiallyDownloadedBlock::InitData(
     // (or don't). Because well-formed cmpctblock messages will have a
     // (relatively) uniform distribution of short IDs, any highly-uneven
     // distribution of elements can be safely treated as a READ_STATUS_FAILED.
-    std::unordered_map<uint64_t, uint16_t> shorttxids(
+    std::unordered_map<uint64_t, uint32_t> shorttxids(
         cmpctblock.shorttxids.size());
-    uint16_t index_offset = 0;
+    // Number of positions that can be filled from the mempool, i.e. whose
+    // short ID does not collide with another one in the block.
+    size_t unique_count = 0;
+    uint32_t index_offset = 0;
     for (size_t i = 0; i < cmpctblock.shorttxids.size(); i++) {
         while (txn_available[i + index_offset])
             index_offset++;
-        shorttxids[cmpctblock.shorttxids[i]] = i + index_offset;
+        auto inserted =
+            shorttxids.emplace(cmpctblock.shorttxids[i], i + index_offset);
+        if (inserted.second) {
+            unique_count++;
+        } else if (inserted.first->second != SHORTID_COLLISION) {
+            // Short ID collision: we can't tell which transaction goes where,
+            // so leave every colliding position empty and request them all.
+            inserted.first->second = SHORTID_COLLISION;
+            unique_count--;
+        }
         // To determine the chance that the number of entries in a bucket
         // exceeds N, we use the fact that the number of elements in a single
         // bucket is binomially distributed (with n = the number of shorttxids
@@ -105,52 +135,66 @@ ReadStatus PartiallyDownloadedBlock::InitData(
                 shorttxids.bucket(cmpctblock.shorttxids[i])) > 12)
             return READ_STATUS_FAILED;
     }
-    // TODO: in the shortid-collision case, we should instead request both
-    // transactions which collided. Falling back to full-block-request here is
-    // overkill.
-    if (shorttxids.size() != cmpctblock.shorttxids.size()) {
-        // Short ID collision
-        return READ_STATUS_FAILED;
-    }
 
     std::vector<bool> have_txn(txn_available.size());
     {
         LOCK(pool->cs);
         const std::vector<std::pair<uint256, CTxMemPool::txiter>> &vTxHashes =
             pool->vTxHashes;
-        for (size_t i = 0; i < vTxHashes.size(); i++) {
-            uint64_t shortid = cmpctblock.GetShortID(vTxHashes[i].first);
-            std::unordered_map<uint64_t, uint16_t>::iterator idit =
-                shorttxids.find(shortid);
-            if (idit != shorttxids.end()) {
-                if (!have_txn[idit->second]) {
-                    txn_available[idit->second] =
-                        vTxHashes[i].second->GetSharedTx();
-                    have_txn[idit->second] = true;
-                    mempool_count++;
-                } else {
-                    // If we find two mempool txn that match the short id, just
-                    // request it. This should be rare enough that the extra
-                    // bandwidth doesn't matter, but eating a round-trip due to
-                    // FillBlock failure would be annoying.
-                    if (txn_available[idit->second]) {
-                        txn_available[idit->second].reset();
-                        mempool_count--;
+
+        // Hashing and looking up every mempool transaction dominates the cost
+        // of reconstruction for large mempools, so it is spread over the
+        // script check threads. Matches are collected per range and applied
+        // in mempool order, so the outcome doesn't depend on the split.
+        std::vector<std::pair<size_t, uint32_t>> matches;
+        CCriticalSection cs_matches;
+        ParallelForRange(
+            vTxHashes.size(), std::max(nScriptCheckThreads, 1),
+            [&](size_t begin, size_t end) {
+                std::vector<std::pair<size_t, uint32_t>> range_matches;
+                for (size_t i = begin; i < end; i++) {
+                    auto idit = shorttxids.find(
+                        cmpctblock.GetShortID(vTxHashes[i].first));
+                    if (idit != shorttxids.end() &&
+                        idit->second != SHORTID_COLLISION) {
+                        range_matches.emplace_back(i, idit->second);
                     }
                 }
+                LOCK(cs_matches);
+                matches.insert(matches.end(), range_matches.begin(),
+                               range_matches.end());
+            });
+        std::sort(matches.begin(), matches.end());
+
+        for (const std::pair<size_t, uint32_t> &match : matches) {
+            if (!have_txn[match.second]) {
+                txn_available[match.second] =
+                    vTxHashes[match.first].second->GetSharedTx();
+                have_txn[match.second] = true;
+                mempool_count++;
+            } else {
+                // If we find two mempool txn that match the short id, just
+                // request it. This should be rare enough that the extra
+                // bandwidth doesn't matter, but eating a round-trip due to
+                // FillBlock failure would be annoying.
+                if (txn_available[match.second]) {
+                    txn_available[match.second].reset();
+                    mempool_count--;
+                }
             }
-            // Though ideally we'd continue scanning for the
-            // two-txn-match-shortid case, the performance win of an early exit
-            // here is too good to pass up and worth the extra risk.
-            if (mempool_count == shorttxids.size()) break;
         }
     }
 
     for (size_t i = 0; i < extra_txn.size(); i++) {
+        // Though ideally we'd continue scanning for the two-txn-match-shortid
+        // case, the performance win of an early exit here is too good to pass
+        // up and worth the extra risk.
+        if (mempool_count == unique_count) break;
+
         uint64_t shortid = cmpctblock.GetShortID(extra_txn[i].first);
-        std::unordered_map<uint64_t, uint16_t>::iterator idit =
+        std::unordered_map<uint64_t, uint32_t>::iterator idit =
             shorttxids.find(shortid);
-        if (idit != shorttxids.end()) {
+        if (idit != shorttxids.end() && idit->second != SHORTID_COLLISION) {
             if (!have_txn[idit->second]) {
                 txn_available[idit->second] = extra_txn[i].second;
                 have_txn[idit->second] = true;
@@ -172,11 +216,6 @@ ReadStatus PartiallyDownloadedBlock::InitData(
                 }
             }
         }
-
-        // Though ideally we'd continue scanning for the two-txn-match-shortid
-        // case, the performance win of an early exit here is too good to pass
-        // up and worth the extra risk.
-        if (mempool_count == shorttxids.size()) break;
     }
 
     LogPrint(BCLog::CMPCTBLOCK, "Initialized PartiallyDownloadedBlock for "
@@ -32,7 +32,7 @@ class BlockTransactionsRequest {
 public:
     // A BlockTransactionsRequest message
     uint256 blockhash;
-    std::vector<uint16_t> indexes;
+    std::vector<uint32_t> indexes;
 
     ADD_SERIALIZE_METHODS;
 
@@ -49,18 +49,18 @@ public:
                 for (; i < indexes.size(); i++) {
                     uint64_t index = 0;
                     READWRITE(COMPACTSIZE(index));
-                    if (index > std::numeric_limits<uint16_t>::max())
+                    if (index > std::numeric_limits<uint32_t>::max())
                         throw std::ios_base::failure(
-                            "index overflowed 16 bits");
+                            "index overflowed 32 bits");
                     indexes[i] = index;
                 }
             }
 
-            uint16_t offset = 0;
+            uint32_t offset = 0;
             for (size_t j = 0; j < indexes.size(); j++) {
                 if (uint64_t(indexes[j]) + uint64_t(offset) >
-                    std::numeric_limits<uint16_t>::max())
-                    throw std::ios_base::failure("indexes overflowed 16 bits");
+                    std::numeric_limits<uint32_t>::max())
+                    throw std::ios_base::failure("indexes overflowed 32 bits");
                 indexes[j] = indexes[j] + offset;
                 offset = indexes[j] + 1;
             }
@@ -110,7 +110,7 @@ public:
 struct PrefilledTransaction {
     // Used as an offset since last prefilled tx in CBlockHeaderAndShortTxIDs,
     // as a proper transaction-in-block-index in PartiallyDownloadedBlock
-    uint16_t index;
+    uint32_t index;
     CTransactionRef tx;
 
     ADD_SERIALIZE_METHODS;
@@ -119,8 +119,8 @@ struct PrefilledTransaction {
     inline void SerializationOp(Stream &s, Operation ser_action) {
         uint64_t idx = index;
         READWRITE(COMPACTSIZE(idx));
-        if (idx > std::numeric_limits<uint16_t>::max())
-            throw std::ios_base::failure("index overflowed 16-bits");
+        if (idx > std::numeric_limits<uint32_t>::max())
+            throw std::ios_base::failure("index overflowed 32-bits");
         index = idx;
         READWRITE(REF(TransactionCompressor(tx)));
     }
@@ -145,6 +145,7 @@ private:
     void FillShortTxIDSelector() const;
 
     friend class PartiallyDownloadedBlock;
+    friend class CGrapheneBlock;
 
     static const int SHORTTXIDS_LENGTH = 6;
 
@@ -160,7 +161,13 @@ public:
 
     CBlockHeaderAndShortTxIDs(const CBlock &block);
 
+    CBlockHeaderAndShortTxIDs(const CBlockHeader &headerIn, uint64_t nonceIn,
+                              std::vector<uint64_t> shorttxidsIn,
+                              std::vector<PrefilledTransaction> prefilledtxnIn);
+
     uint64_t GetShortID(const uint256 &txhash) const;
+    static uint64_t GetShortID(uint64_t k0, uint64_t k1,
+                               const uint256 &txhash);
 
     size_t BlockTxCount() const {
         return shorttxids.size() + prefilledtxn.size();
@@ -0,0 +1,309 @@
+// Copyright (c) 2018 The Bitcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockfilter.h"
+
+#include "crypto/common.h"
+#include "hash.h"
+#include "primitives/block.h"
+#include "script/script.h"
+#include "streams.h"
+#include "undo.h"
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+//! Parameters of the basic filter, chosen by BIP 158.
+static const uint8_t BASIC_FILTER_P = 19;
+static const uint32_t BASIC_FILTER_M = 784931;
+
+namespace {
+/** Appends bits to a byte vector, most significant bit first. */
+class BitWriter {
+public:
+    explicit BitWriter(std::vector<uint8_t> &vDataIn) : vData(vDataIn) {}
+
+    //! Write the nBits low bits of nValue, nBits <= 64.
+    void Write(uint64_t nValue, int nBits) {
+        while (nBits > 0) {
+            int nFree = 8 - nOffset;
+            int n = std::min(nFree, nBits);
+            uint8_t nChunk = (nValue >> (nBits - n)) & ((1 << n) - 1);
+            nBuffer |= nChunk << (nFree - n);
+            nOffset += n;
+            nBits -= n;
+            if (nOffset == 8) {
+                Flush();
+            }
+        }
+    }
+
+    //! Write the partial last byte, padded with zeros.
+    void Flush() {
+        if (nOffset == 0) {
+            return;
+        }
+        vData.push_back(nBuffer);
+        nBuffer = 0;
+        nOffset = 0;
+    }
+
+private:
+    std::vector<uint8_t> &vData;
+    uint8_t nBuffer = 0;
+    int nOffset = 0;
+};
+
+/** Reads bits written by BitWriter. */
+class BitReader {
+public:
+    BitReader(const std::vector<uint8_t> &vDataIn, size_t nPosIn)
+        : vData(vDataIn), nPos(nPosIn) {}
+
+    uint64_t Read(int nBits) {
+        uint64_t nValue = 0;
+        while (nBits > 0) {
+            if (nOffset == 8) {
+                if (nPos >= vData.size()) {
+                    throw std::ios_base::failure("end of filter data");
+                }
+                nBuffer = vData[nPos++];
+                nOffset = 0;
+            }
+            int n = std::min(8 - nOffset, nBits);
+            nValue = (nValue << n) |
+                     ((nBuffer >> (8 - nOffset - n)) & ((1 << n) - 1));
+            nOffset += n;
+            nBits -= n;
+        }
+        return nValue;
+    }
+
+private:
+    const std::vector<uint8_t> &vData;
+    size_t nPos;
+    uint8_t nBuffer = 0;
+    int nOffset = 8;
+};
+
+/** Just enough of a stream to read the element count of a filter. */
+class FilterHeaderReader {
+public:
+    explicit FilterHeaderReader(const std::vector<uint8_t> &vDataIn)
+        : vData(vDataIn) {}
+
+    void read(char *pch, size_t nSize) {
+        if (nSize > vData.size() - nPos) {
+            throw std::ios_base::failure("end of filter data");
+        }
+        memcpy(pch, vData.data() + nPos, nSize);
+        nPos += nSize;
+    }
+
+    size_t GetPos() const { return nPos; }
+
+private:
+    const std::vector<uint8_t> &vData;
+    size_t nPos = 0;
+};
+} // namespace
+
+static void GolombRiceEncode(BitWriter &writer, uint8_t nP, uint64_t nValue) {
+    // Quotient in unary, then the remainder in nP bits.
+    uint64_t nQuotient = nValue >> nP;
+    while (nQuotient > 0) {
+        int nBits = std::min<uint64_t>(nQuotient, 64);
+        writer.Write(~uint64_t(0), nBits);
+        nQuotient -= nBits;
+    }
+    writer.Write(0, 1);
+    writer.Write(nValue, nP);
+}
+
+static uint64_t GolombRiceDecode(BitReader &reader, uint8_t nP) {
+    uint64_t nQuotient = 0;
+    while (reader.Read(1) == 1) {
+        nQuotient++;
+    }
+    uint64_t nRemainder = reader.Read(nP);
+    return (nQuotient << nP) + nRemainder;
+}
+
+/** Map x uniformly into [0, n), without a division. */
+static uint64_t MapIntoRange(uint64_t x, uint64_t n) {
+#ifdef __SIZEOF_INT128__
+    return (static_cast<unsigned __int128>(x) * n) >> 64;
+#else
+    uint64_t x_hi = x >> 32, x_lo = x & 0xffffffff;
+    uint64_t n_hi = n >> 32, n_lo = n & 0xffffffff;
+    uint64_t ac = x_hi * n_hi;
+    uint64_t ad = x_hi * n_lo;
+    uint64_t bc = x_lo * n_hi;
+    uint64_t bd = x_lo * n_lo;
+    uint64_t mid34 = (bd >> 32) + (bc & 0xffffffff) + (ad & 0xffffffff);
+    return ac + (bc >> 32) + (ad >> 32) + (mid34 >> 32);
+#endif
+}
+
+GCSFilter::GCSFilter(const Params &paramsIn)
+    : params(paramsIn), nN(0), nF(0), vEncoded(1, 0) {}
+
+GCSFilter::GCSFilter(const Params &paramsIn, std::vector<uint8_t> vEncodedIn)
+    : params(paramsIn), vEncoded(std::move(vEncodedIn)) {
+    FilterHeaderReader stream(vEncoded);
+    uint64_t nElements = ReadCompactSize(stream);
+    if (nElements > std::numeric_limits<uint32_t>::max()) {
+        throw std::ios_base::failure("too many elements in filter");
+    }
+    nN = nElements;
+    nF = uint64_t(nN) * params.nM;
+
+    // Decode the whole filter once, so that matching cannot fail later.
+    BitReader reader(vEncoded, stream.GetPos());
+    for (uint32_t i = 0; i < nN; i++) {
+        GolombRiceDecode(reader, params.nP);
+    }
+}
+
+GCSFilter::GCSFilter(const Params &paramsIn, ElementSet elements)
+    : params(paramsIn) {
+    std::sort(elements.begin(), elements.end());
+    elements.erase(std::unique(elements.begin(), elements.end()),
+                   elements.end());
+    if (elements.size() > std::numeric_limits<uint32_t>::max()) {
+        throw std::invalid_argument("too many elements for a filter");
+    }
+    nN = elements.size();
+    nF = uint64_t(nN) * params.nM;
+
+    std::vector<uint64_t> vHashes;
+    vHashes.reserve(elements.size());
+    for (const Element &element : elements) {
+        vHashes.push_back(HashToRange(element));
+    }
+    std::sort(vHashes.begin(), vHashes.end());
+
+    CVectorWriter stream(SER_NETWORK, 0, vEncoded, 0);
+    WriteCompactSize(stream, nN);
+    BitWriter writer(vEncoded);
+    uint64_t nLast = 0;
+    for (uint64_t nHash : vHashes) {
+        GolombRiceEncode(writer, params.nP, nHash - nLast);
+        nLast = nHash;
+    }
+    writer.Flush();
+}
+
+uint64_t GCSFilter::HashToRange(const Element &element) const {
+    uint64_t nHash = CSipHasher(params.nSipHashK0, params.nSipHashK1)
+                         .Write(element.data(), element.size())
+                         .Finalize();
+    return MapIntoRange(nHash, nF);
+}
+
+bool GCSFilter::MatchInternal(const std::vector<uint64_t> &vQueries) const {
+    // Both the filter and the queries are sorted: walk them together.
+    BitReader reader(vEncoded, GetSizeOfCompactSize(nN));
+    uint64_t nValue = 0;
+    size_t i = 0;
+    for (uint32_t n = 0; n < nN; n++) {
+        nValue += GolombRiceDecode(reader, params.nP);
+        while (vQueries[i] <= nValue) {
+            if (vQueries[i] == nValue) {
+                return true;
+            }
+            if (++i == vQueries.size()) {
+                return false;
+            }
+        }
+    }
+    return false;
+}
+
+bool GCSFilter::Match(const Element &element) const {
+    return MatchInternal(std::vector<uint64_t>(1, HashToRange(element)));
+}
+
+bool GCSFilter::MatchAny(const ElementSet &elements) const {
+    if (elements.empty()) {
+        return false;
+    }
+    std::vector<uint64_t> vQueries;
+    vQueries.reserve(elements.size());
+    for (const Element &element : elements) {
+        vQueries.push_back(HashToRange(element));
+    }
+    std::sort(vQueries.begin(), vQueries.end());
+    return MatchInternal(vQueries);
+}
+
+const std::string &BlockFilterTypeName(BlockFilterType filterType) {
+    static const std::string basic = "basic";
+    static const std::string unknown;
+    return filterType == BlockFilterType::BASIC ? basic : unknown;
+}
+
+bool BlockFilterTypeByName(const std::string &name,
+                           BlockFilterType &filterType) {
+    if (name == BlockFilterTypeName(BlockFilterType::BASIC)) {
+        filterType = BlockFilterType::BASIC;
+        return true;
+    }
+    return false;
+}
+
+static GCSFilter::ElementSet BasicFilterElements(const CBlock &block,
+                                                 const CBlockUndo &blockundo) {
+    GCSFilter::ElementSet elements;
+    for (const CTransactionRef &tx : block.vtx) {
+        for (const CTxOut &txout : tx->vout) {
+            const CScript &script = txout.scriptPubKey;
+            if (script.empty() || script[0] == OP_RETURN) {
+                continue;
+            }
+            elements.emplace_back(script.begin(), script.end());
+        }
+    }
+    for (const CTxUndo &txundo : blockundo.vtxundo) {
+        for (const Coin &coin : txundo.vprevout) {
+            const CScript &script = coin.GetTxOut().scriptPubKey;
+            if (script.empty()) {
+                continue;
+            }
+            elements.emplace_back(script.begin(), script.end());
+        }
+    }
+    return elements;
+}
+
+BlockFilter::BlockFilter(BlockFilterType filterTypeIn,
+                         const uint256 &hashBlockIn,
+                         std::vector<uint8_t> vFilter)
+    : filterType(filterTypeIn), hashBlock(hashBlockIn),
+      filter(GetParams(), std::move(vFilter)) {}
+
+BlockFilter::BlockFilter(BlockFilterType filterTypeIn, const CBlock &block,
+                         const CBlockUndo &blockundo)
+    : filterType(filterTypeIn), hashBlock(block.GetHash()),
+      filter(GetParams(), BasicFilterElements(block, blockundo)) {}
+
+GCSFilter::Params BlockFilter::GetParams() const {
+    // The siphash key is the first half of the block hash.
+    return GCSFilter::Params(ReadLE64(hashBlock.begin()),
+                             ReadLE64(hashBlock.begin() + 8), BASIC_FILTER_P,
+                             BASIC_FILTER_M);
+}
+
+uint256 BlockFilter::GetHash() const {
+    const std::vector<uint8_t> &vData = filter.GetEncoded();
+    return Hash(vData.begin(), vData.end());
+}
+
+uint256 BlockFilter::ComputeHeader(const uint256 &hashPrevHeader) const {
+    const uint256 hashFilter = GetHash();
+    return Hash(hashFilter.begin(), hashFilter.end(), hashPrevHeader.begin(),
+                hashPrevHeader.end());
+}
@@ -0,0 +1,130 @@
+// Copyright (c) 2018 The Bitcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKFILTER_H
+#define BITCOIN_BLOCKFILTER_H
+
+#include "serialize.h"
+#include "uint256.h"
+
+#include <cstdint>
+#include <ios>
+#include <string>
+#include <vector>
+
+class CBlock;
+class CBlockUndo;
+
+/**
+ * Golomb-coded set of the hashes of byte strings, as specified by BIP 158.
+ * Matching an element that is not in the set returns true with probability
+ * about 1/M.
+ */
+class GCSFilter {
+public:
+    typedef std::vector<uint8_t> Element;
+    typedef std::vector<Element> ElementSet;
+
+    struct Params {
+        uint64_t nSipHashK0;
+        uint64_t nSipHashK1;
+        //! Golomb-Rice coding parameter.
+        uint8_t nP;
+        //! Inverse false positive rate.
+        uint32_t nM;
+
+        Params(uint64_t nSipHashK0In = 0, uint64_t nSipHashK1In = 0,
+               uint8_t nPIn = 0, uint32_t nMIn = 1)
+            : nSipHashK0(nSipHashK0In), nSipHashK1(nSipHashK1In), nP(nPIn),
+              nM(nMIn) {}
+    };
+
+    //! An empty filter.
+    explicit GCSFilter(const Params &paramsIn = Params());
+    //! Decode a filter, throws std::ios_base::failure if it is malformed.
+    GCSFilter(const Params &paramsIn, std::vector<uint8_t> vEncodedIn);
+    //! Build the filter of a set of elements, duplicates are ignored.
+    GCSFilter(const Params &paramsIn, ElementSet elements);
+
+    uint32_t GetN() const { return nN; }
+    const Params &GetParams() const { return params; }
+    const std::vector<uint8_t> &GetEncoded() const { return vEncoded; }
+
+    bool Match(const Element &element) const;
+    //! Whether any of the elements matches, in a single pass over the filter.
+    bool MatchAny(const ElementSet &elements) const;
+
+private:
+    Params params;
+    uint32_t nN;
+    //! Range the elements are hashed into, nN * params.nM.
+    uint64_t nF;
+    std::vector<uint8_t> vEncoded;
+
+    uint64_t HashToRange(const Element &element) const;
+    bool MatchInternal(const std::vector<uint64_t> &vQueries) const;
+};
+
+enum class BlockFilterType : uint8_t {
+    BASIC = 0,
+};
+
+//! Name of a filter type, as used in REST paths.
+const std::string &BlockFilterTypeName(BlockFilterType filterType);
+//! Return false if the name is not a known filter type.
+bool BlockFilterTypeByName(const std::string &name,
+                           BlockFilterType &filterType);
+
+/**
+ * Compact filter of a block, as specified by BIP 158. The basic filter holds
+ * the scriptPubKeys of the outputs the block creates, except OP_RETURN ones,
+ * and of the outputs it spends.
+ */
+class BlockFilter {
+public:
+    BlockFilter() : filterType(BlockFilterType::BASIC) {}
+    //! Decode a filter, throws std::ios_base::failure if it is malformed.
+    BlockFilter(BlockFilterType filterTypeIn, const uint256 &hashBlockIn,
+                std::vector<uint8_t> vFilter);
+    //! Build the filter of a block, the undo data gives the spent outputs.
+    BlockFilter(BlockFilterType filterTypeIn, const CBlock &block,
+                const CBlockUndo &blockundo);
+
+    BlockFilterType GetFilterType() const { return filterType; }
+    const uint256 &GetBlockHash() const { return hashBlock; }
+    const GCSFilter &GetFilter() const { return filter; }
+    const std::vector<uint8_t> &GetEncodedFilter() const {
+        return filter.GetEncoded();
+    }
+
+    //! Hash of the encoded filter.
+    uint256 GetHash() const;
+    //! Header committing to this filter and, through hashPrevHeader, to the
+    //! filters of all the blocks before it.
+    uint256 ComputeHeader(const uint256 &hashPrevHeader) const;
+
+    template <typename Stream> void Serialize(Stream &s) const {
+        s << uint8_t(filterType) << hashBlock << filter.GetEncoded();
+    }
+
+    template <typename Stream> void Unserialize(Stream &s) {
+        uint8_t nFilterType;
+        std::vector<uint8_t> vFilter;
+        s >> nFilterType >> hashBlock >> vFilter;
+        if (nFilterType != uint8_t(BlockFilterType::BASIC)) {
+            throw std::ios_base::failure("unknown filter type");
+        }
+        filterType = BlockFilterType(nFilterType);
+        filter = GCSFilter(GetParams(), std::move(vFilter));
+    }
+
+private:
+    BlockFilterType filterType;
+    uint256 hashBlock;
+    GCSFilter filter;
+
+    GCSFilter::Params GetParams() const;
+};
+
+#endif // BITCOIN_BLOCKFILTER_H
@@ -0,0 +1,170 @@
+// Copyright (c) 2018 The Bitcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockfilterindex.h"
+
+#include "chain.h"
+#include "config.h"
+#include "indexbackfill.h"
+#include "primitives/block.h"
+#include "undo.h"
+#include "util.h"
+#include "validation.h"
+
+static const char DB_FILTER = 'f';
+static const char DB_FILTER_HASHES = 'h';
+static const char DB_BEST_BLOCK = 'B';
+
+//! Write size at which Wipe flushes its batch of erasures.
+static const size_t WIPE_BATCH_SIZE = 16 << 20;
+
+CBlockFilterIndex *pblockfilterindex = nullptr;
+
+CBlockFilterIndex::CBlockFilterIndex(size_t nCacheSize, bool fMemory,
+                                     bool fWipe)
+    : db(GetDataDir() / "indexes" / "blockfilter" /
+             BlockFilterTypeName(BlockFilterType::BASIC),
+         nCacheSize, fMemory, fWipe) {
+    if (!db.Read(DB_BEST_BLOCK, hashBestBlock)) {
+        hashBestBlock.SetNull();
+    }
+}
+
+bool CBlockFilterIndex::WriteFilters(const std::vector<BlockFilter> &filters) {
+    if (filters.empty()) {
+        return true;
+    }
+
+    CBlockFilterHashes hashes;
+    if (!hashBestBlock.IsNull() &&
+        !LookupFilterHashes(hashBestBlock, hashes)) {
+        return error("%s: missing filter header of the best block %s",
+                     __func__, hashBestBlock.ToString());
+    }
+
+    CDBBatch batch(db);
+    for (const BlockFilter &filter : filters) {
+        hashes.hashFilter = filter.GetHash();
+        hashes.hashHeader = filter.ComputeHeader(hashes.hashHeader);
+        batch.Write(std::make_pair(DB_FILTER, filter.GetBlockHash()),
+                    filter.GetEncodedFilter());
+        batch.Write(std::make_pair(DB_FILTER_HASHES, filter.GetBlockHash()),
+                    hashes);
+    }
+    batch.Write(DB_BEST_BLOCK, filters.back().GetBlockHash());
+    if (!db.WriteBatch(batch)) {
+        return false;
+    }
+    hashBestBlock = filters.back().GetBlockHash();
+    return true;
+}
+
+bool CBlockFilterIndex::ConnectBlock(const CBlock &block,
+                                     const CBlockUndo &blockundo,
+                                     const CBlockIndex *pindex) {
+    std::vector<BlockFilter> filters;
+    filters.emplace_back(BlockFilterType::BASIC, block, blockundo);
+    return WriteFilters(filters);
+}
+
+bool CBlockFilterIndex::SetBestBlock(const uint256 &hashBlock) {
+    bool fOk = hashBlock.IsNull() ? db.Erase(DB_BEST_BLOCK, true)
+                                  : db.Write(DB_BEST_BLOCK, hashBlock, true);
+    if (!fOk) {
+        return false;
+    }
+    hashBestBlock = hashBlock;
+    return true;
+}
+
+static bool EraseFilters(CDBWrapper &db, char prefix) {
+    std::unique_ptr<CDBIterator> pcursor(db.NewIterator());
+    CDBBatch batch(db);
+    for (pcursor->Seek(std::make_pair(prefix, uint256())); pcursor->Valid();
+         pcursor->Next()) {
+        std::pair<char, uint256> key;
+        if (!pcursor->GetKey(key) || key.first != prefix) {
+            break;
+        }
+        batch.Erase(key);
+        if (batch.SizeEstimate() > WIPE_BATCH_SIZE) {
+            if (!db.WriteBatch(batch)) {
+                return false;
+            }
+            batch.Clear();
+        }
+    }
+    return db.WriteBatch(batch);
+}
+
+bool CBlockFilterIndex::Wipe() {
+    return SetBestBlock(uint256()) && EraseFilters(db, DB_FILTER) &&
+           EraseFilters(db, DB_FILTER_HASHES);
+}
+
+bool CBlockFilterIndex::LookupFilter(const uint256 &hashBlock,
+                                     BlockFilter &filter) const {
+    std::vector<uint8_t> vFilter;
+    if (!db.Read(std::make_pair(DB_FILTER, hashBlock), vFilter)) {
+        return false;
+    }
+    try {
+        filter = BlockFilter(BlockFilterType::BASIC, hashBlock,
+                             std::move(vFilter));
+    } catch (const std::exception &e) {
+        return error("%s: invalid filter of block %s: %s", __func__,
+                     hashBlock.ToString(), e.what());
+    }
+    return true;
+}
+
+bool CBlockFilterIndex::LookupFilterHashes(const uint256 &hashBlock,
+                                           CBlockFilterHashes &hashes) const {
+    return db.Read(std::make_pair(DB_FILTER_HASHES, hashBlock), hashes);
+}
+
+namespace {
+/** Backfill hooks of the block filter index. */
+class CBlockFilterIndexBackfill : public CIndexBackfill {
+public:
+    CBlockFilterIndexBackfill() : CIndexBackfill("Block filter index", true) {}
+
+    uint256 GetBestBlock() const override {
+        return pblockfilterindex->GetBestBlock();
+    }
+
+    bool Rewind(const CBlockIndex *pindexBest,
+                const CBlockIndex *pindexFork) override {
+        return pblockfilterindex->SetBestBlock(pindexFork->GetBlockHash());
+    }
+
+    bool Wipe() override { return pblockfilterindex->Wipe(); }
+
+    void BeginBatch(size_t nBlocks) override {
+        filters.clear();
+        filters.resize(nBlocks);
+    }
+
+    bool ProcessBlock(size_t i, const CBackfillBlock &entry,
+                      const CBlock &block,
+                      const CBlockUndo &blockundo) override {
+        filters[i] = BlockFilter(BlockFilterType::BASIC, block, blockundo);
+        return true;
+    }
+
+    bool WriteBatch(const CBlockIndex *pindexLast) override {
+        return pblockfilterindex->WriteFilters(filters);
+    }
+
+private:
+    std::vector<BlockFilter> filters;
+};
+} // namespace
+
+void ThreadBlockFilterIndexBackfill(const Config &config) {
+    RenameThread("bitcoin-filteridx");
+
+    CBlockFilterIndexBackfill backfill;
+    ThreadIndexBackfill(config, backfill);
+}
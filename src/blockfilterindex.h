@@ -0,0 +1,91 @@
+// Copyright (c) 2018 The Bitcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKFILTERINDEX_H
+#define BITCOIN_BLOCKFILTERINDEX_H
+
+#include "blockfilter.h"
+#include "dbwrapper.h"
+#include "serialize.h"
+#include "uint256.h"
+
+#include <vector>
+
+class CBlock;
+class CBlockIndex;
+class CBlockUndo;
+class Config;
+
+//! -blockfilterindex default
+static const bool DEFAULT_BLOCKFILTERINDEX = false;
+//! -peerblockfilters default
+static const bool DEFAULT_PEERBLOCKFILTERS = false;
+//! Max memory allocated to the block filter index database cache (MiB)
+static const int64_t nMaxBlockFilterIndexCache = 256;
+
+/** Hash of a block's filter and the filter header committing to it. */
+struct CBlockFilterHashes {
+    uint256 hashFilter;
+    uint256 hashHeader;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream &s, Operation ser_action) {
+        READWRITE(hashFilter);
+        READWRITE(hashHeader);
+    }
+};
+
+/**
+ * Index of the basic BIP 158 filters of the blocks and their filter headers,
+ * kept in its own database (indexes/blockfilter/basic/).
+ *
+ * Filters are stored by block hash, so disconnecting a block only moves the
+ * block the index is synced to back; the filters of blocks that left the
+ * active chain are left behind and reused if they come back. As for the
+ * address index, ConnectBlock only applies while the index is synced to the
+ * tip, ThreadBlockFilterIndexBackfill brings it up to date otherwise, and all
+ * methods but the lookups must be called with cs_main held.
+ */
+class CBlockFilterIndex {
+public:
+    CBlockFilterIndex(size_t nCacheSize, bool fMemory = false,
+                      bool fWipe = false);
+
+    //! Block the index is synced to, null if the index is empty.
+    const uint256 &GetBestBlock() const { return hashBestBlock; }
+
+    //! Add the filter of the block connected on top of the best block.
+    bool ConnectBlock(const CBlock &block, const CBlockUndo &blockundo,
+                      const CBlockIndex *pindex);
+    //! Add the filters of consecutive blocks, the first one on top of the
+    //! best block, in a single batch.
+    bool WriteFilters(const std::vector<BlockFilter> &filters);
+    //! Move the best block back to an ancestor, null to empty the index.
+    bool SetBestBlock(const uint256 &hashBlock);
+    //! Remove everything from the index.
+    bool Wipe();
+
+    bool LookupFilter(const uint256 &hashBlock, BlockFilter &filter) const;
+    bool LookupFilterHashes(const uint256 &hashBlock,
+                            CBlockFilterHashes &hashes) const;
+
+private:
+    CDBWrapper db;
+    uint256 hashBestBlock;
+};
+
+/** The block filter index, or nullptr unless -blockfilterindex is set. */
+extern CBlockFilterIndex *pblockfilterindex;
+
+/**
+ * Bring the block filter index up to the active chain tip, first moving it
+ * back to the active chain if it is on a stale branch. The filters of a batch
+ * of blocks are built from several threads, then chained into headers and
+ * written together.
+ */
+void ThreadBlockFilterIndexBackfill(const Config &config);
+
+#endif // BITCOIN_BLOCKFILTERINDEX_H
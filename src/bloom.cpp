@@ -5,14 +5,17 @@
 #include "bloom.h"
 
 #include "hash.h"
+#include "primitives/block.h"
 #include "primitives/transaction.h"
 #include "random.h"
 #include "script/script.h"
 #include "script/standard.h"
 #include "streams.h"
 
+#include <algorithm>
 #include <cmath>
 #include <cstdlib>
+#include <limits>
 
 #define LN2SQUARED 0.4804530139182014246671025263266649717305529515945455
 #define LN2 0.6931471805599453094172321214581765680755001343602552
@@ -48,25 +51,30 @@ CBloomFilter::CBloomFilter(unsigned int nElements, double nFPRate,
       nHashFuncs((unsigned int)(vData.size() * 8 / nElements * LN2)),
       nTweak(nTweakIn), nFlags(BLOOM_UPDATE_NONE) {}
 
-inline unsigned int
-CBloomFilter::Hash(unsigned int nHashNum,
-                   const std::vector<uint8_t> &vDataToHash) const {
+inline unsigned int CBloomFilter::Hash(unsigned int nHashNum,
+                                       const uint8_t *pDataToHash,
+                                       size_t nDataSize) const {
     // 0xFBA4C795 chosen as it guarantees a reasonable bit difference between
     // nHashNum values.
-    return MurmurHash3(nHashNum * 0xFBA4C795 + nTweak, vDataToHash) %
+    return MurmurHash3(nHashNum * 0xFBA4C795 + nTweak, pDataToHash,
+                       nDataSize) %
            (vData.size() * 8);
 }
 
-void CBloomFilter::insert(const std::vector<uint8_t> &vKey) {
+void CBloomFilter::insert(const uint8_t *pKey, size_t nKeySize) {
     if (isFull) return;
     for (unsigned int i = 0; i < nHashFuncs; i++) {
-        unsigned int nIndex = Hash(i, vKey);
+        unsigned int nIndex = Hash(i, pKey, nKeySize);
         // Sets bit nIndex of vData
         vData[nIndex >> 3] |= (1 << (7 & nIndex));
     }
     isEmpty = false;
 }
 
+void CBloomFilter::insert(const std::vector<uint8_t> &vKey) {
+    insert(vKey.data(), vKey.size());
+}
+
 void CBloomFilter::insert(const COutPoint &outpoint) {
     CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
     stream << outpoint;
@@ -79,17 +87,21 @@ void CBloomFilter::insert(const uint256 &hash) {
     insert(data);
 }
 
-bool CBloomFilter::contains(const std::vector<uint8_t> &vKey) const {
+bool CBloomFilter::contains(const uint8_t *pKey, size_t nKeySize) const {
     if (isFull) return true;
     if (isEmpty) return false;
     for (unsigned int i = 0; i < nHashFuncs; i++) {
-        unsigned int nIndex = Hash(i, vKey);
+        unsigned int nIndex = Hash(i, pKey, nKeySize);
         // Checks bit nIndex of vData
         if (!(vData[nIndex >> 3] & (1 << (7 & nIndex)))) return false;
     }
     return true;
 }
 
+bool CBloomFilter::contains(const std::vector<uint8_t> &vKey) const {
+    return contains(vKey.data(), vKey.size());
+}
+
 bool CBloomFilter::contains(const COutPoint &outpoint) const {
     CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
     stream << outpoint;
@@ -177,6 +189,53 @@ bool CBloomFilter::IsRelevantAndUpdate(const CTransaction &tx) {
     return false;
 }
 
+bool CBloomFilter::IsRelevantAndUpdate(const CBloomBlockElements &elements,
+                                       size_t nTx) {
+    if (isFull) return true;
+    if (isEmpty) return false;
+    const CTransaction &tx = *elements.pblock->vtx[nTx];
+    const uint256 &txid = tx.GetId();
+    bool fFound = contains(txid.begin(), txid.size());
+
+    // Only the first element of an output that matches updates the filter,
+    // as in the CTransaction version.
+    uint32_t nMatchedOutput = std::numeric_limits<uint32_t>::max();
+    for (uint32_t i = elements.vTxBegin[nTx]; i < elements.vTxInputs[nTx];
+         i++) {
+        const CBloomBlockElements::Element &element = elements.vElements[i];
+        if (element.nOutput == nMatchedOutput ||
+            !contains(&elements.vData[element.nBegin], element.nSize)) {
+            continue;
+        }
+        fFound = true;
+        nMatchedOutput = element.nOutput;
+        if ((nFlags & BLOOM_UPDATE_MASK) == BLOOM_UPDATE_ALL) {
+            insert(COutPoint(txid, element.nOutput));
+        } else if ((nFlags & BLOOM_UPDATE_MASK) == BLOOM_UPDATE_P2PUBKEY_ONLY) {
+            txnouttype type;
+            std::vector<std::vector<uint8_t>> vSolutions;
+            if (Solver(tx.vout[element.nOutput].scriptPubKey, type,
+                       vSolutions) &&
+                (type == TX_PUBKEY || type == TX_MULTISIG)) {
+                insert(COutPoint(txid, element.nOutput));
+            }
+        }
+    }
+
+    if (fFound) return true;
+
+    // Outpoints spent and scriptSig data elements.
+    for (uint32_t i = elements.vTxInputs[nTx]; i < elements.vTxBegin[nTx + 1];
+         i++) {
+        const CBloomBlockElements::Element &element = elements.vElements[i];
+        if (contains(&elements.vData[element.nBegin], element.nSize)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
 void CBloomFilter::UpdateEmptyFull() {
     bool full = true;
     bool empty = true;
@@ -188,50 +247,150 @@ void CBloomFilter::UpdateEmptyFull() {
     isEmpty = empty;
 }
 
+CBloomBlockElements::CBloomBlockElements(
+    std::shared_ptr<const CBlock> pblockIn)
+    : pblock(std::move(pblockIn)) {
+    vTxBegin.reserve(pblock->vtx.size() + 1);
+    vTxInputs.reserve(pblock->vtx.size());
+    std::vector<uint8_t> data;
+    for (const CTransactionRef &ptx : pblock->vtx) {
+        vTxBegin.push_back(vElements.size());
+        for (uint32_t i = 0; i < ptx->vout.size(); i++) {
+            const CScript &script = ptx->vout[i].scriptPubKey;
+            CScript::const_iterator pc = script.begin();
+            while (pc < script.end()) {
+                opcodetype opcode;
+                if (!script.GetOp(pc, opcode, data)) break;
+                if (data.size() != 0) {
+                    AddElement(data.data(), data.size(), i);
+                }
+            }
+        }
+
+        vTxInputs.push_back(vElements.size());
+        for (const CTxIn &txin : ptx->vin) {
+            CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
+            stream << txin.prevout;
+            AddElement((const uint8_t *)stream.data(), stream.size(), 0);
+
+            CScript::const_iterator pc = txin.scriptSig.begin();
+            while (pc < txin.scriptSig.end()) {
+                opcodetype opcode;
+                if (!txin.scriptSig.GetOp(pc, opcode, data)) break;
+                if (data.size() != 0) {
+                    AddElement(data.data(), data.size(), 0);
+                }
+            }
+        }
+    }
+    vTxBegin.push_back(vElements.size());
+}
+
+void CBloomBlockElements::AddElement(const uint8_t *pbegin, size_t nSize,
+                                     uint32_t nOutput) {
+    vElements.push_back({uint32_t(vData.size()), uint32_t(nSize), nOutput});
+    vData.insert(vData.end(), pbegin, pbegin + nSize);
+}
+
+/**
+ * False positive rate of a blocked filter of nBlocks blocks holding nElements
+ * elements. The number of elements in a block follows a Poisson distribution,
+ * and each block behaves as a standard filter of ROLLING_BLOOM_BLOCK_BITS
+ * positions.
+ */
+static double BlockedBloomFPRate(double nElements, uint32_t nBlocks,
+                                 int nHashFuncs) {
+    const double lambda = nElements / nBlocks;
+    const double nSpread = 10 * sqrt(lambda) + 10;
+    const int nMin = std::max(0, int(lambda - nSpread));
+    const int nMax = int(lambda + nSpread);
+    // Probability that a position stays unset after one more element.
+    const double fUnset = pow(
+        1.0 - 1.0 / CRollingBloomFilter::ROLLING_BLOOM_BLOCK_BITS, nHashFuncs);
+    double fpRate = 0;
+    double fProbability = exp(nMin * log(lambda) - lambda - lgamma(nMin + 1.0));
+    double fUnsetAll = pow(fUnset, nMin);
+    for (int n = nMin; n <= nMax; n++) {
+        fpRate += fProbability * pow(1.0 - fUnsetAll, nHashFuncs);
+        fProbability *= lambda / (n + 1);
+        fUnsetAll *= fUnset;
+    }
+    return fpRate;
+}
+
 CRollingBloomFilter::CRollingBloomFilter(unsigned int nElements,
                                          double fpRate) {
     double logFpRate = log(fpRate);
     /* The optimal number of hash functions is log(fpRate) / log(0.5), but
      * restrict it to the range 1-50. */
-    nHashFuncs = std::max(1, std::min((int)round(logFpRate / log(0.5)), 50));
+    int nMaxHashFuncs =
+        std::max(1, std::min((int)round(logFpRate / log(0.5)), 50));
     /* In this rolling bloom filter, we'll store between 2 and 3 generations of
      * nElements / 2 entries. */
     nEntriesPerGeneration = (nElements + 1) / 2;
     uint32_t nMaxElements = nEntriesPerGeneration * 3;
-    /* The maximum fpRate = pow(1.0 - exp(-nHashFuncs * nMaxElements /
+    /* The size of a standard filter is a lower bound for the blocked one:
+     * The maximum fpRate = pow(1.0 - exp(-nHashFuncs * nMaxElements /
      * nFilterBits), nHashFuncs)
-     * =>          pow(fpRate, 1.0 / nHashFuncs) = 1.0 - exp(-nHashFuncs *
-     * nMaxElements / nFilterBits)
-     * =>          1.0 - pow(fpRate, 1.0 / nHashFuncs) = exp(-nHashFuncs *
-     * nMaxElements / nFilterBits)
-     * =>          log(1.0 - pow(fpRate, 1.0 / nHashFuncs)) = -nHashFuncs *
-     * nMaxElements / nFilterBits
-     * =>          nFilterBits = -nHashFuncs * nMaxElements / log(1.0 -
-     * pow(fpRate, 1.0 / nHashFuncs))
      * =>          nFilterBits = -nHashFuncs * nMaxElements / log(1.0 -
      * exp(logFpRate / nHashFuncs))
      */
     uint32_t nFilterBits =
-        (uint32_t)ceil(-1.0 * nHashFuncs * nMaxElements /
-                       log(1.0 - exp(logFpRate / nHashFuncs)));
+        (uint32_t)ceil(-1.0 * nMaxHashFuncs * nMaxElements /
+                       log(1.0 - exp(logFpRate / nMaxHashFuncs)));
+    uint32_t nMinBlocks = std::max<uint32_t>(
+        1, (nFilterBits + ROLLING_BLOOM_BLOCK_BITS - 1) /
+               ROLLING_BLOOM_BLOCK_BITS);
+    /* Grow the filter until the blocked false positive rate is reached, and
+     * keep the number of hash functions that needs the fewest blocks. Fewer
+     * hash functions than for a standard filter are best, as they overfill
+     * the most loaded blocks less. */
+    nHashFuncs = nMaxHashFuncs;
+    nBlocks = std::numeric_limits<uint32_t>::max();
+    for (int k = nMaxHashFuncs; k > 0; k--) {
+        uint32_t n = nMinBlocks;
+        while (n < nBlocks && BlockedBloomFPRate(nMaxElements, n, k) > fpRate) {
+            n += std::max<uint32_t>(1, n / 64);
+        }
+        if (n >= nBlocks) {
+            break;
+        }
+        nHashFuncs = k;
+        nBlocks = n;
+    }
     data.clear();
-    /* For each data element we need to store 2 bits. If both bits are 0, the
-     * bit is treated as unset. If the bits are (01), (10), or (11), the bit is
-     * treated as set in generation 1, 2, or 3 respectively. These bits are
-     * stored in separate integers: position P corresponds to bit (P & 63) of
-     * the integers data[(P >> 6) * 2] and data[(P >> 6) * 2 + 1]. */
-    data.resize(((nFilterBits + 63) / 64) << 1);
+    /* For each position we need to store 2 bits. If both bits are 0, the
+     * position is treated as unset. If the bits are (01), (10), or (11), the
+     * position is treated as set in generation 1, 2, or 3 respectively. Each
+     * block stores its first bits in its first BLOCK_WORDS / 2 integers and
+     * its second bits in the others. Blocks are aligned to 128 bytes. */
+    data.resize(size_t(nBlocks) * BLOCK_WORDS + BLOCK_WORDS - 1);
+    const size_t nBlockSize = BLOCK_WORDS * sizeof(uint64_t);
+    size_t nMisalignment =
+        reinterpret_cast<uintptr_t>(data.data()) % nBlockSize;
+    nDataOffset =
+        nMisalignment ? (nBlockSize - nMisalignment) / sizeof(uint64_t) : 0;
     reset();
 }
 
-/* Similar to CBloomFilter::Hash */
-static inline uint32_t
-RollingBloomHash(unsigned int nHashNum, uint32_t nTweak,
-                 const std::vector<uint8_t> &vDataToHash) {
-    return MurmurHash3(nHashNum * 0xFBA4C795 + nTweak, vDataToHash);
+size_t CRollingBloomFilter::GetBlock(uint64_t nHash, uint64_t *masks) const {
+    /* The high half of the hash picks the block. The positions within it are
+     * the top bits of a linear congruential generator seeded with the hash,
+     * which unlike double hashing keeps them independent at this width. */
+    uint32_t nBlock = ((nHash >> 32) * nBlocks) >> 32;
+    for (int w = 0; w < BLOCK_WORDS / 2; w++) {
+        masks[w] = 0;
+    }
+    uint64_t nState = nHash;
+    for (int n = 0; n < nHashFuncs; n++) {
+        nState = nState * 0x5851f42d4c957f2dULL + 0x14057b7ef767814fULL;
+        uint32_t pos = nState >> 55;
+        masks[pos >> 6] |= uint64_t(1) << (pos & 63);
+    }
+    return nDataOffset + size_t(nBlock) * BLOCK_WORDS;
 }
 
-void CRollingBloomFilter::insert(const std::vector<uint8_t> &vKey) {
+void CRollingBloomFilter::InsertHash(uint64_t nHash) {
     if (nEntriesThisGeneration == nEntriesPerGeneration) {
         nEntriesThisGeneration = 0;
         nGeneration++;
@@ -241,58 +400,67 @@ void CRollingBloomFilter::insert(const std::vector<uint8_t> &vKey) {
         uint64_t nGenerationMask1 = -(uint64_t)(nGeneration & 1);
         uint64_t nGenerationMask2 = -(uint64_t)(nGeneration >> 1);
         /* Wipe old entries that used this generation number. */
-        for (uint32_t p = 0; p < data.size(); p += 2) {
-            uint64_t p1 = data[p], p2 = data[p + 1];
-            uint64_t mask = (p1 ^ nGenerationMask1) | (p2 ^ nGenerationMask2);
-            data[p] = p1 & mask;
-            data[p + 1] = p2 & mask;
+        uint64_t *pblock = &data[nDataOffset];
+        for (uint32_t b = 0; b < nBlocks; b++, pblock += BLOCK_WORDS) {
+            for (int w = 0; w < BLOCK_WORDS / 2; w++) {
+                uint64_t p1 = pblock[w], p2 = pblock[w + BLOCK_WORDS / 2];
+                uint64_t mask =
+                    (p1 ^ nGenerationMask1) | (p2 ^ nGenerationMask2);
+                pblock[w] = p1 & mask;
+                pblock[w + BLOCK_WORDS / 2] = p2 & mask;
+            }
         }
     }
     nEntriesThisGeneration++;
 
-    for (int n = 0; n < nHashFuncs; n++) {
-        uint32_t h = RollingBloomHash(n, nTweak, vKey);
-        int bit = h & 0x3F;
-        uint32_t pos = (h >> 6) % data.size();
-        /* The lowest bit of pos is ignored, and set to zero for the first bit,
-         * and to one for the second. */
-        data[pos & ~1] = (data[pos & ~1] & ~(((uint64_t)1) << bit)) |
-                         ((uint64_t)(nGeneration & 1)) << bit;
-        data[pos | 1] = (data[pos | 1] & ~(((uint64_t)1) << bit)) |
-                        ((uint64_t)(nGeneration >> 1)) << bit;
+    uint64_t masks[BLOCK_WORDS / 2];
+    uint64_t *pblock = &data[GetBlock(nHash, masks)];
+    uint64_t nGenerationMask1 = -(uint64_t)(nGeneration & 1);
+    uint64_t nGenerationMask2 = -(uint64_t)(nGeneration >> 1);
+    for (int w = 0; w < BLOCK_WORDS / 2; w++) {
+        pblock[w] = (pblock[w] & ~masks[w]) | (masks[w] & nGenerationMask1);
+        pblock[w + BLOCK_WORDS / 2] =
+            (pblock[w + BLOCK_WORDS / 2] & ~masks[w]) |
+            (masks[w] & nGenerationMask2);
+    }
+}
+
+bool CRollingBloomFilter::ContainsHash(uint64_t nHash) const {
+    uint64_t masks[BLOCK_WORDS / 2];
+    const uint64_t *pblock = &data[GetBlock(nHash, masks)];
+    /* Every position needs to be set in some generation, check all of them
+     * without branching. */
+    uint64_t nMissing = 0;
+    for (int w = 0; w < BLOCK_WORDS / 2; w++) {
+        nMissing |= masks[w] & ~(pblock[w] | pblock[w + BLOCK_WORDS / 2]);
     }
+    return nMissing == 0;
+}
+
+void CRollingBloomFilter::insert(const std::vector<uint8_t> &vKey) {
+    InsertHash(CSipHasher(nHashKey0, nHashKey1)
+                   .Write(vKey.data(), vKey.size())
+                   .Finalize());
 }
 
 void CRollingBloomFilter::insert(const uint256 &hash) {
-    std::vector<uint8_t> vData(hash.begin(), hash.end());
-    insert(vData);
+    InsertHash(SipHashUint256(nHashKey0, nHashKey1, hash));
 }
 
 bool CRollingBloomFilter::contains(const std::vector<uint8_t> &vKey) const {
-    for (int n = 0; n < nHashFuncs; n++) {
-        uint32_t h = RollingBloomHash(n, nTweak, vKey);
-        int bit = h & 0x3F;
-        uint32_t pos = (h >> 6) % data.size();
-        /* If the relevant bit is not set in either data[pos & ~1] or data[pos |
-         * 1], the filter does not contain vKey */
-        if (!(((data[pos & ~1] | data[pos | 1]) >> bit) & 1)) {
-            return false;
-        }
-    }
-    return true;
+    return ContainsHash(CSipHasher(nHashKey0, nHashKey1)
+                            .Write(vKey.data(), vKey.size())
+                            .Finalize());
 }
 
 bool CRollingBloomFilter::contains(const uint256 &hash) const {
-    std::vector<uint8_t> vData(hash.begin(), hash.end());
-    return contains(vData);
+    return ContainsHash(SipHashUint256(nHashKey0, nHashKey1, hash));
 }
 
 void CRollingBloomFilter::reset() {
-    nTweak = GetRand(std::numeric_limits<unsigned int>::max());
+    nHashKey0 = GetRand(std::numeric_limits<uint64_t>::max());
+    nHashKey1 = GetRand(std::numeric_limits<uint64_t>::max());
     nEntriesThisGeneration = 0;
     nGeneration = 1;
-    for (std::vector<uint64_t>::iterator it = data.begin(); it != data.end();
-         it++) {
-        *it = 0;
-    }
+    std::fill(data.begin(), data.end(), 0);
 }
@@ -7,8 +7,11 @@
 
 #include "serialize.h"
 
+#include <memory>
 #include <vector>
 
+class CBlock;
+class CBloomBlockElements;
 class COutPoint;
 class CTransaction;
 class uint256;
@@ -50,8 +53,11 @@ private:
     unsigned int nTweak;
     uint8_t nFlags;
 
-    unsigned int Hash(unsigned int nHashNum,
-                      const std::vector<uint8_t> &vDataToHash) const;
+    unsigned int Hash(unsigned int nHashNum, const uint8_t *pDataToHash,
+                      size_t nDataSize) const;
+
+    void insert(const uint8_t *pKey, size_t nKeySize);
+    bool contains(const uint8_t *pKey, size_t nKeySize) const;
 
     // Private constructor for CRollingBloomFilter, no restrictions on size
     CBloomFilter(unsigned int nElements, double nFPRate, unsigned int nTweak);
@@ -103,24 +109,68 @@ public:
     //! Also adds any outputs which match the filter to the filter (to match
     //! their spending txes)
     bool IsRelevantAndUpdate(const CTransaction &tx);
+    //! Same as above for transaction nTx of a block whose elements were
+    //! already extracted.
+    bool IsRelevantAndUpdate(const CBloomBlockElements &elements, size_t nTx);
 
     //! Checks for empty and full filters to avoid wasting cpu
     void UpdateEmptyFull();
 };
 
+/**
+ * The data elements of a block that CBloomFilter::IsRelevantAndUpdate looks
+ * at: the txids, the data pushed by every scriptPubKey and scriptSig and the
+ * outpoints spent. Scripts are parsed and outpoints serialized once, so that
+ * matching the block against the filters of many peers only has to hash the
+ * elements.
+ */
+class CBloomBlockElements {
+public:
+    explicit CBloomBlockElements(std::shared_ptr<const CBlock> pblockIn);
+
+    const CBlock &GetBlock() const { return *pblock; }
+
+private:
+    struct Element {
+        //! Position of the element in vData.
+        uint32_t nBegin;
+        uint32_t nSize;
+        //! Output whose scriptPubKey pushes the element, unused for inputs.
+        uint32_t nOutput;
+    };
+
+    std::shared_ptr<const CBlock> pblock;
+    std::vector<uint8_t> vData;
+    std::vector<Element> vElements;
+    //! The elements of transaction i are those of its outputs, in order, in
+    //! [vTxBegin[i], vTxInputs[i]) followed by those of its inputs up to
+    //! vTxBegin[i + 1].
+    std::vector<uint32_t> vTxBegin;
+    std::vector<uint32_t> vTxInputs;
+
+    void AddElement(const uint8_t *pbegin, size_t nSize, uint32_t nOutput);
+
+    friend class CBloomFilter;
+};
+
 /**
  * RollingBloomFilter is a probabilistic "keep track of most recently inserted"
  * set. Construct it with the number of items to keep track of, and a
- * false-positive rate. Unlike CBloomFilter, by default nTweak is set to a
- * cryptographically secure random value for you. Similarly rather than clear()
- * the method reset() is provided, which also changes nTweak to decrease the
- * impact of false-positives.
+ * false-positive rate. Unlike CBloomFilter, by default the hash key is set to
+ * a cryptographically secure random value for you. Similarly rather than
+ * clear() the method reset() is provided, which also changes the hash key to
+ * decrease the impact of false-positives.
  *
  * contains(item) will always return true if item was one of the last N to 1.5*N
  * insert()'ed ... but may also return true for items that were not inserted.
  *
- * It needs around 1.8 bytes per element per factor 0.1 of false positive rate.
- * (More accurately: 3/(log(256)*log(2)) * log(1/fpRate) * nElements bytes)
+ * The filter is blocked: a single 64-bit SipHash of an item picks one block of
+ * ROLLING_BLOOM_BLOCK_BITS positions, 128 aligned bytes, and all the positions
+ * of the item within it, so an insert or lookup touches one block instead of
+ * one cache line per hash function. Blocks fill unevenly, which the size and
+ * the number of hash functions are chosen to make up for: it needs around 2.4
+ * bytes per element per factor 0.1 of false positive rate at a rate of 1e-6,
+ * less at higher rates.
  */
 class CRollingBloomFilter {
 public:
@@ -136,13 +186,30 @@ public:
 
     void reset();
 
+    //! Positions per block.
+    static const int ROLLING_BLOOM_BLOCK_BITS = 512;
+
 private:
+    //! 64-bit words per block. Each position takes 2 bits, stored in the
+    //! first and the second half of the block.
+    static const int BLOCK_WORDS = 2 * ROLLING_BLOOM_BLOCK_BITS / 64;
+
     int nEntriesPerGeneration;
     int nEntriesThisGeneration;
     int nGeneration;
     std::vector<uint64_t> data;
-    unsigned int nTweak;
+    //! Offset of the first block in data, which aligns the blocks.
+    size_t nDataOffset;
+    uint32_t nBlocks;
+    uint64_t nHashKey0;
+    uint64_t nHashKey1;
     int nHashFuncs;
+
+    void InsertHash(uint64_t nHash);
+    bool ContainsHash(uint64_t nHash) const;
+    //! Return the index in data of the block of an item, and set masks to
+    //! its positions in each word of one half of the block.
+    size_t GetBlock(uint64_t nHash, uint64_t *masks) const;
 };
 
 #endif // BITCOIN_BLOOM_H
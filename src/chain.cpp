@@ -130,6 +130,102 @@ void CBlockIndex::BuildSkip() {
     }
 }
 
+size_t BlockMap::FindSlot(const uint256 &hash) const {
+    size_t pos = BlockHasher()(hash) & Mask();
+    while (used[pos] && slots[pos].first != hash) {
+        pos = (pos + 1) & Mask();
+    }
+    return pos;
+}
+
+void BlockMap::Rehash(size_t nSlots) {
+    std::vector<value_type> oldSlots(nSlots);
+    std::vector<bool> oldUsed(nSlots, false);
+    oldSlots.swap(slots);
+    oldUsed.swap(used);
+    for (size_t i = 0; i < oldSlots.size(); i++) {
+        if (oldUsed[i]) {
+            size_t pos = FindSlot(oldSlots[i].first);
+            slots[pos] = oldSlots[i];
+            used[pos] = true;
+        }
+    }
+}
+
+BlockMap::iterator BlockMap::find(const uint256 &hash) {
+    if (nSize == 0) {
+        return end();
+    }
+    size_t pos = FindSlot(hash);
+    return used[pos] ? iterator(this, pos) : end();
+}
+
+BlockMap::const_iterator BlockMap::find(const uint256 &hash) const {
+    if (nSize == 0) {
+        return end();
+    }
+    size_t pos = FindSlot(hash);
+    return used[pos] ? const_iterator(this, pos) : end();
+}
+
+std::pair<BlockMap::iterator, bool> BlockMap::insert(const value_type &value) {
+    // Keep the load factor at or below 3/4 so probe sequences stay short.
+    if (4 * (nSize + 1) > 3 * slots.size()) {
+        Rehash(std::max<size_t>(64, 2 * slots.size()));
+    }
+    size_t pos = FindSlot(value.first);
+    if (used[pos]) {
+        return std::make_pair(iterator(this, pos), false);
+    }
+    slots[pos] = value;
+    used[pos] = true;
+    nSize++;
+    return std::make_pair(iterator(this, pos), true);
+}
+
+void BlockMap::reserve(size_t n) {
+    size_t nSlots = std::max<size_t>(64, slots.size());
+    while (4 * n > 3 * nSlots) {
+        nSlots *= 2;
+    }
+    if (nSlots != slots.size()) {
+        Rehash(nSlots);
+    }
+}
+
+void BlockMap::clear() {
+    slots.clear();
+    used.clear();
+    nSize = 0;
+}
+
+size_t BlockMap::DynamicMemoryUsage() const {
+    return slots.capacity() * sizeof(value_type) + used.capacity() / 8;
+}
+
+CBlockIndex *BlockIndexArena::Allocate(const uint256 &hash,
+                                       const CBlockIndex &init) {
+    if (nUsedInLastChunk == ENTRIES_PER_CHUNK) {
+        chunks.emplace_back(new Entry[ENTRIES_PER_CHUNK]);
+        nUsedInLastChunk = 0;
+    }
+    Entry &entry = chunks.back()[nUsedInLastChunk++];
+    entry.hash = hash;
+    entry.index = init;
+    entry.index.phashBlock = &entry.hash;
+    return &entry.index;
+}
+
+void BlockIndexArena::Clear() {
+    chunks.clear();
+    nUsedInLastChunk = ENTRIES_PER_CHUNK;
+}
+
+size_t BlockIndexArena::DynamicMemoryUsage() const {
+    return chunks.size() * ENTRIES_PER_CHUNK * sizeof(Entry) +
+           chunks.capacity() * sizeof(std::unique_ptr<Entry[]>);
+}
+
 arith_uint256 GetBlockProof(const CBlockIndex &block) {
     arith_uint256 bnTarget;
     bool fNegative;
@@ -14,7 +14,8 @@
 #include "uint256.h"
 #include "serialize.h"
 
-#include <unordered_map>
+#include <memory>
+#include <utility>
 #include <vector>
 
 class CBlockFileInfo {
@@ -410,7 +411,134 @@ struct BlockHasher {
     size_t operator()(const uint256 &hash) const { return hash.GetCheapHash(); }
 };
 
-typedef std::unordered_map<uint256, CBlockIndex *, BlockHasher> BlockMap;
+/**
+ * Open addressing hash map from block hash to block index, with linear probing
+ * over one contiguous array, so that lookups during header sync touch a
+ * couple of cache lines instead of walking bucket chains of individually
+ * allocated nodes. Implements the subset of the std::unordered_map interface
+ * used on mapBlockIndex. Unlike std::unordered_map, inserting may move
+ * existing entries, so keys must not be referenced beyond the lifetime of an
+ * iterator: block indexes point to the hash stored in BlockIndexArena
+ * instead.
+ */
+class BlockMap {
+public:
+    typedef std::pair<uint256, CBlockIndex *> value_type;
+
+private:
+    std::vector<value_type> slots;
+    std::vector<bool> used;
+    size_t nSize;
+
+    size_t Mask() const { return slots.size() - 1; }
+    size_t FindSlot(const uint256 &hash) const;
+    void Rehash(size_t nSlots);
+
+    template <typename Map, typename Value> class Iterator {
+        Map *map;
+        size_t pos;
+
+        void SkipUnused() {
+            while (pos < map->slots.size() && !map->used[pos]) {
+                pos++;
+            }
+        }
+
+    public:
+        Iterator(Map *mapIn, size_t posIn) : map(mapIn), pos(posIn) {
+            SkipUnused();
+        }
+        template <typename OtherMap, typename OtherValue>
+        Iterator(const Iterator<OtherMap, OtherValue> &other)
+            : map(other.map), pos(other.pos) {}
+
+        Value &operator*() const { return map->slots[pos]; }
+        Value *operator->() const { return &map->slots[pos]; }
+        Iterator &operator++() {
+            pos++;
+            SkipUnused();
+            return *this;
+        }
+        Iterator operator++(int) {
+            Iterator ret = *this;
+            ++*this;
+            return ret;
+        }
+        bool operator==(const Iterator &other) const {
+            return pos == other.pos;
+        }
+        bool operator!=(const Iterator &other) const {
+            return pos != other.pos;
+        }
+
+        template <typename OtherMap, typename OtherValue>
+        friend class Iterator;
+        friend class BlockMap;
+    };
+
+public:
+    typedef Iterator<BlockMap, value_type> iterator;
+    typedef Iterator<const BlockMap, const value_type> const_iterator;
+
+    BlockMap() : nSize(0) {}
+
+    iterator begin() { return iterator(this, 0); }
+    iterator end() { return iterator(this, slots.size()); }
+    const_iterator begin() const { return const_iterator(this, 0); }
+    const_iterator end() const { return const_iterator(this, slots.size()); }
+
+    size_t size() const { return nSize; }
+    bool empty() const { return nSize == 0; }
+
+    iterator find(const uint256 &hash);
+    const_iterator find(const uint256 &hash) const;
+    size_t count(const uint256 &hash) const {
+        return find(hash) != end() ? 1 : 0;
+    }
+    std::pair<iterator, bool> insert(const value_type &value);
+    CBlockIndex *&operator[](const uint256 &hash) {
+        return insert(value_type(hash, nullptr)).first->second;
+    }
+
+    //! Make room for at least n entries without further rehashing.
+    void reserve(size_t n);
+    void clear();
+
+    size_t DynamicMemoryUsage() const;
+};
+
+/**
+ * Slab allocator for block index entries. Entries are carved out of large
+ * chunks, in allocation order, together with the hash they are indexed by,
+ * so chain traversals following pprev/pskip mostly stay within the same
+ * chunk. Individual entries are never freed; Clear() releases all of them at
+ * once.
+ */
+class BlockIndexArena {
+private:
+    struct Entry {
+        uint256 hash;
+        CBlockIndex index;
+    };
+
+    static const size_t ENTRIES_PER_CHUNK = 4096;
+
+    std::vector<std::unique_ptr<Entry[]>> chunks;
+    size_t nUsedInLastChunk;
+
+public:
+    BlockIndexArena() : nUsedInLastChunk(ENTRIES_PER_CHUNK) {}
+
+    /**
+     * Return a new block index, initialized from the given one, whose
+     * phashBlock points to storage owned by the arena.
+     */
+    CBlockIndex *Allocate(const uint256 &hash, const CBlockIndex &init);
+    void Clear();
+
+    size_t DynamicMemoryUsage() const;
+};
+
 extern BlockMap mapBlockIndex;
 
 arith_uint256 GetBlockProof(const CBlockIndex &block);
@@ -11,6 +11,7 @@
 #include "utilstrencodings.h"
 
 #include <cassert>
+#include <limits>
 
 #include "chainparamsseeds.h"
 #include "primitives/transaction.h"
@@ -148,6 +149,9 @@ public:
         // Nov, 13 hard fork
         consensus.daaHeight = 504031;
 
+        // Canonical transaction ordering is not scheduled on mainnet.
+        consensus.canonicalTxOrderHeight = std::numeric_limits<int>::max();
+
         /**
          * The message start string is designed to be unlikely to occur in
          * normal data. The characters are rarely used upper ASCII, not valid as
@@ -321,6 +325,9 @@ public:
         // Nov, 13 hard fork
         consensus.daaHeight = 1188697;
 
+        // Canonical transaction ordering is opt-in on testnet.
+        consensus.canonicalTxOrderHeight = std::numeric_limits<int>::max();
+
         diskMagic[0] = 0x0b;
         diskMagic[1] = 0x11;
         diskMagic[2] = 0x09;
@@ -392,6 +399,10 @@ public:
         // (height 1063660)
         chainTxData = ChainTxData{1483546230, 12834668, 0.15};
     }
+
+    void UpdateCanonicalTxOrderHeight(int nHeight) {
+        consensus.canonicalTxOrderHeight = nHeight;
+    }
 };
 static CTestNetParams testNetParams;
 
@@ -446,6 +457,9 @@ public:
         // Nov, 13 hard fork is always on on regtest.
         consensus.daaHeight = 0;
 
+        // Canonical transaction ordering is opt-in on regtest.
+        consensus.canonicalTxOrderHeight = std::numeric_limits<int>::max();
+
         diskMagic[0] = 0xfa;
         diskMagic[1] = 0xbf;
         diskMagic[2] = 0xb5;
@@ -496,6 +510,10 @@ public:
         consensus.vDeployments[d].nStartTime = nStartTime;
         consensus.vDeployments[d].nTimeout = nTimeout;
     }
+
+    void UpdateCanonicalTxOrderHeight(int nHeight) {
+        consensus.canonicalTxOrderHeight = nHeight;
+    }
 };
 
 static CRegTestParams regTestParams;
@@ -533,3 +551,17 @@ void UpdateRegtestBIP9Parameters(Consensus::DeploymentPos d, int64_t nStartTime,
                                  int64_t nTimeout) {
     regTestParams.UpdateBIP9Parameters(d, nStartTime, nTimeout);
 }
+
+bool UpdateCanonicalTxOrderHeight(const std::string &chain, int nHeight) {
+    if (chain == CBaseChainParams::TESTNET) {
+        testNetParams.UpdateCanonicalTxOrderHeight(nHeight);
+        return true;
+    }
+
+    if (chain == CBaseChainParams::REGTEST) {
+        regTestParams.UpdateCanonicalTxOrderHeight(nHeight);
+        return true;
+    }
+
+    return false;
+}
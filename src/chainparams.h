@@ -138,4 +138,10 @@ void SelectParams(const std::string &chain);
 void UpdateRegtestBIP9Parameters(Consensus::DeploymentPos d, int64_t nStartTime,
                                  int64_t nTimeout);
 
+/**
+ * Allows scheduling canonical transaction ordering on the test chains.
+ * @returns false if the given chain does not allow it.
+ */
+bool UpdateCanonicalTxOrderHeight(const std::string &chain, int nHeight);
+
 #endif // BITCOIN_CHAINPARAMS_H
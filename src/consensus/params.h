@@ -59,6 +59,11 @@ struct Params {
     int uahfHeight;
     /** Block height at which the new DAA becomes active */
     int daaHeight;
+    /**
+     * Block height after which transactions in a block must be sorted by
+     * txid (canonical transaction ordering)
+     */
+    int canonicalTxOrderHeight;
     /** Block height at which OP_RETURN replay protection stops */
     int antiReplayOpReturnSunsetHeight;
     /** Committed OP_RETURN value for replay protection */
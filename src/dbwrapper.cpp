@@ -14,6 +14,7 @@
 
 #include <algorithm>
 #include <cstdint>
+#include <mutex>
 #include <leveldb/cache.h>
 #include <leveldb/env.h>
 #include <leveldb/filter_policy.h>
@@ -77,14 +78,159 @@ public:
     }
 };
 
-static leveldb::Options GetOptions(size_t nCacheSize) {
+namespace {
+struct DBTunable {
+    const char *name;
+    int64_t nMin;
+    int64_t nMax;
+    int64_t nDefault;
+};
+
+// Order matches the fields of DBTunables.
+const DBTunable dbTunables[] = {
+    {"block_size", 1 << 10, 4 << 20, 4 << 10},
+    {"max_open_files", 16, 1 << 16, 64},
+    {"bloom_bits", 0, 64, 10},
+    {"max_file_size", 1 << 20, 1 << 30, 2 << 20},
+};
+
+struct DBTunables {
+    int64_t values[ARRAYLEN(dbTunables)];
+};
+
+// Databases that can be named in -dbopt values.
+const char *const dbNames[] = {"chainstate", "index", "txindex", "address",
+                               "blockfilter"};
+
+bool IsDBName(const std::string &strName) {
+    for (const char *pszName : dbNames) {
+        if (strName == pszName) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Name selecting the -dbopt values of the database at path: its directory
+ * name, or that of its parent for databases kept per type, such as
+ * indexes/blockfilter/basic.
+ */
+std::string GetDBName(const fs::path &path) {
+    std::string strName = path.filename().string();
+    std::string strParent = path.parent_path().filename().string();
+    return !IsDBName(strName) && IsDBName(strParent) ? strParent : strName;
+}
+
+/**
+ * Split a -dbopt value of the form [<db>.]<option>=<value>. Returns the index
+ * of the option in dbTunables, or -1 if it is malformed or out of range.
+ */
+int ParseDBOption(const std::string &str, std::string &strDB,
+                  int64_t &nValue) {
+    size_t nEq = str.find('=');
+    if (nEq == std::string::npos) {
+        return -1;
+    }
+    std::string strKey = str.substr(0, nEq);
+    size_t nDot = strKey.find('.');
+    if (nDot == 0) {
+        return -1;
+    }
+    strDB = nDot == std::string::npos ? "" : strKey.substr(0, nDot);
+    strKey = nDot == std::string::npos ? strKey : strKey.substr(nDot + 1);
+    if (!ParseInt64(str.substr(nEq + 1), &nValue)) {
+        return -1;
+    }
+    for (size_t i = 0; i < ARRAYLEN(dbTunables); i++) {
+        if (strKey == dbTunables[i].name) {
+            if (nValue < dbTunables[i].nMin || nValue > dbTunables[i].nMax) {
+                return -1;
+            }
+            return i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Tunables of the named database: defaults, overridden by the -dbopt values
+ * for all databases, overridden by those for this one.
+ */
+DBTunables GetDBTunables(const std::string &strName) {
+    DBTunables tunables;
+    for (size_t i = 0; i < ARRAYLEN(dbTunables); i++) {
+        tunables.values[i] = dbTunables[i].nDefault;
+    }
+    if (!mapMultiArgs.count("-dbopt")) {
+        return tunables;
+    }
+    for (bool fNamed : {false, true}) {
+        for (const std::string &str : mapMultiArgs.at("-dbopt")) {
+            std::string strDB;
+            int64_t nValue;
+            int nOption = ParseDBOption(str, strDB, nValue);
+            if (nOption >= 0 && strDB.empty() != fNamed &&
+                (!fNamed || strDB == strName)) {
+                tunables.values[nOption] = nValue;
+            }
+        }
+    }
+    return tunables;
+}
+
+std::mutex csOpenDBs;
+std::vector<const CDBWrapper *> vOpenDBs;
+} // namespace
+
+bool CheckDBOptions(std::string &strError) {
+    if (!mapMultiArgs.count("-dbopt")) {
+        return true;
+    }
+    for (const std::string &str : mapMultiArgs.at("-dbopt")) {
+        std::string strDB;
+        int64_t nValue;
+        if (ParseDBOption(str, strDB, nValue) < 0) {
+            strError = strprintf("Invalid -dbopt value: %s", str);
+            return false;
+        }
+        if (!strDB.empty() && !IsDBName(strDB)) {
+            strError = strprintf("Unknown database in -dbopt value: %s", str);
+            return false;
+        }
+    }
+    return true;
+}
+
+void ForEachDBWrapper(const std::function<void(const CDBWrapper &)> &fn) {
+    std::lock_guard<std::mutex> lock(csOpenDBs);
+    for (const CDBWrapper *pdbw : vOpenDBs) {
+        fn(*pdbw);
+    }
+}
+
+static leveldb::Options GetOptions(size_t nCacheSize,
+                                   const std::string &strName) {
+    const DBTunables tunables = GetDBTunables(strName);
+    for (size_t i = 0; i < ARRAYLEN(dbTunables); i++) {
+        if (tunables.values[i] != dbTunables[i].nDefault) {
+            LogPrintf("Using LevelDB option %s=%d for %s\n",
+                      dbTunables[i].name, tunables.values[i], strName);
+        }
+    }
+
     leveldb::Options options;
     options.block_cache = leveldb::NewLRUCache(nCacheSize / 2);
     // up to two write buffers may be held in memory simultaneously
     options.write_buffer_size = nCacheSize / 4;
-    options.filter_policy = leveldb::NewBloomFilterPolicy(10);
+    options.filter_policy =
+        tunables.values[2] > 0
+            ? leveldb::NewBloomFilterPolicy(tunables.values[2])
+            : nullptr;
     options.compression = leveldb::kNoCompression;
-    options.max_open_files = 64;
+    options.block_size = tunables.values[0];
+    options.max_open_files = tunables.values[1];
+    options.max_file_size = tunables.values[3];
 <<<<<<< HEAD
     options.info_log = new CBitcoinLevelDBLogger();
     if (leveldb::kMajorVersion > 1 ||
@@ -100,13 +246,14 @@ static leveldb::Options GetOptions(size_t nCacheSize) {
 }
 
 CDBWrapper::CDBWrapper(const fs::path &path, size_t nCacheSize, bool fMemory,
-                       bool fWipe, bool obfuscate) {
+                       bool fWipe, bool obfuscate)
+    : name(GetDBName(path)) {
     penv = nullptr;
     readoptions.verify_checksums = true;
     iteroptions.verify_checksums = true;
     iteroptions.fill_cache = false;
     syncoptions.sync = true;
-    options = GetOptions(nCacheSize);
+    options = GetOptions(nCacheSize, name);
     options.create_if_missing = true;
     if (fMemory) {
         penv = leveldb::NewMemEnv(leveldb::Env::Default());
@@ -150,9 +297,16 @@ CDBWrapper::CDBWrapper(const fs::path &path, size_t nCacheSize, bool fMemory,
 
     LogPrintf("Using obfuscation key for %s: %s\n", path.string(),
               HexStr(obfuscate_key));
+
+    std::lock_guard<std::mutex> lock(csOpenDBs);
+    vOpenDBs.push_back(this);
 }
 
 CDBWrapper::~CDBWrapper() {
+    {
+        std::lock_guard<std::mutex> lock(csOpenDBs);
+        vOpenDBs.erase(std::find(vOpenDBs.begin(), vOpenDBs.end(), this));
+    }
     delete pdb;
     pdb = nullptr;
     delete options.filter_policy;
@@ -165,6 +319,11 @@ CDBWrapper::~CDBWrapper() {
     options.env = nullptr;
 }
 
+bool CDBWrapper::GetProperty(const std::string &property,
+                             std::string &value) const {
+    return pdb->GetProperty(property, &value);
+}
+
 bool CDBWrapper::WriteBatch(CDBBatch &batch, bool fSync) {
     leveldb::Status status = pdb->Write(fSync ? syncoptions : writeoptions, &batch.batch);
     dbwrapper_private::HandleError(status);
@@ -230,4 +389,8 @@ void HandleError(const leveldb::Status &status) {
 const std::vector<uint8_t> &GetObfuscateKey(const CDBWrapper &w) {
     return w.obfuscate_key;
 }
+
+const leveldb::Options &GetOptions(const CDBWrapper &w) {
+    return w.options;
+}
 }; // namespace dbwrapper_private
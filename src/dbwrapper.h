@@ -23,6 +23,9 @@
 #include <leveldb/db.h>
 #include <leveldb/write_batch.h>
 
+#include <functional>
+#include <string>
+
 static const size_t DBWRAPPER_PREALLOC_KEY_SIZE = 64;
 static const size_t DBWRAPPER_PREALLOC_VALUE_SIZE = 1024;
 
@@ -49,6 +52,9 @@ void HandleError(const leveldb::Status &status);
  * specific database.
  */
 const std::vector<uint8_t> &GetObfuscateKey(const CDBWrapper &w);
+
+/** Options the database was opened with, for testing in dbwrapper_tests. */
+const leveldb::Options &GetOptions(const CDBWrapper &w);
 }; // namespace dbwrapper_private
 
 /** Batch of changes queued to be written to a CDBWrapper */
@@ -179,8 +185,13 @@ public:
 // 对leveldb操作的封装
 class CDBWrapper {
     friend const std::vector<uint8_t> &dbwrapper_private::GetObfuscateKey(const CDBWrapper &w);
+    friend const leveldb::Options &
+    dbwrapper_private::GetOptions(const CDBWrapper &w);
 
 private:
+    //! name of the database directory, selecting its -dbopt values
+    const std::string name;
+
     //! custom environment this database is using (may be nullptr in case of
     //! default environment)
     leveldb::Env *penv;
@@ -285,6 +296,11 @@ public:
 
     bool WriteBatch(CDBBatch &batch, bool fSync = false);
 
+    const std::string &GetName() const { return name; }
+
+    //! Read a LevelDB property, such as "leveldb.stats".
+    bool GetProperty(const std::string &property, std::string &value) const;
+
     // not available for LevelDB; provide for compatibility with BDB
     bool Flush() { return true; }
 
@@ -318,4 +334,13 @@ public:
     }
 };
 
+/**
+ * Check the -dbopt values, each of the form [<db>.]<option>=<value> where
+ * <db> is chainstate, index, txindex, address or blockfilter.
+ */
+bool CheckDBOptions(std::string &strError);
+
+/** Call fn on every open database, which stay open until it returns. */
+void ForEachDBWrapper(const std::function<void(const CDBWrapper &)> &fn);
+
 #endif // BITCOIN_DBWRAPPER_H
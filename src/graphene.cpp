@@ -0,0 +1,323 @@
+// Copyright (c) 2018 The Bitcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "graphene.h"
+
+#include "config.h"
+#include "consensus/consensus.h"
+#include "random.h"
+#include "txmempool.h"
+#include "util.h"
+#include "validation.h"
+
+#include <algorithm>
+#include <cmath>
+
+/**
+ * Expected number of mempool false positives the filter is sized for, per
+ * block transaction. Each false positive costs about 1.5 IBLT cells of 16
+ * bytes, while halving the false positive rate costs about 1.44 bits per block
+ * transaction in the filter: the total size is minimal around 1 / 92.
+ */
+static const double GRAPHENE_FALSE_POSITIVES_PER_TX = 1.0 / 92;
+/**
+ * Extra IBLT capacity for block transactions the receiver doesn't have, as a
+ * fraction of the block, on top of a fixed margin.
+ */
+static const double GRAPHENE_MISSING_TX_RATE = 0.01;
+static const size_t GRAPHENE_MISSING_TX_MARGIN = 4;
+
+/** Finalizer of SplitMix64, a cheap and well mixing 64-bit hash. */
+static uint64_t Mix64(uint64_t x) {
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+CShortIDFilter::CShortIDFilter(size_t nElements, double dFPRate)
+    : nHashFuncs(0) {
+    if (nElements == 0 || dFPRate >= 1) {
+        return;
+    }
+    const double LN2 = std::log(2.0);
+    size_t nBits = std::ceil(-1 / (LN2 * LN2) * nElements * std::log(dFPRate));
+    vData.resize((nBits + 7) / 8);
+    nHashFuncs = std::max<unsigned int>(
+        1, std::min<unsigned int>(vData.size() * 8 * LN2 / nElements,
+                                  MAX_HASH_FUNCS));
+}
+
+void CShortIDFilter::insert(uint64_t shortid) {
+    if (vData.empty()) {
+        return;
+    }
+    uint64_t nBits = vData.size() * 8;
+    uint64_t h1 = Mix64(shortid), h2 = Mix64(h1) | 1;
+    for (unsigned int i = 0; i < nHashFuncs; i++) {
+        uint64_t nIndex = (h1 + i * h2) % nBits;
+        vData[nIndex >> 3] |= (1 << (7 & nIndex));
+    }
+}
+
+bool CShortIDFilter::contains(uint64_t shortid) const {
+    if (vData.empty()) {
+        return true;
+    }
+    uint64_t nBits = vData.size() * 8;
+    uint64_t h1 = Mix64(shortid), h2 = Mix64(h1) | 1;
+    for (unsigned int i = 0; i < nHashFuncs; i++) {
+        uint64_t nIndex = (h1 + i * h2) % nBits;
+        if (!(vData[nIndex >> 3] & (1 << (7 & nIndex)))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+CIblt::CIblt(size_t nEntries, uint32_t nSaltIn) : nSalt(nSaltIn) {
+    // About 1.5 cells per entry decode reliably for large tables, but small
+    // ones fail too often unless they get some headroom.
+    size_t nCells = nEntries + nEntries / 2 + 8 * NUM_HASHES;
+    vCells.resize((nCells + NUM_HASHES - 1) / NUM_HASHES * NUM_HASHES);
+}
+
+size_t CIblt::GetCellIndex(uint64_t key, size_t nHash) const {
+    size_t nSubtableSize = vCells.size() / NUM_HASHES;
+    return nHash * nSubtableSize +
+           Mix64(key ^ (uint64_t(nSalt) << 32 | nHash)) % nSubtableSize;
+}
+
+uint32_t CIblt::GetKeyCheck(uint64_t key) const {
+    return Mix64(key ^ ~uint64_t(nSalt)) >> 32;
+}
+
+void CIblt::Update(uint64_t key, uint32_t nDelta) {
+    if (vCells.empty()) {
+        return;
+    }
+    uint32_t keyCheck = GetKeyCheck(key);
+    for (size_t i = 0; i < NUM_HASHES; i++) {
+        Cell &cell = vCells[GetCellIndex(key, i)];
+        cell.count += nDelta;
+        cell.keySum ^= key;
+        cell.keyCheck ^= keyCheck;
+    }
+}
+
+bool CIblt::IsPure(const Cell &cell) const {
+    return (cell.count == 1 || cell.count == uint32_t(-1)) &&
+           cell.keyCheck == GetKeyCheck(cell.keySum);
+}
+
+bool CIblt::ListEntries(std::set<uint64_t> &positive,
+                        std::set<uint64_t> &negative) const {
+    CIblt peeled(*this);
+    std::vector<size_t> vPure;
+    for (size_t i = 0; i < peeled.vCells.size(); i++) {
+        if (peeled.IsPure(peeled.vCells[i])) {
+            vPure.push_back(i);
+        }
+    }
+
+    // Every key of a well formed table is peeled once. Crafted tables can make
+    // a key come back, so listing one twice fails, and the number of peels is
+    // capped so that decoding always ends.
+    size_t nPeels = 0;
+    while (!vPure.empty()) {
+        const Cell cell = peeled.vCells[vPure.back()];
+        vPure.pop_back();
+        // The cell may have been peeled since it was queued.
+        if (!peeled.IsPure(cell)) {
+            continue;
+        }
+        if (++nPeels > peeled.vCells.size() ||
+            positive.count(cell.keySum) || negative.count(cell.keySum)) {
+            return false;
+        }
+        if (cell.count == 1) {
+            positive.insert(cell.keySum);
+        } else {
+            negative.insert(cell.keySum);
+        }
+        peeled.Update(cell.keySum, -cell.count);
+        for (size_t i = 0; i < NUM_HASHES; i++) {
+            size_t nIndex = peeled.GetCellIndex(cell.keySum, i);
+            if (peeled.IsPure(peeled.vCells[nIndex])) {
+                vPure.push_back(nIndex);
+            }
+        }
+    }
+
+    for (const Cell &cell : peeled.vCells) {
+        if (!cell.IsEmpty()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/** Number of bits needed to write any rank below nCount. */
+static unsigned int GetRankBits(uint64_t nCount) {
+    unsigned int nBits = 0;
+    while (nBits < 64 && (uint64_t(1) << nBits) < nCount) {
+        nBits++;
+    }
+    return nBits;
+}
+
+CGrapheneBlock::CGrapheneBlock(const CBlock &block, uint64_t nReceiverPoolSize)
+    : header(block) {
+    CBlockHeaderAndShortTxIDs cmpctblock(block);
+    nonce = cmpctblock.nonce;
+    prefilledtxn = cmpctblock.prefilledtxn;
+    nShortTxIDs = cmpctblock.shorttxids.size();
+
+    // Size the filter so that about GRAPHENE_FALSE_POSITIVES_PER_TX mempool
+    // transactions per block transaction get through, and the IBLT to cover
+    // them plus the transactions the receiver is missing.
+    double dFalsePositives =
+        std::max(1.0, nShortTxIDs * GRAPHENE_FALSE_POSITIVES_PER_TX);
+    double dFPRate = nReceiverPoolSize > nShortTxIDs
+                         ? dFalsePositives / (nReceiverPoolSize - nShortTxIDs)
+                         : 1.0;
+    filter = CShortIDFilter(nShortTxIDs, dFPRate);
+    size_t nEntries = std::min(1.0, dFPRate) * nReceiverPoolSize +
+                      nShortTxIDs * GRAPHENE_MISSING_TX_RATE +
+                      GRAPHENE_MISSING_TX_MARGIN;
+    iblt = CIblt(nEntries, nonce >> 32);
+
+    for (uint64_t shortid : cmpctblock.shorttxids) {
+        filter.insert(shortid);
+        iblt.Insert(shortid);
+    }
+
+    // Write the rank of each short ID in sorted order, in block order.
+    std::vector<uint64_t> sorted(cmpctblock.shorttxids);
+    std::sort(sorted.begin(), sorted.end());
+    unsigned int nRankBits = GetRankBits(nShortTxIDs);
+    vOrder.assign((nShortTxIDs * nRankBits + 7) / 8, 0);
+    uint64_t nBitPos = 0;
+    for (uint64_t shortid : cmpctblock.shorttxids) {
+        uint64_t nRank =
+            std::lower_bound(sorted.begin(), sorted.end(), shortid) -
+            sorted.begin();
+        for (unsigned int i = 0; i < nRankBits; i++, nBitPos++) {
+            if ((nRank >> i) & 1) {
+                vOrder[nBitPos >> 3] |= 1 << (nBitPos & 7);
+            }
+        }
+    }
+}
+
+ReadStatus CGrapheneBlock::Decode(
+    const Config &config, CTxMemPool &pool,
+    const std::vector<std::pair<uint256, CTransactionRef>> &extra_txn,
+    CBlockHeaderAndShortTxIDs &cmpctblock) const {
+    if (header.IsNull() || nShortTxIDs + prefilledtxn.size() == 0 ||
+        nShortTxIDs + prefilledtxn.size() >
+            config.GetMaxBlockSize() / MIN_TRANSACTION_SIZE) {
+        return READ_STATUS_INVALID;
+    }
+    unsigned int nRankBits = GetRankBits(nShortTxIDs);
+    if (vOrder.size() != (nShortTxIDs * nRankBits + 7) / 8) {
+        return READ_STATUS_INVALID;
+    }
+    // Don't let a peer make us work on outsized tables: a filter can't
+    // usefully have more than 64 bits per element, and the IBLT never needs
+    // to hold much more than the block.
+    if (filter.GetSize() > 8 * nShortTxIDs + 8 ||
+        filter.GetHashFuncs() > CShortIDFilter::MAX_HASH_FUNCS ||
+        iblt.GetCellCount() > 2 * nShortTxIDs + 16 * CIblt::NUM_HASHES) {
+        return READ_STATUS_INVALID;
+    }
+
+    CBlockHeaderAndShortTxIDs salt(header, nonce, {}, {});
+    uint64_t k0 = salt.shorttxidk0, k1 = salt.shorttxidk1;
+
+    // Collect the short IDs of the mempool transactions that pass the filter.
+    std::vector<uint64_t> candidates;
+    {
+        LOCK(pool.cs);
+        const std::vector<std::pair<uint256, CTxMemPool::txiter>> &vTxHashes =
+            pool.vTxHashes;
+        CCriticalSection cs_candidates;
+        ParallelForRange(
+            vTxHashes.size(), std::max(nScriptCheckThreads, 1),
+            [&](size_t begin, size_t end) {
+                std::vector<uint64_t> range_candidates;
+                for (size_t i = begin; i < end; i++) {
+                    uint64_t shortid = CBlockHeaderAndShortTxIDs::GetShortID(
+                        k0, k1, vTxHashes[i].first);
+                    if (filter.contains(shortid)) {
+                        range_candidates.push_back(shortid);
+                    }
+                }
+                LOCK(cs_candidates);
+                candidates.insert(candidates.end(), range_candidates.begin(),
+                                  range_candidates.end());
+            });
+    }
+    for (const std::pair<uint256, CTransactionRef> &extra : extra_txn) {
+        uint64_t shortid =
+            CBlockHeaderAndShortTxIDs::GetShortID(k0, k1, extra.first);
+        if (filter.contains(shortid)) {
+            candidates.push_back(shortid);
+        }
+    }
+    std::sort(candidates.begin(), candidates.end());
+    candidates.erase(std::unique(candidates.begin(), candidates.end()),
+                     candidates.end());
+
+    // What remains in the IBLT once the candidates are taken out are the
+    // block transactions we miss, and the false positives.
+    CIblt diff(iblt);
+    for (uint64_t shortid : candidates) {
+        diff.Erase(shortid);
+    }
+    std::set<uint64_t> missing, falsepositives;
+    if (!diff.ListEntries(missing, falsepositives)) {
+        return READ_STATUS_FAILED;
+    }
+
+    std::vector<uint64_t> sorted;
+    sorted.reserve(nShortTxIDs);
+    for (uint64_t shortid : candidates) {
+        if (!falsepositives.count(shortid)) {
+            sorted.push_back(shortid);
+        }
+    }
+    sorted.insert(sorted.end(), missing.begin(), missing.end());
+    if (sorted.size() != nShortTxIDs ||
+        sorted.size() + falsepositives.size() !=
+            candidates.size() + missing.size()) {
+        // Short ID collisions, in the block or against the mempool.
+        return READ_STATUS_FAILED;
+    }
+    std::sort(sorted.begin(), sorted.end());
+    if (std::adjacent_find(sorted.begin(), sorted.end()) != sorted.end()) {
+        return READ_STATUS_FAILED;
+    }
+
+    std::vector<uint64_t> shorttxids(nShortTxIDs);
+    std::vector<bool> used(nShortTxIDs);
+    uint64_t nBitPos = 0;
+    for (size_t i = 0; i < nShortTxIDs; i++) {
+        uint64_t nRank = 0;
+        for (unsigned int j = 0; j < nRankBits; j++, nBitPos++) {
+            if ((vOrder[nBitPos >> 3] >> (nBitPos & 7)) & 1) {
+                nRank |= uint64_t(1) << j;
+            }
+        }
+        if (nRank >= nShortTxIDs || used[nRank]) {
+            return READ_STATUS_INVALID;
+        }
+        used[nRank] = true;
+        shorttxids[i] = sorted[nRank];
+    }
+
+    cmpctblock = CBlockHeaderAndShortTxIDs(header, nonce, std::move(shorttxids),
+                                           prefilledtxn);
+    return READ_STATUS_OK;
+}
@@ -0,0 +1,178 @@
+// Copyright (c) 2018 The Bitcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_GRAPHENE_H
+#define BITCOIN_GRAPHENE_H
+
+#include "blockencodings.h"
+#include "serialize.h"
+
+#include <set>
+#include <vector>
+
+/**
+ * Bloom filter over compact block short IDs. Unlike CBloomFilter, it is not
+ * bounded by the BIP37 limits and hashes 64-bit keys directly. An empty filter
+ * contains everything.
+ */
+class CShortIDFilter {
+private:
+    std::vector<uint8_t> vData;
+    uint8_t nHashFuncs;
+
+public:
+    static const unsigned int MAX_HASH_FUNCS = 32;
+
+    CShortIDFilter() : nHashFuncs(0) {}
+    /**
+     * Create a filter with the given false positive rate for nElements. A rate
+     * of 1 or more gives an empty filter.
+     */
+    CShortIDFilter(size_t nElements, double dFPRate);
+
+    void insert(uint64_t shortid);
+    bool contains(uint64_t shortid) const;
+
+    size_t GetSize() const { return vData.size(); }
+    unsigned int GetHashFuncs() const { return nHashFuncs; }
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream &s, Operation ser_action) {
+        READWRITE(vData);
+        READWRITE(nHashFuncs);
+    }
+};
+
+/**
+ * Invertible Bloom lookup table over 64-bit keys. Keys can be inserted and
+ * erased in any order, and as long as the table holds few enough keys for its
+ * size, the keys with a positive and a negative count can be listed back.
+ */
+class CIblt {
+public:
+    struct Cell {
+        //! Keys inserted minus keys erased, wrapping around so that the counts
+        //! of tables received from peers cannot overflow. 1 and uint32_t(-1)
+        //! mark cells that may hold a single key.
+        uint32_t count;
+        uint64_t keySum;
+        uint32_t keyCheck;
+
+        Cell() : count(0), keySum(0), keyCheck(0) {}
+
+        bool IsEmpty() const {
+            return count == 0 && keySum == 0 && keyCheck == 0;
+        }
+
+        ADD_SERIALIZE_METHODS;
+
+        template <typename Stream, typename Operation>
+        inline void SerializationOp(Stream &s, Operation ser_action) {
+            READWRITE(count);
+            READWRITE(keySum);
+            READWRITE(keyCheck);
+        }
+    };
+
+    //! Every key is hashed into one cell of each of that many subtables.
+    static const size_t NUM_HASHES = 4;
+
+private:
+    uint32_t nSalt;
+    std::vector<Cell> vCells;
+
+    size_t GetCellIndex(uint64_t key, size_t nHash) const;
+    uint32_t GetKeyCheck(uint64_t key) const;
+    void Update(uint64_t key, uint32_t nDelta);
+    bool IsPure(const Cell &cell) const;
+
+public:
+    CIblt() : nSalt(0) {}
+    /** Create a table able to list about nEntries keys. */
+    CIblt(size_t nEntries, uint32_t nSaltIn);
+
+    void Insert(uint64_t key) { Update(key, 1); }
+    void Erase(uint64_t key) { Update(key, uint32_t(-1)); }
+
+    /**
+     * List the keys with a positive count (inserted more than erased) and the
+     * ones with a negative count. Returns false if the table could not be
+     * fully decoded, or lists a key more than once.
+     */
+    bool ListEntries(std::set<uint64_t> &positive,
+                     std::set<uint64_t> &negative) const;
+
+    size_t GetCellCount() const { return vCells.size(); }
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream &s, Operation ser_action) {
+        READWRITE(nSalt);
+        READWRITE(vCells);
+        if (ser_action.ForRead() && vCells.size() % NUM_HASHES != 0) {
+            throw std::ios_base::failure("invalid IBLT size");
+        }
+    }
+};
+
+/**
+ * Block encoding for set reconciliation against the receiver's mempool
+ * (Graphene). The sender announces the short IDs of the block's transactions
+ * as a Bloom filter, which the receiver uses to pick candidates from its
+ * mempool, plus an IBLT which lets the receiver remove the false positives
+ * and learn the short IDs it is missing. The block order is sent as the rank
+ * of each short ID, using as few bits as possible.
+ *
+ * A decoded block is turned back into a CBlockHeaderAndShortTxIDs, so that
+ * missing transactions are fetched with getblocktxn as for compact blocks.
+ */
+class CGrapheneBlock {
+private:
+    uint64_t nonce;
+    std::vector<PrefilledTransaction> prefilledtxn;
+    uint64_t nShortTxIDs;
+    CShortIDFilter filter;
+    CIblt iblt;
+    std::vector<uint8_t> vOrder;
+
+public:
+    CBlockHeader header;
+
+    // Dummy for deserialization
+    CGrapheneBlock() : nonce(0), nShortTxIDs(0) {}
+
+    /**
+     * Encode a block for a receiver with about nReceiverPoolSize transactions
+     * in its mempool.
+     */
+    CGrapheneBlock(const CBlock &block, uint64_t nReceiverPoolSize);
+
+    /**
+     * Reconcile against the mempool and extra transactions. On success, fills
+     * cmpctblock with the block's short IDs in block order. Returns
+     * READ_STATUS_FAILED if the set difference could not be decoded.
+     */
+    ReadStatus Decode(
+        const Config &config, CTxMemPool &pool,
+        const std::vector<std::pair<uint256, CTransactionRef>> &extra_txn,
+        CBlockHeaderAndShortTxIDs &cmpctblock) const;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream &s, Operation ser_action) {
+        READWRITE(header);
+        READWRITE(nonce);
+        READWRITE(prefilledtxn);
+        READWRITE(COMPACTSIZE(nShortTxIDs));
+        READWRITE(filter);
+        READWRITE(iblt);
+        READWRITE(vOrder);
+    }
+};
+
+#endif // BITCOIN_GRAPHENE_H
@@ -11,20 +11,20 @@ inline uint32_t ROTL32(uint32_t x, int8_t r) {
     return (x << r) | (x >> (32 - r));
 }
 
-unsigned int MurmurHash3(unsigned int nHashSeed,
-                         const std::vector<uint8_t> &vDataToHash) {
+unsigned int MurmurHash3(unsigned int nHashSeed, const uint8_t *pDataToHash,
+                         size_t nDataSize) {
     // The following is MurmurHash3 (x86_32), see
     // http://code.google.com/p/smhasher/source/browse/trunk/MurmurHash3.cpp
     uint32_t h1 = nHashSeed;
-    if (vDataToHash.size() > 0) {
+    if (nDataSize > 0) {
         const uint32_t c1 = 0xcc9e2d51;
         const uint32_t c2 = 0x1b873593;
 
-        const int nblocks = vDataToHash.size() / 4;
+        const int nblocks = nDataSize / 4;
 
         //----------
         // body
-        const uint8_t *blocks = &vDataToHash[0] + nblocks * 4;
+        const uint8_t *blocks = pDataToHash + nblocks * 4;
 
         for (int i = -nblocks; i; i++) {
             uint32_t k1 = ReadLE32(blocks + i * 4);
@@ -40,11 +40,11 @@ unsigned int MurmurHash3(unsigned int nHashSeed,
 
         //----------
         // tail
-        const uint8_t *tail = (const uint8_t *)(&vDataToHash[0] + nblocks * 4);
+        const uint8_t *tail = pDataToHash + nblocks * 4;
 
         uint32_t k1 = 0;
 
-        switch (vDataToHash.size() & 3) {
+        switch (nDataSize & 3) {
             case 3:
                 k1 ^= tail[2] << 16;
             // FALLTHROUGH
@@ -62,7 +62,7 @@ unsigned int MurmurHash3(unsigned int nHashSeed,
 
     //----------
     // finalization
-    h1 ^= vDataToHash.size();
+    h1 ^= nDataSize;
     h1 ^= h1 >> 16;
     h1 *= 0x85ebca6b;
     h1 ^= h1 >> 13;
@@ -72,6 +72,11 @@ unsigned int MurmurHash3(unsigned int nHashSeed,
     return h1;
 }
 
+unsigned int MurmurHash3(unsigned int nHashSeed,
+                         const std::vector<uint8_t> &vDataToHash) {
+    return MurmurHash3(nHashSeed, vDataToHash.data(), vDataToHash.size());
+}
+
 void BIP32Hash(const ChainCode &chainCode, unsigned int nChild, uint8_t header,
                const uint8_t data[32], uint8_t output[64]) {
     uint8_t num[4];
@@ -207,6 +207,8 @@ uint256 SerializeHash(const T &obj, int nType = SER_GETHASH,
     return ss.GetHash();
 }
 
+unsigned int MurmurHash3(unsigned int nHashSeed, const uint8_t *pDataToHash,
+                         size_t nDataSize);
 unsigned int MurmurHash3(unsigned int nHashSeed,
                          const std::vector<uint8_t> &vDataToHash);
 
@@ -0,0 +1,140 @@
+// Copyright (c) 2018 The Bitcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "indexbackfill.h"
+
+#include "config.h"
+#include "init.h"
+#include "primitives/block.h"
+#include "undo.h"
+#include "util.h"
+#include "validation.h"
+
+#include <boost/thread.hpp>
+
+#include <atomic>
+#include <vector>
+
+//! Number of blocks turned into updates before they are written together.
+static const size_t BACKFILL_BATCH_BLOCKS = 1000;
+
+/**
+ * Move the index back to the active chain. Returns false if the index does
+ * not connect to the block tree, in which case it has to be rebuilt.
+ */
+static bool RewindIndex(CIndexBackfill &index) {
+    AssertLockHeld(cs_main);
+
+    const uint256 hashBest = index.GetBestBlock();
+    if (hashBest.IsNull()) {
+        return true;
+    }
+    BlockMap::iterator it = mapBlockIndex.find(hashBest);
+    if (it == mapBlockIndex.end()) {
+        return false;
+    }
+    if (chainActive.Contains(it->second)) {
+        return true;
+    }
+    const CBlockIndex *pindexFork = chainActive.FindFork(it->second);
+    return pindexFork && index.Rewind(it->second, pindexFork);
+}
+
+void ThreadIndexBackfill(const Config &config, CIndexBackfill &index) {
+    while (true) {
+        boost::this_thread::interruption_point();
+        if (ShutdownRequested()) {
+            return;
+        }
+
+        // Pick the next batch of active blocks the index is missing. Their
+        // disk positions are copied so that the reads can happen without
+        // cs_main.
+        uint256 hashStart;
+        const CBlockIndex *pindexLast = nullptr;
+        std::vector<CBackfillBlock> vBlocks;
+        {
+            LOCK(cs_main);
+            if (!RewindIndex(index)) {
+                LogPrintf("%s does not connect to the block tree, rebuilding "
+                          "it\n",
+                          index.GetName());
+                if (!index.Wipe()) {
+                    LogPrintf("%s: %s wipe failed\n", __func__,
+                              index.GetName());
+                    return;
+                }
+            }
+
+            hashStart = index.GetBestBlock();
+            const CBlockIndex *pindex =
+                hashStart.IsNull()
+                    ? chainActive.Genesis()
+                    : chainActive.Next(mapBlockIndex[hashStart]);
+            while (pindex && vBlocks.size() < BACKFILL_BATCH_BLOCKS) {
+                CBackfillBlock entry;
+                entry.hash = pindex->GetBlockHash();
+                entry.hashPrev =
+                    pindex->pprev ? pindex->pprev->GetBlockHash() : uint256();
+                entry.nHeight = pindex->nHeight;
+                entry.pos = pindex->GetBlockPos();
+                entry.undoPos = pindex->GetUndoPos();
+                vBlocks.push_back(entry);
+                pindexLast = pindex;
+                pindex = chainActive.Next(pindex);
+            }
+
+            if (vBlocks.empty()) {
+                LogPrintf("%s synced to height %d\n", index.GetName(),
+                          chainActive.Height());
+            } else {
+                index.BeginBatch(vBlocks.size());
+            }
+        }
+        if (vBlocks.empty()) {
+            index.Synced();
+            return;
+        }
+
+        std::atomic<bool> fFailed(false);
+        ParallelForRange(
+            vBlocks.size(), GetNumCores(),
+            [&](size_t begin, size_t end) {
+                for (size_t i = begin; i < end && !fFailed; i++) {
+                    const CBackfillBlock &entry = vBlocks[i];
+                    CBlock block;
+                    CBlockUndo blockundo;
+                    // The genesis block has no undo data.
+                    if (!ReadBlockFromDisk(block, entry.pos, config) ||
+                        block.GetHash() != entry.hash ||
+                        (index.NeedsUndo() && !entry.hashPrev.IsNull() &&
+                         !UndoReadFromDisk(blockundo, entry.undoPos,
+                                           entry.hashPrev)) ||
+                        !index.ProcessBlock(i, entry, block, blockundo)) {
+                        LogPrintf("%s: failed to read block %s\n", __func__,
+                                  entry.hash.ToString());
+                        fFailed = true;
+                    }
+                }
+            },
+            1);
+        if (fFailed) {
+            return;
+        }
+
+        LOCK(cs_main);
+        // The index moved or the batch left the active chain while it was
+        // being read: start over from wherever the index is now.
+        if (index.GetBestBlock() != hashStart ||
+            !chainActive.Contains(pindexLast)) {
+            continue;
+        }
+        if (!index.WriteBatch(pindexLast)) {
+            LogPrintf("%s: %s write failed\n", __func__, index.GetName());
+            return;
+        }
+        LogPrint(BCLog::BENCH, "%s synced to height %d\n", index.GetName(),
+                 pindexLast->nHeight);
+    }
+}
@@ -0,0 +1,91 @@
+// Copyright (c) 2018 The Bitcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_INDEXBACKFILL_H
+#define BITCOIN_INDEXBACKFILL_H
+
+#include "chain.h"
+#include "uint256.h"
+
+#include <string>
+
+class CBlock;
+class CBlockUndo;
+class Config;
+
+/**
+ * Block read by the backfill, with the disk positions copied from its block
+ * index entry so that it can be read without cs_main.
+ */
+struct CBackfillBlock {
+    uint256 hash;
+    //! Null for the genesis block, which has no undo data.
+    uint256 hashPrev;
+    int nHeight;
+    CDiskBlockPos pos;
+    CDiskBlockPos undoPos;
+};
+
+/**
+ * Hooks through which ThreadIndexBackfill builds an index from the active
+ * chain. The backfill moves the index back to the active chain, then picks
+ * the next batch of blocks it is missing, has them turned into updates from
+ * several threads by ProcessBlock and writes them with WriteBatch, until the
+ * index reaches the tip. All hooks but ProcessBlock and Synced are called with
+ * cs_main held.
+ */
+class CIndexBackfill {
+public:
+    /**
+     * strName is used in log messages. fUndo tells whether ProcessBlock needs
+     * the undo data of the blocks.
+     */
+    CIndexBackfill(const std::string &strNameIn, bool fUndoIn)
+        : strName(strNameIn), fUndo(fUndoIn) {}
+    virtual ~CIndexBackfill() {}
+
+    const std::string &GetName() const { return strName; }
+    bool NeedsUndo() const { return fUndo; }
+
+    //! Block the index is synced to, null if the index is empty.
+    virtual uint256 GetBestBlock() const = 0;
+    //! Move the index back from pindexBest, which left the active chain, to
+    //! its fork point pindexFork. Returns false if the index has to be wiped.
+    virtual bool Rewind(const CBlockIndex *pindexBest,
+                        const CBlockIndex *pindexFork) = 0;
+    //! Remove everything from the index.
+    virtual bool Wipe() = 0;
+
+    //! Get ready for a batch of nBlocks blocks.
+    virtual void BeginBatch(size_t nBlocks) = 0;
+    //! Build the update of the block at position i in the batch. Called from
+    //! several threads at once, each with different blocks.
+    virtual bool ProcessBlock(size_t i, const CBackfillBlock &entry,
+                              const CBlock &block,
+                              const CBlockUndo &blockundo) = 0;
+    //! Write the updates of the batch, ending at pindexLast.
+    virtual bool WriteBatch(const CBlockIndex *pindexLast) = 0;
+    //! Called without cs_main once the index has caught up with the active
+    //! chain tip.
+    virtual void Synced() {}
+
+private:
+    const std::string strName;
+    const bool fUndo;
+};
+
+/** Bring an index up to the active chain tip. */
+void ThreadIndexBackfill(const Config &config, CIndexBackfill &index);
+
+/**
+ * Whether an index synced to hashBest follows the tip when pindex is
+ * connected, which it only does once the backfill has caught up with the
+ * block before it.
+ */
+static inline bool IndexFollowsTip(const uint256 &hashBest,
+                                   const CBlockIndex *pindex) {
+    return pindex->pprev && hashBest == pindex->pprev->GetBlockHash();
+}
+
+#endif // BITCOIN_INDEXBACKFILL_H
@@ -9,8 +9,10 @@
 
 #include "init.h"
 
+#include "addrindex.h"
 #include "addrman.h"
 #include "amount.h"
+#include "blockfilterindex.h"
 #include "chain.h"
 #include "chainparams.h"
 #include "checkpoints.h"
@@ -225,6 +227,10 @@ void Shutdown() {
         LOCK(cs_main);
         if (pcoinsTip != nullptr) {
             FlushStateToDisk();
+            if (GetBoolArg("-blockindexsnapshot",
+                           DEFAULT_BLOCKINDEX_SNAPSHOT)) {
+                WriteBlockIndexSnapshot();
+            }
         }
         delete pcoinsTip;
         pcoinsTip = nullptr;
@@ -234,6 +240,12 @@ void Shutdown() {
         pcoinsdbview = nullptr;
         delete pblocktree;
         pblocktree = nullptr;
+        delete ptxindex;
+        ptxindex = nullptr;
+        delete paddressindex;
+        paddressindex = nullptr;
+        delete pblockfilterindex;
+        pblockfilterindex = nullptr;
     }
 #ifdef ENABLE_WALLET
     if (pwalletMain) pwalletMain->Flush(true);
@@ -339,6 +351,18 @@ std::string HelpMessage(HelpMessageMode mode) {
                   Params(CBaseChainParams::TESTNET)
                       .GetConsensus()
                       .defaultAssumeValid.GetHex()));
+    strUsage += HelpMessageOpt(
+        "-blockbuffersize=<n>",
+        strprintf(_("Keep up to <n> MiB of blocks received ahead of the tip "
+                    "in memory until they are connected, 0 to disable "
+                    "(default: %u)"),
+                  DEFAULT_BLOCK_BUFFER_SIZE));
+    strUsage += HelpMessageOpt(
+        "-blockindexsnapshot",
+        strprintf(_("Write a flat block index snapshot on shutdown and load "
+                    "it instead of the block index database on startup when "
+                    "up to date (default: %u)"),
+                  DEFAULT_BLOCKINDEX_SNAPSHOT));
     strUsage += HelpMessageOpt(
         "-conf=<file>", strprintf(_("Specify configuration file (default: %s)"),
                                   BITCOIN_CONF_FILENAME));
@@ -355,6 +379,13 @@ std::string HelpMessage(HelpMessageMode mode) {
         strprintf(
             _("Set database cache size in megabytes (%d to %d, default: %d)"),
             nMinDbCache, nMaxDbCache, nDefaultDbCache));
+    strUsage += HelpMessageOpt(
+        "-dbopt=<[db.]option=n>",
+        _("Tune the LevelDB databases, or only the one in directory <db> "
+          "(chainstate, index, txindex, address or blockfilter). Options: "
+          "block_size, max_open_files, bloom_bits (0 disables the filter) "
+          "and max_file_size, sizes in bytes. Can be specified multiple "
+          "times"));
     if (showDebug)
         strUsage += HelpMessageOpt(
             "-feefilter", strprintf("Tell other nodes to filter invs to us by "
@@ -413,15 +444,30 @@ std::string HelpMessage(HelpMessageMode mode) {
         HelpMessageOpt("-reindex", _("Rebuild chain state and block index from "
                                      "the blk*.dat files on disk"));
 #ifndef WIN32
+    strUsage += HelpMessageOpt(
+        "-addressindex",
+        strprintf(_("Maintain an index of the transactions and unspent "
+                    "outputs of every script, built in the background and "
+                    "used by the getaddresshistory and getaddressutxos rpc "
+                    "calls (default: %d)"),
+                  DEFAULT_ADDRESSINDEX));
+    strUsage += HelpMessageOpt(
+        "-blockfilterindex",
+        strprintf(_("Maintain an index of the BIP 158 basic filters of the "
+                    "blocks, built in the background and served to peers "
+                    "with -peerblockfilters and over REST (default: %d)"),
+                  DEFAULT_BLOCKFILTERINDEX));
     strUsage += HelpMessageOpt(
         "-sysperms",
         _("Create new files with system default permissions, instead of umask "
           "077 (only effective with disabled wallet functionality)"));
 #endif
     strUsage += HelpMessageOpt(
-        "-txindex", strprintf(_("Maintain a full transaction index, used by "
-                                "the getrawtransaction rpc call (default: %d)"),
-                              DEFAULT_TXINDEX));
+        "-txindex",
+        strprintf(_("Maintain a full transaction index, used by the "
+                    "getrawtransaction rpc call. Enabling it on an existing "
+                    "chain builds it in the background (default: %d)"),
+                  DEFAULT_TXINDEX));
     strUsage += HelpMessageOpt(
         "-usecashaddr", _("Use Cash Address for destination encoding instead "
                           "of base58 (activate by default on Jan, 14)"));
@@ -463,6 +509,12 @@ std::string HelpMessage(HelpMessageMode mode) {
         strprintf(
             _("Always query for peer addresses via DNS lookup (default: %d)"),
             DEFAULT_FORCEDNSSEED));
+    strUsage += HelpMessageOpt(
+        "-graphene",
+        strprintf(_("Request new blocks as graphene set reconciliations "
+                    "from peers which support it, instead of compact blocks "
+                    "(default: %d)"),
+                  DEFAULT_GRAPHENE_RELAY));
     strUsage +=
         HelpMessageOpt("-listen", _("Accept connections from outside (default: "
                                     "1 if no -proxy or -connect/-noconnect)"));
@@ -506,6 +558,11 @@ std::string HelpMessage(HelpMessageMode mode) {
         strprintf(_("Support filtering of blocks and transaction with bloom "
                     "filters (default: %d)"),
                   DEFAULT_PEERBLOOMFILTERS));
+    strUsage += HelpMessageOpt(
+        "-peerblockfilters",
+        strprintf(_("Serve compact block filters to peers, as specified by "
+                    "BIP 157. Requires -blockfilterindex (default: %d)"),
+                  DEFAULT_PEERBLOCKFILTERS));
     strUsage += HelpMessageOpt(
         "-port=<port>",
         strprintf(
@@ -587,6 +644,16 @@ std::string HelpMessage(HelpMessageMode mode) {
     strUsage +=
         HelpMessageOpt("-zmqpubrawtx=<address>",
                        _("Enable publish raw transaction in <address>"));
+    strUsage += HelpMessageOpt(
+        "-zmqpubmempoolremoved=<address>",
+        _("Enable publish transactions removed from the mempool, with the "
+          "reason, in <address>"));
+    strUsage += HelpMessageOpt(
+        "-zmqpubblockconnected=<address>",
+        _("Enable publish connected blocks with their txids in <address>"));
+    strUsage += HelpMessageOpt(
+        "-zmqpubblockdisconnected=<address>",
+        _("Enable publish disconnected blocks with their txids in <address>"));
 #endif
 
     strUsage += HelpMessageGroup(_("Debugging/Testing options:"));
@@ -666,6 +733,10 @@ std::string HelpMessage(HelpMessageMode mode) {
         strUsage += HelpMessageOpt("-bip9params=deployment:start:end",
                                    "Use given start/end times for specified "
                                    "BIP9 deployment (regtest-only)");
+        strUsage += HelpMessageOpt(
+            "-canonicaltxorderheight=<n>",
+            "Require transactions in blocks after height <n> to be sorted by "
+            "txid (testnet and regtest only)");
     }
     strUsage += HelpMessageOpt(
         "-debug=<category>",
@@ -1277,10 +1348,21 @@ bool AppInitParameterInteraction(Config &config) {
 
     // also see: InitParameterInteraction()
 
+    std::string strDBOptError;
+    if (!CheckDBOptions(strDBOptError)) {
+        return InitError(strDBOptError);
+    }
+
     // if using block pruning, then disallow txindex
     if (GetArg("-prune", 0)) {
         if (GetBoolArg("-txindex", DEFAULT_TXINDEX))
             return InitError(_("Prune mode is incompatible with -txindex."));
+        if (GetBoolArg("-addressindex", DEFAULT_ADDRESSINDEX))
+            return InitError(
+                _("Prune mode is incompatible with -addressindex."));
+        if (GetBoolArg("-blockfilterindex", DEFAULT_BLOCKFILTERINDEX))
+            return InitError(
+                _("Prune mode is incompatible with -blockfilterindex."));
     }
 
     // if space reserved for high priority transactions is misconfigured
@@ -1537,6 +1619,14 @@ bool AppInitParameterInteraction(Config &config) {
     if (GetBoolArg("-peerbloomfilters", DEFAULT_PEERBLOOMFILTERS))
         nLocalServices = ServiceFlags(nLocalServices | NODE_BLOOM);
 
+    if (GetBoolArg("-peerblockfilters", DEFAULT_PEERBLOCKFILTERS)) {
+        if (!GetBoolArg("-blockfilterindex", DEFAULT_BLOCKFILTERINDEX)) {
+            return InitError(
+                _("-peerblockfilters requires -blockfilterindex."));
+        }
+        nLocalServices = ServiceFlags(nLocalServices | NODE_COMPACT_FILTERS);
+    }
+
     // Signal Bitcoin Cash support.
     // TODO: remove some time after the hardfork when no longer needed
     // to differentiate the network nodes.
@@ -1589,6 +1679,23 @@ bool AppInitParameterInteraction(Config &config) {
         }
     }
 
+    if (IsArgSet("-canonicaltxorderheight")) {
+        int64_t nHeight;
+        if (!ParseInt64(GetArg("-canonicaltxorderheight", ""), &nHeight) ||
+            nHeight < 0 || nHeight > std::numeric_limits<int>::max()) {
+            return InitError(
+                strprintf("Invalid -canonicaltxorderheight (%s)",
+                          GetArg("-canonicaltxorderheight", "")));
+        }
+        if (!UpdateCanonicalTxOrderHeight(chainparams.NetworkIDString(),
+                                          nHeight)) {
+            return InitError("Canonical transaction ordering may only be "
+                             "scheduled on testnet and regtest.");
+        }
+        LogPrintf("Canonical transaction ordering enabled after height %d\n",
+                  nHeight);
+    }
+
     return true;
 }
 
@@ -1931,12 +2038,25 @@ bool AppInitMain(Config &config, boost::thread_group &threadGroup,
     // total cache cannot be greater than nMaxDbcache
     nTotalCache = std::min(nTotalCache, nMaxDbCache << 20);
     int64_t nBlockTreeDBCache = nTotalCache / 8;
-    nBlockTreeDBCache = std::min(nBlockTreeDBCache,
-                                 (GetBoolArg("-txindex", DEFAULT_TXINDEX)
-                                      ? nMaxBlockDBAndTxIndexCache
-                                      : nMaxBlockDBCache)
-                                     << 20);
+    nBlockTreeDBCache = std::min(nBlockTreeDBCache, nMaxBlockDBCache << 20);
     nTotalCache -= nBlockTreeDBCache;
+    int64_t nTxIndexCache = 0;
+    if (GetBoolArg("-txindex", DEFAULT_TXINDEX)) {
+        nTxIndexCache = std::min(nTotalCache / 8, nMaxTxIndexCache << 20);
+        nTotalCache -= nTxIndexCache;
+    }
+    int64_t nAddressIndexCache = 0;
+    if (GetBoolArg("-addressindex", DEFAULT_ADDRESSINDEX)) {
+        nAddressIndexCache =
+            std::min(nTotalCache / 8, nMaxAddressIndexCache << 20);
+        nTotalCache -= nAddressIndexCache;
+    }
+    int64_t nBlockFilterIndexCache = 0;
+    if (GetBoolArg("-blockfilterindex", DEFAULT_BLOCKFILTERINDEX)) {
+        nBlockFilterIndexCache =
+            std::min(nTotalCache / 8, nMaxBlockFilterIndexCache << 20);
+        nTotalCache -= nBlockFilterIndexCache;
+    }
     // use 25%-50% of the remainder for disk cache
     int64_t nCoinDBCache =
         std::min(nTotalCache / 2, (nTotalCache / 4) + (1 << 23));
@@ -1950,12 +2070,29 @@ bool AppInitMain(Config &config, boost::thread_group &threadGroup,
     LogPrintf("Cache configuration:\n");
     LogPrintf("* Using %.1fMiB for block index database\n",
               nBlockTreeDBCache * (1.0 / 1024 / 1024));
+    if (nTxIndexCache > 0) {
+        LogPrintf("* Using %.1fMiB for transaction index database\n",
+                  nTxIndexCache * (1.0 / 1024 / 1024));
+    }
+    if (nAddressIndexCache > 0) {
+        LogPrintf("* Using %.1fMiB for address index database\n",
+                  nAddressIndexCache * (1.0 / 1024 / 1024));
+    }
+    if (nBlockFilterIndexCache > 0) {
+        LogPrintf("* Using %.1fMiB for block filter index database\n",
+                  nBlockFilterIndexCache * (1.0 / 1024 / 1024));
+    }
     LogPrintf("* Using %.1fMiB for chain state database\n",
               nCoinDBCache * (1.0 / 1024 / 1024));
     LogPrintf("* Using %.1fMiB for in-memory UTXO set (plus up to %.1fMiB of "
               "unused mempool space)\n",
               nCoinCacheUsage * (1.0 / 1024 / 1024),
               nMempoolSizeMax * (1.0 / 1024 / 1024));
+    int64_t nBlockBufferSize = std::max<int64_t>(
+        0, GetArg("-blockbuffersize", DEFAULT_BLOCK_BUFFER_SIZE));
+    SetBlockBufferSize(nBlockBufferSize << 20);
+    LogPrintf("* Using %.1fMiB for blocks awaiting connection\n",
+              double(nBlockBufferSize));
 
     bool fLoaded = false;
     while (!fLoaded) {
@@ -1973,9 +2110,27 @@ bool AppInitMain(Config &config, boost::thread_group &threadGroup,
                 delete pcoinsdbview;
                 delete pcoinscatcher;
                 delete pblocktree;
+                delete ptxindex;
+                ptxindex = nullptr;
+                delete paddressindex;
+                paddressindex = nullptr;
+                delete pblockfilterindex;
+                pblockfilterindex = nullptr;
 
                 // 初始化相应的区块数据对象
                 pblocktree = new CBlockTreeDB(nBlockTreeDBCache, false, fReindex);
+                if (nTxIndexCache > 0) {
+                    ptxindex =
+                        new CTxIndexDB(nTxIndexCache, false, fReindex);
+                }
+                if (nAddressIndexCache > 0) {
+                    paddressindex = new CAddressIndex(nAddressIndexCache,
+                                                      false, fReindex);
+                }
+                if (nBlockFilterIndexCache > 0) {
+                    pblockfilterindex = new CBlockFilterIndex(
+                        nBlockFilterIndexCache, false, fReindex);
+                }
                 pcoinsdbview = new CCoinsViewDB(nCoinDBCache, false, fReindex || fReindexChainState);
                 pcoinscatcher = new CCoinsViewErrorCatcher(pcoinsdbview);
                 pcoinsTip = new CCoinsViewCache(pcoinscatcher);
@@ -2015,13 +2170,6 @@ bool AppInitMain(Config &config, boost::thread_group &threadGroup,
                     break;
                 }
 
-                // Check for changed -txindex state
-                if (fTxIndex != GetBoolArg("-txindex", DEFAULT_TXINDEX)) {
-                    strLoadError = _("You need to rebuild the database using "
-                                     "-reindex-chainstate to change -txindex");
-                    break;
-                }
-
                 // Check for changed -prune state.  What we are concerned about
                 // is a user who has pruned blocks in the past, but is now
                 // trying to run unpruned.
@@ -2187,6 +2335,19 @@ bool AppInitMain(Config &config, boost::thread_group &threadGroup,
         uiInterface.NotifyBlockTip.disconnect(BlockNotifyGenesisWait);
     }
 
+    if (fTxIndex) {
+        threadGroup.create_thread(
+            boost::bind(&ThreadTxIndexBackfill, std::ref(config)));
+    }
+    if (paddressindex) {
+        threadGroup.create_thread(
+            boost::bind(&ThreadAddressIndexBackfill, std::ref(config)));
+    }
+    if (pblockfilterindex) {
+        threadGroup.create_thread(
+            boost::bind(&ThreadBlockFilterIndexBackfill, std::ref(config)));
+    }
+
     // Step 11: start node
 
     //// debug print
@@ -31,6 +31,30 @@ CMerkleBlock::CMerkleBlock(const CBlock &block, CBloomFilter &filter) {
     txn = CPartialMerkleTree(vHashes, vMatch);
 }
 
+CMerkleBlock::CMerkleBlock(const CBloomBlockElements &elements,
+                           CBloomFilter &filter) {
+    const CBlock &block = elements.GetBlock();
+    header = block.GetBlockHeader();
+
+    std::vector<bool> vMatch;
+    std::vector<uint256> vHashes;
+
+    vMatch.reserve(block.vtx.size());
+    vHashes.reserve(block.vtx.size());
+
+    for (size_t i = 0; i < block.vtx.size(); i++) {
+        const uint256 &txid = block.vtx[i]->GetId();
+        bool fMatch = filter.IsRelevantAndUpdate(elements, i);
+        if (fMatch) {
+            vMatchedTxn.push_back(std::make_pair(i, txid));
+        }
+        vMatch.push_back(fMatch);
+        vHashes.push_back(txid);
+    }
+
+    txn = CPartialMerkleTree(vHashes, vMatch);
+}
+
 CMerkleBlock::CMerkleBlock(const CBlock &block, const std::set<uint256> &txids) {
     header = block.GetBlockHeader();
 
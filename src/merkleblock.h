@@ -150,6 +150,9 @@ public:
      * transaction, thus the filter will likely be modified.
      */
     CMerkleBlock(const CBlock &block, CBloomFilter &filter);
+    //! Same as above, from the elements extracted from a block once for all
+    //! the filters it is matched against.
+    CMerkleBlock(const CBloomBlockElements &elements, CBloomFilter &filter);
 
     // Create from a CBlock, matching the txids in the set.
     CMerkleBlock(const CBlock &block, const std::set<uint256> &txids);
@@ -183,6 +183,33 @@ std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlock(const CScript &sc
     int nDescendantsUpdated = 0;
     addPackageTxs(nPackagesSelected, nDescendantsUpdated);
 
+    if (IsCanonicalTxOrderEnabled(*config, pindexPrev)) {
+        // Sort everything but the coinbase by txid, keeping the per
+        // transaction fees and sigop counts aligned.
+        std::vector<size_t> order(pblock->vtx.size() - 1);
+        for (size_t i = 0; i < order.size(); i++) {
+            order[i] = i + 1;
+        }
+        std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+            return pblock->vtx[a]->GetId() < pblock->vtx[b]->GetId();
+        });
+
+        std::vector<CTransactionRef> vtx(1);
+        std::vector<Amount> vTxFees(1);
+        std::vector<int64_t> vTxSigOpsCount(1);
+        for (size_t i : order) {
+            vtx.push_back(std::move(pblock->vtx[i]));
+            vTxFees.push_back(pblocktemplate->vTxFees[i]);
+            vTxSigOpsCount.push_back(pblocktemplate->vTxSigOpsCount[i]);
+        }
+        vtx[0] = std::move(pblock->vtx[0]);
+        vTxFees[0] = pblocktemplate->vTxFees[0];
+        vTxSigOpsCount[0] = pblocktemplate->vTxSigOpsCount[0];
+        pblock->vtx.swap(vtx);
+        pblocktemplate->vTxFees.swap(vTxFees);
+        pblocktemplate->vTxSigOpsCount.swap(vTxSigOpsCount);
+    }
+
     int64_t nTime1 = GetTimeMicros();
 
     nLastBlockTx = nBlockTx;
@@ -661,6 +661,8 @@ void CNode::copyStats(CNodeStats &stats) {
     X(fInbound);
     X(fAddnode);
     X(nStartingHeight);
+    X(nAddrProcessed);
+    X(nAddrRateLimited);
     {
         LOCK(cs_vSend);
         X(mapSendBytesPerMsgCmd);
@@ -2834,6 +2836,11 @@ CNode::CNode(NodeId idIn, ServiceFlags nLocalServicesIn,
     fGetAddr = false;
     nNextLocalAddrSend = 0;
     nNextAddrSend = 0;
+    // One token, so that the peer can announce its own address.
+    nAddrTokenBucket = 1.0;
+    nAddrTokenTimestamp = GetTimeMicros();
+    nAddrProcessed = 0;
+    nAddrRateLimited = 0;
     nNextInvSend = 0;
     fRelayTxes = false;
     fSentAddr = false;
@@ -2851,6 +2858,8 @@ CNode::CNode(NodeId idIn, ServiceFlags nLocalServicesIn,
     nextSendTimeFeeFilter = 0;
     fPauseRecv = false;
     fPauseSend = false;
+    fFilteredBlockQueued = false;
+    fFilteredBlockReady = false;
     nProcessQueueSize = 0;
 
     for (const std::string &msg : getAllNetMessageTypes()) {
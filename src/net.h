@@ -112,6 +112,7 @@ struct AddedNodeInfo {
 
 class CTransaction;
 class CNodeStats;
+struct CFilteredBlockReply;
 class CClientUIInterface;
 
 struct CSerializedNetMsg {
@@ -513,6 +514,8 @@ public:
     double dMinPing;
     std::string addrLocal;
     CAddress addr;
+    uint64_t nAddrProcessed;
+    uint64_t nAddrRateLimited;
 };
 
 class CNetMessage {
@@ -639,6 +642,13 @@ public:
     const uint64_t nKeyedNetGroup;
     std::atomic_bool fPauseRecv;
     std::atomic_bool fPauseSend;
+    //! Set while the filtered block at the front of vRecvGetData is being
+    //! matched by the filtered block server's thread, and once it was.
+    std::atomic_bool fFilteredBlockQueued;
+    std::atomic_bool fFilteredBlockReady;
+    //! The reply to that request, null if the peer had no filter. Guarded by
+    //! cs_filter.
+    std::shared_ptr<const CFilteredBlockReply> pfilteredBlockReply;
 
 protected:
     mapMsgCmdSize mapSendBytesPerMsgCmd;
@@ -655,6 +665,14 @@ public:
     std::set<uint256> setKnown;
     int64_t nNextAddrSend;
     int64_t nNextLocalAddrSend;
+    //! Number of addresses from this peer we may still process, refilled at
+    //! MAX_ADDR_RATE_PER_SECOND, and when it was last refilled (in
+    //! microseconds).
+    double nAddrTokenBucket;
+    int64_t nAddrTokenTimestamp;
+    //! Addresses from this peer we processed, and dropped for lack of tokens.
+    std::atomic<uint64_t> nAddrProcessed;
+    std::atomic<uint64_t> nAddrRateLimited;
 
     // Inventory based relay.
     CRollingBloomFilter filterInventoryKnown;
@@ -8,9 +8,11 @@
 #include "addrman.h"
 #include "arith_uint256.h"
 #include "blockencodings.h"
+#include "blockfilterindex.h"
 #include "chainparams.h"
 #include "config.h"
 #include "consensus/validation.h"
+#include "graphene.h"
 #include "hash.h"
 #include "init.h"
 #include "merkleblock.h"
@@ -34,6 +36,11 @@
 #include <boost/range/adaptor/reversed.hpp>
 #include <boost/thread.hpp>
 
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
 #if defined(NDEBUG)
 #error "Bitcoin cannot be compiled without assertions."
 #endif
@@ -123,6 +130,10 @@ int nPreferredDownload = 0;
 /** Number of peers from which we're downloading blocks. */
 int nPeersWithValidatedDownloads = 0;
 
+/** Exponential moving average of the size of recently downloaded blocks, or 0
+ * if no block was downloaded yet. Protected by cs_main. */
+double dAvgDownloadedBlockSize = 0;
+
 /** Relay map, protected by cs_main. */
 typedef std::map<uint256, CTransactionRef> MapRelay;
 MapRelay mapRelay;
@@ -188,6 +199,15 @@ struct CNodeState {
     int64_t nDownloadingSince;
     int nBlocksInFlight;
     int nBlocksInFlightValidHeaders;
+    //! Exponential moving average of the rate at which this peer delivers the
+    //! blocks we request, in bytes per second, or 0 if not measured yet.
+    double dBlockDownloadRate;
+    //! Number of consecutive times this peer stalled the block download
+    //! window and had its in-flight blocks handed over to other peers.
+    int nStallReassignments;
+    //! Until when (in microseconds) no blocks are requested from this peer,
+    //! after its stalled blocks were handed over to other peers.
+    int64_t nStallBackoffUntil;
     //! Whether we consider this a preferred download peer.
     bool fPreferredDownload;
     //! Whether this peer wants invs or headers (when possible) for block
@@ -209,6 +229,10 @@ struct CNodeState {
      * non-witnesses in cmpctblocks/blocktxns.
      */
     bool fSupportsDesiredCmpctVersion;
+    //! Whether this peer can decode grapheneblocks and wants them.
+    bool fSupportsGraphene;
+    //! Number of transactions in this peer's mempool, as last announced.
+    uint64_t nGraphenePoolSize;
 
     CNodeState(CAddress addrIn, std::string addrNameIn)
         : address(addrIn), name(addrNameIn) {
@@ -225,11 +249,16 @@ struct CNodeState {
         nDownloadingSince = 0;
         nBlocksInFlight = 0;
         nBlocksInFlightValidHeaders = 0;
+        dBlockDownloadRate = 0;
+        nStallReassignments = 0;
+        nStallBackoffUntil = 0;
         fPreferredDownload = false;
         fPreferHeaders = false;
         fPreferHeaderAndIDs = false;
         fProvidesHeaderAndIDs = false;
         fSupportsDesiredCmpctVersion = false;
+        fSupportsGraphene = false;
+        nGraphenePoolSize = 0;
     }
 };
 
@@ -386,6 +415,90 @@ bool MarkBlockAsReceived(const uint256 &hash) {
     return false;
 }
 
+// Requires cs_main.
+// Record that a block of nSize bytes requested from nodeid arrived, to update
+// the peer's download rate and the expected size of upcoming blocks. Must be
+// called before MarkBlockAsReceived.
+static void UpdateBlockDownloadStats(NodeId nodeid, const uint256 &hash,
+                                     size_t nSize) {
+    // Weight given to the newest sample in the moving averages.
+    static const double DOWNLOAD_STATS_ALPHA = 0.2;
+
+    std::map<uint256,
+             std::pair<NodeId, std::list<QueuedBlock>::iterator>>::iterator
+        itInFlight = mapBlocksInFlight.find(hash);
+    if (itInFlight == mapBlocksInFlight.end() ||
+        itInFlight->second.first != nodeid) {
+        return;
+    }
+
+    dAvgDownloadedBlockSize =
+        dAvgDownloadedBlockSize == 0
+            ? nSize
+            : (1 - DOWNLOAD_STATS_ALPHA) * dAvgDownloadedBlockSize +
+                  DOWNLOAD_STATS_ALPHA * nSize;
+
+    // Only the block at the front of the queue has a meaningful start time:
+    // blocks are delivered in order, and nDownloadingSince is moved forward
+    // every time the front block arrives.
+    CNodeState *state = State(nodeid);
+    if (state->vBlocksInFlight.begin() != itInFlight->second.second) {
+        return;
+    }
+    int64_t nElapsed =
+        std::max<int64_t>(GetTimeMicros() - state->nDownloadingSince, 1000);
+    double dRate = nSize * 1000000.0 / nElapsed;
+    state->dBlockDownloadRate =
+        state->dBlockDownloadRate == 0
+            ? dRate
+            : (1 - DOWNLOAD_STATS_ALPHA) * state->dBlockDownloadRate +
+                  DOWNLOAD_STATS_ALPHA * dRate;
+    state->nStallReassignments = 0;
+}
+
+// Requires cs_main.
+// Maximum number of blocks to have in flight from this peer at once: enough to
+// keep BLOCK_DOWNLOAD_TARGET_INFLIGHT_TIME seconds of data in flight at the
+// rate the peer has been delivering blocks.
+static int GetMaxBlocksInTransit(const CNodeState &state) {
+    if (state.dBlockDownloadRate == 0 || dAvgDownloadedBlockSize == 0) {
+        return MAX_BLOCKS_IN_TRANSIT_PER_PEER;
+    }
+    double dBlocks = state.dBlockDownloadRate *
+                     BLOCK_DOWNLOAD_TARGET_INFLIGHT_TIME /
+                     dAvgDownloadedBlockSize;
+    return std::max(
+        1, std::min<int>(dBlocks, MAX_ADAPTIVE_BLOCKS_IN_TRANSIT_PER_PEER));
+}
+
+// Requires cs_main.
+// Number of blocks past the last common block we are willing to download
+// ahead, shrunk when blocks are large so the window covers a bounded amount
+// of data.
+static int GetBlockDownloadWindow() {
+    if (dAvgDownloadedBlockSize == 0) {
+        return BLOCK_DOWNLOAD_WINDOW;
+    }
+    uint64_t nWindow = BLOCK_DOWNLOAD_WINDOW_BYTES / dAvgDownloadedBlockSize;
+    return std::max<uint64_t>(
+        MIN_BLOCK_DOWNLOAD_WINDOW,
+        std::min<uint64_t>(nWindow, BLOCK_DOWNLOAD_WINDOW));
+}
+
+// Requires cs_main.
+// How long, in microseconds, a peer may hold up the download window before
+// its blocks are requested elsewhere. Slow peers get longer when blocks are
+// large, as a single block may legitimately take a while.
+static int64_t GetBlockStallingTimeout(const CNodeState &state) {
+    int64_t nTimeout = 1000000 * int64_t(BLOCK_STALLING_TIMEOUT);
+    if (state.dBlockDownloadRate > 0) {
+        nTimeout = std::max<int64_t>(nTimeout, 2 * 1000000.0 *
+                                                   dAvgDownloadedBlockSize /
+                                                   state.dBlockDownloadRate);
+    }
+    return nTimeout;
+}
+
 // Requires cs_main.
 // returns false, still setting pit, if the block was already in flight from the
 // same peer pit will only be valid as long as the same cs_main lock is being
@@ -609,11 +722,11 @@ void FindNextBlocksToDownload(NodeId nodeid, unsigned int count,
     std::vector<const CBlockIndex *> vToFetch;
     const CBlockIndex *pindexWalk = state->pindexLastCommonBlock;
     // Never fetch further than the best block we know the peer has, or more
-    // than BLOCK_DOWNLOAD_WINDOW + 1 beyond the last linked block we have in
+    // than the download window + 1 beyond the last linked block we have in
     // common with this peer. The +1 is so we can detect stalling, namely if we
     // would be able to download that next block if the window were 1 larger.
     int nWindowEnd =
-        state->pindexLastCommonBlock->nHeight + BLOCK_DOWNLOAD_WINDOW;
+        state->pindexLastCommonBlock->nHeight + GetBlockDownloadWindow();
     int nMaxHeight =
         std::min<int>(state->pindexBestKnownBlock->nHeight, nWindowEnd + 1);
     NodeId waitingfor = -1;
@@ -689,6 +802,8 @@ bool GetNodeStateStats(NodeId nodeid, CNodeStateStats &stats) {
             stats.vHeightInFlight.push_back(queue.pindex->nHeight);
         }
     }
+    stats.dBlockDownloadRate = state->dBlockDownloadRate;
+    stats.nMaxBlocksInFlight = GetMaxBlocksInTransit(*state);
     return true;
 }
 
@@ -879,10 +994,155 @@ static void Misbehaving(CNode *node, int howmuch, const std::string &reason) {
 // blockchain -> download logic notification
 //
 
+/** Number of blocks whose elements the filtered block server keeps. */
+static const size_t FILTERED_BLOCK_ELEMENTS_CACHE_SIZE = 4;
+
+/** A merkleblock, along with the matched transactions to send after it. */
+struct CFilteredBlockReply {
+    CMerkleBlock merkleBlock;
+    std::vector<CTransactionRef> vtx;
+};
+
+/**
+ * Matches blocks against bloom filters for filtered block requests on its own
+ * thread, so that it does not hold up the message handler or cs_main. The
+ * elements of a block are extracted once and matched against the filters of
+ * every peer asking for it. Replies are sent by the message handler, so that
+ * no other message comes between a merkleblock and its transactions.
+ */
+class CFilteredBlockServer {
+public:
+    void Start(CConnman *connmanIn);
+    void Stop();
+
+    /**
+     * Queue a filtered block request. pnode->fFilteredBlockQueued is set
+     * until the reply is in pnode->pfilteredBlockReply, then
+     * pnode->fFilteredBlockReady. Return false if the server is not running.
+     */
+    bool Queue(CNode *pnode, std::shared_ptr<const CBlock> pblock);
+
+private:
+    std::mutex cs;
+    std::condition_variable cond;
+    CConnman *connman = nullptr;
+    bool fRunning = false;
+    std::vector<std::pair<CNode *, std::shared_ptr<const CBlock>>> vQueue;
+    std::thread threadServe;
+    //! Elements of the last blocks served, only used by threadServe.
+    std::deque<std::pair<uint256, std::shared_ptr<const CBloomBlockElements>>>
+        recentElements;
+
+    void ThreadServe();
+    std::shared_ptr<const CBloomBlockElements>
+    GetElements(const std::shared_ptr<const CBlock> &pblock);
+};
+
+static CFilteredBlockServer filteredBlockServer;
+
+void CFilteredBlockServer::Start(CConnman *connmanIn) {
+    {
+        std::lock_guard<std::mutex> lock(cs);
+        connman = connmanIn;
+        fRunning = true;
+    }
+    threadServe = std::thread(&TraceThread<std::function<void()>>, "bloom",
+                              std::function<void()>(std::bind(
+                                  &CFilteredBlockServer::ThreadServe, this)));
+}
+
+void CFilteredBlockServer::Stop() {
+    {
+        std::lock_guard<std::mutex> lock(cs);
+        fRunning = false;
+    }
+    cond.notify_all();
+    if (threadServe.joinable()) {
+        threadServe.join();
+    }
+    recentElements.clear();
+}
+
+bool CFilteredBlockServer::Queue(CNode *pnode,
+                                 std::shared_ptr<const CBlock> pblock) {
+    std::lock_guard<std::mutex> lock(cs);
+    if (!fRunning) {
+        return false;
+    }
+    pnode->fFilteredBlockQueued = true;
+    vQueue.emplace_back(pnode->AddRef(), std::move(pblock));
+    cond.notify_one();
+    return true;
+}
+
+std::shared_ptr<const CBloomBlockElements>
+CFilteredBlockServer::GetElements(const std::shared_ptr<const CBlock> &pblock) {
+    const uint256 hash = pblock->GetHash();
+    for (const auto &entry : recentElements) {
+        if (entry.first == hash) {
+            return entry.second;
+        }
+    }
+    if (recentElements.size() >= FILTERED_BLOCK_ELEMENTS_CACHE_SIZE) {
+        recentElements.pop_front();
+    }
+    recentElements.emplace_back(
+        hash, std::make_shared<const CBloomBlockElements>(pblock));
+    return recentElements.back().second;
+}
+
+void CFilteredBlockServer::ThreadServe() {
+    std::unique_lock<std::mutex> lock(cs);
+    while (true) {
+        cond.wait(lock, [this] { return !fRunning || !vQueue.empty(); });
+        // Requests queued before Stop() are still answered, so that their
+        // nodes are released.
+        if (vQueue.empty()) {
+            return;
+        }
+        std::vector<std::pair<CNode *, std::shared_ptr<const CBlock>>>
+            vRequests;
+        vRequests.swap(vQueue);
+        lock.unlock();
+
+        for (const auto &request : vRequests) {
+            CNode *pnode = request.first;
+            if (!pnode->fDisconnect) {
+                std::shared_ptr<const CBloomBlockElements> pelements =
+                    GetElements(request.second);
+                LOCK(pnode->cs_filter);
+                if (pnode->pfilter) {
+                    std::shared_ptr<CFilteredBlockReply> preply =
+                        std::make_shared<CFilteredBlockReply>();
+                    preply->merkleBlock =
+                        CMerkleBlock(*pelements, *pnode->pfilter);
+                    for (const auto &pair : preply->merkleBlock.vMatchedTxn) {
+                        preply->vtx.push_back(
+                            request.second->vtx[pair.first]);
+                    }
+                    pnode->pfilteredBlockReply = std::move(preply);
+                }
+            }
+            pnode->fFilteredBlockReady = true;
+            pnode->fFilteredBlockQueued = false;
+            pnode->Release();
+        }
+        // Let the message handler send the replies.
+        connman->WakeMessageHandler();
+
+        lock.lock();
+    }
+}
+
 PeerLogicValidation::PeerLogicValidation(CConnman *connmanIn)
     : connman(connmanIn) {
     // Initialize global variables that cannot be constructed at startup.
     recentRejects.reset(new CRollingBloomFilter(120000, 0.000001));
+    filteredBlockServer.Start(connman);
+}
+
+PeerLogicValidation::~PeerLogicValidation() {
+    filteredBlockServer.Stop();
 }
 
 void PeerLogicValidation::SyncTransaction(const CTransaction &tx,
@@ -1094,31 +1354,64 @@ static void RelayTransaction(const CTransaction &tx, CConnman &connman) {
     connman.ForEachNode([&inv](CNode *pnode) { pnode->PushInventory(inv); });
 }
 
+/**
+ * Addresses waiting to be relayed, with whether they are reachable. They are
+ * handed to the peers relaying them every ADDRESS_RELAY_FLUSH_INTERVAL
+ * seconds, in a single pass over the nodes. Only used from the message
+ * handler thread.
+ */
+static std::vector<std::pair<CAddress, bool>> vAddrRelayQueue;
+static int64_t nNextAddrRelayFlush = 0;
+
 static void RelayAddress(const CAddress &addr, bool fReachable,
-                         CConnman &connman) {
-    // Limited relaying of addresses outside our network(s)
-    unsigned int nRelayNodes = fReachable ? 2 : 1;
-
-    // Relay to a limited number of other nodes.
-    // Use deterministic randomness to send to the same nodes for 24 hours at a
-    // time so the addrKnowns of the chosen nodes prevent repeats.
-    uint64_t hashAddr = addr.GetHash();
-    const CSipHasher hasher =
-        connman.GetDeterministicRandomizer(RANDOMIZER_ID_ADDRESS_RELAY)
-            .Write(hashAddr << 32)
-            .Write((GetTime() + hashAddr) / (24 * 60 * 60));
-    FastRandomContext insecure_rand;
-
-    std::array<std::pair<uint64_t, CNode *>, 2> best{
-        {{0, nullptr}, {0, nullptr}}};
-    assert(nRelayNodes <= best.size());
-
-    auto sortfunc = [&best, &hasher, nRelayNodes](CNode *pnode) {
-        if (pnode->nVersion >= CADDR_TIME_VERSION) {
-            uint64_t hashKey = CSipHasher(hasher).Write(pnode->id).Finalize();
-            for (unsigned int i = 0; i < nRelayNodes; i++) {
+                         FastRandomContext &insecure_rand) {
+    if (vAddrRelayQueue.size() >= MAX_ADDR_TO_SEND) {
+        vAddrRelayQueue[insecure_rand.randrange(vAddrRelayQueue.size())] =
+            std::make_pair(addr, fReachable);
+    } else {
+        vAddrRelayQueue.push_back(std::make_pair(addr, fReachable));
+    }
+}
+
+static void FlushAddressRelay(CConnman &connman) {
+    if (vAddrRelayQueue.empty()) {
+        return;
+    }
+
+    struct AddrRelay {
+        CSipHasher hasher;
+        // Limited relaying of addresses outside our network(s)
+        unsigned int nRelayNodes;
+        std::array<std::pair<uint64_t, CNode *>, 2> best;
+    };
+    std::vector<AddrRelay> vRelay;
+    vRelay.reserve(vAddrRelayQueue.size());
+    int64_t nNow = GetTime();
+    for (const auto &entry : vAddrRelayQueue) {
+        // Relay to a limited number of other nodes.
+        // Use deterministic randomness to send to the same nodes for 24 hours
+        // at a time so the addrKnowns of the chosen nodes prevent repeats.
+        uint64_t hashAddr = entry.first.GetHash();
+        vRelay.push_back(AddrRelay{
+            connman.GetDeterministicRandomizer(RANDOMIZER_ID_ADDRESS_RELAY)
+                .Write(hashAddr << 32)
+                .Write((nNow + hashAddr) / (24 * 60 * 60)),
+            entry.second ? 2u : 1u,
+            {{{0, nullptr}, {0, nullptr}}}});
+    }
+
+    auto sortfunc = [&vRelay](CNode *pnode) {
+        if (pnode->nVersion < CADDR_TIME_VERSION) {
+            return;
+        }
+        for (AddrRelay &relay : vRelay) {
+            uint64_t hashKey =
+                CSipHasher(relay.hasher).Write(pnode->id).Finalize();
+            auto &best = relay.best;
+            for (unsigned int i = 0; i < relay.nRelayNodes; i++) {
                 if (hashKey > best[i].first) {
-                    std::copy(best.begin() + i, best.begin() + nRelayNodes - 1,
+                    std::copy(best.begin() + i,
+                              best.begin() + relay.nRelayNodes - 1,
                               best.begin() + i + 1);
                     best[i] = std::make_pair(hashKey, pnode);
                     break;
@@ -1127,13 +1420,20 @@ static void RelayAddress(const CAddress &addr, bool fReachable,
         }
     };
 
-    auto pushfunc = [&addr, &best, nRelayNodes, &insecure_rand] {
-        for (unsigned int i = 0; i < nRelayNodes && best[i].first != 0; i++) {
-            best[i].second->PushAddress(addr, insecure_rand);
+    auto pushfunc = [&vRelay] {
+        FastRandomContext insecure_rand;
+        for (size_t n = 0; n < vRelay.size(); n++) {
+            const AddrRelay &relay = vRelay[n];
+            for (unsigned int i = 0;
+                 i < relay.nRelayNodes && relay.best[i].first != 0; i++) {
+                relay.best[i].second->PushAddress(vAddrRelayQueue[n].first,
+                                                  insecure_rand);
+            }
         }
     };
 
     connman.ForEachNodeThen(std::move(sortfunc), std::move(pushfunc));
+    vAddrRelayQueue.clear();
 }
 
 static void ProcessGetData(const Config &config, CNode *pfrom,
@@ -1143,6 +1443,12 @@ static void ProcessGetData(const Config &config, CNode *pfrom,
     std::deque<CInv>::iterator it = pfrom->vRecvGetData.begin();
     std::vector<CInv> vNotFound;
     const CNetMsgMaker msgMaker(pfrom->GetSendVersion());
+
+    // Answer nothing behind a filtered block before it is sent.
+    if (pfrom->fFilteredBlockQueued) {
+        return;
+    }
+
     LOCK(cs_main);
 
     while (it != pfrom->vRecvGetData.end()) {
@@ -1159,8 +1465,14 @@ static void ProcessGetData(const Config &config, CNode *pfrom,
 
             it++;
 
+            // Whether the filtered block server matched this request's
+            // block. It stays at the front of the queue until then.
+            bool fFilteredBlockReady =
+                pfrom->fFilteredBlockReady.exchange(false);
+
             if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK ||
-                inv.type == MSG_CMPCT_BLOCK) {
+                inv.type == MSG_CMPCT_BLOCK ||
+                inv.type == MSG_GRAPHENE_BLOCK) {
                 bool send = false;
                 BlockMap::iterator mi = mapBlockIndex.find(inv.hash);
                 if (mi != mapBlockIndex.end()) {
@@ -1230,17 +1542,53 @@ static void ProcessGetData(const Config &config, CNode *pfrom,
                 }
                 // Pruned nodes may have deleted the block, so check whether
                 // it's available before trying to send.
-                if (send && (mi->second->nStatus & BLOCK_HAVE_DATA)) {
-                    // Send block from disk
-                    CBlock block;
-                    if (!ReadBlockFromDisk(block, (*mi).second, config)) {
-                        assert(!"cannot load block from disk");
+                send = send && (mi->second->nStatus & BLOCK_HAVE_DATA);
+                if (fFilteredBlockReady) {
+                    std::shared_ptr<const CFilteredBlockReply> preply;
+                    {
+                        LOCK(pfrom->cs_filter);
+                        preply.swap(pfrom->pfilteredBlockReply);
+                    }
+                    if (send && preply) {
+                        connman.PushMessage(
+                            pfrom, msgMaker.Make(NetMsgType::MERKLEBLOCK,
+                                                 preply->merkleBlock));
+                        // As below, also push the matched transactions.
+                        for (const CTransactionRef &ptx : preply->vtx) {
+                            connman.PushMessage(
+                                pfrom, msgMaker.Make(NetMsgType::TX, *ptx));
+                        }
+                    }
+                } else if (send) {
+                    std::shared_ptr<const CBlock> pblock;
+                    if (inv.type == MSG_FILTERED_BLOCK) {
+                        LOCK(cs_most_recent_block);
+                        if (most_recent_block_hash == inv.hash) {
+                            pblock = most_recent_block;
+                        }
                     }
+                    if (!pblock) {
+                        // Send block from disk
+                        std::shared_ptr<CBlock> pblockRead =
+                            std::make_shared<CBlock>();
+                        if (!ReadBlockFromDisk(*pblockRead, (*mi).second,
+                                               config)) {
+                            assert(!"cannot load block from disk");
+                        }
+                        pblock = pblockRead;
+                    }
+                    const CBlock &block = *pblock;
 
                     if (inv.type == MSG_BLOCK) {
                         connman.PushMessage(
                             pfrom, msgMaker.Make(NetMsgType::BLOCK, block));
                     } else if (inv.type == MSG_FILTERED_BLOCK) {
+                        if (filteredBlockServer.Queue(pfrom, pblock)) {
+                            // Leave the request at the front of the queue
+                            // until the server sent it.
+                            --it;
+                            break;
+                        }
                         bool sendMerkleBlock = false;
                         CMerkleBlock merkleBlock;
                         {
@@ -1299,8 +1647,28 @@ static void ProcessGetData(const Config &config, CNode *pfrom,
                                                               NetMsgType::BLOCK,
                                                               block));
                         }
+                    } else if (inv.type == MSG_GRAPHENE_BLOCK) {
+                        // Same as compact blocks: old blocks are sent in full.
+                        // Our own mempool size stands in for the peer's if it
+                        // is larger, as the peer's may have grown since it
+                        // told us about it.
+                        if (CanDirectFetch(consensusParams) &&
+                            mi->second->nHeight >=
+                                chainActive.Height() - MAX_CMPCTBLOCK_DEPTH) {
+                            uint64_t nPoolSize = std::max<uint64_t>(
+                                State(pfrom->GetId())->nGraphenePoolSize,
+                                mempool.size());
+                            CGrapheneBlock grapheneblock(block, nPoolSize);
+                            connman.PushMessage(
+                                pfrom, msgMaker.Make(NetMsgType::GRAPHENEBLOCK,
+                                                     grapheneblock));
+                        } else {
+                            connman.PushMessage(
+                                pfrom, msgMaker.Make(NetMsgType::BLOCK, block));
+                        }
                     }
-
+                }
+                if (send) {
                     // Trigger the peer node to send a getblocks request for the
                     // next batch of inventory.
                     if (inv.hash == pfrom->hashContinue) {
@@ -1348,7 +1716,8 @@ static void ProcessGetData(const Config &config, CNode *pfrom,
             GetMainSignals().Inventory(inv.hash);
 
             if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK ||
-                inv.type == MSG_CMPCT_BLOCK) {
+                inv.type == MSG_CMPCT_BLOCK ||
+                inv.type == MSG_GRAPHENE_BLOCK) {
                 break;
             }
         }
@@ -1398,6 +1767,62 @@ inline static void SendBlockTransactions(const CBlock &block,
                         msgMaker.Make(nSendFlags, NetMsgType::BLOCKTXN, resp));
 }
 
+/**
+ * Check a BIP 157 request against the block filter index, and find the block
+ * it stops at. Peers asking for filters we do not serve or for an invalid
+ * range are disconnected. Requests for blocks the index has not caught up
+ * with yet are ignored.
+ */
+static bool PrepareBlockFilterRequest(CNode *pfrom, uint8_t nFilterType,
+                                      uint32_t nStartHeight,
+                                      const uint256 &hashStop,
+                                      uint32_t nMaxHeightRange,
+                                      const CBlockIndex *&pindexStop) {
+    AssertLockHeld(cs_main);
+
+    if (!(pfrom->GetLocalServices() & NODE_COMPACT_FILTERS) ||
+        !pblockfilterindex ||
+        nFilterType != uint8_t(BlockFilterType::BASIC)) {
+        LogPrint(BCLog::NET,
+                 "peer %d requested unsupported block filter type %d\n",
+                 pfrom->id, nFilterType);
+        pfrom->fDisconnect = true;
+        return false;
+    }
+
+    BlockMap::iterator it = mapBlockIndex.find(hashStop);
+    if (it == mapBlockIndex.end() || !chainActive.Contains(it->second)) {
+        LogPrint(BCLog::NET, "peer %d requested filters up to unknown block "
+                             "%s\n",
+                 pfrom->id, hashStop.ToString());
+        pfrom->fDisconnect = true;
+        return false;
+    }
+    pindexStop = it->second;
+
+    uint32_t nStopHeight = pindexStop->nHeight;
+    if (nStartHeight > nStopHeight ||
+        nStopHeight - nStartHeight >= nMaxHeightRange) {
+        LogPrint(BCLog::NET, "peer %d requested filters of too many blocks: "
+                             "start height %d, stop height %d\n",
+                 pfrom->id, nStartHeight, nStopHeight);
+        pfrom->fDisconnect = true;
+        return false;
+    }
+
+    BlockMap::iterator itBest =
+        mapBlockIndex.find(pblockfilterindex->GetBestBlock());
+    if (itBest == mapBlockIndex.end() ||
+        !chainActive.Contains(itBest->second) ||
+        itBest->second->nHeight < pindexStop->nHeight) {
+        LogPrint(BCLog::NET, "block filter index is not synced up to block "
+                             "%s requested by peer %d\n",
+                 hashStop.ToString(), pfrom->id);
+        return false;
+    }
+    return true;
+}
+
 // 通过这些代码我略微体会到了P2P网络的一些功能,各种结点之间的独立性，
 // 都是通过发送消息进行通信的。ProcessMessages侦听到消息后，通过循环消息队列调用ProcessMessage函数进行不同的消息处理。
 static bool ProcessMessage(const Config &config, CNode *pfrom,
@@ -1599,6 +2024,8 @@ static bool ProcessMessage(const Config &config, CNode *pfrom,
                     pfrom,
                     CNetMsgMaker(nSendVersion).Make(NetMsgType::GETADDR));
                 pfrom->fGetAddr = true;
+                // The reply to our getaddr is not rate limited.
+                pfrom->nAddrTokenBucket += MAX_ADDR_PROCESSING_TOKEN_BUCKET;
             }
             connman.MarkAddressGood(pfrom->addr);
         }
@@ -1681,6 +2108,15 @@ static bool ProcessMessage(const Config &config, CNode *pfrom,
                                 msgMaker.Make(NetMsgType::SENDCMPCT,
                                               fAnnounceUsingCMPCTBLOCK,
                                               nCMPCTBLOCKVersion));
+            if (GetBoolArg("-graphene", DEFAULT_GRAPHENE_RELAY)) {
+                // Tell our peer we would like grapheneblocks, and how big our
+                // mempool is so that it can size them.
+                uint64_t nGrapheneVersion = 1;
+                uint64_t nPoolSize = mempool.size();
+                connman.PushMessage(pfrom,
+                                    msgMaker.Make(NetMsgType::SENDGRAPHENE,
+                                                  nGrapheneVersion, nPoolSize));
+            }
         }
         pfrom->fSuccessfullyConnected = true;
     }
@@ -1707,15 +2143,46 @@ static bool ProcessMessage(const Config &config, CNode *pfrom,
             return error("message addr size() = %u", vAddr.size());
         }
 
+        // Refill the token bucket for the time since the last refill.
+        int64_t nTimeMicros = GetTimeMicros();
+        if (pfrom->nAddrTokenBucket < MAX_ADDR_PROCESSING_TOKEN_BUCKET &&
+            nTimeMicros > pfrom->nAddrTokenTimestamp) {
+            pfrom->nAddrTokenBucket = std::min<double>(
+                pfrom->nAddrTokenBucket +
+                    MAX_ADDR_RATE_PER_SECOND *
+                        (nTimeMicros - pfrom->nAddrTokenTimestamp) / 1000000,
+                MAX_ADDR_PROCESSING_TOKEN_BUCKET);
+        }
+        pfrom->nAddrTokenTimestamp = nTimeMicros;
+
+        // Process the addresses in random order, so that the peer does not
+        // choose which of them fit in its token bucket.
+        FastRandomContext insecure_rand;
+        for (size_t i = vAddr.size(); i > 1; i--) {
+            std::swap(vAddr[i - 1], vAddr[insecure_rand.randrange(i)]);
+        }
+
         // Store the new addresses
         std::vector<CAddress> vAddrOk;
         int64_t nNow = GetAdjustedTime();
         int64_t nSince = nNow - 10 * 60;
+        uint64_t nProcessed = 0, nRateLimited = 0;
         for (CAddress &addr : vAddr) {
             if (interruptMsgProc) {
                 return true;
             }
 
+            // Whitelisted peers are not rate limited, but still use tokens.
+            if (pfrom->nAddrTokenBucket < 1.0) {
+                if (!pfrom->fWhitelisted) {
+                    nRateLimited++;
+                    continue;
+                }
+            } else {
+                pfrom->nAddrTokenBucket -= 1.0;
+            }
+            nProcessed++;
+
             if ((addr.nServices & REQUIRED_SERVICES) != REQUIRED_SERVICES) {
                 continue;
             }
@@ -1728,13 +2195,21 @@ static bool ProcessMessage(const Config &config, CNode *pfrom,
             if (addr.nTime > nSince && !pfrom->fGetAddr && vAddr.size() <= 10 &&
                 addr.IsRoutable()) {
                 // Relay to a limited number of other nodes
-                RelayAddress(addr, fReachable, connman);
+                RelayAddress(addr, fReachable, insecure_rand);
             }
             // Do not store addresses outside our network
             if (fReachable) {
                 vAddrOk.push_back(addr);
             }
         }
+        pfrom->nAddrProcessed += nProcessed;
+        pfrom->nAddrRateLimited += nRateLimited;
+        if (nRateLimited > 0) {
+            LogPrint(BCLog::NET,
+                     "Received addr: %u addresses, %u processed, %u rate "
+                     "limited, peer=%d\n",
+                     vAddr.size(), nProcessed, nRateLimited, pfrom->id);
+        }
         connman.AddNewAddresses(vAddrOk, pfrom->addr, 2 * 60 * 60);
         if (vAddr.size() < 1000) {
             pfrom->fGetAddr = false;
@@ -1769,6 +2244,17 @@ static bool ProcessMessage(const Config &config, CNode *pfrom,
         }
     }
 
+    else if (strCommand == NetMsgType::SENDGRAPHENE) {
+        uint64_t nGrapheneVersion = 0;
+        uint64_t nPoolSize = 0;
+        vRecv >> nGrapheneVersion >> nPoolSize;
+        if (nGrapheneVersion == 1) {
+            LOCK(cs_main);
+            State(pfrom->GetId())->fSupportsGraphene = true;
+            State(pfrom->GetId())->nGraphenePoolSize = nPoolSize;
+        }
+    }
+
     else if (strCommand == NetMsgType::INV) {
         std::vector<CInv> vInv;
         vRecv >> vInv;
@@ -2385,7 +2871,7 @@ static bool ProcessMessage(const Config &config, CNode *pfrom,
             if (pindex->nHeight <= chainActive.Height() + 2) {
                 if ((!fAlreadyInFlight &&
                      nodestate->nBlocksInFlight <
-                         MAX_BLOCKS_IN_TRANSIT_PER_PEER) ||
+                         GetMaxBlocksInTransit(*nodestate)) ||
                     (fAlreadyInFlight &&
                      blockInFlightIt->second.first == pfrom->GetId())) {
                     std::list<QueuedBlock>::iterator *queuedBlockIt = nullptr;
@@ -2533,6 +3019,59 @@ static bool ProcessMessage(const Config &config, CNode *pfrom,
 
     }
 
+    else if (strCommand == NetMsgType::GRAPHENEBLOCK && !fImporting &&
+             !fReindex) {
+        CGrapheneBlock grapheneblock;
+        vRecv >> grapheneblock;
+        const uint256 hash = grapheneblock.header.GetHash();
+
+        {
+            // Only spend time reconciling blocks we asked this peer for.
+            LOCK(cs_main);
+            std::map<uint256,
+                     std::pair<NodeId, std::list<QueuedBlock>::iterator>>::
+                iterator blockInFlightIt = mapBlocksInFlight.find(hash);
+            if (blockInFlightIt == mapBlocksInFlight.end() ||
+                blockInFlightIt->second.first != pfrom->GetId()) {
+                LogPrint(BCLog::NET,
+                         "Unrequested grapheneblock %s from peer=%d\n",
+                         hash.ToString(), pfrom->id);
+                return true;
+            }
+        }
+
+        CBlockHeaderAndShortTxIDs cmpctblock;
+        ReadStatus status = grapheneblock.Decode(config, mempool,
+                                                 vExtraTxnForCompact,
+                                                 cmpctblock);
+        if (status == READ_STATUS_INVALID) {
+            LOCK(cs_main);
+            MarkBlockAsReceived(hash);
+            Misbehaving(pfrom, 100, "invalid-grapheneblk");
+            LogPrintf("Peer %d sent us invalid graphene block\n", pfrom->id);
+            return true;
+        }
+        if (status != READ_STATUS_OK) {
+            // Too many differences with our mempool: fall back to a compact
+            // block and getblocktxn for whatever we are missing.
+            LogPrint(BCLog::CMPCTBLOCK,
+                     "Failed to decode grapheneblock %s from peer=%d, "
+                     "requesting a compact block\n",
+                     hash.ToString(), pfrom->id);
+            std::vector<CInv> vInv(1, CInv(MSG_CMPCT_BLOCK, hash));
+            connman.PushMessage(pfrom,
+                                msgMaker.Make(NetMsgType::GETDATA, vInv));
+            return true;
+        }
+
+        // Continue as if the peer had sent the compact block.
+        CDataStream cmpctBlockMsg(SER_NETWORK, PROTOCOL_VERSION);
+        cmpctBlockMsg << cmpctblock;
+        return ProcessMessage(config, pfrom, NetMsgType::CMPCTBLOCK,
+                              cmpctBlockMsg, nTimeReceived, chainparams,
+                              connman, interruptMsgProc);
+    }
+
     else if (strCommand == NetMsgType::BLOCKTXN && !fImporting &&
              !fReindex) // Ignore blocks received while importing
     {
@@ -2753,8 +3292,9 @@ static bool ProcessMessage(const Config &config, CNode *pfrom,
                 const CBlockIndex *pindexWalk = pindexLast;
                 // Calculate all the blocks we'd need to switch to pindexLast,
                 // up to a limit.
+                const int nMaxInTransit = GetMaxBlocksInTransit(*nodestate);
                 while (pindexWalk && !chainActive.Contains(pindexWalk) &&
-                       vToFetch.size() <= MAX_BLOCKS_IN_TRANSIT_PER_PEER) {
+                       vToFetch.size() <= size_t(nMaxInTransit)) {
                     if (!(pindexWalk->nStatus & BLOCK_HAVE_DATA) &&
                         !mapBlocksInFlight.count(pindexWalk->GetBlockHash())) {
                         // We don't have this block, and it's not yet in flight.
@@ -2777,8 +3317,7 @@ static bool ProcessMessage(const Config &config, CNode *pfrom,
                     // Download as much as possible, from earliest to latest.
                     for (const CBlockIndex *pindex :
                          boost::adaptors::reverse(vToFetch)) {
-                        if (nodestate->nBlocksInFlight >=
-                            MAX_BLOCKS_IN_TRANSIT_PER_PEER) {
+                        if (nodestate->nBlocksInFlight >= nMaxInTransit) {
                             // Can't download any more from this peer
                             break;
                         }
@@ -2806,8 +3345,12 @@ static bool ProcessMessage(const Config &config, CNode *pfrom,
                             pindexLast->pprev->IsValid(BLOCK_VALID_CHAIN)) {
                             // In any case, we want to download using a compact
                             // block, not a regular one.
-                            vGetData[0] =
-                                CInv(MSG_CMPCT_BLOCK, vGetData[0].hash);
+                            bool fGraphene =
+                                nodestate->fSupportsGraphene &&
+                                GetBoolArg("-graphene", DEFAULT_GRAPHENE_RELAY);
+                            vGetData[0] = CInv(fGraphene ? MSG_GRAPHENE_BLOCK
+                                                         : MSG_CMPCT_BLOCK,
+                                               vGetData[0].hash);
                         }
                         connman.PushMessage(
                             pfrom,
@@ -2822,6 +3365,7 @@ static bool ProcessMessage(const Config &config, CNode *pfrom,
              !fReindex) // Ignore blocks received while importing
     {
         std::shared_ptr<CBlock> pblock = std::make_shared<CBlock>();
+        const size_t nBlockSize = vRecv.size();
         vRecv >> *pblock;
 
         LogPrint(BCLog::NET, "received block %s peer=%d\n",
@@ -2837,6 +3381,7 @@ static bool ProcessMessage(const Config &config, CNode *pfrom,
             LOCK(cs_main);
             // Also always process if we requested the block explicitly, as we
             // may need it even though it is not a candidate for a new best tip.
+            UpdateBlockDownloadStats(pfrom->GetId(), hash, nBlockSize);
             forceProcessing |= MarkBlockAsReceived(hash);
             // mapBlockSource is only used for sending reject messages and DoS
             // scores, so the race between here and cs_main in ProcessNewBlock
@@ -3033,6 +3578,135 @@ static bool ProcessMessage(const Config &config, CNode *pfrom,
         pfrom->fRelayTxes = true;
     }
 
+    else if (strCommand == NetMsgType::GETCFILTERS) {
+        uint8_t nFilterType;
+        uint32_t nStartHeight;
+        uint256 hashStop;
+        vRecv >> nFilterType >> nStartHeight >> hashStop;
+
+        std::vector<uint256> vHashes;
+        {
+            LOCK(cs_main);
+            const CBlockIndex *pindexStop;
+            if (!PrepareBlockFilterRequest(pfrom, nFilterType, nStartHeight,
+                                           hashStop, MAX_GETCFILTERS_SIZE,
+                                           pindexStop)) {
+                return true;
+            }
+            for (const CBlockIndex *pindex = pindexStop;
+                 pindex->nHeight >= int(nStartHeight);
+                 pindex = pindex->pprev) {
+                vHashes.push_back(pindex->GetBlockHash());
+                if (!pindex->pprev) {
+                    break;
+                }
+            }
+        }
+
+        // The filters are read without cs_main, in height order.
+        for (auto it = vHashes.rbegin(); it != vHashes.rend(); ++it) {
+            BlockFilter filter;
+            if (!pblockfilterindex->LookupFilter(*it, filter)) {
+                LogPrintf("Failed to read the filter of block %s\n",
+                          it->ToString());
+                return true;
+            }
+            connman.PushMessage(pfrom,
+                                msgMaker.Make(NetMsgType::CFILTER, filter));
+        }
+    }
+
+    else if (strCommand == NetMsgType::GETCFHEADERS) {
+        uint8_t nFilterType;
+        uint32_t nStartHeight;
+        uint256 hashStop;
+        vRecv >> nFilterType >> nStartHeight >> hashStop;
+
+        std::vector<uint256> vHashes;
+        uint256 hashPrevBlock;
+        {
+            LOCK(cs_main);
+            const CBlockIndex *pindexStop;
+            if (!PrepareBlockFilterRequest(pfrom, nFilterType, nStartHeight,
+                                           hashStop, MAX_GETCFHEADERS_SIZE,
+                                           pindexStop)) {
+                return true;
+            }
+            const CBlockIndex *pindex = pindexStop;
+            for (; pindex && pindex->nHeight >= int(nStartHeight);
+                 pindex = pindex->pprev) {
+                vHashes.push_back(pindex->GetBlockHash());
+            }
+            if (pindex) {
+                hashPrevBlock = pindex->GetBlockHash();
+            }
+        }
+
+        CBlockFilterHashes hashes;
+        uint256 hashPrevHeader;
+        if (!hashPrevBlock.IsNull()) {
+            if (!pblockfilterindex->LookupFilterHashes(hashPrevBlock,
+                                                       hashes)) {
+                LogPrintf("Failed to read the filter header of block %s\n",
+                          hashPrevBlock.ToString());
+                return true;
+            }
+            hashPrevHeader = hashes.hashHeader;
+        }
+        std::vector<uint256> vFilterHashes;
+        vFilterHashes.reserve(vHashes.size());
+        for (auto it = vHashes.rbegin(); it != vHashes.rend(); ++it) {
+            if (!pblockfilterindex->LookupFilterHashes(*it, hashes)) {
+                LogPrintf("Failed to read the filter hash of block %s\n",
+                          it->ToString());
+                return true;
+            }
+            vFilterHashes.push_back(hashes.hashFilter);
+        }
+        connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::CFHEADERS,
+                                                 nFilterType, hashStop,
+                                                 hashPrevHeader,
+                                                 vFilterHashes));
+    }
+
+    else if (strCommand == NetMsgType::GETCFCHECKPT) {
+        uint8_t nFilterType;
+        uint256 hashStop;
+        vRecv >> nFilterType >> hashStop;
+
+        std::vector<uint256> vHashes;
+        {
+            LOCK(cs_main);
+            const CBlockIndex *pindexStop;
+            if (!PrepareBlockFilterRequest(
+                    pfrom, nFilterType, 0, hashStop,
+                    std::numeric_limits<uint32_t>::max(), pindexStop)) {
+                return true;
+            }
+            for (int nHeight = CFCHECKPT_INTERVAL;
+                 nHeight <= pindexStop->nHeight;
+                 nHeight += CFCHECKPT_INTERVAL) {
+                vHashes.push_back(
+                    pindexStop->GetAncestor(nHeight)->GetBlockHash());
+            }
+        }
+
+        std::vector<uint256> vHeaders;
+        vHeaders.reserve(vHashes.size());
+        for (const uint256 &hash : vHashes) {
+            CBlockFilterHashes hashes;
+            if (!pblockfilterindex->LookupFilterHashes(hash, hashes)) {
+                LogPrintf("Failed to read the filter header of block %s\n",
+                          hash.ToString());
+                return true;
+            }
+            vHeaders.push_back(hashes.hashHeader);
+        }
+        connman.PushMessage(pfrom,
+                            msgMaker.Make(NetMsgType::CFCHECKPT, nFilterType,
+                                          hashStop, vHeaders));
+    }
+
     else if (strCommand == NetMsgType::FEEFILTER) {
         Amount newFeeFilter(0);
         vRecv >> newFeeFilter;
@@ -3120,7 +3794,8 @@ bool ProcessMessages(const Config &config, CNode *pfrom, CConnman &connman,
 
     // this maintains the order of responses
     if (!pfrom->vRecvGetData.empty()) {
-        return true;
+        // The filtered block server wakes us up once it sent the block.
+        return !pfrom->fFilteredBlockQueued;
     }
 
     // Don't bother if send buffer is too full to respond anyway
@@ -3315,6 +3990,10 @@ bool SendMessages(const Config &config, CNode *pto, CConnman &connman,
     //
     // Message: addr
     //
+    if (nNextAddrRelayFlush < nNow) {
+        nNextAddrRelayFlush = nNow + ADDRESS_RELAY_FLUSH_INTERVAL * 1000000LL;
+        FlushAddressRelay(connman);
+    }
     if (pto->nNextAddrSend < nNow) {
         pto->nNextAddrSend =
             PoissonNextSend(nNow, AVG_ADDRESS_BROADCAST_INTERVAL);
@@ -3708,15 +4387,30 @@ bool SendMessages(const Config &config, CNode *pto, CConnman &connman,
     // Detect whether we're stalling
     nNow = GetTimeMicros();
     if (state.nStallingSince &&
-        state.nStallingSince < nNow - 1000000 * BLOCK_STALLING_TIMEOUT) {
+        state.nStallingSince < nNow - GetBlockStallingTimeout(state)) {
         // Stalling only triggers when the block download window cannot move.
         // During normal steady state, the download window should be much larger
-        // than the to-be-downloaded set of blocks, so disconnection should only
-        // happen during initial block download.
-        LogPrintf("Peer=%d is stalling block download, disconnecting\n",
-                  pto->id);
-        pto->fDisconnect = true;
-        return true;
+        // than the to-be-downloaded set of blocks, so this should only happen
+        // during initial block download.
+        if (++state.nStallReassignments > MAX_BLOCK_STALL_REASSIGNMENTS) {
+            LogPrintf("Peer=%d is stalling block download, disconnecting\n",
+                      pto->id);
+            pto->fDisconnect = true;
+            return true;
+        }
+        // Give the peer's in-flight blocks to other peers and halve its
+        // estimated rate, so that it is asked for fewer blocks from now on.
+        // The peer is not asked for blocks again for one stalling timeout, or
+        // it would be handed back the very blocks it was stalling.
+        LogPrint(BCLog::NET, "Peer=%d is stalling block download, "
+                             "reassigning %d blocks\n",
+                 pto->id, state.nBlocksInFlight);
+        while (!state.vBlocksInFlight.empty()) {
+            MarkBlockAsReceived(state.vBlocksInFlight.front().hash);
+        }
+        state.dBlockDownloadRate /= 2;
+        state.nStallBackoffUntil = nNow + GetBlockStallingTimeout(state);
+        state.nStallingSince = 0;
     }
     // In case there is a block that has been in flight from this peer for 2 +
     // 0.5 * N times the block interval (with N the number of peers from which
@@ -3747,13 +4441,14 @@ bool SendMessages(const Config &config, CNode *pto, CConnman &connman,
     // Message: getdata (blocks)
     //
     std::vector<CInv> vGetData;
+    const int nMaxInTransit = GetMaxBlocksInTransit(state);
     if (!pto->fClient && (fFetch || !IsInitialBlockDownload()) &&
-        state.nBlocksInFlight < MAX_BLOCKS_IN_TRANSIT_PER_PEER) {
+        state.nBlocksInFlight < nMaxInTransit &&
+        nNow >= state.nStallBackoffUntil) {
         std::vector<const CBlockIndex *> vToDownload;
         NodeId staller = -1;
         FindNextBlocksToDownload(pto->GetId(),
-                                 MAX_BLOCKS_IN_TRANSIT_PER_PEER -
-                                     state.nBlocksInFlight,
+                                 nMaxInTransit - state.nBlocksInFlight,
                                  vToDownload, staller, consensusParams);
         for (const CBlockIndex *pindex : vToDownload) {
             uint32_t nFetchFlags =
@@ -21,6 +21,16 @@ static const int64_t ORPHAN_TX_EXPIRE_INTERVAL = 5 * 60;
 /** Default number of orphan+recently-replaced txn to keep around for block
  * reconstruction */
 static const unsigned int DEFAULT_BLOCK_RECONSTRUCTION_EXTRA_TXN = 100;
+/** Default for -graphene, requesting blocks as grapheneblock messages from
+ * peers which support it */
+static const bool DEFAULT_GRAPHENE_RELAY = false;
+/** Maximum number of blocks whose filters a getcfilters may ask for, see
+ * BIP 157 */
+static const uint32_t MAX_GETCFILTERS_SIZE = 1000;
+/** Maximum number of blocks whose filter hashes a getcfheaders may ask for */
+static const uint32_t MAX_GETCFHEADERS_SIZE = 2000;
+/** Height interval of the filter headers in a cfcheckpt */
+static const int CFCHECKPT_INTERVAL = 1000;
 
 /** Register with a network node to receive its signals */
 void RegisterNodeSignals(CNodeSignals &nodeSignals);
@@ -33,6 +43,7 @@ private:
 
 public:
     PeerLogicValidation(CConnman *connmanIn);
+    ~PeerLogicValidation();
 
     void SyncTransaction(const CTransaction &tx, const CBlockIndex *pindex,
                          int nPosInBlock) override;
@@ -50,6 +61,8 @@ struct CNodeStateStats {
     int nSyncHeight;
     int nCommonHeight;
     std::vector<int> vHeightInFlight;
+    double dBlockDownloadRate;
+    int nMaxBlocksInFlight;
 };
 
 /** Get statistics from node state */
@@ -39,6 +39,14 @@ const char *SENDCMPCT = "sendcmpct";
 const char *CMPCTBLOCK = "cmpctblock";
 const char *GETBLOCKTXN = "getblocktxn";
 const char *BLOCKTXN = "blocktxn";
+const char *SENDGRAPHENE = "sendgraphene";
+const char *GRAPHENEBLOCK = "grapheneblock";
+const char *GETCFILTERS = "getcfilters";
+const char *CFILTER = "cfilter";
+const char *GETCFHEADERS = "getcfheaders";
+const char *CFHEADERS = "cfheaders";
+const char *GETCFCHECKPT = "getcfcheckpt";
+const char *CFCHECKPT = "cfcheckpt";
 }; // namespace NetMsgType
 
 /**
@@ -54,7 +62,10 @@ static const std::string allNetMessageTypes[] = {
     NetMsgType::NOTFOUND,    NetMsgType::FILTERLOAD, NetMsgType::FILTERADD,
     NetMsgType::FILTERCLEAR, NetMsgType::REJECT,     NetMsgType::SENDHEADERS,
     NetMsgType::FEEFILTER,   NetMsgType::SENDCMPCT,  NetMsgType::CMPCTBLOCK,
-    NetMsgType::GETBLOCKTXN, NetMsgType::BLOCKTXN,
+    NetMsgType::GETBLOCKTXN, NetMsgType::BLOCKTXN,   NetMsgType::SENDGRAPHENE,
+    NetMsgType::GRAPHENEBLOCK, NetMsgType::GETCFILTERS, NetMsgType::CFILTER,
+    NetMsgType::GETCFHEADERS, NetMsgType::CFHEADERS,  NetMsgType::GETCFCHECKPT,
+    NetMsgType::CFCHECKPT,
 };
 static const std::vector<std::string>
     allNetMessageTypesVec(allNetMessageTypes,
@@ -156,6 +167,8 @@ std::string CInv::GetCommand() const {
             return cmd.append(NetMsgType::MERKLEBLOCK);
         case MSG_CMPCT_BLOCK:
             return cmd.append(NetMsgType::CMPCTBLOCK);
+        case MSG_GRAPHENE_BLOCK:
+            return cmd.append(NetMsgType::GRAPHENEBLOCK);
         default:
             throw std::out_of_range(
                 strprintf("CInv::GetCommand(): type=%d unknown type", type));
@@ -242,6 +242,51 @@ extern const char *GETBLOCKTXN;
  * @since protocol version 70014 as described by BIP 152
  */
 extern const char *BLOCKTXN;
+/**
+ * Contains an 8-byte LE version number and the 8-byte LE number of
+ * transactions in the sender's mempool.
+ * Indicates that a node can reconstruct blocks from "grapheneblock" messages,
+ * and would like to receive them when it requests blocks.
+ */
+extern const char *SENDGRAPHENE;
+/**
+ * Contains a CGrapheneBlock.
+ * Sent in response to a getdata for MSG_GRAPHENE_BLOCK.
+ */
+extern const char *GRAPHENEBLOCK;
+/**
+ * Contains a filter type, a start height and a stop block hash.
+ * Peer should respond with a "cfilter" message for each block in the range.
+ * @since as described by BIP 157
+ */
+extern const char *GETCFILTERS;
+/**
+ * Contains a BlockFilter.
+ * Sent in response to a "getcfilters" message.
+ */
+extern const char *CFILTER;
+/**
+ * Contains a filter type, a start height and a stop block hash.
+ * Peer should respond with a "cfheaders" message.
+ */
+extern const char *GETCFHEADERS;
+/**
+ * Contains a filter type, the stop block hash, the filter header of the block
+ * before the range and the filter hashes of the blocks in the range.
+ * Sent in response to a "getcfheaders" message.
+ */
+extern const char *CFHEADERS;
+/**
+ * Contains a filter type and a stop block hash.
+ * Peer should respond with a "cfcheckpt" message.
+ */
+extern const char *GETCFCHECKPT;
+/**
+ * Contains a filter type, the stop block hash and the filter headers at
+ * evenly spaced heights up to it.
+ * Sent in response to a "getcfcheckpt" message.
+ */
+extern const char *CFCHECKPT;
 }; // namespace NetMsgType
 
 /* Get a vector of all valid message types (see above) */
@@ -277,6 +322,9 @@ enum ServiceFlags : uint64_t {
     // TODO: remove (free up) the NODE_BITCOIN_CASH service bit once no longer
     // needed.
     NODE_BITCOIN_CASH = (1 << 5),
+    // NODE_COMPACT_FILTERS means the node will serve basic block filters and
+    // their headers, as specified by BIP 157 and 158.
+    NODE_COMPACT_FILTERS = (1 << 6),
 
     // Bits 24-31 are reserved for temporary experiments. Just pick a bit that
     // isn't getting used, or one not being used much, and notify the
@@ -338,6 +386,8 @@ enum GetDataMsg {
     MSG_FILTERED_BLOCK = 3,
     //!< Defined in BIP152
     MSG_CMPCT_BLOCK = 4,
+    //!< Graphene set reconciliation, see CGrapheneBlock
+    MSG_GRAPHENE_BLOCK = 5,
 
     //!< Extension block
     MSG_EXT_TX = MSG_TX | MSG_EXT_FLAG,
@@ -373,7 +423,7 @@ public:
     bool IsSomeBlock() const {
         auto k = GetKind();
         return k == MSG_BLOCK || k == MSG_FILTERED_BLOCK ||
-               k == MSG_CMPCT_BLOCK;
+               k == MSG_CMPCT_BLOCK || k == MSG_GRAPHENE_BLOCK;
     }
 
     // TODO: make private (improves encapsulation)
@@ -960,6 +960,9 @@ QString formatServicesStr(quint64 mask) {
                 case NODE_BITCOIN_CASH:
                     strList.append("CASH");
                     break;
+                case NODE_COMPACT_FILTERS:
+                    strList.append("COMPACT_FILTERS");
+                    break;
                 default:
                     strList.append(QString("%1[%2]").arg("UNKNOWN").arg(check));
             }
@@ -3,6 +3,8 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "addrindex.h"
+#include "blockfilterindex.h"
 #include "chain.h"
 #include "chainparams.h"
 #include "config.h"
@@ -665,6 +667,242 @@ static bool rest_getutxos(Config &config, HTTPRequest *req,
     return true;
 }
 
+static bool rest_address(HTTPRequest *req, const std::string &strURIPart,
+                         UniValue (*toJSON)(const uint256 &)) {
+    if (!CheckWarmup(req)) {
+        return false;
+    }
+
+    std::string param;
+    const RetFormat rf = ParseDataFormat(param, strURIPart);
+
+    uint256 scripthash;
+    if (!ParseAddressOrScriptHash(param, scripthash)) {
+        return RESTERR(req, HTTP_BAD_REQUEST,
+                       "Invalid address or script hash: " + param);
+    }
+    if (!paddressindex) {
+        return RESTERR(req, HTTP_NOT_FOUND,
+                       "Address index not enabled (use -addressindex)");
+    }
+
+    switch (rf) {
+        case RF_JSON: {
+            std::string strJSON = toJSON(scripthash).write() + "\n";
+            req->WriteHeader("Content-Type", "application/json");
+            req->WriteReply(HTTP_OK, strJSON);
+            return true;
+        }
+        default: {
+            return RESTERR(req, HTTP_NOT_FOUND,
+                           "output format not found (available: json)");
+        }
+    }
+
+    // not reached
+    // continue to process further HTTP reqs on this cxn
+    return true;
+}
+
+static bool rest_address_history(Config &config, HTTPRequest *req,
+                                 const std::string &strURIPart) {
+    return rest_address(req, strURIPart, AddressHistoryToJSON);
+}
+
+static bool rest_address_utxos(Config &config, HTTPRequest *req,
+                               const std::string &strURIPart) {
+    return rest_address(req, strURIPart, AddressUtxosToJSON);
+}
+
+static bool rest_blockfilter(Config &config, HTTPRequest *req,
+                             const std::string &strURIPart) {
+    if (!CheckWarmup(req)) {
+        return false;
+    }
+
+    std::string param;
+    const RetFormat rf = ParseDataFormat(param, strURIPart);
+    std::vector<std::string> path;
+    boost::split(path, param, boost::is_any_of("/"));
+
+    if (path.size() != 2) {
+        return RESTERR(req, HTTP_BAD_REQUEST, "Invalid URI format. Use "
+                                              "/rest/blockfilter/<type>/"
+                                              "<hash>.<ext>.");
+    }
+
+    BlockFilterType filterType;
+    if (!BlockFilterTypeByName(path[0], filterType)) {
+        return RESTERR(req, HTTP_BAD_REQUEST,
+                       "Unknown filter type: " + path[0]);
+    }
+
+    uint256 hash;
+    if (!ParseHashStr(path[1], hash)) {
+        return RESTERR(req, HTTP_BAD_REQUEST, "Invalid hash: " + path[1]);
+    }
+
+    if (!pblockfilterindex) {
+        return RESTERR(req, HTTP_NOT_FOUND,
+                       "Block filter index not enabled (use "
+                       "-blockfilterindex)");
+    }
+
+    BlockFilter filter;
+    if (!pblockfilterindex->LookupFilter(hash, filter)) {
+        return RESTERR(req, HTTP_NOT_FOUND, path[1] + " not found");
+    }
+    const std::vector<uint8_t> &vFilter = filter.GetEncodedFilter();
+
+    switch (rf) {
+        case RF_BINARY: {
+            std::string binaryFilter(vFilter.begin(), vFilter.end());
+            req->WriteHeader("Content-Type", "application/octet-stream");
+            req->WriteReply(HTTP_OK, binaryFilter);
+            return true;
+        }
+
+        case RF_HEX: {
+            std::string strHex = HexStr(vFilter.begin(), vFilter.end()) + "\n";
+            req->WriteHeader("Content-Type", "text/plain");
+            req->WriteReply(HTTP_OK, strHex);
+            return true;
+        }
+
+        case RF_JSON: {
+            UniValue objFilter(UniValue::VOBJ);
+            objFilter.push_back(Pair("blockhash", hash.GetHex()));
+            objFilter.push_back(Pair("filter", HexStr(vFilter)));
+            std::string strJSON = objFilter.write() + "\n";
+            req->WriteHeader("Content-Type", "application/json");
+            req->WriteReply(HTTP_OK, strJSON);
+            return true;
+        }
+
+        default: {
+            return RESTERR(req, HTTP_NOT_FOUND,
+                           "output format not found (available: " +
+                               AvailableDataFormatsString() + ")");
+        }
+    }
+
+    // not reached
+    // continue to process further HTTP reqs on this cxn
+    return true;
+}
+
+static bool rest_blockfilterheaders(Config &config, HTTPRequest *req,
+                                    const std::string &strURIPart) {
+    if (!CheckWarmup(req)) {
+        return false;
+    }
+
+    std::string param;
+    const RetFormat rf = ParseDataFormat(param, strURIPart);
+    std::vector<std::string> path;
+    boost::split(path, param, boost::is_any_of("/"));
+
+    if (path.size() != 3) {
+        return RESTERR(req, HTTP_BAD_REQUEST,
+                       "No header count specified. Use "
+                       "/rest/blockfilterheaders/<type>/<count>/"
+                       "<hash>.<ext>.");
+    }
+
+    BlockFilterType filterType;
+    if (!BlockFilterTypeByName(path[0], filterType)) {
+        return RESTERR(req, HTTP_BAD_REQUEST,
+                       "Unknown filter type: " + path[0]);
+    }
+
+    long count = strtol(path[1].c_str(), nullptr, 10);
+    if (count < 1 || count > 2000) {
+        return RESTERR(req, HTTP_BAD_REQUEST,
+                       "Header count out of range: " + path[1]);
+    }
+
+    uint256 hash;
+    if (!ParseHashStr(path[2], hash)) {
+        return RESTERR(req, HTTP_BAD_REQUEST, "Invalid hash: " + path[2]);
+    }
+
+    if (!pblockfilterindex) {
+        return RESTERR(req, HTTP_NOT_FOUND,
+                       "Block filter index not enabled (use "
+                       "-blockfilterindex)");
+    }
+
+    std::vector<uint256> vHashes;
+    vHashes.reserve(count);
+    {
+        LOCK(cs_main);
+        BlockMap::const_iterator it = mapBlockIndex.find(hash);
+        const CBlockIndex *pindex =
+            (it != mapBlockIndex.end()) ? it->second : nullptr;
+        while (pindex != nullptr && chainActive.Contains(pindex)) {
+            vHashes.push_back(pindex->GetBlockHash());
+            if (vHashes.size() == size_t(count)) {
+                break;
+            }
+            pindex = chainActive.Next(pindex);
+        }
+    }
+
+    // Stop at the first block the index has not reached yet.
+    std::vector<uint256> vHeaders;
+    vHeaders.reserve(vHashes.size());
+    for (const uint256 &hashBlock : vHashes) {
+        CBlockFilterHashes hashes;
+        if (!pblockfilterindex->LookupFilterHashes(hashBlock, hashes)) {
+            break;
+        }
+        vHeaders.push_back(hashes.hashHeader);
+    }
+
+    CDataStream ssHeader(SER_NETWORK, PROTOCOL_VERSION);
+    for (const uint256 &hashHeader : vHeaders) {
+        ssHeader << hashHeader;
+    }
+
+    switch (rf) {
+        case RF_BINARY: {
+            std::string binaryHeader = ssHeader.str();
+            req->WriteHeader("Content-Type", "application/octet-stream");
+            req->WriteReply(HTTP_OK, binaryHeader);
+            return true;
+        }
+
+        case RF_HEX: {
+            std::string strHex =
+                HexStr(ssHeader.begin(), ssHeader.end()) + "\n";
+            req->WriteHeader("Content-Type", "text/plain");
+            req->WriteReply(HTTP_OK, strHex);
+            return true;
+        }
+
+        case RF_JSON: {
+            UniValue jsonHeaders(UniValue::VARR);
+            for (const uint256 &hashHeader : vHeaders) {
+                jsonHeaders.push_back(hashHeader.GetHex());
+            }
+            std::string strJSON = jsonHeaders.write() + "\n";
+            req->WriteHeader("Content-Type", "application/json");
+            req->WriteReply(HTTP_OK, strJSON);
+            return true;
+        }
+
+        default: {
+            return RESTERR(req, HTTP_NOT_FOUND,
+                           "output format not found (available: " +
+                               AvailableDataFormatsString() + ")");
+        }
+    }
+
+    // not reached
+    // continue to process further HTTP reqs on this cxn
+    return true;
+}
+
 static const struct {
     const char *prefix;
     bool (*handler)(Config &config, HTTPRequest *req,
@@ -678,6 +916,10 @@ static const struct {
     {"/rest/mempool/contents", rest_mempool_contents},
     {"/rest/headers/", rest_headers},
     {"/rest/getutxos", rest_getutxos},
+    {"/rest/address/history/", rest_address_history},
+    {"/rest/address/utxos/", rest_address_utxos},
+    {"/rest/blockfilter/", rest_blockfilter},
+    {"/rest/blockfilterheaders/", rest_blockfilterheaders},
 };
 
 bool StartREST() {
@@ -5,6 +5,7 @@
 
 #include "rpc/blockchain.h"
 
+#include "addrindex.h"
 #include "amount.h"
 #include "chain.h"
 #include "chainparams.h"
@@ -12,11 +13,14 @@
 #include "coins.h"
 #include "config.h"
 #include "consensus/validation.h"
+#include "dbwrapper.h"
+#include "dstencode.h"
 #include "hash.h"
 #include "policy/policy.h"
 #include "primitives/transaction.h"
 #include "rpc/server.h"
 #include "rpc/tojson.h"
+#include "script/standard.h"
 #include "streams.h"
 #include "sync.h"
 #include "txmempool.h"
@@ -1124,6 +1128,223 @@ UniValue gettxout(const Config &config, const JSONRPCRequest &request) {
     return ret;
 }
 
+bool ParseAddressOrScriptHash(const std::string &str, uint256 &scripthash) {
+    if (str.size() == 64 && IsHex(str)) {
+        scripthash.SetHex(str);
+        return true;
+    }
+    CTxDestination dest = DecodeDestination(str);
+    if (!IsValidDestination(dest)) {
+        return false;
+    }
+    scripthash = GetScriptHash(GetScriptForDestination(dest));
+    return true;
+}
+
+/** Common fields of the address index replies. */
+static UniValue AddressIndexReplyToJSON(const uint256 &scripthash) {
+    AssertLockHeld(cs_main);
+    if (!paddressindex) {
+        throw JSONRPCError(RPC_MISC_ERROR, "Address index not enabled, "
+                                           "restart with -addressindex");
+    }
+
+    int nHeight = -1;
+    BlockMap::iterator it = mapBlockIndex.find(paddressindex->GetBestBlock());
+    if (it != mapBlockIndex.end()) {
+        nHeight = it->second->nHeight;
+    }
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("scripthash", scripthash.GetHex()));
+    ret.push_back(Pair("height", nHeight));
+    return ret;
+}
+
+UniValue AddressHistoryToJSON(const uint256 &scripthash) {
+    LOCK(cs_main);
+    UniValue ret = AddressIndexReplyToJSON(scripthash);
+
+    std::vector<std::pair<CAddressHistoryKey, Amount>> history;
+    if (!paddressindex->ReadHistory(scripthash, history)) {
+        throw JSONRPCError(RPC_DATABASE_ERROR, "Failed to read address index");
+    }
+    UniValue entries(UniValue::VARR);
+    for (const auto &entry : history) {
+        UniValue o(UniValue::VOBJ);
+        o.push_back(Pair("txid", entry.first.txid.GetHex()));
+        o.push_back(Pair("height", entry.first.nHeight));
+        o.push_back(Pair("delta", ValueFromAmount(entry.second)));
+        entries.push_back(o);
+    }
+    ret.push_back(Pair("history", entries));
+    return ret;
+}
+
+UniValue AddressUtxosToJSON(const uint256 &scripthash) {
+    LOCK(cs_main);
+    UniValue ret = AddressIndexReplyToJSON(scripthash);
+
+    std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue>> unspent;
+    if (!paddressindex->ReadUnspent(scripthash, unspent)) {
+        throw JSONRPCError(RPC_DATABASE_ERROR, "Failed to read address index");
+    }
+    UniValue entries(UniValue::VARR);
+    for (const auto &entry : unspent) {
+        UniValue o(UniValue::VOBJ);
+        o.push_back(Pair("txid", entry.first.outpoint.hash.GetHex()));
+        o.push_back(Pair("vout", int64_t(entry.first.outpoint.n)));
+        o.push_back(Pair("value", ValueFromAmount(entry.second.nValue)));
+        o.push_back(Pair("height", entry.second.nHeight));
+        entries.push_back(o);
+    }
+    ret.push_back(Pair("utxos", entries));
+    return ret;
+}
+
+static uint256 ParseAddressParam(const UniValue &param) {
+    uint256 scripthash;
+    if (!ParseAddressOrScriptHash(param.get_str(), scripthash)) {
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY,
+                           "Invalid address or script hash");
+    }
+    return scripthash;
+}
+
+UniValue getaddresshistory(const Config &config,
+                           const JSONRPCRequest &request) {
+    if (request.fHelp || request.params.size() != 1) {
+        throw std::runtime_error(
+            "getaddresshistory \"address\"\n"
+            "\nReturns the confirmed transactions that spent from or paid "
+            "to a script.\n"
+            "Requires -addressindex.\n"
+            "\nArguments:\n"
+            "1. \"address\"    (string, required) An address, or the hex "
+            "SHA256 of a scriptPubKey\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"scripthash\" : \"hash\",  (string) The SHA256 of the "
+            "scriptPubKey\n"
+            "  \"height\" : n,            (numeric) The height the index is "
+            "synced to\n"
+            "  \"history\" : [            (array of json objects) In height "
+            "order\n"
+            "    {\n"
+            "      \"txid\" : \"id\",       (string) The transaction id\n"
+            "      \"height\" : n,        (numeric) The block height\n"
+            "      \"delta\" : x.xxx,     (numeric) The net change in " +
+            CURRENCY_UNIT +
+            "\n"
+            "    }\n"
+            "    ,...\n"
+            "  ]\n"
+            "}\n"
+            "\nExamples:\n" +
+            HelpExampleCli("getaddresshistory",
+                           "\"1PSSGeFHDnKNxiEyFrD1wcEaHr9hrQDDWc\"") +
+            HelpExampleRpc("getaddresshistory",
+                           "\"1PSSGeFHDnKNxiEyFrD1wcEaHr9hrQDDWc\""));
+    }
+
+    return AddressHistoryToJSON(ParseAddressParam(request.params[0]));
+}
+
+UniValue getaddressutxos(const Config &config, const JSONRPCRequest &request) {
+    if (request.fHelp || request.params.size() != 1) {
+        throw std::runtime_error(
+            "getaddressutxos \"address\"\n"
+            "\nReturns the confirmed unspent outputs of a script.\n"
+            "Requires -addressindex.\n"
+            "\nArguments:\n"
+            "1. \"address\"    (string, required) An address, or the hex "
+            "SHA256 of a scriptPubKey\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"scripthash\" : \"hash\",  (string) The SHA256 of the "
+            "scriptPubKey\n"
+            "  \"height\" : n,            (numeric) The height the index is "
+            "synced to\n"
+            "  \"utxos\" : [              (array of json objects)\n"
+            "    {\n"
+            "      \"txid\" : \"id\",       (string) The transaction id\n"
+            "      \"vout\" : n,          (numeric) The output number\n"
+            "      \"value\" : x.xxx,     (numeric) The value in " +
+            CURRENCY_UNIT +
+            "\n"
+            "      \"height\" : n,        (numeric) The block height\n"
+            "    }\n"
+            "    ,...\n"
+            "  ]\n"
+            "}\n"
+            "\nExamples:\n" +
+            HelpExampleCli("getaddressutxos",
+                           "\"1PSSGeFHDnKNxiEyFrD1wcEaHr9hrQDDWc\"") +
+            HelpExampleRpc("getaddressutxos",
+                           "\"1PSSGeFHDnKNxiEyFrD1wcEaHr9hrQDDWc\""));
+    }
+
+    return AddressUtxosToJSON(ParseAddressParam(request.params[0]));
+}
+
+UniValue getdbstats(const Config &config, const JSONRPCRequest &request) {
+    if (request.fHelp || request.params.size() > 1) {
+        throw std::runtime_error(
+            "getdbstats ( verbose )\n"
+            "\nReturns LevelDB statistics of the open databases.\n"
+            "\nArguments:\n"
+            "1. verbose       (boolean, optional, default=false) Also list "
+            "the table files\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"name\" : {                (json object) Database directory "
+            "name, eg chainstate\n"
+            "    \"files_per_level\" : [ n, ... ],  (array) Number of table "
+            "files at each level\n"
+            "    \"memory_usage\" : n,      (numeric) Approximate memory "
+            "used, in bytes\n"
+            "    \"stats\" : \"...\",         (string) Compaction "
+            "statistics\n"
+            "    \"sstables\" : \"...\"       (string) The table files, if "
+            "verbose\n"
+            "  },\n"
+            "  ...\n"
+            "}\n"
+            "\nExamples:\n" +
+            HelpExampleCli("getdbstats", "") +
+            HelpExampleRpc("getdbstats", ""));
+    }
+
+    bool fVerbose = false;
+    if (request.params.size() > 0) {
+        fVerbose = request.params[0].get_bool();
+    }
+
+    UniValue ret(UniValue::VOBJ);
+    ForEachDBWrapper([&](const CDBWrapper &db) {
+        UniValue obj(UniValue::VOBJ);
+        std::string value;
+        UniValue levels(UniValue::VARR);
+        while (db.GetProperty(
+            strprintf("leveldb.num-files-at-level%d", levels.size()),
+            value)) {
+            levels.push_back(atoi64(value));
+        }
+        obj.push_back(Pair("files_per_level", levels));
+        if (db.GetProperty("leveldb.approximate-memory-usage", value)) {
+            obj.push_back(Pair("memory_usage", atoi64(value)));
+        }
+        if (db.GetProperty("leveldb.stats", value)) {
+            obj.push_back(Pair("stats", value));
+        }
+        if (fVerbose && db.GetProperty("leveldb.sstables", value)) {
+            obj.push_back(Pair("sstables", value));
+        }
+        ret.push_back(Pair(db.GetName(), obj));
+    });
+    return ret;
+}
+
 UniValue verifychain(const Config &config, const JSONRPCRequest &request) {
     int nCheckLevel = GetArg("-checklevel", DEFAULT_CHECKLEVEL);
     int nCheckDepth = GetArg("-checkblocks", DEFAULT_CHECKBLOCKS);
@@ -1408,7 +1629,7 @@ UniValue getchaintips(const Config &config, const JSONRPCRequest &request) {
     std::set<const CBlockIndex *> setOrphans;
     std::set<const CBlockIndex *> setPrevs;
 
-    for (const std::pair<const uint256, CBlockIndex *> &item : mapBlockIndex) {
+    for (const BlockMap::value_type &item : mapBlockIndex) {
         if (!chainActive.Contains(item.second)) {
             setOrphans.insert(item.second);
             setPrevs.insert(item.second->pprev);
@@ -1631,6 +1852,8 @@ UniValue reconsiderblock(const Config &config, const JSONRPCRequest &request) {
 static const CRPCCommand commands[] = {
     //  category            name                      actor (function)        okSafe argNames
     //  ------------------- ------------------------  ----------------------  ------ ----------
+    { "blockchain",         "getaddresshistory",      getaddresshistory,      true,  {"address"} },
+    { "blockchain",         "getaddressutxos",        getaddressutxos,        true,  {"address"} },
     { "blockchain",         "getblockchaininfo",      getblockchaininfo,      true,  {} },
     { "blockchain",         "getbestblockhash",       getbestblockhash,       true,  {} },
     { "blockchain",         "getblockcount",          getblockcount,          true,  {} },
@@ -1638,6 +1861,7 @@ static const CRPCCommand commands[] = {
     { "blockchain",         "getblockhash",           getblockhash,           true,  {"height"} },
     { "blockchain",         "getblockheader",         getblockheader,         true,  {"blockhash","verbose"} },
     { "blockchain",         "getchaintips",           getchaintips,           true,  {} },
+    { "blockchain",         "getdbstats",             getdbstats,             true,  {"verbose"} },
     { "blockchain",         "getdifficulty",          getdifficulty,          true,  {} },
     { "blockchain",         "getmempoolancestors",    getmempoolancestors,    true,  {"txid","verbose"} },
     { "blockchain",         "getmempooldescendants",  getmempooldescendants,  true,  {"txid","verbose"} },
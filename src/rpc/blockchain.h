@@ -7,12 +7,21 @@
 
 #include <univalue.h>
 
+#include <string>
+
 class CBlockIndex;
 class Config;
 class JSONRPCRequest;
+class uint256;
 
 UniValue getblockchaininfo(const Config &config, const JSONRPCRequest &request);
 
 double GetDifficulty(const CBlockIndex *blockindex);
 
+/** Script hash of an address, or a script hash given as hex. */
+bool ParseAddressOrScriptHash(const std::string &str, uint256 &scripthash);
+/** Address index entries of a script, requires -addressindex. */
+UniValue AddressHistoryToJSON(const uint256 &scripthash);
+UniValue AddressUtxosToJSON(const uint256 &scripthash);
+
 #endif // BITCOIN_RPCBLOCKCHAIN_H
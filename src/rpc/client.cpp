@@ -77,6 +77,7 @@ static const CRPCConvertParam vRPCConvertParams[] = {
     {"listunspent", 2, "addresses"},
     {"getblock", 1, "verbose"},
     {"getblockheader", 1, "verbose"},
+    {"getdbstats", 0, "verbose"},
     {"gettransaction", 1, "include_watchonly"},
     {"getrawtransaction", 1, "verbose"},
     {"createrawtransaction", 0, "inputs"},
@@ -120,8 +120,17 @@ static UniValue getpeerinfo(const Config &config,
             "we're currently asking from this peer\n"
             "       ...\n"
             "    ],\n"
+            "    \"blockdownloadrate\": n,    (numeric) Measured rate at "
+            "which this peer delivers requested blocks, in bytes per second\n"
+            "    \"maxinflight\": n,          (numeric) How many blocks we "
+            "currently allow in flight from this peer\n"
             "    \"whitelisted\": true|false, (boolean) Whether the peer is "
             "whitelisted\n"
+            "    \"addr_processed\": n,       (numeric) The total number of "
+            "addresses processed, excluding those dropped due to rate "
+            "limiting\n"
+            "    \"addr_rate_limited\": n,    (numeric) The total number of "
+            "addresses dropped due to rate limiting\n"
             "    \"bytessent_per_msg\": {\n"
             "       \"addr\": n,              (numeric) The total bytes sent "
             "aggregated by message type\n"
@@ -194,8 +203,13 @@ static UniValue getpeerinfo(const Config &config,
                 heights.push_back(height);
             }
             obj.push_back(Pair("inflight", heights));
+            obj.push_back(
+                Pair("blockdownloadrate", statestats.dBlockDownloadRate));
+            obj.push_back(Pair("maxinflight", statestats.nMaxBlocksInFlight));
         }
         obj.push_back(Pair("whitelisted", stats.fWhitelisted));
+        obj.push_back(Pair("addr_processed", stats.nAddrProcessed));
+        obj.push_back(Pair("addr_rate_limited", stats.nAddrRateLimited));
 
         UniValue sendPerMsgCmd(UniValue::VOBJ);
         for (const mapMsgCmdSize::value_type &i : stats.mapSendBytesPerMsgCmd) {
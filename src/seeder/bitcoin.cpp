@@ -7,8 +7,16 @@
 #include "streams.h"
 #include "uint256.h"
 
+#include "utiltime.h"
+
 #include <algorithm>
 
+#ifdef __linux__
+#define USE_EPOLL
+#include <sys/epoll.h>
+#endif
+#include <poll.h>
+
 // Weither we are on testnet or mainnet.
 bool fTestNet;
 
@@ -33,7 +41,7 @@ class CSeederNode {
     int64_t doneAfter;
     CAddress you;
 
-    int GetTimeout() { return you.IsTor() ? 120 : 30; }
+    int GetTimeout() const { return you.IsTor() ? 120 : 30; }
 
     void BeginMessage(const char *pszCommand) {
         if (nHeaderStart != allones) {
@@ -83,12 +91,20 @@ class CSeederNode {
         if (vSend.empty()) {
             return;
         }
-        int nBytes = send(sock, &vSend[0], vSend.size(), 0);
+        int nBytes = send(sock, &vSend[0], vSend.size(), MSG_NOSIGNAL);
         if (nBytes > 0) {
             vSend.erase(vSend.begin(), vSend.begin() + nBytes);
+        } else if (nBytes < 0 && (WSAGetLastError() == WSAEWOULDBLOCK ||
+                                  WSAGetLastError() == WSAEINTR)) {
+            // Sent once the socket is writable again.
         } else {
-            close(sock);
-            sock = INVALID_SOCKET;
+            Close();
+        }
+    }
+
+    void Close() {
+        if (sock != INVALID_SOCKET) {
+            CloseSocket(sock);
         }
     }
 
@@ -240,74 +256,233 @@ class CSeederNode {
         return false;
     }
 
+    enum State {
+        CONNECTING,
+        SOCKS5_METHOD,
+        SOCKS5_CONNECT,
+        CONNECTED,
+    };
+
+    State state;
+    bool fProxy;
+    bool res;
+    int64_t nConnectDeadline;
+    int64_t nLastActivity;
+
+    void StartVersionHandshake(int64_t nNow) {
+        state = CONNECTED;
+        nLastActivity = nNow;
+        PushVersion();
+    }
+
+    // Ask the proxy for a connection to the node, without authentication.
+    void PushSocks5Connect() {
+        std::string strDest = you.ToStringIP();
+        uint8_t header[] = {0x05, 0x01, 0x00, 0x03, uint8_t(strDest.size())};
+        uint8_t port[] = {uint8_t(you.GetPort() >> 8),
+                          uint8_t(you.GetPort() & 0xff)};
+        vSend.write((const char *)header, sizeof(header));
+        vSend.write(strDest.data(), strDest.size());
+        vSend.write((const char *)port, sizeof(port));
+    }
+
+    // Handle the proxy replies, return false if the proxy failed.
+    bool ProcessSocks5(int64_t nNow) {
+        if (state == SOCKS5_METHOD) {
+            if (vRecv.size() < 2) {
+                return true;
+            }
+            if (vRecv[0] != 0x05 || vRecv[1] != 0x00) {
+                return false;
+            }
+            vRecv.erase(vRecv.begin(), vRecv.begin() + 2);
+            PushSocks5Connect();
+            state = SOCKS5_CONNECT;
+        }
+        if (state == SOCKS5_CONNECT) {
+            if (vRecv.size() < 5) {
+                return true;
+            }
+            if (vRecv[0] != 0x05 || vRecv[1] != 0x00) {
+                return false;
+            }
+            // Reply header, bound address and port.
+            size_t nReply = 4 + 2;
+            switch (vRecv[3]) {
+                case 0x01:
+                    nReply += 4;
+                    break;
+                case 0x03:
+                    nReply += 1 + uint8_t(vRecv[4]);
+                    break;
+                case 0x04:
+                    nReply += 16;
+                    break;
+                default:
+                    return false;
+            }
+            if (vRecv.size() < nReply) {
+                return true;
+            }
+            vRecv.erase(vRecv.begin(), vRecv.begin() + nReply);
+            StartVersionHandshake(nNow);
+        }
+        return true;
+    }
+
 public:
     CSeederNode(const CService &ip, std::vector<CAddress> *vAddrIn)
-        : vSend(SER_NETWORK, 0), vRecv(SER_NETWORK, 0), nHeaderStart(-1),
-          nMessageStart(-1), nVersion(0), vAddr(vAddrIn), ban(0), doneAfter(0),
-          you(ip, ServiceFlags(NODE_NETWORK | NODE_BITCOIN_CASH)) {
+        : sock(INVALID_SOCKET), vSend(SER_NETWORK, 0), vRecv(SER_NETWORK, 0),
+          nHeaderStart(-1), nMessageStart(-1), nVersion(0), nStartingHeight(0),
+          vAddr(vAddrIn), ban(0), doneAfter(0),
+          you(ip, ServiceFlags(NODE_NETWORK | NODE_BITCOIN_CASH)),
+          state(CONNECTING), fProxy(false), res(true), nConnectDeadline(0),
+          nLastActivity(0) {
         if (time(nullptr) > 1329696000) {
             vSend.SetVersion(209);
             vRecv.SetVersion(209);
         }
     }
 
-    bool Run() {
-        bool proxyConnectionFailed = false;
-        if (!ConnectSocket(you, sock, nConnectTimeout,
-                           &proxyConnectionFailed)) {
+    ~CSeederNode() { Close(); }
+
+    SOCKET GetSocket() const { return sock; }
+
+    /**
+     * Start a non-blocking connection to the node, or to the proxy for its
+     * network. Return false if it failed right away.
+     */
+    bool Connect(int64_t nNow) {
+        proxyType proxy;
+        fProxy = GetProxy(you.GetNetwork(), proxy);
+        const CService &addrConnect = fProxy ? proxy.proxy : you;
+
+        struct sockaddr_storage sockaddr;
+        socklen_t len = sizeof(sockaddr);
+        if (!addrConnect.GetSockAddr((struct sockaddr *)&sockaddr, &len)) {
+            return false;
+        }
+        sock = socket(((struct sockaddr *)&sockaddr)->sa_family, SOCK_STREAM,
+                      IPPROTO_TCP);
+        if (sock == INVALID_SOCKET) {
+            return false;
+        }
+        int set = 1;
+        setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, (const char *)&set,
+                   sizeof(int));
+        if (!SetSocketNonBlocking(sock, true)) {
+            Close();
+            return false;
+        }
+        if (connect(sock, (struct sockaddr *)&sockaddr, len) ==
+                SOCKET_ERROR &&
+            WSAGetLastError() != WSAEINPROGRESS &&
+            WSAGetLastError() != WSAEWOULDBLOCK) {
+            Close();
             return false;
         }
 
-        PushVersion();
-        Send();
+        state = CONNECTING;
+        nConnectDeadline = nNow + nConnectTimeout;
+        return true;
+    }
 
-        bool res = true;
-        int64_t now;
-        while (now = time(nullptr),
-               ban == 0 && (doneAfter == 0 || doneAfter > now) &&
-                   sock != INVALID_SOCKET) {
-            char pchBuf[0x10000];
-            fd_set set;
-            FD_ZERO(&set);
-            FD_SET(sock, &set);
-            struct timeval wa;
-            if (doneAfter) {
-                wa.tv_sec = doneAfter - now;
-                wa.tv_usec = 0;
-            } else {
-                wa.tv_sec = GetTimeout();
-                wa.tv_usec = 0;
+    //! Whether the probe is waiting for the socket to be writable.
+    bool WantsWrite() const { return state == CONNECTING || !vSend.empty(); }
+
+    //! Time in milliseconds after which the probe is over.
+    int64_t GetDeadline() const {
+        if (state == CONNECTING) {
+            return nConnectDeadline;
+        }
+        if (state == CONNECTED && doneAfter) {
+            return doneAfter * 1000;
+        }
+        return nLastActivity + GetTimeout() * 1000;
+    }
+
+    /**
+     * Handle the socket becoming readable or writable. Return false once the
+     * probe is over.
+     */
+    bool OnSocketReady(bool fReadable, bool fWritable, int64_t nNow) {
+        if (state == CONNECTING) {
+            if (!fWritable && !fReadable) {
+                return true;
             }
-            int ret = select(sock + 1, &set, nullptr, &set, &wa);
-            if (ret != 1) {
-                if (!doneAfter) res = false;
-                break;
+            int nErr = 0;
+            socklen_t nErrLen = sizeof(nErr);
+            if (getsockopt(sock, SOL_SOCKET, SO_ERROR, (char *)&nErr,
+                           &nErrLen) == SOCKET_ERROR ||
+                nErr != 0) {
+                res = false;
+                return false;
             }
-            int nBytes = recv(sock, pchBuf, sizeof(pchBuf), 0);
-            int nPos = vRecv.size();
+            if (fProxy) {
+                const uint8_t method[] = {0x05, 0x01, 0x00};
+                vSend.write((const char *)method, sizeof(method));
+                state = SOCKS5_METHOD;
+                nLastActivity = nNow;
+            } else {
+                StartVersionHandshake(nNow);
+            }
+            fReadable = false;
+        }
+
+        if (fReadable) {
+            char pchBuf[0x10000];
+            int nBytes = recv(sock, pchBuf, sizeof(pchBuf), MSG_DONTWAIT);
             if (nBytes > 0) {
+                int nPos = vRecv.size();
                 vRecv.resize(nPos + nBytes);
                 memcpy(&vRecv[nPos], pchBuf, nBytes);
-            } else if (nBytes == 0) {
-                // printf("%s: BAD (connection closed prematurely)\n",
-                // ToString(you).c_str());
+                nLastActivity = nNow;
+            } else if (nBytes == 0 || (WSAGetLastError() != WSAEWOULDBLOCK &&
+                                       WSAGetLastError() != WSAEINTR)) {
+                // Connection closed prematurely or connection error.
                 res = false;
-                break;
-            } else {
-                // printf("%s: BAD (connection error)\n",
-                // ToString(you).c_str());
+                return false;
+            }
+            if (state != CONNECTED && !ProcessSocks5(nNow)) {
                 res = false;
-                break;
+                return false;
+            }
+            if (state == CONNECTED) {
+                try {
+                    ProcessMessages();
+                } catch (const std::ios_base::failure &e) {
+                    // Truncated or malformed message: the probe failed, but
+                    // the node is not banned for it.
+                    res = false;
+                    return false;
+                }
             }
-            ProcessMessages();
-            Send();
         }
-        if (sock == INVALID_SOCKET) res = false;
-        close(sock);
-        sock = INVALID_SOCKET;
-        return (ban == 0) && res;
+
+        Send();
+        if (sock == INVALID_SOCKET) {
+            res = false;
+            return false;
+        }
+        return ban == 0 && (doneAfter == 0 || doneAfter * 1000 > nNow);
     }
 
+    /**
+     * Check the deadline. Return false once the probe is over: it succeeded
+     * if the node was only given time to send more addresses.
+     */
+    bool CheckDeadline(int64_t nNow) {
+        if (nNow < GetDeadline()) {
+            return true;
+        }
+        if (state != CONNECTED || !doneAfter) {
+            res = false;
+        }
+        return false;
+    }
+
+    bool IsGood() const { return ban == 0 && res; }
+
     int GetBan() { return ban; }
 
     int GetClientVersion() { return nVersion; }
@@ -317,24 +492,175 @@ public:
     int GetStartingHeight() { return nStartingHeight; }
 };
 
-bool TestNode(const CService &cip, int &ban, int &clientV,
-              std::string &clientSV, int &blocks,
-              std::vector<CAddress> *vAddr) {
-    try {
-        CSeederNode node(cip, vAddr);
-        bool ret = node.Run();
-        if (!ret) {
-            ban = node.GetBan();
-        } else {
-            ban = 0;
-        }
-        clientV = node.GetClientVersion();
-        clientSV = node.GetClientSubVersion();
-        blocks = node.GetStartingHeight();
-        //  printf("%s: %s!!!\n", cip.ToString().c_str(), ret ? "GOOD" : "BAD");
-        return ret;
-    } catch (std::ios_base::failure &e) {
-        ban = 0;
-        return false;
+struct CCrawler::CProbe {
+    CServiceResult res;
+    std::vector<CAddress> vAddr;
+    std::unique_ptr<CSeederNode> node;
+    bool fWatchWrite;
+};
+
+CCrawler::CCrawler(size_t nMaxProbesIn)
+    : nMaxProbes(nMaxProbesIn), nNextTimeoutCheck(0) {
+#ifdef USE_EPOLL
+    fdPoll = epoll_create1(0);
+    if (fdPoll < 0) {
+        fprintf(stderr, "Unable to create epoll instance: %s\n",
+                strerror(errno));
+        exit(1);
+    }
+#else
+    fdPoll = -1;
+#endif
+}
+
+CCrawler::~CCrawler() {
+    mapProbes.clear();
+#ifdef USE_EPOLL
+    close(fdPoll);
+#endif
+}
+
+void CCrawler::Watch(CProbe &probe) {
+#ifdef USE_EPOLL
+    struct epoll_event event = {};
+    event.events = EPOLLIN | (probe.fWatchWrite ? EPOLLOUT : 0);
+    event.data.fd = probe.node->GetSocket();
+    epoll_ctl(fdPoll, EPOLL_CTL_MOD, event.data.fd, &event);
+#endif
+}
+
+void CCrawler::Probe(const CServiceResult &res, bool fGetAddr) {
+    std::unique_ptr<CProbe> probe(new CProbe());
+    probe->res = res;
+    probe->res.nBanTime = 0;
+    probe->res.nClientV = 0;
+    probe->res.nHeight = 0;
+    probe->res.strClientV = "";
+    probe->res.fGood = false;
+    probe->node.reset(
+        new CSeederNode(res.service, fGetAddr ? &probe->vAddr : nullptr));
+    probe->fWatchWrite = true;
+
+    if (!probe->node->Connect(GetTimeMillis())) {
+        vFailed.push_back(std::move(probe));
+        return;
+    }
+
+    SOCKET sock = probe->node->GetSocket();
+
+#ifdef USE_EPOLL
+    struct epoll_event event = {};
+    event.events = EPOLLIN | EPOLLOUT;
+    event.data.fd = sock;
+    if (epoll_ctl(fdPoll, EPOLL_CTL_ADD, sock, &event) != 0) {
+        vFailed.push_back(std::move(probe));
+        return;
+    }
+#endif
+    mapProbes[sock] = std::move(probe);
+}
+
+void CCrawler::Finish(SOCKET sock, std::vector<CServiceResult> &vDone,
+                      std::vector<CAddress> &vAddr) {
+    auto it = mapProbes.find(sock);
+    CProbe &probe = *it->second;
+    CSeederNode &node = *probe.node;
+    probe.res.fGood = node.IsGood();
+    probe.res.nBanTime = probe.res.fGood ? 0 : node.GetBan();
+    probe.res.nClientV = node.GetClientVersion();
+    probe.res.strClientV = node.GetClientSubVersion();
+    probe.res.nHeight = node.GetStartingHeight();
+    vDone.push_back(probe.res);
+    vAddr.insert(vAddr.end(), probe.vAddr.begin(), probe.vAddr.end());
+
+    // Closing the socket also removes it from the epoll set.
+    mapProbes.erase(it);
+}
+
+void CCrawler::Poll(int nTimeout, std::vector<CServiceResult> &vDone,
+                    std::vector<CAddress> &vAddr) {
+    for (const std::unique_ptr<CProbe> &probe : vFailed) {
+        vDone.push_back(probe->res);
+    }
+    vFailed.clear();
+
+    // Deadlines are checked a few times a second at most.
+    int64_t nNow = GetTimeMillis();
+    if (nNextTimeoutCheck - nNow < nTimeout) {
+        nTimeout = std::max<int64_t>(0, nNextTimeoutCheck - nNow);
+    }
+
+    std::vector<std::pair<SOCKET, short>> vReady;
+#ifdef USE_EPOLL
+    std::vector<struct epoll_event> events(
+        std::max<size_t>(1, std::min<size_t>(mapProbes.size(), 1024)));
+    int nEvents = epoll_wait(fdPoll, events.data(), events.size(), nTimeout);
+    for (int i = 0; i < nEvents; i++) {
+        short nFlags = 0;
+        if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+            nFlags |= POLLIN;
+        }
+        if (events[i].events & (EPOLLOUT | EPOLLERR | EPOLLHUP)) {
+            nFlags |= POLLOUT;
+        }
+        SOCKET sock = events[i].data.fd;
+        vReady.emplace_back(sock, nFlags);
+    }
+#else
+    std::vector<struct pollfd> fds;
+    fds.reserve(mapProbes.size());
+    for (const auto &entry : mapProbes) {
+        struct pollfd fd = {};
+        fd.fd = entry.first;
+        fd.events = POLLIN | (entry.second->fWatchWrite ? POLLOUT : 0);
+        fds.push_back(fd);
+    }
+    if (fds.empty()) {
+        Sleep(nTimeout);
+    } else if (poll(fds.data(), fds.size(), nTimeout) > 0) {
+        for (const struct pollfd &fd : fds) {
+            short nFlags = 0;
+            if (fd.revents & (POLLIN | POLLERR | POLLHUP)) {
+                nFlags |= POLLIN;
+            }
+            if (fd.revents & (POLLOUT | POLLERR | POLLHUP)) {
+                nFlags |= POLLOUT;
+            }
+            if (nFlags) {
+                vReady.emplace_back(fd.fd, nFlags);
+            }
+        }
+    }
+#endif
+
+    nNow = GetTimeMillis();
+    for (const auto &ready : vReady) {
+        auto it = mapProbes.find(ready.first);
+        if (it == mapProbes.end()) {
+            continue;
+        }
+        CProbe &probe = *it->second;
+        if (!probe.node->OnSocketReady(ready.second & POLLIN,
+                                       ready.second & POLLOUT, nNow)) {
+            Finish(ready.first, vDone, vAddr);
+            continue;
+        }
+        if (probe.fWatchWrite != probe.node->WantsWrite()) {
+            probe.fWatchWrite = !probe.fWatchWrite;
+            Watch(probe);
+        }
+    }
+
+    if (nNow >= nNextTimeoutCheck) {
+        std::vector<SOCKET> vExpired;
+        for (const auto &entry : mapProbes) {
+            if (!entry.second->node->CheckDeadline(nNow)) {
+                vExpired.push_back(entry.first);
+            }
+        }
+        for (SOCKET sock : vExpired) {
+            Finish(sock, vDone, vAddr);
+        }
+        nNextTimeoutCheck = nNow + 250;
     }
 }
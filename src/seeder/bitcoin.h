@@ -3,6 +3,9 @@
 
 #include "protocol.h"
 
+#include <cstdint>
+#include <map>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -19,7 +22,47 @@ static inline unsigned short GetDefaultPort(const bool testnet = fTestNet) {
 // The network magic to use.
 extern CMessageHeader::MessageMagic netMagic;
 
-bool TestNode(const CService &cip, int &ban, int &client, std::string &clientSV,
-              int &blocks, std::vector<CAddress> *vAddr);
+class CSeederNode;
+struct CServiceResult;
+
+/**
+ * Probe many nodes at once from a single thread. Connections, including the
+ * SOCKS5 negotiation with a proxy, are non-blocking and multiplexed with
+ * epoll (poll where it is not available); each probe has its own deadline.
+ */
+class CCrawler {
+public:
+    explicit CCrawler(size_t nMaxProbesIn);
+    ~CCrawler();
+
+    //! Number of probes that can still be started.
+    size_t GetFreeSlots() const { return nMaxProbes - mapProbes.size(); }
+    size_t GetProbeCount() const { return mapProbes.size(); }
+
+    //! Start probing a node, asking for its addresses if fGetAddr.
+    void Probe(const CServiceResult &res, bool fGetAddr);
+
+    /**
+     * Wait up to nTimeout milliseconds for socket events and expired probes.
+     * Finished probes are appended to vDone, and the addresses they learnt to
+     * vAddr.
+     */
+    void Poll(int nTimeout, std::vector<CServiceResult> &vDone,
+              std::vector<CAddress> &vAddr);
+
+private:
+    struct CProbe;
+
+    const size_t nMaxProbes;
+    int fdPoll;
+    std::map<SOCKET, std::unique_ptr<CProbe>> mapProbes;
+    //! Probes that could not be started, reported by the next Poll.
+    std::vector<std::unique_ptr<CProbe>> vFailed;
+    int64_t nNextTimeoutCheck;
+
+    void Watch(CProbe &probe);
+    void Finish(SOCKET sock, std::vector<CServiceResult> &vDone,
+                std::vector<CAddress> &vAddr);
+};
 
 #endif
@@ -1,6 +1,16 @@
 #include "db.h"
 
+#include "crypto/common.h"
+#include "hash.h"
+
+#include <algorithm>
+#include <cstdio>
 #include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 void CAddrInfo::Update(bool good) {
     int64_t now = time(nullptr);
@@ -61,6 +71,7 @@ bool CAddrDb::Get_(CServiceResult &ip, int &wait) {
         if (idToInfo[ret].ignoreTill && idToInfo[ret].ignoreTill < now) {
             ourId.push_back(ret);
             idToInfo[ret].ourLastTry = now;
+            setDirty.insert(idToInfo[ret].ip);
         } else {
             ip.service = idToInfo[ret].ip;
             ip.ourLastSuccess = idToInfo[ret].ourLastSuccess;
@@ -94,6 +105,7 @@ void CAddrDb::Good_(const CService &addr, int clientV, std::string clientSV,
         //    (int)goodId.size());
     }
     nDirty++;
+    setDirty.insert(addr);
     ourId.push_back(id);
 }
 
@@ -124,6 +136,7 @@ void CAddrDb::Bad_(const CService &addr, int ban) {
         ourId.push_back(id);
     }
     nDirty++;
+    setDirty.insert(addr);
 }
 
 void CAddrDb::Skipped_(const CService &addr) {
@@ -144,6 +157,7 @@ void CAddrDb::Add_(const CAddress &addr, bool force) {
         time_t bantime = banned[ipp];
         if (force || (bantime < time(nullptr) && addr.nTime > bantime)) {
             banned.erase(ipp);
+            setDirty.insert(ipp);
         } else {
             return;
         }
@@ -154,9 +168,11 @@ void CAddrDb::Add_(const CAddress &addr, bool force) {
             ai.lastTry = addr.nTime;
             ai.services |= addr.nServices;
             //      printf("%s: updated\n", ToString(addr).c_str());
+            setDirty.insert(ipp);
         }
         if (force) {
             ai.ignoreTill = 0;
+            setDirty.insert(ipp);
         }
         return;
     }
@@ -174,6 +190,7 @@ void CAddrDb::Add_(const CAddress &addr, bool force) {
     //  printf("%s: added\n", ToString(ipp).c_str(), ipToId[ipp]);
     unkId.insert(id);
     nDirty++;
+    setDirty.insert(ipp);
 }
 
 void CAddrDb::GetIPs_(std::set<CNetAddr> &ips, uint64_t requestedFlags,
@@ -227,3 +244,341 @@ void CAddrDb::GetIPs_(std::set<CNetAddr> &ips, uint64_t requestedFlags,
         }
     }
 }
+
+// Records are checksummed so that a record torn by a crash while it was being
+// rewritten is dropped on load instead of corrupting the database.
+static const uint64_t RECORD_CHECKSUM_K0 = 0x7365656465726462ULL;
+static const uint64_t RECORD_CHECKSUM_K1 = 0x7265636f72647331ULL;
+
+// Record layout, all integers little endian:
+//   0  checksum of bytes 8..255
+//   8  type, subversion length, port
+//  12  client version
+//  16  IPv6 (or mapped) address
+//  32  services, lastTry, ourLastTry, ourLastSuccess, ignoreTill (or the
+//      unban time of a banned address)
+//  72  2H, 8H, 1D, 1W and 1M stats, as weight, count, reliability
+// 132  blocks, total, success
+// 144  client subversion, truncated
+static const size_t RECORD_SUBVERSION_OFFSET = 144;
+static const size_t RECORD_SUBVERSION_MAX =
+    SEEDER_DB_RECORD_SIZE - RECORD_SUBVERSION_OFFSET;
+
+static const char SEEDER_DB_MAGIC[8] = {'s', 'e', 'e', 'd', 'e', 'r', 'd', 'b'};
+
+static uint64_t RecordChecksum(const uint8_t *rec) {
+    return CSipHasher(RECORD_CHECKSUM_K0, RECORD_CHECKSUM_K1)
+        .Write(rec + 8, SEEDER_DB_RECORD_SIZE - 8)
+        .Finalize();
+}
+
+static void EncodeService(uint8_t *rec, uint8_t type, const CService &ip) {
+    memset(rec, 0, SEEDER_DB_RECORD_SIZE);
+    rec[8] = type;
+    WriteLE16(rec + 10, ip.GetPort());
+    struct in6_addr addr;
+    ip.GetIn6Addr(&addr);
+    memcpy(rec + 16, &addr, 16);
+}
+
+static CService DecodeService(const uint8_t *rec) {
+    struct in6_addr addr;
+    memcpy(&addr, rec + 16, 16);
+    return CService(CNetAddr(addr), ReadLE16(rec + 10));
+}
+
+static void EncodeStat(uint8_t *p, float f) {
+    uint32_t n;
+    memcpy(&n, &f, 4);
+    WriteLE32(p, n);
+}
+
+static float DecodeStat(const uint8_t *p) {
+    uint32_t n = ReadLE32(p);
+    float f;
+    memcpy(&f, &n, 4);
+    return f;
+}
+
+void CAddrDb::EncodeRecord(uint8_t *rec, const CAddrInfo &info) {
+    EncodeService(rec, SEEDER_DB_RECORD_INFO, info.ip);
+    size_t nSubVersion =
+        std::min(info.clientSubVersion.size(), RECORD_SUBVERSION_MAX);
+    rec[9] = nSubVersion;
+    WriteLE32(rec + 12, info.clientVersion);
+    WriteLE64(rec + 32, info.services);
+    WriteLE64(rec + 40, info.lastTry);
+    WriteLE64(rec + 48, info.ourLastTry);
+    WriteLE64(rec + 56, info.ourLastSuccess);
+    WriteLE64(rec + 64, info.ignoreTill);
+    const CAddrStat *stats[] = {&info.stat2H, &info.stat8H, &info.stat1D,
+                                &info.stat1W, &info.stat1M};
+    for (int i = 0; i < 5; i++) {
+        EncodeStat(rec + 72 + 12 * i, stats[i]->weight);
+        EncodeStat(rec + 76 + 12 * i, stats[i]->count);
+        EncodeStat(rec + 80 + 12 * i, stats[i]->reliability);
+    }
+    WriteLE32(rec + 132, info.blocks);
+    WriteLE32(rec + 136, info.total);
+    WriteLE32(rec + 140, info.success);
+    memcpy(rec + RECORD_SUBVERSION_OFFSET, info.clientSubVersion.data(),
+           nSubVersion);
+    WriteLE64(rec, RecordChecksum(rec));
+}
+
+void CAddrDb::EncodeBanRecord(uint8_t *rec, const CService &ip,
+                              int64_t banTill) {
+    EncodeService(rec, SEEDER_DB_RECORD_BANNED, ip);
+    WriteLE64(rec + 64, banTill);
+    WriteLE64(rec, RecordChecksum(rec));
+}
+
+uint8_t CAddrDb::DecodeRecord(const uint8_t *rec, CAddrInfo &info,
+                              int64_t &banTill) {
+    uint8_t type = rec[8];
+    if (type != SEEDER_DB_RECORD_INFO && type != SEEDER_DB_RECORD_BANNED) {
+        return SEEDER_DB_RECORD_FREE;
+    }
+    if (ReadLE64(rec) != RecordChecksum(rec) ||
+        rec[9] > RECORD_SUBVERSION_MAX) {
+        return SEEDER_DB_RECORD_FREE;
+    }
+    info.ip = DecodeService(rec);
+    if (type == SEEDER_DB_RECORD_BANNED) {
+        banTill = ReadLE64(rec + 64);
+        return type;
+    }
+    info.clientVersion = ReadLE32(rec + 12);
+    info.services = ReadLE64(rec + 32);
+    info.lastTry = ReadLE64(rec + 40);
+    info.ourLastTry = ReadLE64(rec + 48);
+    info.ourLastSuccess = ReadLE64(rec + 56);
+    info.ignoreTill = ReadLE64(rec + 64);
+    CAddrStat *stats[] = {&info.stat2H, &info.stat8H, &info.stat1D,
+                          &info.stat1W, &info.stat1M};
+    for (int i = 0; i < 5; i++) {
+        stats[i]->weight = DecodeStat(rec + 72 + 12 * i);
+        stats[i]->count = DecodeStat(rec + 76 + 12 * i);
+        stats[i]->reliability = DecodeStat(rec + 80 + 12 * i);
+    }
+    info.blocks = ReadLE32(rec + 132);
+    info.total = ReadLE32(rec + 136);
+    info.success = ReadLE32(rec + 140);
+    info.clientSubVersion.assign(
+        (const char *)rec + RECORD_SUBVERSION_OFFSET, rec[9]);
+    return type;
+}
+
+uint32_t CAddrDb::GetSlot_(const CService &ip) {
+    std::map<CService, uint32_t>::iterator it = mapSlot.find(ip);
+    if (it != mapSlot.end()) {
+        return it->second;
+    }
+    uint32_t slot;
+    if (!vFreeSlots.empty()) {
+        slot = vFreeSlots.back();
+        vFreeSlots.pop_back();
+    } else {
+        slot = nSlots++;
+    }
+    mapSlot[ip] = slot;
+    return slot;
+}
+
+// Map dnsseed.db read-only and check its header. Returns nullptr on failure.
+static const uint8_t *MapDbFile(const char *path, size_t &size) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return nullptr;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < SEEDER_DB_HEADER_SIZE) {
+        close(fd);
+        return nullptr;
+    }
+    size = st.st_size;
+    void *map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return nullptr;
+    }
+
+    const uint8_t *data = (const uint8_t *)map;
+    if (memcmp(data, SEEDER_DB_MAGIC, sizeof(SEEDER_DB_MAGIC)) != 0 ||
+        ReadLE32(data + 8) != SEEDER_DB_VERSION ||
+        ReadLE32(data + 12) != SEEDER_DB_RECORD_SIZE ||
+        data[16] != fTestNet) {
+        munmap(map, size);
+        return nullptr;
+    }
+    return data;
+}
+
+bool CAddrDb::LoadFile(const char *path) {
+    size_t size;
+    const uint8_t *data = MapDbFile(path, size);
+    if (!data) {
+        return false;
+    }
+    void *map = (void *)data;
+
+    LOCK(cs);
+    uint32_t n = (size - SEEDER_DB_HEADER_SIZE) / SEEDER_DB_RECORD_SIZE;
+    std::vector<std::pair<int64_t, int>> tried;
+    for (uint32_t slot = 0; slot < n; slot++) {
+        const uint8_t *rec =
+            data + SEEDER_DB_HEADER_SIZE + size_t(slot) * SEEDER_DB_RECORD_SIZE;
+        CAddrInfo info;
+        int64_t banTill = 0;
+        uint8_t type = DecodeRecord(rec, info, banTill);
+        if (type == SEEDER_DB_RECORD_FREE || mapSlot.count(info.ip)) {
+            vFreeSlots.push_back(slot);
+            continue;
+        }
+        mapSlot[info.ip] = slot;
+        if (type == SEEDER_DB_RECORD_BANNED) {
+            banned[info.ip] = banTill;
+            continue;
+        }
+        if (info.GetBanTime()) {
+            // Dropped, its slot is released on the next save.
+            setDirty.insert(info.ip);
+            continue;
+        }
+        int id = nId++;
+        idToInfo[id] = info;
+        ipToId[info.ip] = id;
+        if (info.ourLastTry) {
+            tried.push_back(std::make_pair(info.ourLastTry, id));
+            if (info.IsGood()) {
+                goodId.insert(id);
+            }
+        } else {
+            unkId.insert(id);
+        }
+    }
+    munmap(map, size);
+
+    // Tried nodes are retried in the order they were last tried.
+    std::sort(tried.begin(), tried.end());
+    for (const auto &entry : tried) {
+        ourId.push_back(entry.second);
+    }
+    nSlots = n;
+    fRewrite = false;
+    nDirty++;
+    return true;
+}
+
+bool CAddrDb::ReadReports(const char *path,
+                          std::vector<CAddrReport> &reports) {
+    size_t size;
+    const uint8_t *data = MapDbFile(path, size);
+    if (!data) {
+        return false;
+    }
+    uint32_t n = (size - SEEDER_DB_HEADER_SIZE) / SEEDER_DB_RECORD_SIZE;
+    for (uint32_t slot = 0; slot < n; slot++) {
+        const uint8_t *rec =
+            data + SEEDER_DB_HEADER_SIZE + size_t(slot) * SEEDER_DB_RECORD_SIZE;
+        CAddrInfo info;
+        int64_t banTill = 0;
+        // Same selection as GetAll: tried nodes that answered at least once.
+        if (DecodeRecord(rec, info, banTill) == SEEDER_DB_RECORD_INFO &&
+            !info.GetBanTime() && info.success > 0) {
+            reports.push_back(info.GetReport());
+        }
+    }
+    munmap((void *)data, size);
+    return true;
+}
+
+bool CAddrDb::SaveFile(const char *path) {
+    std::vector<uint8_t> records;
+    std::vector<uint32_t> slots;
+    bool fTruncate;
+    {
+        LOCK(cs);
+        fTruncate = fRewrite;
+        if (fRewrite) {
+            mapSlot.clear();
+            vFreeSlots.clear();
+            nSlots = 0;
+            setDirty.clear();
+            for (const auto &entry : ipToId) {
+                setDirty.insert(entry.first);
+            }
+            for (const auto &ban : banned) {
+                setDirty.insert(ban.first);
+            }
+            fRewrite = false;
+        }
+
+        records.resize(setDirty.size() * SEEDER_DB_RECORD_SIZE);
+        slots.reserve(setDirty.size());
+        for (const CService &ip : setDirty) {
+            uint8_t *rec = &records[slots.size() * SEEDER_DB_RECORD_SIZE];
+            std::map<CService, int>::const_iterator id = ipToId.find(ip);
+            std::map<CService, int64_t>::const_iterator ban;
+            if (id != ipToId.end()) {
+                EncodeRecord(rec, idToInfo[id->second]);
+            } else if ((ban = banned.find(ip)) != banned.end()) {
+                EncodeBanRecord(rec, ip, ban->second);
+            } else {
+                // The address was forgotten, free its record. Slots are only
+                // reused by later records, which are written after this one.
+                std::map<CService, uint32_t>::iterator it = mapSlot.find(ip);
+                if (it == mapSlot.end()) {
+                    continue;
+                }
+                slots.push_back(it->second);
+                vFreeSlots.push_back(it->second);
+                mapSlot.erase(it);
+                continue;
+            }
+            slots.push_back(GetSlot_(ip));
+        }
+        setDirty.clear();
+    }
+
+    // A full rewrite goes to a new file, renamed over the old one once
+    // complete, so that a failure midway leaves the previous database intact.
+    // Otherwise only the dirty records are updated in place.
+    std::string strNewPath = std::string(path) + ".new";
+    int fd = fTruncate ? open(strNewPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC,
+                              0644)
+                       : open(path, O_RDWR | O_CREAT, 0644);
+    bool ret = fd >= 0;
+    if (ret && fTruncate) {
+        uint8_t header[SEEDER_DB_HEADER_SIZE] = {};
+        memcpy(header, SEEDER_DB_MAGIC, sizeof(SEEDER_DB_MAGIC));
+        WriteLE32(header + 8, SEEDER_DB_VERSION);
+        WriteLE32(header + 12, SEEDER_DB_RECORD_SIZE);
+        header[16] = fTestNet;
+        ret = pwrite(fd, header, sizeof(header), 0) == sizeof(header);
+    }
+    for (size_t i = 0; ret && i < slots.size(); i++) {
+        off_t pos =
+            SEEDER_DB_HEADER_SIZE + off_t(slots[i]) * SEEDER_DB_RECORD_SIZE;
+        ret = pwrite(fd, &records[i * SEEDER_DB_RECORD_SIZE],
+                     SEEDER_DB_RECORD_SIZE, pos) == SEEDER_DB_RECORD_SIZE;
+    }
+    if (ret) {
+        ret = fsync(fd) == 0;
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+    if (fTruncate) {
+        ret = ret && rename(strNewPath.c_str(), path) == 0;
+        if (!ret) {
+            unlink(strNewPath.c_str());
+        }
+    }
+    if (!ret) {
+        // The file may be inconsistent with mapSlot, start over next time.
+        LOCK(cs);
+        fRewrite = true;
+    }
+    return ret;
+}
@@ -21,6 +21,15 @@
 
 #define REQUIRE_VERSION 70001
 
+// dnsseed.db: a header followed by fixed size records, one per known or banned
+// address, so that saving only rewrites the records that changed.
+#define SEEDER_DB_VERSION 1
+#define SEEDER_DB_HEADER_SIZE 256
+#define SEEDER_DB_RECORD_SIZE 256
+#define SEEDER_DB_RECORD_FREE 0
+#define SEEDER_DB_RECORD_INFO 1
+#define SEEDER_DB_RECORD_BANNED 2
+
 static inline int GetRequireHeight(const bool testnet = fTestNet) {
     return testnet ? 500000 : 350000;
 }
@@ -59,6 +68,7 @@ public:
     }
 
     friend class CAddrInfo;
+    friend class CAddrDb;
 };
 
 class CAddrReport {
@@ -261,6 +271,16 @@ private:
     // set of good nodes  (d, good e)
     std::set<int> goodId;
     int nDirty;
+    // record slot of each address in dnsseed.db
+    std::map<CService, uint32_t> mapSlot;
+    // record slots not holding an address
+    std::vector<uint32_t> vFreeSlots;
+    // number of record slots in dnsseed.db
+    uint32_t nSlots = 0;
+    // addresses whose record must be rewritten on the next save
+    std::set<CService> setDirty;
+    // whether the whole file must be rewritten on the next save
+    bool fRewrite = true;
 
 protected:
     // internal routines that assume proper locks are acquired
@@ -283,6 +303,15 @@ protected:
     // get a random set of IPs (shared lock only)
     void GetIPs_(std::set<CNetAddr> &ips, uint64_t requestedFlags, uint32_t max,
                  const bool *nets);
+    // get the record slot of an address, assigning one if needed
+    uint32_t GetSlot_(const CService &ip);
+    // dnsseed.db record encoding; DecodeRecord returns the record type, which
+    // is SEEDER_DB_RECORD_FREE for free or corrupt records
+    static void EncodeRecord(uint8_t *rec, const CAddrInfo &info);
+    static void EncodeBanRecord(uint8_t *rec, const CService &ip,
+                                int64_t banTill);
+    static uint8_t DecodeRecord(const uint8_t *rec, CAddrInfo &info,
+                                int64_t &banTill);
 
 public:
     // nodes that are banned, with their unban time (a)
@@ -299,12 +328,35 @@ public:
     }
 
     void ResetIgnores() {
+        LOCK(cs);
         for (std::map<int, CAddrInfo>::iterator it = idToInfo.begin();
              it != idToInfo.end(); it++) {
             (*it).second.ignoreTill = 0;
+            setDirty.insert((*it).second.ip);
+        }
+    }
+
+    void ResetBans() {
+        LOCK(cs);
+        for (const auto &ban : banned) {
+            setDirty.insert(ban.first);
         }
+        banned.clear();
     }
 
+    // Load dnsseed.db into an empty database. The records are read straight
+    // from a read-only mapping of the file.
+    bool LoadFile(const char *path);
+
+    // Write the records changed since the last save to dnsseed.db. The lock
+    // is only held while encoding them, not during the disk writes.
+    bool SaveFile(const char *path);
+
+    // Read the reports of dnsseed.db as written by the last SaveFile, without
+    // taking the lock.
+    static bool ReadReports(const char *path,
+                            std::vector<CAddrReport> &reports);
+
     std::vector<CAddrReport> GetAll() {
         std::vector<CAddrReport> ret;
         LOCK(cs);
@@ -304,6 +304,20 @@ error:
     return error;
 }
 
+int dns_encode_record(const addr_t *addr, int ttl, uint8_t *out) {
+    // The question name is always at offset 12 of the response.
+    uint8_t *outpos = out;
+    int ret;
+    if (addr->v == 4) {
+        ret = write_record_a(&outpos, out + DNS_RECORD_A_SIZE, "", 12,
+                             CLASS_IN, ttl, addr);
+    } else {
+        ret = write_record_aaaa(&outpos, out + DNS_RECORD_AAAA_SIZE, "", 12,
+                                CLASS_IN, ttl, addr);
+    }
+    return ret ? -1 : outpos - out;
+}
+
 static ssize_t dnshandle(dns_opt_t *opt, const uint8_t *inbuf, size_t insize,
                          uint8_t *outbuf) {
     int error = 0;
@@ -459,29 +473,19 @@ static ssize_t dnshandle(dns_opt_t *opt, const uint8_t *inbuf, size_t insize,
         // A/AAAA records
         if ((typ == TYPE_A || typ == TYPE_AAAA || typ == QTYPE_ANY) &&
             (cls == CLASS_IN || cls == QCLASS_ANY)) {
-            addr_t addr[32];
-            int naddr = opt->cb((void *)opt, name, addr, 32,
-                                typ == TYPE_A || typ == QTYPE_ANY,
-                                typ == TYPE_AAAA || typ == QTYPE_ANY);
-            int n = 0;
-            while (n < naddr) {
-                int ret = 1;
-                if (addr[n].v == 4) {
-                    ret = write_record_a(&outpos, outend - max_auth_size, "",
-                                         offset, CLASS_IN, opt->datattl,
-                                         &addr[n]);
-                } else if (addr[n].v == 6) {
-                    ret = write_record_aaaa(&outpos, outend - max_auth_size, "",
-                                            offset, CLASS_IN, opt->datattl,
-                                            &addr[n]);
-                }
-
-                //      printf("wrote A record: %i\n", ret);
-                if (ret) {
+            const uint8_t *records[32];
+            int nrecords = opt->cb((void *)opt, name, records, 32,
+                                   typ == TYPE_A || typ == QTYPE_ANY,
+                                   typ == TYPE_AAAA || typ == QTYPE_ANY);
+            for (int n = 0; n < nrecords; n++) {
+                // The records are encoded already, the length follows the
+                // fixed header.
+                int size = 12 + records[n][11];
+                if (outend - max_auth_size - outpos < size) {
                     break;
                 }
-
-                n++;
+                memcpy(outpos, records[n], size);
+                outpos += size;
                 outbuf[7]++;
             }
         }
@@ -11,6 +11,10 @@ struct addr_t {
     } data;
 };
 
+// Size of an encoded A or AAAA answer record.
+#define DNS_RECORD_A_SIZE 16
+#define DNS_RECORD_AAAA_SIZE 28
+
 struct dns_opt_t {
     int port;
     int datattl;
@@ -18,12 +22,21 @@ struct dns_opt_t {
     const char *host;
     const char *ns;
     const char *mbox;
-    uint32_t (*cb)(void *opt, char *requested_hostname, addr_t *addr,
-                   uint32_t max, uint32_t ipv4, uint32_t ipv6);
+    // Pick at most max answer records, encoded by dns_encode_record, for the
+    // requested hostname. The records must stay valid until the next call
+    // from the same thread.
+    uint32_t (*cb)(void *opt, char *requested_hostname,
+                   const uint8_t **records, uint32_t max, uint32_t ipv4,
+                   uint32_t ipv6);
     // stats
     uint64_t nRequests;
 };
 
+// Encode the A or AAAA record answering the question with addr, so that it
+// can be copied as is into responses. Returns the size of the record, or -1
+// if it cannot be encoded.
+int dns_encode_record(const addr_t *addr, int ttl, uint8_t *out);
+
 int dnsserver(dns_opt_t *opt);
 
 #endif
@@ -3,6 +3,7 @@
 #include "db.h"
 #include "dns.h"
 #include "protocol.h"
+#include "random.h"
 #include "streams.h"
 
 #include <algorithm>
@@ -10,9 +11,13 @@
 #include <cinttypes>
 #include <cstdio>
 #include <cstdlib>
+#include <memory>
 #include <getopt.h>
 #include <pthread.h>
 #include <signal.h>
+#ifndef WIN32
+#include <sys/resource.h>
+#endif
 
 class CDnsSeedOpts {
 public:
@@ -31,7 +36,7 @@ public:
     std::set<uint64_t> filter_whitelist;
 
     CDnsSeedOpts()
-        : nThreads(96), nPort(53), nDnsThreads(4), fUseTestNet(false),
+        : nThreads(1024), nPort(53), nDnsThreads(4), fUseTestNet(false),
           fWipeBan(false), fWipeIgnore(false), mbox(nullptr), ns(nullptr),
           host(nullptr), tor(nullptr), ipv4_proxy(nullptr),
           ipv6_proxy(nullptr) {}
@@ -46,8 +51,8 @@ public:
             "-h <host>       Hostname of the DNS seed\n"
             "-n <ns>         Hostname of the nameserver\n"
             "-m <mbox>       E-Mail address reported in SOA records\n"
-            "-t <threads>    Number of crawlers to run in parallel (default "
-            "96)\n"
+            "-t <threads>    Number of nodes to crawl in parallel (default "
+            "1024)\n"
             "-d <threads>    Number of DNS server threads (default 4)\n"
             "-p <port>       UDP port to listen on (default 53)\n"
             "-o <ip:port>    Tor proxy IP/Port\n"
@@ -101,7 +106,7 @@ public:
 
                 case 't': {
                     int n = strtol(optarg, nullptr, 10);
-                    if (n > 0 && n < 1000) nThreads = n;
+                    if (n > 0 && n < 65536) nThreads = n;
                     break;
                 }
 
@@ -169,122 +174,171 @@ extern "C" {
 
 CAddrDb db;
 
+//! TTL of the A and AAAA records served
+static const int DNS_DATA_TTL = 3600;
+//! Seconds between DNS answers refreshes
+static const int DNS_REFRESH_INTERVAL = 5;
+
 extern "C" void *ThreadCrawler(void *data) {
     int *nThreads = (int *)data;
+    CCrawler crawler(*nThreads);
+    std::vector<CServiceResult> done;
+    std::vector<CAddress> addr;
     do {
+        // Keep as many probes in flight as allowed.
         std::vector<CServiceResult> ips;
         int wait = 5;
-        db.GetMany(ips, 16, wait);
+        if (crawler.GetFreeSlots() > 0) {
+            db.GetMany(ips, crawler.GetFreeSlots(), wait);
+        }
         int64_t now = time(nullptr);
-        if (ips.empty()) {
-            wait *= 1000;
-            wait += rand() % (500 * *nThreads);
-            Sleep(wait);
-            continue;
+        for (const CServiceResult &res : ips) {
+            bool getaddr = res.ourLastSuccess + 86400 < now;
+            crawler.Probe(res, getaddr);
         }
 
-        std::vector<CAddress> addr;
-        for (size_t i = 0; i < ips.size(); i++) {
-            CServiceResult &res = ips[i];
-            res.nBanTime = 0;
-            res.nClientV = 0;
-            res.nHeight = 0;
-            res.strClientV = "";
-            bool getaddr = res.ourLastSuccess + 86400 < now;
-            res.fGood = TestNode(res.service, res.nBanTime, res.nClientV,
-                                 res.strClientV, res.nHeight,
-                                 getaddr ? &addr : nullptr);
+        // Nothing to probe: wait for the database to have nodes to retry.
+        int timeout = 1000;
+        if (ips.empty() && crawler.GetProbeCount() == 0) {
+            timeout = wait * 1000 + rand() % 500;
         }
+        crawler.Poll(timeout, done, addr);
 
-        db.ResultMany(ips);
-        db.Add(addr);
+        if (!done.empty()) {
+            db.ResultMany(done);
+            done.clear();
+        }
+        if (!addr.empty()) {
+            db.Add(addr);
+            addr.clear();
+        }
     } while (1);
     return nullptr;
 }
 
 extern "C" uint32_t GetIPList(void *thread, char *requestedHostname,
-                              addr_t *addr, uint32_t max, uint32_t ipv4,
-                              uint32_t ipv6);
-
-class CDnsThread {
-public:
-    struct FlagSpecificData {
-        int nIPv4, nIPv6;
-        std::vector<addr_t> cache;
-        time_t cacheTime;
-        unsigned int cacheHits;
-        FlagSpecificData() : nIPv4(0), nIPv6(0), cacheTime(0), cacheHits(0) {}
-    };
+                              const uint8_t **records, uint32_t max,
+                              uint32_t ipv4, uint32_t ipv6);
+
+/**
+ * DNS answers for one service flags filter: the encoded A and AAAA records of
+ * good nodes. Immutable once published.
+ */
+struct CDnsAnswers {
+    std::vector<uint8_t> recordsIPv4;
+    std::vector<uint8_t> recordsIPv6;
+    uint32_t nIPv4;
+    uint32_t nIPv6;
+
+    CDnsAnswers() : nIPv4(0), nIPv6(0) {}
+};
 
-    dns_opt_t dns_opt; // must be first
-    const int id;
-    std::map<uint64_t, FlagSpecificData> perflag;
+/**
+ * Answers for every whitelisted filter, rebuilt from the database by the
+ * stats thread and swapped in atomically. DNS threads never wait for the
+ * database. A replaced answer set is freed when the last DNS thread using it
+ * lets go of it.
+ */
+class CDnsAnswerCache {
+private:
+    // Filters are fixed before the DNS threads start, only the answer sets
+    // change, through std::atomic_load and std::atomic_store.
+    std::map<uint64_t, std::shared_ptr<const CDnsAnswers>> answers;
     std::atomic<uint64_t> dbQueries;
-    std::set<uint64_t> filterWhitelist;
 
-    void cacheHit(uint64_t requestedFlags, bool force = false) {
-        static bool nets[NET_MAX] = {};
-        if (!nets[NET_IPV4]) {
-            nets[NET_IPV4] = true;
-            nets[NET_IPV6] = true;
+public:
+    CDnsAnswerCache() : dbQueries(0) {}
+
+    void Init(const std::set<uint64_t> &filters) {
+        answers[0] = nullptr;
+        for (uint64_t flags : filters) {
+            answers[flags] = nullptr;
         }
-        time_t now = time(nullptr);
-        FlagSpecificData &thisflag = perflag[requestedFlags];
-        thisflag.cacheHits++;
-        if (force ||
-            thisflag.cacheHits * 400 >
-                (thisflag.cache.size() * thisflag.cache.size()) ||
-            (thisflag.cacheHits * thisflag.cacheHits * 20 >
-                 thisflag.cache.size() &&
-             (now - thisflag.cacheTime > 5))) {
+    }
+
+    std::shared_ptr<const CDnsAnswers> Get(uint64_t flags) const {
+        auto it = answers.find(flags);
+        return it == answers.end() ? nullptr : std::atomic_load(&it->second);
+    }
+
+    uint64_t GetDbQueries() const { return dbQueries; }
+
+    void Refresh(CAddrDb &db, int ttl) {
+        bool nets[NET_MAX] = {};
+        nets[NET_IPV4] = true;
+        nets[NET_IPV6] = true;
+        for (auto &entry : answers) {
             std::set<CNetAddr> ips;
-            db.GetIPs(ips, requestedFlags, 1000, nets);
+            db.GetIPs(ips, entry.first, 1000, nets);
             dbQueries++;
-            thisflag.cache.clear();
-            thisflag.nIPv4 = 0;
-            thisflag.nIPv6 = 0;
-            thisflag.cache.reserve(ips.size());
-            for (auto &ip : ips) {
+
+            std::shared_ptr<CDnsAnswers> newAnswers =
+                std::make_shared<CDnsAnswers>();
+            for (const CNetAddr &ip : ips) {
                 struct in_addr addr;
                 struct in6_addr addr6;
+                addr_t a;
+                std::vector<uint8_t> *records;
+                uint32_t *pnCount;
                 if (ip.GetInAddr(&addr)) {
-                    addr_t a;
                     a.v = 4;
                     memcpy(&a.data.v4, &addr, 4);
-                    thisflag.cache.push_back(a);
-                    thisflag.nIPv4++;
+                    records = &newAnswers->recordsIPv4;
+                    pnCount = &newAnswers->nIPv4;
                 } else if (ip.GetIn6Addr(&addr6)) {
-                    addr_t a;
                     a.v = 6;
                     memcpy(&a.data.v6, &addr6, 16);
-                    thisflag.cache.push_back(a);
-                    thisflag.nIPv6++;
+                    records = &newAnswers->recordsIPv6;
+                    pnCount = &newAnswers->nIPv6;
+                } else {
+                    continue;
+                }
+                uint8_t record[DNS_RECORD_AAAA_SIZE];
+                int size = dns_encode_record(&a, ttl, record);
+                if (size < 0) {
+                    continue;
                 }
+                records->insert(records->end(), record, record + size);
+                (*pnCount)++;
             }
-            thisflag.cacheHits = 0;
-            thisflag.cacheTime = now;
+
+            std::atomic_store(
+                &entry.second,
+                std::shared_ptr<const CDnsAnswers>(std::move(newAnswers)));
         }
     }
+};
+
+static CDnsAnswerCache dnsAnswers;
+
+class CDnsThread {
+public:
+    dns_opt_t dns_opt; // must be first
+    const int id;
+    std::set<uint64_t> filterWhitelist;
+    FastRandomContext rng;
+    //! Answer set the records of the last reply point into, kept alive until
+    //! the next request.
+    std::shared_ptr<const CDnsAnswers> answers;
 
     CDnsThread(CDnsSeedOpts *opts, int idIn) : id(idIn) {
         dns_opt.host = opts->host;
         dns_opt.ns = opts->ns;
         dns_opt.mbox = opts->mbox;
-        dns_opt.datattl = 3600;
+        dns_opt.datattl = DNS_DATA_TTL;
         dns_opt.nsttl = 40000;
         dns_opt.cb = GetIPList;
         dns_opt.port = opts->nPort;
         dns_opt.nRequests = 0;
-        dbQueries = 0;
-        perflag.clear();
         filterWhitelist = opts->filter_whitelist;
     }
 
     void run() { dnsserver(&dns_opt); }
 };
 
-extern "C" uint32_t GetIPList(void *data, char *requestedHostname, addr_t *addr,
-                              uint32_t max, uint32_t ipv4, uint32_t ipv6) {
+extern "C" uint32_t GetIPList(void *data, char *requestedHostname,
+                              const uint8_t **records, uint32_t max,
+                              uint32_t ipv4, uint32_t ipv6) {
     CDnsThread *thread = (CDnsThread *)data;
 
     uint64_t requestedFlags = 0;
@@ -304,36 +358,38 @@ extern "C" uint32_t GetIPList(void *data, char *requestedHostname, addr_t *addr,
     } else if (strcasecmp(requestedHostname, thread->dns_opt.host)) {
         return 0;
     }
-    thread->cacheHit(requestedFlags);
-    auto &thisflag = thread->perflag[requestedFlags];
-    uint32_t size = thisflag.cache.size();
-    uint32_t maxmax = (ipv4 ? thisflag.nIPv4 : 0) + (ipv6 ? thisflag.nIPv6 : 0);
+
+    thread->answers = dnsAnswers.Get(requestedFlags);
+    const CDnsAnswers *answers = thread->answers.get();
+    if (!answers) {
+        return 0;
+    }
+    uint32_t nIPv4 = ipv4 ? answers->nIPv4 : 0;
+    uint32_t nIPv6 = ipv6 ? answers->nIPv6 : 0;
+    uint32_t size = nIPv4 + nIPv6;
     if (max > size) {
         max = size;
     }
-    if (max > maxmax) {
-        max = maxmax;
+
+    // Pick max distinct records at random (Floyd's algorithm), IPv4 records
+    // first in the index space.
+    uint32_t picked[32];
+    uint32_t n = 0;
+    for (uint32_t j = size - max; j < size && n < 32; j++) {
+        uint32_t t = thread->rng.randrange(j + 1);
+        if (std::find(picked, picked + n, t) != picked + n) {
+            t = j;
+        }
+        picked[n++] = t;
     }
-    uint32_t i = 0;
-    while (i < max) {
-        uint32_t j = i + (rand() % (size - i));
-        do {
-            bool ok = (ipv4 && thisflag.cache[j].v == 4) ||
-                      (ipv6 && thisflag.cache[j].v == 6);
-            if (ok) {
-                break;
-            }
-            j++;
-            if (j == size) {
-                j = i;
-            }
-        } while (1);
-        addr[i] = thisflag.cache[j];
-        thisflag.cache[j] = thisflag.cache[i];
-        thisflag.cache[i] = addr[i];
-        i++;
+    for (uint32_t i = 0; i < n; i++) {
+        records[i] =
+            picked[i] < nIPv4
+                ? &answers->recordsIPv4[picked[i] * DNS_RECORD_A_SIZE]
+                : &answers->recordsIPv6[(picked[i] - nIPv4) *
+                                        DNS_RECORD_AAAA_SIZE];
     }
-    return max;
+    return n;
 }
 
 std::vector<CDnsThread *> dnsThread;
@@ -366,16 +422,15 @@ extern "C" void *ThreadDumper(void *) {
         }
 
         {
-            std::vector<CAddrReport> v = db.GetAll();
-            sort(v.begin(), v.end(), StatCompare);
-            FILE *f = fopen("dnsseed.dat.new", "w+");
-            if (f) {
-                {
-                    CAutoFile cf(f, SER_DISK, CLIENT_VERSION);
-                    cf << db;
-                }
-                rename("dnsseed.dat.new", "dnsseed.dat");
+            // The dump is built from the file just saved rather than from
+            // the database, so that crawling is not held up meanwhile.
+            std::vector<CAddrReport> v;
+            if (!db.SaveFile("dnsseed.db") ||
+                !CAddrDb::ReadReports("dnsseed.db", v)) {
+                fprintf(stderr, "Error writing dnsseed.db\n");
+                continue;
             }
+            sort(v.begin(), v.end(), StatCompare);
             FILE *d = fopen("dnsseed.dump", "w");
             fprintf(d, "# address                                        good  "
                        "lastSuccess    %%(2h)   %%(8h)   %%(1d)   %%(7d)  "
@@ -411,7 +466,12 @@ extern "C" void *ThreadDumper(void *) {
 
 extern "C" void *ThreadStats(void *) {
     bool first = true;
+    int count = 0;
     do {
+        // Rebuild the DNS answers every few seconds.
+        if (++count % DNS_REFRESH_INTERVAL == 0) {
+            dnsAnswers.Refresh(db, DNS_DATA_TTL);
+        }
         char c[256];
         time_t tim = time(nullptr);
         struct tm *tmp = localtime(&tim);
@@ -425,10 +485,9 @@ extern "C" void *ThreadStats(void *) {
             printf("\x1b[2K\x1b[u");
         printf("\x1b[s");
         uint64_t requests = 0;
-        uint64_t queries = 0;
+        uint64_t queries = dnsAnswers.GetDbQueries();
         for (unsigned int i = 0; i < dnsThread.size(); i++) {
             requests += dnsThread[i]->dns_opt.nRequests;
-            queries += dnsThread[i]->dbQueries;
         }
         printf("%s %i/%i available (%i tried in %is, %i new, %i active), %i "
                "banned; %llu DNS requests, %llu db queries",
@@ -526,17 +585,26 @@ int main(int argc, char **argv) {
         fprintf(stderr, "No e-mail address set. Please use -m.\n");
         exit(1);
     }
-    FILE *f = fopen("dnsseed.dat", "r");
-    if (f) {
-        printf("Loading dnsseed.dat...");
-        CAutoFile cf(f, SER_DISK, CLIENT_VERSION);
-        cf >> db;
-        if (opts.fWipeBan) db.banned.clear();
-        if (opts.fWipeIgnore) db.ResetIgnores();
+    printf("Loading dnsseed.db...");
+    if (db.LoadFile("dnsseed.db")) {
         printf("done\n");
+    } else {
+        printf("not found\n");
+        // Databases written by older versions are converted on the next save.
+        FILE *f = fopen("dnsseed.dat", "r");
+        if (f) {
+            printf("Loading dnsseed.dat...");
+            CAutoFile cf(f, SER_DISK, CLIENT_VERSION);
+            cf >> db;
+            printf("done\n");
+        }
     }
+    if (opts.fWipeBan) db.ResetBans();
+    if (opts.fWipeIgnore) db.ResetIgnores();
     pthread_t threadDns, threadSeed, threadDump, threadStats;
     if (fDNS) {
+        dnsAnswers.Init(opts.filter_whitelist);
+        dnsAnswers.Refresh(db, DNS_DATA_TTL);
         printf("Starting %i DNS threads for %s on %s (port %i)...",
                opts.nDnsThreads, opts.host, opts.ns, opts.nPort);
         dnsThread.clear();
@@ -551,15 +619,27 @@ int main(int argc, char **argv) {
     printf("Starting seeder...");
     pthread_create(&threadSeed, nullptr, ThreadSeeder, nullptr);
     printf("done\n");
-    printf("Starting %i crawler threads...", opts.nThreads);
-    pthread_attr_t attr_crawler;
-    pthread_attr_init(&attr_crawler);
-    pthread_attr_setstacksize(&attr_crawler, 0x20000);
-    for (int i = 0; i < opts.nThreads; i++) {
-        pthread_t thread;
-        pthread_create(&thread, &attr_crawler, ThreadCrawler, &opts.nThreads);
+#ifndef WIN32
+    // Every node crawled in parallel holds a socket.
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0) {
+        if (limit.rlim_cur < limit.rlim_max) {
+            limit.rlim_cur = limit.rlim_max;
+            setrlimit(RLIMIT_NOFILE, &limit);
+            getrlimit(RLIMIT_NOFILE, &limit);
+        }
+        if (limit.rlim_cur != RLIM_INFINITY &&
+            (rlim_t)opts.nThreads + 256 > limit.rlim_cur) {
+            opts.nThreads = std::max<int>(16, int(limit.rlim_cur) - 256);
+            printf("Crawling at most %i nodes in parallel (file descriptor "
+                   "limit)\n",
+                   opts.nThreads);
+        }
     }
-    pthread_attr_destroy(&attr_crawler);
+#endif
+    printf("Starting crawler for %i nodes in parallel...", opts.nThreads);
+    pthread_t threadCrawler;
+    pthread_create(&threadCrawler, nullptr, ThreadCrawler, &opts.nThreads);
     printf("done\n");
     pthread_create(&threadStats, nullptr, ThreadStats, nullptr);
     pthread_create(&threadDump, nullptr, ThreadDumper, nullptr);
@@ -0,0 +1,132 @@
+// Copyright (c) 2018 The Bitcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "addrindex.h"
+#include "chain.h"
+#include "primitives/block.h"
+#include "undo.h"
+
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(addrindex_tests, BasicTestingSetup)
+
+static CTransactionRef MakeCoinbase(const CScript &script, Amount value,
+                                    int nHeight) {
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].scriptSig = CScript() << nHeight << OP_0;
+    tx.vout.push_back(CTxOut(value, script));
+    return MakeTransactionRef(tx);
+}
+
+BOOST_AUTO_TEST_CASE(addrindex_connect_disconnect) {
+    CAddressIndex index(1 << 20, true);
+    BOOST_CHECK(index.GetBestBlock().IsNull());
+
+    CScript scriptA = CScript() << OP_1;
+    CScript scriptB = CScript() << OP_2;
+    CScript scriptC = CScript() << OP_3;
+    uint256 hashA = GetScriptHash(scriptA);
+    uint256 hashB = GetScriptHash(scriptB);
+
+    // Chain of three blocks: genesis, a block paying A and a block spending
+    // that coinbase to B and back to A.
+    std::vector<uint256> hashes = {InsecureRand256(), InsecureRand256(),
+                                   InsecureRand256()};
+    CBlockIndex indexes[3];
+    for (int i = 0; i < 3; i++) {
+        indexes[i].phashBlock = &hashes[i];
+        indexes[i].pprev = i > 0 ? &indexes[i - 1] : nullptr;
+        indexes[i].nHeight = i;
+    }
+
+    CBlock genesis;
+    genesis.vtx.push_back(MakeCoinbase(scriptC, 50 * COIN, 0));
+
+    CBlock block1;
+    block1.vtx.push_back(MakeCoinbase(scriptA, 50 * COIN, 1));
+    CBlockUndo undo1;
+
+    CBlock block2;
+    block2.vtx.push_back(MakeCoinbase(scriptC, 50 * COIN, 2));
+    CMutableTransaction spend;
+    spend.vin.push_back(CTxIn(COutPoint(block1.vtx[0]->GetId(), 0)));
+    spend.vout.push_back(CTxOut(30 * COIN, scriptB));
+    spend.vout.push_back(CTxOut(20 * COIN, scriptA));
+    block2.vtx.push_back(MakeTransactionRef(spend));
+    CBlockUndo undo2;
+    undo2.vtxundo.resize(1);
+    undo2.vtxundo[0].vprevout.push_back(
+        Coin(block1.vtx[0]->vout[0], 1, true));
+
+    // Undo data that does not match the block is rejected.
+    CAddressIndexUpdate update;
+    BOOST_CHECK(!update.ConnectBlock(block2, undo1, 2));
+
+    BOOST_CHECK(index.ConnectBlock(genesis, CBlockUndo(), &indexes[0]));
+    BOOST_CHECK(index.ConnectBlock(block1, undo1, &indexes[1]));
+    BOOST_CHECK(index.ConnectBlock(block2, undo2, &indexes[2]));
+    BOOST_CHECK(index.GetBestBlock() == hashes[2]);
+
+    std::vector<std::pair<CAddressHistoryKey, Amount>> history;
+    BOOST_CHECK(index.ReadHistory(hashA, history));
+    BOOST_CHECK_EQUAL(history.size(), 2);
+    BOOST_CHECK_EQUAL(history[0].first.nHeight, 1);
+    BOOST_CHECK(history[0].first.txid == block1.vtx[0]->GetId());
+    BOOST_CHECK(history[0].second == 50 * COIN);
+    BOOST_CHECK_EQUAL(history[1].first.nHeight, 2);
+    BOOST_CHECK(history[1].second == -30 * COIN);
+
+    std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue>> unspent;
+    BOOST_CHECK(index.ReadUnspent(hashA, unspent));
+    BOOST_CHECK_EQUAL(unspent.size(), 1);
+    BOOST_CHECK(unspent[0].first.outpoint == COutPoint(spend.GetId(), 1));
+    BOOST_CHECK(unspent[0].second.nValue == 20 * COIN);
+    BOOST_CHECK_EQUAL(unspent[0].second.nHeight, 2);
+
+    unspent.clear();
+    BOOST_CHECK(index.ReadUnspent(hashB, unspent));
+    BOOST_CHECK_EQUAL(unspent.size(), 1);
+
+    // Disconnecting restores the spent coinbase.
+    BOOST_CHECK(index.DisconnectBlock(block2, undo2, &indexes[2]));
+    BOOST_CHECK(index.GetBestBlock() == hashes[1]);
+
+    history.clear();
+    BOOST_CHECK(index.ReadHistory(hashA, history));
+    BOOST_CHECK_EQUAL(history.size(), 1);
+
+    unspent.clear();
+    BOOST_CHECK(index.ReadUnspent(hashA, unspent));
+    BOOST_CHECK_EQUAL(unspent.size(), 1);
+    BOOST_CHECK(unspent[0].first.outpoint ==
+                COutPoint(block1.vtx[0]->GetId(), 0));
+    BOOST_CHECK_EQUAL(unspent[0].second.nHeight, 1);
+
+    unspent.clear();
+    BOOST_CHECK(index.ReadUnspent(hashB, unspent));
+    BOOST_CHECK(unspent.empty());
+
+    // The same blocks written as one batch give the same index.
+    BOOST_CHECK(index.Wipe());
+    BOOST_CHECK(index.GetBestBlock().IsNull());
+    history.clear();
+    BOOST_CHECK(index.ReadHistory(hashA, history));
+    BOOST_CHECK(history.empty());
+
+    std::vector<CAddressIndexUpdate> updates(2);
+    BOOST_CHECK(updates[0].ConnectBlock(block1, undo1, 1));
+    BOOST_CHECK(updates[1].ConnectBlock(block2, undo2, 2));
+    BOOST_CHECK(index.WriteUpdates(updates, hashes[2]));
+    BOOST_CHECK(index.GetBestBlock() == hashes[2]);
+    BOOST_CHECK(index.ReadHistory(hashA, history));
+    BOOST_CHECK_EQUAL(history.size(), 2);
+    unspent.clear();
+    BOOST_CHECK(index.ReadUnspent(hashA, unspent));
+    BOOST_CHECK_EQUAL(unspent.size(), 1);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
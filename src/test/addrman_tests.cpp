@@ -327,13 +327,54 @@ BOOST_AUTO_TEST_CASE(addrman_delete) {
     BOOST_CHECK(info2 == nullptr);
 }
 
+BOOST_AUTO_TEST_CASE(addrman_delete_many) {
+    CAddrManTest addrman;
+
+    // Set addrman addr placement to be deterministic.
+    addrman.MakeDeterministic();
+
+    CNetAddr source = ResolveIP("252.1.1.1");
+    std::vector<CAddress> vAddr;
+    std::vector<int> vId;
+    for (int i = 0; i < 5000; i++) {
+        vAddr.push_back(CAddress(
+            ResolveService(strprintf("250.%i.%i.1", i / 256, i % 256), 8333),
+            NODE_NONE));
+        int nId;
+        addrman.Create(vAddr.back(), source, &nId);
+        vId.push_back(nId);
+    }
+    BOOST_CHECK(addrman.size() == 5000);
+
+    // Test 22: Deleting entries leaves the others in place, whatever their
+    // position in the lookup table.
+    for (int i = 0; i < 5000; i += 2) {
+        addrman.Delete(vId[i]);
+    }
+    BOOST_CHECK(addrman.size() == 2500);
+    for (int i = 0; i < 5000; i++) {
+        CAddrInfo *pinfo = addrman.Find(vAddr[i]);
+        if (i % 2) {
+            BOOST_CHECK(pinfo != nullptr && *pinfo == vAddr[i]);
+        } else {
+            BOOST_CHECK(pinfo == nullptr);
+        }
+    }
+
+    // Test 23: Deleted entries are reused.
+    int nId;
+    addrman.Create(vAddr[0], source, &nId);
+    BOOST_CHECK(nId < 5000);
+    BOOST_CHECK(addrman.Find(vAddr[0]) != nullptr);
+}
+
 BOOST_AUTO_TEST_CASE(addrman_getaddr) {
     CAddrManTest addrman;
 
     // Set addrman addr placement to be deterministic.
     addrman.MakeDeterministic();
 
-    // Test 22: Sanity check, GetAddr should never return anything if addrman
+    // Test 24: Sanity check, GetAddr should never return anything if addrman
     //  is empty.
     BOOST_CHECK(addrman.size() == 0);
     std::vector<CAddress> vAddr1 = addrman.GetAddr();
@@ -352,7 +393,7 @@ BOOST_AUTO_TEST_CASE(addrman_getaddr) {
     CNetAddr source1 = ResolveIP("250.1.2.1");
     CNetAddr source2 = ResolveIP("250.2.3.3");
 
-    // Test 23: Ensure GetAddr works with new addresses.
+    // Test 25: Ensure GetAddr works with new addresses.
     addrman.Add(addr1, source1);
     addrman.Add(addr2, source2);
     addrman.Add(addr3, source1);
@@ -362,12 +403,12 @@ BOOST_AUTO_TEST_CASE(addrman_getaddr) {
     // GetAddr returns 23% of addresses, 23% of 5 is 1 rounded down.
     BOOST_CHECK(addrman.GetAddr().size() == 1);
 
-    // Test 24: Ensure GetAddr works with new and tried addresses.
+    // Test 26: Ensure GetAddr works with new and tried addresses.
     addrman.Good(CAddress(addr1, NODE_NONE));
     addrman.Good(CAddress(addr2, NODE_NONE));
     BOOST_CHECK(addrman.GetAddr().size() == 1);
 
-    // Test 25: Ensure GetAddr still returns 23% when addrman has many addrs.
+    // Test 27: Ensure GetAddr still returns 23% when addrman has many addrs.
     for (unsigned int i = 1; i < (8 * 256); i++) {
         int octet1 = i % 256;
         int octet2 = (i / 256) % 256;
@@ -409,11 +450,11 @@ BOOST_AUTO_TEST_CASE(caddrinfo_get_tried_bucket) {
 
     BOOST_CHECK(info1.GetTriedBucket(nKey1) == 40);
 
-    // Test 26: Make sure key actually randomizes bucket placement. A fail on
+    // Test 28: Make sure key actually randomizes bucket placement. A fail on
     //  this test could be a security issue.
     BOOST_CHECK(info1.GetTriedBucket(nKey1) != info1.GetTriedBucket(nKey2));
 
-    // Test 27: Two addresses with same IP but different ports can map to
+    // Test 29: Two addresses with same IP but different ports can map to
     //  different buckets because they have different keys.
     CAddrInfo info2 = CAddrInfo(addr2, source1);
 
@@ -428,7 +469,7 @@ BOOST_AUTO_TEST_CASE(caddrinfo_get_tried_bucket) {
         int bucket = infoi.GetTriedBucket(nKey1);
         buckets.insert(bucket);
     }
-    // Test 28: IP addresses in the same group (\16 prefix for IPv4) should
+    // Test 30: IP addresses in the same group (\16 prefix for IPv4) should
     //  never get more than 8 buckets
     BOOST_CHECK(buckets.size() == 8);
 
@@ -441,7 +482,7 @@ BOOST_AUTO_TEST_CASE(caddrinfo_get_tried_bucket) {
         int bucket = infoj.GetTriedBucket(nKey1);
         buckets.insert(bucket);
     }
-    // Test 29: IP addresses in the different groups should map to more than
+    // Test 31: IP addresses in the different groups should map to more than
     //  8 buckets.
     BOOST_CHECK(buckets.size() == 160);
 }
@@ -464,11 +505,11 @@ BOOST_AUTO_TEST_CASE(caddrinfo_get_new_bucket) {
 
     BOOST_CHECK(info1.GetNewBucket(nKey1) == 786);
 
-    // Test 30: Make sure key actually randomizes bucket placement. A fail on
+    // Test 32: Make sure key actually randomizes bucket placement. A fail on
     //  this test could be a security issue.
     BOOST_CHECK(info1.GetNewBucket(nKey1) != info1.GetNewBucket(nKey2));
 
-    // Test 31: Ports should not effect bucket placement in the addr
+    // Test 33: Ports should not effect bucket placement in the addr
     CAddrInfo info2 = CAddrInfo(addr2, source1);
     BOOST_CHECK(info1.GetKey() != info2.GetKey());
     BOOST_CHECK(info1.GetNewBucket(nKey1) == info2.GetNewBucket(nKey1));
@@ -481,7 +522,7 @@ BOOST_AUTO_TEST_CASE(caddrinfo_get_new_bucket) {
         int bucket = infoi.GetNewBucket(nKey1);
         buckets.insert(bucket);
     }
-    // Test 32: IP addresses in the same group (\16 prefix for IPv4) should
+    // Test 34: IP addresses in the same group (\16 prefix for IPv4) should
     //  always map to the same bucket.
     BOOST_CHECK(buckets.size() == 1);
 
@@ -495,7 +536,7 @@ BOOST_AUTO_TEST_CASE(caddrinfo_get_new_bucket) {
         int bucket = infoj.GetNewBucket(nKey1);
         buckets.insert(bucket);
     }
-    // Test 33: IP addresses in the same source groups should map to no more
+    // Test 35: IP addresses in the same source groups should map to no more
     //  than 64 buckets.
     BOOST_CHECK(buckets.size() <= 64);
 
@@ -507,7 +548,7 @@ BOOST_AUTO_TEST_CASE(caddrinfo_get_new_bucket) {
         int bucket = infoj.GetNewBucket(nKey1);
         buckets.insert(bucket);
     }
-    // Test 34: IP addresses in the different source groups should map to more
+    // Test 36: IP addresses in the different source groups should map to more
     //  than 64 buckets.
     BOOST_CHECK(buckets.size() > 64);
 }
@@ -0,0 +1,83 @@
+// Copyright (c) 2018 The Bitcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockbuffer.h"
+#include "primitives/block.h"
+
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(blockbuffer_tests, BasicTestingSetup)
+
+namespace {
+struct TestChain {
+    std::vector<uint256> hashes;
+    std::vector<CBlockIndex> indexes;
+    std::vector<std::shared_ptr<const CBlock>> blocks;
+
+    explicit TestChain(int nLength) : hashes(nLength), indexes(nLength) {
+        for (int i = 0; i < nLength; i++) {
+            hashes[i] = InsecureRand256();
+            indexes[i].phashBlock = &hashes[i];
+            indexes[i].nHeight = i;
+            CMutableTransaction tx;
+            tx.vout.resize(1);
+            tx.vout[0].scriptPubKey = CScript() << i;
+            std::shared_ptr<CBlock> pblock = std::make_shared<CBlock>();
+            pblock->vtx.push_back(MakeTransactionRef(tx));
+            blocks.push_back(pblock);
+        }
+    }
+};
+} // namespace
+
+BOOST_AUTO_TEST_CASE(blockbuffer_take) {
+    TestChain chain(10);
+    CBlockBuffer buffer(1 << 20);
+    for (int i = 0; i < 10; i++) {
+        BOOST_CHECK(buffer.Add(&chain.indexes[i], chain.blocks[i]));
+    }
+    BOOST_CHECK_EQUAL(buffer.Count(), 10U);
+    BOOST_CHECK(buffer.DynamicMemoryUsage() > 0);
+
+    BOOST_CHECK(buffer.Take(chain.hashes[3]) == chain.blocks[3]);
+    BOOST_CHECK(buffer.Take(chain.hashes[3]) == nullptr);
+    BOOST_CHECK_EQUAL(buffer.Count(), 9U);
+
+    buffer.RemoveUpTo(5);
+    BOOST_CHECK_EQUAL(buffer.Count(), 4U);
+    BOOST_CHECK(buffer.Take(chain.hashes[4]) == nullptr);
+    BOOST_CHECK(buffer.Take(chain.hashes[6]) == chain.blocks[6]);
+
+    buffer.Clear();
+    BOOST_CHECK_EQUAL(buffer.Count(), 0U);
+    BOOST_CHECK_EQUAL(buffer.DynamicMemoryUsage(), 0U);
+}
+
+BOOST_AUTO_TEST_CASE(blockbuffer_eviction) {
+    TestChain chain(10);
+    CBlockBuffer unbounded(1 << 20);
+    BOOST_CHECK(unbounded.Add(&chain.indexes[0], chain.blocks[0]));
+    size_t nBlockUsage = unbounded.DynamicMemoryUsage();
+
+    // Room for three blocks: the highest ones are evicted first.
+    CBlockBuffer buffer(3 * nBlockUsage);
+    BOOST_CHECK(buffer.Add(&chain.indexes[5], chain.blocks[5]));
+    BOOST_CHECK(buffer.Add(&chain.indexes[6], chain.blocks[6]));
+    BOOST_CHECK(buffer.Add(&chain.indexes[7], chain.blocks[7]));
+    BOOST_CHECK(!buffer.Add(&chain.indexes[8], chain.blocks[8]));
+    BOOST_CHECK(buffer.Add(&chain.indexes[2], chain.blocks[2]));
+    BOOST_CHECK_EQUAL(buffer.Count(), 3U);
+    BOOST_CHECK(buffer.DynamicMemoryUsage() <= buffer.GetMaxUsage());
+    BOOST_CHECK(buffer.Take(chain.hashes[7]) == nullptr);
+    BOOST_CHECK(buffer.Take(chain.hashes[2]) == chain.blocks[2]);
+
+    // Shrinking the buffer also evicts from the top.
+    buffer.SetMaxUsage(nBlockUsage);
+    BOOST_CHECK_EQUAL(buffer.Count(), 1U);
+    BOOST_CHECK(buffer.Take(chain.hashes[5]) == chain.blocks[5]);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -252,6 +252,37 @@ BOOST_AUTO_TEST_CASE(NonCoinbasePreforwardRTTest) {
                       SHARED_TX_OFFSET + 0);
 }
 
+BOOST_AUTO_TEST_CASE(ShortIDCollisionTest) {
+    CTxMemPool pool(CFeeRate(Amount(0)));
+    TestMemPoolEntryHelper entry;
+    CBlock block(BuildBlockTestCase());
+
+    pool.addUnchecked(block.vtx[2]->GetId(), entry.FromTx(*block.vtx[2]));
+
+    // Give tx 1 and tx 2 the same short ID: both must be requested, rather
+    // than failing over to a full block download.
+    TestHeaderAndShortIDs shortIDs(block);
+    shortIDs.shorttxids[0] = shortIDs.GetShortID(block.vtx[2]->GetId());
+    shortIDs.shorttxids[1] = shortIDs.shorttxids[0];
+
+    CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
+    stream << shortIDs;
+
+    CBlockHeaderAndShortTxIDs shortIDs2;
+    stream >> shortIDs2;
+
+    PartiallyDownloadedBlock partialBlock(GetConfig(), &pool);
+    BOOST_CHECK(partialBlock.InitData(shortIDs2, extra_txn) == READ_STATUS_OK);
+    BOOST_CHECK(partialBlock.IsTxAvailable(0));
+    BOOST_CHECK(!partialBlock.IsTxAvailable(1));
+    BOOST_CHECK(!partialBlock.IsTxAvailable(2));
+
+    CBlock block2;
+    BOOST_CHECK(partialBlock.FillBlock(block2, {block.vtx[1], block.vtx[2]}) ==
+                READ_STATUS_OK);
+    BOOST_CHECK_EQUAL(block.GetHash().ToString(), block2.GetHash().ToString());
+}
+
 BOOST_AUTO_TEST_CASE(SufficientPreforwardRTTest) {
     CTxMemPool pool(CFeeRate(Amount(0)));
     TestMemPoolEntryHelper entry;
@@ -367,11 +398,13 @@ BOOST_AUTO_TEST_CASE(EmptyBlockRoundTripTest) {
 BOOST_AUTO_TEST_CASE(TransactionsRequestSerializationTest) {
     BlockTransactionsRequest req1;
     req1.blockhash = InsecureRand256();
-    req1.indexes.resize(4);
+    req1.indexes.resize(5);
     req1.indexes[0] = 0;
     req1.indexes[1] = 1;
     req1.indexes[2] = 3;
     req1.indexes[3] = 4;
+    // Blocks may have more than 65535 transactions.
+    req1.indexes[4] = 100000;
 
     CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
     stream << req1;
@@ -385,6 +418,7 @@ BOOST_AUTO_TEST_CASE(TransactionsRequestSerializationTest) {
     BOOST_CHECK_EQUAL(req1.indexes[1], req2.indexes[1]);
     BOOST_CHECK_EQUAL(req1.indexes[2], req2.indexes[2]);
     BOOST_CHECK_EQUAL(req1.indexes[3], req2.indexes[3]);
+    BOOST_CHECK_EQUAL(req1.indexes[4], req2.indexes[4]);
 }
 
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,186 @@
+// Copyright (c) 2018 The Bitcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockfilter.h"
+#include "blockfilterindex.h"
+#include "chain.h"
+#include "consensus/merkle.h"
+#include "primitives/block.h"
+#include "undo.h"
+#include "utilstrencodings.h"
+
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+
+#include <cstring>
+
+BOOST_FIXTURE_TEST_SUITE(blockfilter_tests, BasicTestingSetup)
+
+static GCSFilter::Element RandomElement() {
+    GCSFilter::Element element(32);
+    GetRandBytes(element.data(), element.size());
+    return element;
+}
+
+BOOST_AUTO_TEST_CASE(gcsfilter_match) {
+    GCSFilter::Params params(GetRand(1000000), GetRand(1000000), 19, 784931);
+
+    GCSFilter::ElementSet included;
+    for (int i = 0; i < 100; i++) {
+        included.push_back(RandomElement());
+    }
+    // Duplicates are only counted once.
+    included.push_back(included[0]);
+    GCSFilter::ElementSet excluded;
+    for (int i = 0; i < 100; i++) {
+        excluded.push_back(RandomElement());
+    }
+
+    GCSFilter filter(params, included);
+    BOOST_CHECK_EQUAL(filter.GetN(), 100);
+
+    // Decoding gives back a filter matching the same elements.
+    GCSFilter decoded(params, filter.GetEncoded());
+    BOOST_CHECK_EQUAL(decoded.GetN(), 100);
+    for (const GCSFilter::Element &element : included) {
+        BOOST_CHECK(decoded.Match(element));
+    }
+    BOOST_CHECK(decoded.MatchAny(included));
+    excluded.push_back(included[42]);
+    BOOST_CHECK(decoded.MatchAny(excluded));
+    BOOST_CHECK(!decoded.MatchAny(GCSFilter::ElementSet()));
+
+    // Truncated filters are rejected.
+    std::vector<uint8_t> vTruncated = filter.GetEncoded();
+    vTruncated.resize(vTruncated.size() / 2);
+    BOOST_CHECK_THROW(GCSFilter(params, vTruncated), std::ios_base::failure);
+
+    GCSFilter empty(params);
+    BOOST_CHECK_EQUAL(empty.GetN(), 0);
+    BOOST_CHECK(!empty.Match(included[0]));
+    BOOST_CHECK(GCSFilter(params, empty.GetEncoded()).GetN() == 0);
+}
+
+// Basic filter of the testnet genesis block, from the BIP 158 test vectors.
+BOOST_AUTO_TEST_CASE(blockfilter_basic_test_vector) {
+    const char *pszTimestamp = "The Times 03/Jan/2009 Chancellor on brink of "
+                               "second bailout for banks";
+    CMutableTransaction txNew;
+    txNew.nVersion = 1;
+    txNew.vin.resize(1);
+    txNew.vout.resize(1);
+    txNew.vin[0].scriptSig =
+        CScript() << 486604799 << CScriptNum(4)
+                  << std::vector<uint8_t>((const uint8_t *)pszTimestamp,
+                                          (const uint8_t *)pszTimestamp +
+                                              strlen(pszTimestamp));
+    txNew.vout[0].nValue = 50 * COIN;
+    txNew.vout[0].scriptPubKey =
+        CScript() << ParseHex("04678afdb0fe5548271967f1a67130b7105cd6a828e039"
+                              "09a67962e0ea1f61deb649f6bc3f4cef38c4f35504e51e"
+                              "c112de5c384df7ba0b8d578a4c702b6bf11d5f")
+                  << OP_CHECKSIG;
+
+    CBlock genesis;
+    genesis.nVersion = 1;
+    genesis.nTime = 1296688602;
+    genesis.nBits = 0x1d00ffff;
+    genesis.nNonce = 414098458;
+    genesis.vtx.push_back(MakeTransactionRef(std::move(txNew)));
+    genesis.hashMerkleRoot = BlockMerkleRoot(genesis);
+    BOOST_CHECK_EQUAL(genesis.GetHash().GetHex(),
+                      "000000000933ea01ad0ee984209779baaec3ced90fa3f408719526"
+                      "f8d77f4943");
+
+    BlockFilter filter(BlockFilterType::BASIC, genesis, CBlockUndo());
+    BOOST_CHECK_EQUAL(HexStr(filter.GetEncodedFilter()), "019dfca8");
+    BOOST_CHECK_EQUAL(filter.ComputeHeader(uint256()).GetHex(),
+                      "21584579b7eb08997773e5aeff3a7f932700042d0ed2a6129012b7"
+                      "d7ae81b750");
+
+    // The filter matches the genesis output and survives serialization.
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << filter;
+    BlockFilter filter2;
+    ss >> filter2;
+    BOOST_CHECK(filter2.GetBlockHash() == genesis.GetHash());
+    BOOST_CHECK(filter2.GetHash() == filter.GetHash());
+    const CScript &script = genesis.vtx[0]->vout[0].scriptPubKey;
+    BOOST_CHECK(filter2.GetFilter().Match(
+        GCSFilter::Element(script.begin(), script.end())));
+}
+
+BOOST_AUTO_TEST_CASE(blockfilterindex_connect) {
+    CBlockFilterIndex index(1 << 20, true);
+    BOOST_CHECK(index.GetBestBlock().IsNull());
+
+    CScript scriptA = CScript() << OP_1;
+    CScript scriptB = CScript() << OP_2;
+
+    std::vector<CBlock> blocks(3);
+    std::vector<CBlockUndo> undos(3);
+    std::vector<uint256> hashes;
+    CBlockIndex indexes[3];
+    for (int i = 0; i < 3; i++) {
+        CMutableTransaction coinbase;
+        coinbase.vin.resize(1);
+        coinbase.vin[0].scriptSig = CScript() << i << OP_0;
+        coinbase.vout.push_back(CTxOut(50 * COIN, i == 1 ? scriptA : scriptB));
+        blocks[i].vtx.push_back(MakeTransactionRef(coinbase));
+        hashes.push_back(blocks[i].GetHash());
+    }
+    undos[2].vtxundo.resize(1);
+    undos[2].vtxundo[0].vprevout.push_back(
+        Coin(blocks[1].vtx[0]->vout[0], 1, true));
+    for (int i = 0; i < 3; i++) {
+        indexes[i].phashBlock = &hashes[i];
+        indexes[i].pprev = i > 0 ? &indexes[i - 1] : nullptr;
+        indexes[i].nHeight = i;
+    }
+
+    // The first block is connected on its own, the others in a single batch.
+    BOOST_CHECK(index.ConnectBlock(blocks[0], undos[0], &indexes[0]));
+    std::vector<BlockFilter> filters;
+    for (int i = 1; i < 3; i++) {
+        filters.emplace_back(BlockFilterType::BASIC, blocks[i], undos[i]);
+    }
+    BOOST_CHECK(index.WriteFilters(filters));
+    BOOST_CHECK(index.GetBestBlock() == hashes[2]);
+
+    // Headers chain the filter hashes.
+    uint256 hashHeader;
+    for (int i = 0; i < 3; i++) {
+        BlockFilter filter;
+        BOOST_CHECK(index.LookupFilter(hashes[i], filter));
+        BOOST_CHECK(filter.GetBlockHash() == hashes[i]);
+        BOOST_CHECK(filter.GetHash() ==
+                    BlockFilter(BlockFilterType::BASIC, blocks[i], undos[i])
+                        .GetHash());
+
+        CBlockFilterHashes filterHashes;
+        BOOST_CHECK(index.LookupFilterHashes(hashes[i], filterHashes));
+        BOOST_CHECK(filterHashes.hashFilter == filter.GetHash());
+        hashHeader = filter.ComputeHeader(hashHeader);
+        BOOST_CHECK(filterHashes.hashHeader == hashHeader);
+    }
+
+    // The spending block matches the script of the output it spends.
+    BlockFilter filter;
+    BOOST_CHECK(index.LookupFilter(hashes[2], filter));
+    BOOST_CHECK(filter.GetFilter().Match(
+        GCSFilter::Element(scriptA.begin(), scriptA.end())));
+
+    // Moving the best block back keeps the filters around.
+    BOOST_CHECK(index.SetBestBlock(hashes[0]));
+    BOOST_CHECK(index.GetBestBlock() == hashes[0]);
+    BOOST_CHECK(index.LookupFilter(hashes[2], filter));
+
+    BOOST_CHECK(index.Wipe());
+    BOOST_CHECK(index.GetBestBlock().IsNull());
+    BOOST_CHECK(!index.LookupFilter(hashes[0], filter));
+    BOOST_CHECK(!index.LookupFilter(hashes[2], filter));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,76 @@
+// Copyright (c) 2018 The Bitcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "chain.h"
+#include "test/test_bitcoin.h"
+
+#include <map>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(blockmap_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(blockmap_insert_find) {
+    BlockMap map;
+    BlockIndexArena arena;
+    std::map<uint256, CBlockIndex *> reference;
+
+    BOOST_CHECK(map.empty());
+    BOOST_CHECK(map.find(uint256()) == map.end());
+
+    for (int i = 0; i < 10000; i++) {
+        uint256 hash = InsecureRand256();
+        CBlockIndex *pindex = arena.Allocate(hash, CBlockIndex());
+        pindex->nHeight = i;
+        BOOST_CHECK(*pindex->phashBlock == hash);
+        BOOST_CHECK(map.insert(std::make_pair(hash, pindex)).second);
+        reference[hash] = pindex;
+    }
+    BOOST_CHECK_EQUAL(map.size(), reference.size());
+
+    // Entries survive rehashing and duplicates are not inserted twice.
+    for (const std::pair<const uint256, CBlockIndex *> &item : reference) {
+        BlockMap::const_iterator it = map.find(item.first);
+        BOOST_CHECK(it != map.end());
+        BOOST_CHECK(it->second == item.second);
+        BOOST_CHECK(it->second->GetBlockHash() == item.first);
+        BOOST_CHECK(!map.insert(std::make_pair(item.first, nullptr)).second);
+        BOOST_CHECK_EQUAL(map.count(item.first), 1);
+    }
+    BOOST_CHECK_EQUAL(map.size(), reference.size());
+    BOOST_CHECK_EQUAL(map.count(InsecureRand256()), 0);
+
+    // Iteration visits every entry exactly once.
+    size_t nVisited = 0;
+    for (const BlockMap::value_type &item : map) {
+        BOOST_CHECK(reference.at(item.first) == item.second);
+        nVisited++;
+    }
+    BOOST_CHECK_EQUAL(nVisited, reference.size());
+
+    // operator[] inserts a null entry for unknown hashes.
+    uint256 unknown = InsecureRand256();
+    BOOST_CHECK(map[unknown] == nullptr);
+    BOOST_CHECK_EQUAL(map.size(), reference.size() + 1);
+
+    map.clear();
+    arena.Clear();
+    BOOST_CHECK(map.empty());
+    BOOST_CHECK(map.begin() == map.end());
+}
+
+BOOST_AUTO_TEST_CASE(blockmap_reserve) {
+    BlockMap map;
+    map.reserve(1000);
+    size_t nUsage = map.DynamicMemoryUsage();
+    for (int i = 0; i < 1000; i++) {
+        map[InsecureRand256()] = nullptr;
+    }
+    // No rehash was needed.
+    BOOST_CHECK_EQUAL(map.DynamicMemoryUsage(), nUsage);
+    BOOST_CHECK_EQUAL(map.size(), 1000);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -6,9 +6,11 @@
 
 #include "base58.h"
 #include "clientversion.h"
+#include "consensus/merkle.h"
 #include "key.h"
 #include "merkleblock.h"
 #include "random.h"
+#include "script/standard.h"
 #include "serialize.h"
 #include "streams.h"
 #include "test/test_bitcoin.h"
@@ -1054,6 +1056,74 @@ static std::vector<uint8_t> RandomData() {
     return std::vector<uint8_t>(r.begin(), r.end());
 }
 
+BOOST_AUTO_TEST_CASE(merkle_block_from_elements) {
+    CKey key;
+    key.MakeNewKey(true);
+    CPubKey pubkey = key.GetPubKey();
+    CKeyID keyid = pubkey.GetID();
+
+    // A chain of spends through pay to pubkey, pay to pubkey hash, multisig
+    // and an output with a truncated push, and an unrelated transaction.
+    CBlock block;
+    CMutableTransaction tx0;
+    tx0.vin.resize(1);
+    tx0.vin[0].scriptSig = CScript() << OP_0 << OP_0;
+    tx0.vout.push_back(
+        CTxOut(Amount(1), CScript() << ToByteVector(pubkey) << OP_CHECKSIG));
+    tx0.vout.push_back(CTxOut(Amount(0), CScript() << OP_RETURN
+                                                   << ToByteVector(keyid)));
+    block.vtx.push_back(MakeTransactionRef(tx0));
+
+    std::vector<uint8_t> vSigData = RandomData();
+    CMutableTransaction tx1;
+    tx1.vin.push_back(CTxIn(COutPoint(tx0.GetId(), 0)));
+    tx1.vin[0].scriptSig = CScript() << vSigData;
+    tx1.vout.push_back(CTxOut(Amount(1), GetScriptForDestination(keyid)));
+    tx1.vout.push_back(
+        CTxOut(Amount(1), GetScriptForMultisig(1, {pubkey, pubkey})));
+    block.vtx.push_back(MakeTransactionRef(tx1));
+
+    CMutableTransaction tx2;
+    tx2.vin.push_back(CTxIn(COutPoint(tx1.GetId(), 1)));
+    std::vector<uint8_t> truncated = ParseHex("76a94c");
+    tx2.vout.push_back(
+        CTxOut(Amount(1), CScript(truncated.begin(), truncated.end())));
+    block.vtx.push_back(MakeTransactionRef(tx2));
+
+    CMutableTransaction tx3;
+    tx3.vin.push_back(CTxIn(COutPoint(InsecureRand256(), 0)));
+    tx3.vin[0].scriptSig = CScript() << RandomData();
+    tx3.vout.push_back(CTxOut(Amount(1), CScript() << RandomData()));
+    block.vtx.push_back(MakeTransactionRef(tx3));
+    block.hashMerkleRoot = BlockMerkleRoot(block);
+
+    CBloomBlockElements elements(std::make_shared<const CBlock>(block));
+
+    // Matching the extracted elements sends and updates the filters the same
+    // way as matching the block.
+    std::vector<std::vector<uint8_t>> vKeys = {
+        ToByteVector(pubkey), ToByteVector(keyid), vSigData,
+        ToByteVector(block.vtx[3]->GetId()), RandomData()};
+    for (uint8_t nFlags : {BLOOM_UPDATE_NONE, BLOOM_UPDATE_ALL,
+                           BLOOM_UPDATE_P2PUBKEY_ONLY}) {
+        for (const std::vector<uint8_t> &vKey : vKeys) {
+            CBloomFilter filter(10, 0.000001, insecure_rand(), nFlags);
+            filter.insert(vKey);
+            CBloomFilter filterCopy = filter;
+
+            CMerkleBlock merkleBlock(block, filter);
+            CMerkleBlock merkleBlockCopy(elements, filterCopy);
+            BOOST_CHECK(merkleBlock.vMatchedTxn == merkleBlockCopy.vMatchedTxn);
+
+            CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+            CDataStream ssCopy(SER_NETWORK, PROTOCOL_VERSION);
+            ss << merkleBlock << filter;
+            ssCopy << merkleBlockCopy << filterCopy;
+            BOOST_CHECK(ss.str() == ssCopy.str());
+        }
+    }
+}
+
 BOOST_AUTO_TEST_CASE(rolling_bloom) {
     // last-100-entry, 1% false positive:
     CRollingBloomFilter rb1(100, 0.01);
@@ -1126,4 +1196,33 @@ BOOST_AUTO_TEST_CASE(rolling_bloom) {
     }
 }
 
+BOOST_AUTO_TEST_CASE(rolling_bloom_hash) {
+    // Sized like recentRejects.
+    CRollingBloomFilter rb(120000, 0.000001);
+
+    // Roll through three generations: the last 120000 hashes are always
+    // remembered, and looking up uint256 and byte vector keys agrees.
+    std::vector<uint256> hashes;
+    for (int i = 0; i < 240000; i++) {
+        hashes.push_back(GetRandHash());
+        rb.insert(hashes.back());
+    }
+    for (int i = 120000; i < 240000; i++) {
+        BOOST_CHECK(rb.contains(hashes[i]));
+    }
+    std::vector<uint8_t> vKey(hashes.back().begin(), hashes.back().end());
+    BOOST_CHECK(rb.contains(vKey));
+
+    // The filter is as full as it gets: at a 1e-6 rate, 100000 random hashes
+    // should all be rejected.
+    unsigned int nHits = 0;
+    for (int i = 0; i < 100000; i++) {
+        if (rb.contains(GetRandHash())) ++nHits;
+    }
+    BOOST_CHECK(nHits < 5);
+
+    rb.reset();
+    BOOST_CHECK(!rb.contains(hashes.back()));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -325,4 +325,64 @@ BOOST_AUTO_TEST_CASE(iterator_string_ordering) {
     }
 }
 
+BOOST_AUTO_TEST_CASE(dbwrapper_options) {
+    std::string strError;
+    BOOST_CHECK(CheckDBOptions(strError));
+    for (const char *opt :
+         {"block_size", "unknown=1", "block_size=1",
+          "chainstate.bloom_bits=-1", "max_file_size=x", "compression=1",
+          "chainstat.bloom_bits=0", ".bloom_bits=0"}) {
+        ForceSetMultiArg("-dbopt", opt);
+        BOOST_CHECK(!CheckDBOptions(strError));
+        ClearArg("-dbopt");
+    }
+
+    fs::path ph = fs::temp_directory_path() / fs::unique_path();
+    ForceSetMultiArg("-dbopt", "block_size=16384");
+    ForceSetMultiArg("-dbopt", "chainstate.bloom_bits=0");
+    ForceSetMultiArg("-dbopt", "chainstate.max_open_files=1000");
+    ForceSetMultiArg("-dbopt", "blockfilter.max_file_size=8388608");
+    BOOST_CHECK(CheckDBOptions(strError));
+    {
+        CDBWrapper dbw(ph / "chainstate", (1 << 20), false, true, false);
+        for (int i = 0; i < 1000; i++) {
+            BOOST_CHECK(dbw.Write(i, uint256()));
+        }
+        uint256 res;
+        BOOST_CHECK(dbw.Read(999, res));
+        BOOST_CHECK(!dbw.Read(1000, res));
+
+        // Options for all databases and for this one are applied.
+        const leveldb::Options &options = dbwrapper_private::GetOptions(dbw);
+        BOOST_CHECK_EQUAL(options.block_size, 16384);
+        BOOST_CHECK(options.filter_policy == nullptr);
+        BOOST_CHECK_EQUAL(options.max_open_files, 1000);
+        BOOST_CHECK_EQUAL(options.max_file_size, 2 << 20);
+
+        // The database is listed with its LevelDB statistics.
+        bool fFound = false;
+        ForEachDBWrapper([&](const CDBWrapper &db) {
+            std::string value;
+            if (&db == &dbw) {
+                fFound = db.GetName() == "chainstate" &&
+                         db.GetProperty("leveldb.stats", value);
+            }
+        });
+        BOOST_CHECK(fFound);
+    }
+    {
+        // Per-type databases are named after their parent directory, and
+        // options for other databases are not applied.
+        CDBWrapper dbw(ph / "blockfilter" / "basic", (1 << 20), false, true,
+                       false);
+        BOOST_CHECK_EQUAL(dbw.GetName(), "blockfilter");
+        const leveldb::Options &options = dbwrapper_private::GetOptions(dbw);
+        BOOST_CHECK_EQUAL(options.block_size, 16384);
+        BOOST_CHECK(options.filter_policy != nullptr);
+        BOOST_CHECK_EQUAL(options.max_open_files, 64);
+        BOOST_CHECK_EQUAL(options.max_file_size, 8 << 20);
+    }
+    ClearArg("-dbopt");
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,235 @@
+// Copyright (c) 2018 The Bitcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "graphene.h"
+#include "config.h"
+#include "consensus/merkle.h"
+#include "pow.h"
+#include "random.h"
+#include "streams.h"
+#include "txmempool.h"
+
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+
+struct GrapheneTestingSetup : public TestingSetup {
+    GrapheneTestingSetup() : TestingSetup(CBaseChainParams::REGTEST) {}
+};
+
+BOOST_FIXTURE_TEST_SUITE(graphene_tests, GrapheneTestingSetup)
+
+static CTransactionRef MakeRandomTx() {
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].prevout.hash = InsecureRand256();
+    tx.vin[0].prevout.n = 0;
+    tx.vout.resize(1);
+    tx.vout[0].nValue = Amount(42);
+    return MakeTransactionRef(tx);
+}
+
+static CBlock BuildBlock(size_t nTx) {
+    CBlock block;
+    CMutableTransaction coinbase;
+    coinbase.vin.resize(1);
+    coinbase.vin[0].scriptSig.resize(10);
+    coinbase.vout.resize(1);
+    coinbase.vout[0].nValue = Amount(42);
+    block.vtx.push_back(MakeTransactionRef(coinbase));
+    for (size_t i = 1; i < nTx; i++) {
+        block.vtx.push_back(MakeRandomTx());
+    }
+    block.nVersion = 42;
+    block.hashPrevBlock = InsecureRand256();
+    block.nBits = 0x207fffff;
+
+    bool mutated;
+    block.hashMerkleRoot = BlockMerkleRoot(block, &mutated);
+    assert(!mutated);
+
+    GlobalConfig config;
+    while (!CheckProofOfWork(block.GetHash(), block.nBits, config)) {
+        ++block.nNonce;
+    }
+    return block;
+}
+
+BOOST_AUTO_TEST_CASE(iblt_list_entries) {
+    CIblt iblt(40, insecure_rand());
+    std::set<uint64_t> inserted, erased;
+    for (int i = 0; i < 10; i++) {
+        inserted.insert(GetRand(1ULL << 48));
+        erased.insert(GetRand(1ULL << 48));
+    }
+    // Keys both inserted and erased cancel out.
+    for (int i = 0; i < 1000; i++) {
+        uint64_t key = GetRand(1ULL << 48);
+        iblt.Insert(key);
+        iblt.Erase(key);
+    }
+    for (uint64_t key : inserted) {
+        iblt.Insert(key);
+    }
+    for (uint64_t key : erased) {
+        iblt.Erase(key);
+    }
+
+    CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
+    stream << iblt;
+    CIblt iblt2;
+    stream >> iblt2;
+
+    std::set<uint64_t> positive, negative;
+    BOOST_CHECK(iblt2.ListEntries(positive, negative));
+    BOOST_CHECK(positive == inserted);
+    BOOST_CHECK(negative == erased);
+
+    // An overloaded table can't be decoded.
+    for (int i = 0; i < 1000; i++) {
+        iblt2.Insert(GetRand(1ULL << 48));
+    }
+    positive.clear();
+    negative.clear();
+    BOOST_CHECK(!iblt2.ListEntries(positive, negative));
+}
+
+BOOST_AUTO_TEST_CASE(iblt_list_entries_crafted) {
+    // Insert a single key, then rewrite all but one of its cells so that
+    // peeling it makes the others pure again, forever unless decoding notices
+    // the key coming back.
+    CIblt iblt(10, insecure_rand());
+    iblt.Insert(GetRand(1ULL << 48));
+
+    CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
+    stream << iblt;
+    uint32_t nSalt;
+    std::vector<CIblt::Cell> cells;
+    stream >> nSalt >> cells;
+    bool fFirst = true;
+    for (CIblt::Cell &cell : cells) {
+        if (cell.IsEmpty()) {
+            continue;
+        }
+        if (!fFirst) {
+            cell = CIblt::Cell();
+            cell.count = 2;
+        }
+        fFirst = false;
+    }
+    stream << nSalt << cells;
+    CIblt crafted;
+    stream >> crafted;
+
+    std::set<uint64_t> positive, negative;
+    BOOST_CHECK(!crafted.ListEntries(positive, negative));
+}
+
+BOOST_AUTO_TEST_CASE(iblt_list_entries_extreme_counts) {
+    // Counts at the edge of the signed range wrap around when a key is peeled
+    // from their cell, and the table fails to decode.
+    CIblt iblt(10, insecure_rand());
+    iblt.Insert(GetRand(1ULL << 48));
+
+    CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
+    stream << iblt;
+    uint32_t nSalt;
+    std::vector<CIblt::Cell> cells;
+    stream >> nSalt >> cells;
+    bool fFirst = true;
+    for (CIblt::Cell &cell : cells) {
+        if (!cell.IsEmpty() && !fFirst) {
+            cell.count = 0x80000000;
+        }
+        fFirst &= cell.IsEmpty();
+    }
+    stream << nSalt << cells;
+    CIblt crafted;
+    stream >> crafted;
+
+    std::set<uint64_t> positive, negative;
+    BOOST_CHECK(!crafted.ListEntries(positive, negative));
+}
+
+BOOST_AUTO_TEST_CASE(shortid_filter) {
+    CShortIDFilter filter(1000, 0.01);
+    std::vector<uint64_t> keys;
+    for (int i = 0; i < 1000; i++) {
+        keys.push_back(GetRand(1ULL << 48));
+        filter.insert(keys.back());
+    }
+    for (uint64_t key : keys) {
+        BOOST_CHECK(filter.contains(key));
+    }
+    int nFalsePositives = 0;
+    for (int i = 0; i < 10000; i++) {
+        nFalsePositives += filter.contains(GetRand(1ULL << 48));
+    }
+    BOOST_CHECK(nFalsePositives < 300);
+
+    // A filter that can't filter anything is empty.
+    CShortIDFilter full(1000, 1.0);
+    BOOST_CHECK_EQUAL(full.GetSize(), 0U);
+    BOOST_CHECK(full.contains(GetRand(1ULL << 48)));
+}
+
+BOOST_AUTO_TEST_CASE(graphene_round_trip) {
+    CTxMemPool pool(CFeeRate(Amount(0)));
+    TestMemPoolEntryHelper entry;
+    CBlock block(BuildBlock(2000));
+
+    // The mempool has most of the block, and many other transactions.
+    for (size_t i = 1; i < block.vtx.size(); i++) {
+        if (i % 500 != 0) {
+            pool.addUnchecked(block.vtx[i]->GetId(),
+                              entry.FromTx(*block.vtx[i]));
+        }
+    }
+    for (int i = 0; i < 10000; i++) {
+        CTransactionRef tx = MakeRandomTx();
+        pool.addUnchecked(tx->GetId(), entry.FromTx(*tx));
+    }
+
+    CGrapheneBlock grapheneblock(block, pool.size());
+    CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
+    stream << grapheneblock;
+    // Much smaller than the 6 bytes per transaction of compact blocks.
+    BOOST_CHECK(stream.size() <
+                GetSerializeSize(CBlockHeaderAndShortTxIDs(block),
+                                 SER_NETWORK, PROTOCOL_VERSION));
+
+    CGrapheneBlock grapheneblock2;
+    stream >> grapheneblock2;
+    CBlockHeaderAndShortTxIDs cmpctblock;
+    std::vector<std::pair<uint256, CTransactionRef>> extra_txn;
+    BOOST_CHECK(grapheneblock2.Decode(GetConfig(), pool, extra_txn,
+                                      cmpctblock) == READ_STATUS_OK);
+
+    PartiallyDownloadedBlock partialBlock(GetConfig(), &pool);
+    BOOST_CHECK(partialBlock.InitData(cmpctblock, extra_txn) ==
+                READ_STATUS_OK);
+    std::vector<CTransactionRef> vtx_missing;
+    for (size_t i = 0; i < block.vtx.size(); i++) {
+        BOOST_CHECK_EQUAL(partialBlock.IsTxAvailable(i),
+                          i % 500 != 0 || i == 0);
+        if (!partialBlock.IsTxAvailable(i)) {
+            vtx_missing.push_back(block.vtx[i]);
+        }
+    }
+    CBlock block2;
+    BOOST_CHECK(partialBlock.FillBlock(block2, vtx_missing) == READ_STATUS_OK);
+    BOOST_CHECK_EQUAL(block.GetHash().ToString(), block2.GetHash().ToString());
+
+    // With none of the block in the mempool, the difference is too large to
+    // decode.
+    CTxMemPool emptyPool(CFeeRate(Amount(0)));
+    for (int i = 0; i < 2000; i++) {
+        CTransactionRef tx = MakeRandomTx();
+        emptyPool.addUnchecked(tx->GetId(), entry.FromTx(*tx));
+    }
+    BOOST_CHECK(grapheneblock2.Decode(GetConfig(), emptyPool, extra_txn,
+                                      cmpctblock) == READ_STATUS_FAILED);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,153 @@
+// Copyright (c) 2018 The Bitcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "txdb.h"
+#include "arith_uint256.h"
+#include "util.h"
+
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+
+#include <memory>
+#include <unordered_map>
+
+BOOST_FIXTURE_TEST_SUITE(txdb_tests, BasicTestingSetup)
+
+namespace {
+struct TestBlockIndex {
+    std::unordered_map<uint256, std::unique_ptr<CBlockIndex>, BlockHasher> map;
+
+    CBlockIndex *Insert(const uint256 &hash) {
+        if (hash.IsNull()) {
+            return nullptr;
+        }
+        std::unique_ptr<CBlockIndex> &entry = map[hash];
+        if (!entry) {
+            entry.reset(new CBlockIndex());
+            entry->phashBlock = &map.find(hash)->first;
+        }
+        return entry.get();
+    }
+};
+} // namespace
+
+BOOST_AUTO_TEST_CASE(blockindex_snapshot) {
+    CBlockTreeDB db(1 << 20, true);
+    fs::path path = GetDataDir() / "index.snapshot";
+
+    // Build a small chain. Low hashes satisfy the proof of work of any sane
+    // nBits.
+    std::vector<uint256> hashes;
+    std::vector<std::unique_ptr<CBlockIndex>> chain;
+    for (int i = 0; i < 50; i++) {
+        hashes.push_back(ArithToUint256(arith_uint256(i + 1)));
+    }
+    for (int i = 0; i < 50; i++) {
+        chain.emplace_back(new CBlockIndex());
+        CBlockIndex *pindex = chain.back().get();
+        pindex->phashBlock = &hashes[i];
+        pindex->pprev = i > 0 ? chain[i - 1].get() : nullptr;
+        pindex->nHeight = i;
+        pindex->nStatus = BLOCK_VALID_TREE | BLOCK_HAVE_DATA;
+        pindex->nFile = i / 10;
+        pindex->nDataPos = 1000 * i;
+        pindex->nTx = i + 1;
+        pindex->nVersion = 4;
+        pindex->hashMerkleRoot = InsecureRand256();
+        pindex->nTime = 1500000000 + 600 * i;
+        pindex->nBits = 0x1d00ffff;
+        pindex->nNonce = insecure_rand();
+    }
+    std::vector<const CBlockIndex *> blockinfo;
+    for (const std::unique_ptr<CBlockIndex> &pindex : chain) {
+        blockinfo.push_back(pindex.get());
+    }
+
+    // No snapshot written yet.
+    TestBlockIndex loaded;
+    auto insert = [&](const uint256 &hash) { return loaded.Insert(hash); };
+    BOOST_CHECK(!db.LoadBlockIndexSnapshot(path, insert));
+    BOOST_CHECK(loaded.map.empty());
+
+    BOOST_CHECK(db.WriteBlockIndexSnapshot(path, blockinfo));
+    BOOST_CHECK(db.LoadBlockIndexSnapshot(path, insert));
+    BOOST_CHECK_EQUAL(loaded.map.size(), chain.size());
+    for (const std::unique_ptr<CBlockIndex> &pindex : chain) {
+        const CBlockIndex *pcopy = loaded.map[pindex->GetBlockHash()].get();
+        BOOST_CHECK(pcopy->GetBlockHeader().GetHash() ==
+                    pindex->GetBlockHeader().GetHash());
+        BOOST_CHECK_EQUAL(pcopy->nHeight, pindex->nHeight);
+        BOOST_CHECK_EQUAL(pcopy->nStatus, pindex->nStatus);
+        BOOST_CHECK_EQUAL(pcopy->nFile, pindex->nFile);
+        BOOST_CHECK_EQUAL(pcopy->nDataPos, pindex->nDataPos);
+        BOOST_CHECK_EQUAL(pcopy->nTx, pindex->nTx);
+        BOOST_CHECK((pcopy->pprev ? pcopy->pprev->GetBlockHash()
+                                  : uint256()) ==
+                    (pindex->pprev ? pindex->pprev->GetBlockHash()
+                                   : uint256()));
+    }
+
+    // Writing block index entries invalidates the snapshot.
+    BOOST_CHECK(db.WriteBatchSync({}, 0, {blockinfo.back()}));
+    TestBlockIndex reloaded;
+    BOOST_CHECK(!db.LoadBlockIndexSnapshot(
+        path, [&](const uint256 &hash) { return reloaded.Insert(hash); }));
+    BOOST_CHECK(reloaded.map.empty());
+
+    // A corrupted snapshot is rejected.
+    BOOST_CHECK(db.WriteBlockIndexSnapshot(path, blockinfo));
+    FILE *file = fsbridge::fopen(path, "r+b");
+    BOOST_CHECK(file);
+    fseek(file, 100, SEEK_SET);
+    int ch = fgetc(file);
+    fseek(file, 100, SEEK_SET);
+    fputc(ch ^ 0xff, file);
+    fclose(file);
+    BOOST_CHECK(!db.LoadBlockIndexSnapshot(
+        path, [&](const uint256 &hash) { return reloaded.Insert(hash); }));
+    BOOST_CHECK(reloaded.map.empty());
+}
+
+BOOST_AUTO_TEST_CASE(txindex_queue) {
+    CTxIndexDB db(1 << 20, true);
+    uint256 hashBest;
+    BOOST_CHECK(!db.ReadBestBlock(hashBest));
+
+    std::vector<std::pair<uint256, CDiskTxPos>> entries;
+    for (int i = 0; i < 1000; i++) {
+        entries.push_back(std::make_pair(
+            InsecureRand256(), CDiskTxPos(CDiskBlockPos(i / 100, i), i + 81)));
+    }
+    uint256 hashBlock = InsecureRand256();
+
+    // Queued entries can be looked up before they are written.
+    BOOST_CHECK(db.QueueTxIndex(
+        std::vector<std::pair<uint256, CDiskTxPos>>(entries), uint256()));
+    for (const auto &entry : entries) {
+        CDiskTxPos pos;
+        BOOST_CHECK(db.ReadTxIndex(entry.first, pos));
+        BOOST_CHECK(pos == entry.second);
+        BOOST_CHECK_EQUAL(pos.nTxOffset, entry.second.nTxOffset);
+    }
+
+    // The sync point only moves with the batches that set it.
+    BOOST_CHECK(db.Sync());
+    BOOST_CHECK(!db.ReadBestBlock(hashBest));
+    BOOST_CHECK(db.QueueTxIndex({}, hashBlock));
+    BOOST_CHECK(db.Sync());
+    BOOST_CHECK(db.ReadBestBlock(hashBest));
+    BOOST_CHECK(hashBest == hashBlock);
+
+    for (const auto &entry : entries) {
+        CDiskTxPos pos;
+        BOOST_CHECK(db.ReadTxIndex(entry.first, pos));
+        BOOST_CHECK(pos == entry.second);
+        BOOST_CHECK_EQUAL(pos.nTxOffset, entry.second.nTxOffset);
+    }
+    CDiskTxPos pos;
+    BOOST_CHECK(!db.ReadTxIndex(InsecureRand256(), pos));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,137 @@
+// Copyright (c) 2018 The Bitcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "chainparams.h"
+#include "config.h"
+#include "consensus/validation.h"
+#include "key.h"
+#include "miner.h"
+#include "script/sign.h"
+#include "test/test_bitcoin.h"
+#include "validation.h"
+
+#include <boost/test/unit_test.hpp>
+
+#include <limits>
+
+namespace {
+/**
+ * Regtest chain on which canonical transaction ordering applies to every
+ * block after the initial 100.
+ */
+struct CanonicalOrderSetup : public TestChain100Setup {
+    CanonicalOrderSetup() {
+        UpdateCanonicalTxOrderHeight(CBaseChainParams::REGTEST,
+                                     chainActive.Height());
+    }
+
+    ~CanonicalOrderSetup() {
+        UpdateCanonicalTxOrderHeight(CBaseChainParams::REGTEST,
+                                     std::numeric_limits<int>::max());
+    }
+
+    // Spend the output of the given coinbase to an anyone-can-spend output.
+    CMutableTransaction SpendCoinbase(size_t nCoinbase, Amount nValue) {
+        const CTransaction &coinbaseTx = coinbaseTxns[nCoinbase];
+        CMutableTransaction tx;
+        tx.nVersion = 1;
+        tx.vin.resize(1);
+        tx.vin[0].prevout = COutPoint(coinbaseTx.GetId(), 0);
+        tx.vout.resize(1);
+        tx.vout[0].nValue = nValue;
+        tx.vout[0].scriptPubKey = CScript() << OP_TRUE;
+
+        std::vector<uint8_t> vchSig;
+        uint256 hash = SignatureHash(coinbaseTx.vout[0].scriptPubKey, tx, 0,
+                                     SIGHASH_ALL | SIGHASH_FORKID,
+                                     coinbaseTx.vout[0].nValue);
+        BOOST_CHECK(coinbaseKey.Sign(hash, vchSig));
+        vchSig.push_back(uint8_t(SIGHASH_ALL | SIGHASH_FORKID));
+        tx.vin[0].scriptSig << vchSig;
+        return tx;
+    }
+
+    // Build a block on the tip holding the given transactions in the given
+    // order, and check it as if it were to be connected.
+    bool CheckBlockWith(const std::vector<CMutableTransaction> &txns,
+                        CValidationState &state) {
+        const Config &config = GetConfig();
+        CScript scriptPubKey = CScript() << OP_TRUE;
+        std::unique_ptr<CBlockTemplate> pblocktemplate =
+            BlockAssembler(config, Params()).CreateNewBlock(scriptPubKey);
+        CBlock &block = pblocktemplate->block;
+        block.vtx.resize(1);
+        for (const CMutableTransaction &tx : txns) {
+            block.vtx.push_back(MakeTransactionRef(tx));
+        }
+
+        LOCK(cs_main);
+        unsigned int extraNonce = 0;
+        IncrementExtraNonce(config, &block, chainActive.Tip(), extraNonce);
+        return TestBlockValidity(config, state, block, chainActive.Tip(),
+                                 false, true);
+    }
+};
+} // namespace
+
+BOOST_FIXTURE_TEST_SUITE(txorder_tests, CanonicalOrderSetup)
+
+BOOST_AUTO_TEST_CASE(txorder_unsorted_block) {
+    std::vector<CMutableTransaction> txns;
+    txns.push_back(SpendCoinbase(0, 10 * CENT));
+    txns.push_back(SpendCoinbase(1, 10 * CENT));
+    if (txns[0].GetId() < txns[1].GetId()) {
+        std::swap(txns[0], txns[1]);
+    }
+
+    CValidationState state;
+    BOOST_CHECK(!CheckBlockWith(txns, state));
+    BOOST_CHECK_EQUAL(state.GetRejectReason(), "tx-ordering");
+
+    // The same transactions are fine once sorted.
+    std::swap(txns[0], txns[1]);
+    CValidationState stateSorted;
+    BOOST_CHECK(CheckBlockWith(txns, stateSorted));
+}
+
+BOOST_AUTO_TEST_CASE(txorder_spend_later_output) {
+    CMutableTransaction parent = SpendCoinbase(0, 10 * CENT);
+
+    // Find a child that sorts before its parent.
+    CMutableTransaction child;
+    child.nVersion = 1;
+    child.vin.resize(1);
+    child.vin[0].prevout = COutPoint(parent.GetId(), 0);
+    child.vout.resize(1);
+    child.vout[0].nValue = 9 * CENT;
+    child.vout[0].scriptPubKey = CScript() << OP_TRUE;
+    while (!(child.GetId() < parent.GetId())) {
+        child.nLockTime++;
+    }
+
+    std::vector<CMutableTransaction> txns = {child, parent};
+    CValidationState state;
+    BOOST_CHECK(CheckBlockWith(txns, state));
+
+    CScript scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey())
+                                     << OP_CHECKSIG;
+    CBlock block = CreateAndProcessBlock(txns, scriptPubKey);
+    BOOST_CHECK(chainActive.Tip()->GetBlockHash() == block.GetHash());
+}
+
+BOOST_AUTO_TEST_CASE(txorder_double_spend) {
+    std::vector<CMutableTransaction> txns;
+    txns.push_back(SpendCoinbase(0, 10 * CENT));
+    txns.push_back(SpendCoinbase(0, 11 * CENT));
+    if (txns[1].GetId() < txns[0].GetId()) {
+        std::swap(txns[0], txns[1]);
+    }
+
+    CValidationState state;
+    BOOST_CHECK(!CheckBlockWith(txns, state));
+    BOOST_CHECK_EQUAL(state.GetRejectReason(),
+                      "bad-txns-inputs-missingorspent");
+}
+
+BOOST_AUTO_TEST_SUITE_END()
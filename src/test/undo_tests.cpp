@@ -103,4 +103,136 @@ BOOST_AUTO_TEST_CASE(connect_utxo_extblock) {
     BOOST_CHECK(HasSpendableCoin(view, prevTx0.GetId()));
 }
 
+BOOST_AUTO_TEST_CASE(undo_unordered_block) {
+    CCoinsView coinsDummy;
+    CCoinsViewCache view(&coinsDummy);
+
+    CBlock block;
+    block.hashPrevBlock = InsecureRand256();
+    view.SetBestBlock(block.hashPrevBlock);
+
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].scriptSig.resize(10);
+    tx.vout.resize(1);
+    tx.vout[0].nValue = Amount(42);
+    tx.vout[0].scriptPubKey = CScript() << OP_TRUE;
+    auto coinbaseTx = CTransaction(tx);
+
+    tx.vin[0].prevout.hash = InsecureRand256();
+    tx.vin[0].prevout.n = 0;
+    tx.vin[0].scriptSig.resize(0);
+    auto prevTx = CTransaction(tx);
+    AddCoins(view, prevTx, 100);
+
+    tx.vin[0].prevout.hash = prevTx.GetId();
+    auto parentTx = CTransaction(tx);
+    tx.vin[0].prevout.hash = parentTx.GetId();
+    auto childTx = CTransaction(tx);
+
+    // The child comes first, as canonical ordering may require.
+    block.vtx.push_back(MakeTransactionRef(coinbaseTx));
+    block.vtx.push_back(MakeTransactionRef(childTx));
+    block.vtx.push_back(MakeTransactionRef(parentTx));
+
+    // Add all the outputs before spending any input.
+    CBlockUndo blockundo;
+    for (const auto &ptx : block.vtx) {
+        AddCoins(view, *ptx, 123456);
+    }
+    for (size_t i = 1; i < block.vtx.size(); i++) {
+        blockundo.vtxundo.push_back(CTxUndo());
+        for (const CTxIn &txin : block.vtx[i]->vin) {
+            blockundo.vtxundo.back().vprevout.emplace_back();
+            BOOST_CHECK(view.SpendCoin(
+                txin.prevout, &blockundo.vtxundo.back().vprevout.back()));
+        }
+    }
+    view.SetBestBlock(block.GetHash());
+
+    BOOST_CHECK(HasSpendableCoin(view, childTx.GetId()));
+    BOOST_CHECK(!HasSpendableCoin(view, parentTx.GetId()));
+    BOOST_CHECK(!HasSpendableCoin(view, prevTx.GetId()));
+
+    CBlockIndex pindex;
+    pindex.nHeight = 123456;
+    BOOST_CHECK_EQUAL(ApplyBlockUndo(blockundo, block, &pindex, view),
+                      DISCONNECT_OK);
+
+    BOOST_CHECK(view.GetBestBlock() == block.hashPrevBlock);
+    BOOST_CHECK(!HasSpendableCoin(view, coinbaseTx.GetId()));
+    BOOST_CHECK(!HasSpendableCoin(view, childTx.GetId()));
+    BOOST_CHECK(!HasSpendableCoin(view, parentTx.GetId()));
+    BOOST_CHECK(HasSpendableCoin(view, prevTx.GetId()));
+}
+
+BOOST_AUTO_TEST_CASE(undo_sharded_block) {
+    // Enough coins to undo the block from several threads.
+    const int nScriptCheckThreadsOld = nScriptCheckThreads;
+    nScriptCheckThreads = 4;
+
+    CCoinsView coinsDummy;
+    CCoinsViewCache base(&coinsDummy);
+
+    CBlock block;
+    block.hashPrevBlock = InsecureRand256();
+    base.SetBestBlock(block.hashPrevBlock);
+
+    CMutableTransaction coinbase;
+    coinbase.vin.resize(1);
+    coinbase.vin[0].scriptSig.resize(10);
+    coinbase.vout.resize(1);
+    coinbase.vout[0].nValue = Amount(42);
+    coinbase.vout[0].scriptPubKey = CScript() << OP_TRUE;
+    block.vtx.push_back(MakeTransactionRef(coinbase));
+
+    // Spend 2000 coins from earlier blocks, half of them through a second
+    // transaction in the block.
+    std::vector<uint256> prevTxIds;
+    for (int i = 0; i < 2000; i++) {
+        CMutableTransaction tx;
+        tx.vin.resize(1);
+        tx.vin[0].prevout = COutPoint(InsecureRand256(), 0);
+        tx.vout.resize(2);
+        tx.vout[0].nValue = Amount(i + 1);
+        tx.vout[0].scriptPubKey = CScript() << OP_TRUE;
+        tx.vout[1] = tx.vout[0];
+        CTransaction prevTx(tx);
+        AddCoins(base, prevTx, 100);
+        prevTxIds.push_back(prevTx.GetId());
+
+        tx.vin[0].prevout = COutPoint(prevTx.GetId(), 0);
+        CTransaction spendTx(tx);
+        block.vtx.push_back(MakeTransactionRef(spendTx));
+        if (i % 2 == 0) {
+            tx.vin[0].prevout = COutPoint(spendTx.GetId(), 1);
+            block.vtx.push_back(MakeTransactionRef(CTransaction(tx)));
+        }
+    }
+
+    CCoinsViewCache view(&base);
+    CBlockUndo blockundo;
+    UpdateCoins(*block.vtx[0], view, 123456);
+    for (size_t i = 1; i < block.vtx.size(); i++) {
+        blockundo.vtxundo.push_back(CTxUndo());
+        UpdateCoins(*block.vtx[i], view, blockundo.vtxundo.back(), 123456);
+    }
+    view.SetBestBlock(block.GetHash());
+
+    CBlockIndex pindex;
+    pindex.nHeight = 123456;
+    BOOST_CHECK_EQUAL(ApplyBlockUndo(blockundo, block, &pindex, view),
+                      DISCONNECT_OK);
+    BOOST_CHECK(view.GetBestBlock() == block.hashPrevBlock);
+    for (const auto &ptx : block.vtx) {
+        BOOST_CHECK(!view.HaveCoin(COutPoint(ptx->GetId(), 0)));
+    }
+    for (const uint256 &txid : prevTxIds) {
+        BOOST_CHECK(view.HaveCoin(COutPoint(txid, 0)));
+        BOOST_CHECK(view.HaveCoin(COutPoint(txid, 1)));
+    }
+
+    nScriptCheckThreads = nScriptCheckThreadsOld;
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -7,13 +7,19 @@
 
 #include "chainparams.h"
 #include "config.h"
+#include "crypto/common.h"
+#include "crypto/sha256.h"
 #include "hash.h"
 #include "pow.h"
+#include "random.h"
 #include "uint256.h"
+#include "util.h"
 
 #include <boost/thread.hpp>
 
+#include <atomic>
 #include <cstdint>
+#include <limits>
 
 static const char DB_COIN = 'C';
 static const char DB_COINS = 'c';
@@ -25,6 +31,12 @@ static const char DB_BEST_BLOCK = 'B';
 static const char DB_FLAG = 'F';
 static const char DB_REINDEX_FLAG = 'R';
 static const char DB_LAST_BLOCK = 'l';
+static const char DB_INDEX_SNAPSHOT = 'S';
+
+//! Write size at which erasing the old transaction index flushes its batch.
+static const size_t TXINDEX_BATCH_SIZE = 16 << 20;
+//! Entries CTxIndexDB keeps in memory before QueueTxIndex waits for writes.
+static const size_t MAX_PENDING_TXINDEX_ENTRIES = 1 << 19;
 
 namespace {         // 匿名命名空间，只能在本文件中使用
 
@@ -196,6 +208,10 @@ bool CBlockTreeDB::WriteBatchSync(
     for (std::vector<const CBlockIndex *>::const_iterator it = blockinfo.begin(); it != blockinfo.end(); it++) {
         batch.Write(std::make_pair(DB_BLOCK_INDEX, (*it)->GetBlockHash()), CDiskBlockIndex(*it));
     }
+    // Block index entries are changing, so any snapshot no longer matches.
+    if (!blockinfo.empty()) {
+        batch.Erase(DB_INDEX_SNAPSHOT);
+    }
     return WriteBatch(batch, true);
 }
 
@@ -203,13 +219,23 @@ bool CBlockTreeDB::ReadTxIndex(const uint256 &txid, CDiskTxPos &pos) {
     return Read(std::make_pair(DB_TXINDEX, txid), pos);
 }
 
-bool CBlockTreeDB::WriteTxIndex(
-    const std::vector<std::pair<uint256, CDiskTxPos>> &vect) {
+bool CBlockTreeDB::EraseTxIndex() {
+    std::unique_ptr<CDBIterator> pcursor(NewIterator());
     CDBBatch batch(*this);
-    for (std::vector<std::pair<uint256, CDiskTxPos>>::const_iterator it =
-             vect.begin();
-         it != vect.end(); it++)
-        batch.Write(std::make_pair(DB_TXINDEX, it->first), it->second);
+    for (pcursor->Seek(std::make_pair(DB_TXINDEX, uint256()));
+         pcursor->Valid(); pcursor->Next()) {
+        std::pair<char, uint256> key;
+        if (!pcursor->GetKey(key) || key.first != DB_TXINDEX) {
+            break;
+        }
+        batch.Erase(key);
+        if (batch.SizeEstimate() > TXINDEX_BATCH_SIZE) {
+            if (!WriteBatch(batch)) {
+                return false;
+            }
+            batch.Clear();
+        }
+    }
     return WriteBatch(batch);
 }
 
@@ -272,6 +298,204 @@ bool CBlockTreeDB::LoadBlockIndexGuts(
     return true;
 }
 
+namespace {
+/**
+ * The block index snapshot is a flat little-endian file: a fixed header, then
+ * one fixed-size record per block index entry, then the SHA256 of everything
+ * before it. Records can be located by offset, which allows decoding them in
+ * parallel without any per-entry stream deserialization.
+ */
+const uint8_t SNAPSHOT_MAGIC[4] = {'b', 'i', 'd', 'x'};
+const uint32_t SNAPSHOT_VERSION = 1;
+// magic, version, nonce, record count
+const size_t SNAPSHOT_HEADER_SIZE = 4 + 4 + 8 + 8;
+// hash, hashPrev, hashMerkleRoot, then 10 32-bit fields
+const size_t SNAPSHOT_RECORD_SIZE = 3 * 32 + 10 * 4;
+const size_t SNAPSHOT_CHECKSUM_SIZE = CSHA256::OUTPUT_SIZE;
+
+struct SnapshotRecord {
+    uint256 hashBlock;
+    CDiskBlockIndex index;
+};
+
+void EncodeSnapshotRecord(uint8_t *p, const CBlockIndex *pindex) {
+    const uint256 hashPrev =
+        pindex->pprev ? pindex->pprev->GetBlockHash() : uint256();
+    memcpy(p, pindex->GetBlockHash().begin(), 32);
+    memcpy(p + 32, hashPrev.begin(), 32);
+    memcpy(p + 64, pindex->hashMerkleRoot.begin(), 32);
+    p += 96;
+    WriteLE32(p, pindex->nHeight);
+    WriteLE32(p + 4, pindex->nStatus);
+    WriteLE32(p + 8, pindex->nTx);
+    WriteLE32(p + 12, pindex->nFile);
+    WriteLE32(p + 16, pindex->nDataPos);
+    WriteLE32(p + 20, pindex->nUndoPos);
+    WriteLE32(p + 24, pindex->nVersion);
+    WriteLE32(p + 28, pindex->nTime);
+    WriteLE32(p + 32, pindex->nBits);
+    WriteLE32(p + 36, pindex->nNonce);
+}
+
+void DecodeSnapshotRecord(const uint8_t *p, SnapshotRecord &record) {
+    CDiskBlockIndex &index = record.index;
+    memcpy(record.hashBlock.begin(), p, 32);
+    memcpy(index.hashPrev.begin(), p + 32, 32);
+    memcpy(index.hashMerkleRoot.begin(), p + 64, 32);
+    p += 96;
+    index.nHeight = ReadLE32(p);
+    index.nStatus = ReadLE32(p + 4);
+    index.nTx = ReadLE32(p + 8);
+    index.nFile = ReadLE32(p + 12);
+    index.nDataPos = ReadLE32(p + 16);
+    index.nUndoPos = ReadLE32(p + 20);
+    index.nVersion = ReadLE32(p + 24);
+    index.nTime = ReadLE32(p + 28);
+    index.nBits = ReadLE32(p + 32);
+    index.nNonce = ReadLE32(p + 36);
+}
+} // namespace
+
+bool CBlockTreeDB::WriteBlockIndexSnapshot(
+    const fs::path &path, const std::vector<const CBlockIndex *> &blockinfo) {
+    const uint64_t nonce = GetRand(std::numeric_limits<uint64_t>::max());
+    const size_t nPayload =
+        SNAPSHOT_HEADER_SIZE + blockinfo.size() * SNAPSHOT_RECORD_SIZE;
+    std::vector<uint8_t> data(nPayload + SNAPSHOT_CHECKSUM_SIZE);
+
+    memcpy(data.data(), SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+    WriteLE32(&data[4], SNAPSHOT_VERSION);
+    WriteLE64(&data[8], nonce);
+    WriteLE64(&data[16], blockinfo.size());
+    ParallelForRange(blockinfo.size(), GetNumCores(),
+                     [&](size_t begin, size_t end) {
+                         for (size_t i = begin; i < end; i++) {
+                             EncodeSnapshotRecord(
+                                 &data[SNAPSHOT_HEADER_SIZE +
+                                       i * SNAPSHOT_RECORD_SIZE],
+                                 blockinfo[i]);
+                         }
+                     });
+    CSHA256().Write(data.data(), nPayload).Finalize(&data[nPayload]);
+
+    fs::path pathTmp = path;
+    pathTmp += ".new";
+    FILE *file = fsbridge::fopen(pathTmp, "wb");
+    if (!file) {
+        return error("%s: failed to open %s", __func__, pathTmp.string());
+    }
+    bool fWritten = fwrite(data.data(), 1, data.size(), file) == data.size();
+    if (fWritten) {
+        FileCommit(file);
+    }
+    fclose(file);
+    if (!fWritten || !RenameOver(pathTmp, path)) {
+        return error("%s: failed to write %s", __func__, path.string());
+    }
+
+    // Only once the file is durably in place, record that it matches the
+    // database.
+    return Write(DB_INDEX_SNAPSHOT, nonce, true);
+}
+
+bool CBlockTreeDB::LoadBlockIndexSnapshot(
+    const fs::path &path,
+    std::function<CBlockIndex *(const uint256 &)> insertBlockIndex) {
+    uint64_t nonce;
+    if (!Read(DB_INDEX_SNAPSHOT, nonce)) {
+        LogPrintf("%s: no up to date block index snapshot\n", __func__);
+        return false;
+    }
+
+    std::vector<uint8_t> data;
+    try {
+        data.resize(fs::file_size(path));
+    } catch (const fs::filesystem_error &e) {
+        LogPrintf("%s: cannot stat %s: %s\n", __func__, path.string(),
+                  e.what());
+        return false;
+    }
+    if (data.size() < SNAPSHOT_HEADER_SIZE + SNAPSHOT_CHECKSUM_SIZE) {
+        LogPrintf("%s: block index snapshot is truncated\n", __func__);
+        return false;
+    }
+
+    FILE *file = fsbridge::fopen(path, "rb");
+    if (!file) {
+        LogPrintf("%s: failed to open %s\n", __func__, path.string());
+        return false;
+    }
+    bool fRead = fread(data.data(), 1, data.size(), file) == data.size();
+    fclose(file);
+    if (!fRead) {
+        LogPrintf("%s: failed to read %s\n", __func__, path.string());
+        return false;
+    }
+
+    const uint64_t nCount = ReadLE64(&data[16]);
+    if (memcmp(data.data(), SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) != 0 ||
+        ReadLE32(&data[4]) != SNAPSHOT_VERSION ||
+        ReadLE64(&data[8]) != nonce ||
+        nCount > (data.size() - SNAPSHOT_HEADER_SIZE - SNAPSHOT_CHECKSUM_SIZE) /
+                     SNAPSHOT_RECORD_SIZE) {
+        LogPrintf("%s: block index snapshot does not match the database\n",
+                  __func__);
+        return false;
+    }
+    const size_t nPayload = SNAPSHOT_HEADER_SIZE + nCount * SNAPSHOT_RECORD_SIZE;
+    uint8_t checksum[CSHA256::OUTPUT_SIZE];
+    CSHA256().Write(data.data(), nPayload).Finalize(checksum);
+    if (data.size() != nPayload + SNAPSHOT_CHECKSUM_SIZE ||
+        memcmp(checksum, &data[nPayload], SNAPSHOT_CHECKSUM_SIZE) != 0) {
+        LogPrintf("%s: block index snapshot checksum mismatch\n", __func__);
+        return false;
+    }
+
+    // Decode and check proof of work in parallel, before anything is
+    // inserted, so that a bad snapshot leaves the index untouched.
+    const Config &config = GetConfig();
+    std::vector<SnapshotRecord> records(nCount);
+    std::atomic<bool> fValid(true);
+    ParallelForRange(nCount, GetNumCores(), [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end && fValid; i++) {
+            DecodeSnapshotRecord(
+                &data[SNAPSHOT_HEADER_SIZE + i * SNAPSHOT_RECORD_SIZE],
+                records[i]);
+            if (!CheckProofOfWork(records[i].hashBlock,
+                                  records[i].index.nBits, config)) {
+                fValid = false;
+            }
+        }
+    });
+    if (!fValid) {
+        LogPrintf("%s: CheckProofOfWork failed on snapshot entry\n",
+                  __func__);
+        return false;
+    }
+
+    for (const SnapshotRecord &record : records) {
+        boost::this_thread::interruption_point();
+        const CDiskBlockIndex &diskindex = record.index;
+        CBlockIndex *pindexNew = insertBlockIndex(record.hashBlock);
+        pindexNew->pprev = insertBlockIndex(diskindex.hashPrev);
+        pindexNew->nHeight = diskindex.nHeight;
+        pindexNew->nFile = diskindex.nFile;
+        pindexNew->nDataPos = diskindex.nDataPos;
+        pindexNew->nUndoPos = diskindex.nUndoPos;
+        pindexNew->nVersion = diskindex.nVersion;
+        pindexNew->hashMerkleRoot = diskindex.hashMerkleRoot;
+        pindexNew->nTime = diskindex.nTime;
+        pindexNew->nBits = diskindex.nBits;
+        pindexNew->nNonce = diskindex.nNonce;
+        pindexNew->nStatus = diskindex.nStatus;
+        pindexNew->nTx = diskindex.nTx;
+    }
+
+    LogPrintf("%s: loaded %u block index entries from snapshot\n", __func__,
+              nCount);
+    return true;
+}
+
 namespace {
 //! Legacy class to deserialize pre-pertxout database entries without reindex.
 class CCoins {
@@ -377,3 +601,126 @@ bool CCoinsViewDB::Upgrade() {
     db.WriteBatch(batch);
     return true;
 }
+
+CTxIndexDB::SaltedTxidHasher::SaltedTxidHasher()
+    : k0(GetRand(std::numeric_limits<uint64_t>::max())),
+      k1(GetRand(std::numeric_limits<uint64_t>::max())) {}
+
+CTxIndexDB::CTxIndexDB(size_t nCacheSize, bool fMemory, bool fWipe)
+    : CDBWrapper(GetDataDir() / "indexes" / "txindex", nCacheSize, fMemory,
+                 fWipe),
+      nWriting(0), fWriteFailed(false), fStop(false) {
+    threadWriter = std::thread(
+        &TraceThread<std::function<void()>>, "txidxwr",
+        std::function<void()>(std::bind(&CTxIndexDB::ThreadWriter, this)));
+}
+
+CTxIndexDB::~CTxIndexDB() {
+    {
+        std::lock_guard<std::mutex> lock(cs);
+        fStop = true;
+    }
+    cond.notify_all();
+    threadWriter.join();
+}
+
+bool CTxIndexDB::ReadTxIndex(const uint256 &txid, CDiskTxPos &pos) {
+    {
+        std::lock_guard<std::mutex> lock(cs);
+        auto it = mapPending.find(txid);
+        if (it != mapPending.end()) {
+            pos = it->second;
+            return true;
+        }
+    }
+    return Read(std::make_pair(DB_TXINDEX, txid), pos);
+}
+
+bool CTxIndexDB::ReadBestBlock(uint256 &hashBestBlock) {
+    return Read(DB_BEST_BLOCK, hashBestBlock);
+}
+
+bool CTxIndexDB::QueueTxIndex(
+    std::vector<std::pair<uint256, CDiskTxPos>> &&list,
+    const uint256 &hashBestBlock) {
+    std::unique_lock<std::mutex> lock(cs);
+    cond.wait(lock, [this] {
+        return fWriteFailed || mapPending.size() < MAX_PENDING_TXINDEX_ENTRIES;
+    });
+    if (fWriteFailed) {
+        return false;
+    }
+    for (const auto &entry : list) {
+        mapPending[entry.first] = entry.second;
+    }
+    queue.push_back(PendingBatch());
+    queue.back().entries = std::move(list);
+    queue.back().hashBestBlock = hashBestBlock;
+    cond.notify_all();
+    return true;
+}
+
+bool CTxIndexDB::Sync() {
+    std::unique_lock<std::mutex> lock(cs);
+    cond.wait(lock, [this] {
+        return fWriteFailed || (queue.empty() && nWriting == 0);
+    });
+    return !fWriteFailed;
+}
+
+static bool SameTxPos(const CDiskTxPos &a, const CDiskTxPos &b) {
+    return a.nFile == b.nFile && a.nPos == b.nPos &&
+           a.nTxOffset == b.nTxOffset;
+}
+
+void CTxIndexDB::ThreadWriter() {
+    std::unique_lock<std::mutex> lock(cs);
+    while (true) {
+        cond.wait(lock, [this] { return fStop || !queue.empty(); });
+        if (queue.empty()) {
+            // Only stop once everything queued has been written.
+            return;
+        }
+
+        // Write everything queued so far in a single batch.
+        std::deque<PendingBatch> writing;
+        writing.swap(queue);
+        nWriting = writing.size();
+        lock.unlock();
+
+        CDBBatch batch(*this);
+        uint256 hashBestBlock;
+        for (const PendingBatch &pending : writing) {
+            for (const auto &entry : pending.entries) {
+                batch.Write(std::make_pair(DB_TXINDEX, entry.first),
+                            entry.second);
+            }
+            if (!pending.hashBestBlock.IsNull()) {
+                hashBestBlock = pending.hashBestBlock;
+            }
+        }
+        if (!hashBestBlock.IsNull()) {
+            batch.Write(DB_BEST_BLOCK, hashBestBlock);
+        }
+        bool fOk = WriteBatch(batch);
+
+        lock.lock();
+        if (!fOk) {
+            LogPrintf("%s: failed to write the transaction index\n",
+                      __func__);
+            fWriteFailed = true;
+        }
+        // Entries queued again since keep their newer position.
+        for (const PendingBatch &pending : writing) {
+            for (const auto &entry : pending.entries) {
+                auto it = mapPending.find(entry.first);
+                if (it != mapPending.end() &&
+                    SameTxPos(it->second, entry.second)) {
+                    mapPending.erase(it);
+                }
+            }
+        }
+        nWriting = 0;
+        cond.notify_all();
+    }
+}
@@ -10,8 +10,13 @@
 #include "coins.h"
 #include "dbwrapper.h"
 
+#include <condition_variable>
+#include <deque>
 #include <map>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
@@ -35,15 +40,17 @@ static const int64_t nDefaultDbCache = 450;
 static const int64_t nMaxDbCache = sizeof(void *) > 4 ? 16384 : 1024;
 //! min. -dbcache (MiB)
 static const int64_t nMinDbCache = 4;
-//! Max memory allocated to block tree DB specific cache, if no -txindex (MiB)
+//! Max memory allocated to block tree DB specific cache (MiB)
 static const int64_t nMaxBlockDBCache = 2;
-//! Max memory allocated to block tree DB specific cache, if -txindex (MiB)
+//! Max memory allocated to the transaction index DB cache (MiB)
 // Unlike for the UTXO database, for the txindex scenario the leveldb cache make
 // a meaningful difference:
 // https://github.com/bitcoin/bitcoin/pull/8273#issuecomment-229601991
-static const int64_t nMaxBlockDBAndTxIndexCache = 1024;
+static const int64_t nMaxTxIndexCache = 1024;
 //! Max memory allocated to coin DB specific cache (MiB)
 static const int64_t nMaxCoinsDBCache = 8;
+//! -blockindexsnapshot default
+static const bool DEFAULT_BLOCKINDEX_SNAPSHOT = true;
 
 struct CDiskTxPos : public CDiskBlockPos {
     unsigned int nTxOffset; // after header    // tx偏移量
@@ -134,11 +141,91 @@ public:
     bool ReadLastBlockFile(int &nFile);
     bool WriteReindexing(bool fReindex);
     bool ReadReindexing(bool &fReindex);
+    //! Entries written by older versions, see CTxIndexDB.
     bool ReadTxIndex(const uint256 &txid, CDiskTxPos &pos);
-    bool WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos>> &list);
+    //! Remove the transaction index entries kept here by older versions.
+    bool EraseTxIndex();
     bool WriteFlag(const std::string &name, bool fValue);
     bool ReadFlag(const std::string &name, bool &fValue);
     bool LoadBlockIndexGuts(std::function<CBlockIndex *(const uint256 &)> insertBlockIndex);
+
+    /**
+     * Write every given block index entry to a flat snapshot file, and mark
+     * the snapshot as matching the current database content. Any later
+     * WriteBatchSync touching block index entries invalidates it again.
+     */
+    bool WriteBlockIndexSnapshot(const fs::path &path,
+                                 const std::vector<const CBlockIndex *> &blockinfo);
+    /**
+     * Load the block index from a snapshot written by WriteBlockIndexSnapshot.
+     * Returns false without touching the index if the snapshot is missing,
+     * corrupted or out of date, in which case LoadBlockIndexGuts must be used.
+     */
+    bool LoadBlockIndexSnapshot(
+        const fs::path &path,
+        std::function<CBlockIndex *(const uint256 &)> insertBlockIndex);
+};
+
+/**
+ * Access to the transaction index database (indexes/txindex/).
+ *
+ * Entries are handed over to a writer thread so that block connection does
+ * not wait on them; lookups see them as soon as they are queued. Each batch
+ * can move the block the index is synced to, so that an index left behind
+ * by a crash is caught up again from there.
+ */
+class CTxIndexDB : public CDBWrapper {
+public:
+    CTxIndexDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+    ~CTxIndexDB();
+
+    bool ReadTxIndex(const uint256 &txid, CDiskTxPos &pos);
+    bool ReadBestBlock(uint256 &hashBestBlock);
+
+    /**
+     * Queue entries to be written, along with the new sync point unless
+     * hashBestBlock is null. Waits while too many entries are pending.
+     * Returns false if an earlier write failed.
+     */
+    bool QueueTxIndex(std::vector<std::pair<uint256, CDiskTxPos>> &&list,
+                      const uint256 &hashBestBlock);
+    //! Wait until every queued entry is written.
+    bool Sync();
+
+private:
+    CTxIndexDB(const CTxIndexDB &);
+    void operator=(const CTxIndexDB &);
+
+    struct PendingBatch {
+        std::vector<std::pair<uint256, CDiskTxPos>> entries;
+        uint256 hashBestBlock;
+    };
+
+    std::mutex cs;
+    std::condition_variable cond;
+    std::deque<PendingBatch> queue;
+    //! Hashes txids with a random salt, as they are chosen by whoever
+    //! creates the transactions.
+    class SaltedTxidHasher {
+    private:
+        const uint64_t k0, k1;
+
+    public:
+        SaltedTxidHasher();
+
+        size_t operator()(const uint256 &txid) const {
+            return SipHashUint256(k0, k1, txid);
+        }
+    };
+
+    //! Queued or being written entries, for lookups.
+    std::unordered_map<uint256, CDiskTxPos, SaltedTxidHasher> mapPending;
+    size_t nWriting;
+    bool fWriteFailed;
+    bool fStop;
+    std::thread threadWriter;
+
+    void ThreadWriter();
 };
 
 #endif // BITCOIN_TXDB_H
@@ -38,6 +38,7 @@
 
 #include <algorithm>
 #include <fcntl.h>
+#include <thread>
 #include <sys/resource.h>
 #include <sys/stat.h>
 
@@ -475,6 +476,7 @@ void ForceSetMultiArg(const std::string &strArg, const std::string &strValue) {
 void ClearArg(const std::string &strArg) {
     LOCK(cs_args);
     mapArgs.erase(strArg);
+    _mapMultiArgs.erase(strArg);
 }
 
 static const int screenWidth = 79;
@@ -871,6 +873,33 @@ int GetNumCores() {
 #endif
 }
 
+void ParallelForRange(size_t nCount, int nThreads,
+                      const std::function<void(size_t, size_t)> &fn,
+                      size_t nMinItemsPerThread) {
+    // Below nMinItemsPerThread items per thread, spawning threads costs more
+    // than it saves.
+    size_t nMaxThreads =
+        std::max<size_t>(1, nCount / std::max<size_t>(1, nMinItemsPerThread));
+    size_t nWorkers = std::min<size_t>(std::max(nThreads, 1), nMaxThreads);
+    if (nWorkers <= 1) {
+        fn(0, nCount);
+        return;
+    }
+
+    size_t nChunk = (nCount + nWorkers - 1) / nWorkers;
+    std::vector<std::thread> workers;
+    workers.reserve(nWorkers - 1);
+    for (size_t begin = nChunk; begin < nCount; begin += nChunk) {
+        size_t end = std::min(nCount, begin + nChunk);
+        workers.emplace_back([&fn, begin, end]() { fn(begin, end); });
+    }
+    // The calling thread takes the first range.
+    fn(0, std::min(nCount, nChunk));
+    for (std::thread &t : workers) {
+        t.join();
+    }
+}
+
 std::string CopyrightHolders(const std::string &strPrefix) {
     std::string strCopyrightHolders =
         strPrefix +
@@ -22,6 +22,7 @@
 #include <atomic>
 #include <cstdint>
 #include <exception>
+#include <functional>
 #include <map>
 #include <string>
 #include <vector>
@@ -246,6 +247,17 @@ std::string HelpMessageOpt(const std::string &option,
  */
 int GetNumCores();
 
+/**
+ * Split [0, nCount) into contiguous ranges and run fn(begin, end) on each of
+ * them from up to nThreads threads, returning once all ranges are processed.
+ * Runs inline when nThreads <= 1 or the range is too small to be worth it,
+ * that is when there are fewer than nMinItemsPerThread items per thread.
+ * fn must be safe to call concurrently on disjoint ranges and must not throw.
+ */
+void ParallelForRange(size_t nCount, int nThreads,
+                      const std::function<void(size_t, size_t)> &fn,
+                      size_t nMinItemsPerThread = 256);
+
 void RenameThread(const char *name);
 
 /**
@@ -6,7 +6,10 @@
 
 #include "validation.h"
 
+#include "addrindex.h"
 #include "arith_uint256.h"
+#include "blockbuffer.h"
+#include "blockfilterindex.h"
 #include "chainparams.h"
 #include "checkpoints.h"
 #include "checkqueue.h"
@@ -16,6 +19,7 @@
 #include "consensus/validation.h"
 #include "fs.h"
 #include "hash.h"
+#include "indexbackfill.h"
 #include "init.h"
 #include "policy/fees.h"
 #include "policy/policy.h"
@@ -43,6 +47,7 @@
 
 #include <atomic>
 #include <sstream>
+#include <unordered_map>
 
 #include <boost/algorithm/string/join.hpp>
 #include <boost/algorithm/string/replace.hpp>
@@ -63,6 +68,10 @@
 CCriticalSection cs_main;
 
 BlockMap mapBlockIndex;
+//! Backing storage for every CBlockIndex in mapBlockIndex.
+static BlockIndexArena blockIndexArena;
+//! Blocks received ahead of the tip, kept to avoid reading them back from disk.
+static CBlockBuffer blockBuffer(size_t(DEFAULT_BLOCK_BUFFER_SIZE) << 20);
 CChain chainActive;
 CBlockIndex *pindexBestHeader = nullptr;
 CWaitableCriticalSection csBestBlock;
@@ -71,6 +80,11 @@ int nScriptCheckThreads = 0;
 std::atomic_bool fImporting(false);
 bool fReindex = false;
 bool fTxIndex = false;
+/**
+ * Active chain block up to which the transaction index is complete, null if
+ * it has not been built yet. Guarded by cs_main.
+ */
+static uint256 hashTxIndexBestBlock;
 bool fHavePruned = false;
 bool fPruneMode = false;
 bool fIsBareMultisigStd = DEFAULT_PERMIT_BAREMULTISIG;
@@ -216,6 +230,7 @@ CBlockIndex *FindForkInGlobalIndex(const CChain &chain,
 
 CCoinsViewCache *pcoinsTip = nullptr;
 CBlockTreeDB *pblocktree = nullptr;
+CTxIndexDB *ptxindex = nullptr;
 
 enum FlushStateMode {
     FLUSH_STATE_NONE,
@@ -631,6 +646,20 @@ bool IsDAAEnabled(const Config &config, const CBlockIndex *pindexPrev) {
     return IsDAAEnabled(config, pindexPrev->nHeight);
 }
 
+static bool IsCanonicalTxOrderEnabled(const Config &config, int nHeight) {
+    return nHeight >=
+           config.GetChainParams().GetConsensus().canonicalTxOrderHeight;
+}
+
+bool IsCanonicalTxOrderEnabled(const Config &config,
+                               const CBlockIndex *pindexPrev) {
+    if (pindexPrev == nullptr) {
+        return false;
+    }
+
+    return IsCanonicalTxOrderEnabled(config, pindexPrev->nHeight);
+}
+
 // Used to avoid mempool polluting consensus critical paths if CCoinsViewMempool
 // were somehow broken and returning the wrong scriptPubKeys
 static bool CheckInputsFromMempoolAndCache(const CTransaction &tx,
@@ -1057,8 +1086,11 @@ bool GetTransaction(const Config &config, const uint256 &txid,
     }
 
     if (fTxIndex) {
+        // Entries written by older versions are used until the index is
+        // rebuilt in its own database.
         CDiskTxPos postx;
-        if (pblocktree->ReadTxIndex(txid, postx)) {
+        if (ptxindex->ReadTxIndex(txid, postx) ||
+            pblocktree->ReadTxIndex(txid, postx)) {
             CAutoFile file(OpenBlockFile(postx, true), SER_DISK,
                            CLIENT_VERSION);
             if (file.IsNull())
@@ -1103,6 +1135,87 @@ bool GetTransaction(const Config &config, const uint256 &txid,
     return false;
 }
 
+/** Transaction index entries of a block stored at pos. */
+static void GetTxIndexEntries(
+    const CBlock &block, const CDiskBlockPos &pos,
+    std::vector<std::pair<uint256, CDiskTxPos>> &vPos) {
+    CDiskTxPos postx(pos, GetSizeOfCompactSize(block.vtx.size()));
+    for (const auto &tx : block.vtx) {
+        vPos.push_back(std::make_pair(tx->GetId(), postx));
+        postx.nTxOffset += ::GetSerializeSize(*tx, SER_DISK, CLIENT_VERSION);
+    }
+}
+
+namespace {
+/** Backfill hooks of the transaction index. */
+class CTxIndexBackfill : public CIndexBackfill {
+public:
+    CTxIndexBackfill() : CIndexBackfill("Transaction index", false) {}
+
+    uint256 GetBestBlock() const override { return hashTxIndexBestBlock; }
+
+    bool Rewind(const CBlockIndex *pindexBest,
+                const CBlockIndex *pindexFork) override {
+        // Entries of blocks that left the active chain need not be removed:
+        // they still point at the blocks on disk.
+        hashTxIndexBestBlock = pindexFork->GetBlockHash();
+        return true;
+    }
+
+    bool Wipe() override {
+        hashTxIndexBestBlock.SetNull();
+        return true;
+    }
+
+    void BeginBatch(size_t nBlocks) override {
+        vEntries.clear();
+        vEntries.resize(nBlocks);
+    }
+
+    bool ProcessBlock(size_t i, const CBackfillBlock &entry,
+                      const CBlock &block,
+                      const CBlockUndo &blockundo) override {
+        // The genesis block is never indexed.
+        if (!entry.hashPrev.IsNull()) {
+            GetTxIndexEntries(block, entry.pos, vEntries[i]);
+        }
+        return true;
+    }
+
+    bool WriteBatch(const CBlockIndex *pindexLast) override {
+        std::vector<std::pair<uint256, CDiskTxPos>> vPos;
+        for (const auto &entries : vEntries) {
+            vPos.insert(vPos.end(), entries.begin(), entries.end());
+        }
+        if (!ptxindex->QueueTxIndex(std::move(vPos),
+                                    pindexLast->GetBlockHash())) {
+            return false;
+        }
+        hashTxIndexBestBlock = pindexLast->GetBlockHash();
+        return true;
+    }
+
+    void Synced() override {
+        // The index is complete, drop what older versions kept in the block
+        // tree database.
+        if (!ptxindex->Sync() || !pblocktree->EraseTxIndex()) {
+            LogPrintf("%s: failed to remove the old transaction index\n",
+                      __func__);
+        }
+    }
+
+private:
+    std::vector<std::vector<std::pair<uint256, CDiskTxPos>>> vEntries;
+};
+} // namespace
+
+void ThreadTxIndexBackfill(const Config &config) {
+    RenameThread("bitcoin-txindex");
+
+    CTxIndexBackfill backfill;
+    ThreadIndexBackfill(config, backfill);
+}
+
 //////////////////////////////////////////////////////////////////////////////
 //
 // CBlock and CBlockIndex
@@ -1356,6 +1469,130 @@ void UpdateCoins(const CTransaction &tx, CCoinsViewCache &inputs, int nHeight) {
     UpdateCoins(tx, inputs, txundo, nHeight);
 }
 
+/**
+ * Below this many coins per shard, spreading the UTXO updates of a block over
+ * several threads costs more than it saves.
+ */
+static const size_t MIN_COINS_PER_SHARD = 256;
+
+static size_t GetCoinShardCount(size_t nCoins) {
+    return std::max<size_t>(
+        1, std::min<size_t>(std::max(nScriptCheckThreads, 1),
+                            nCoins / MIN_COINS_PER_SHARD));
+}
+
+static size_t GetCoinShard(const COutPoint &out, size_t nShards) {
+    return (out.hash.GetCheapHash() + out.n) % nShards;
+}
+
+/**
+ * Run fn(shard, cache) for each of nShards shards, each from its own thread
+ * against its own child cache of view, then merge the child caches into view.
+ * Shards must touch disjoint outpoints and may only read the coins that view
+ * already has cached, as the child caches share view without locking.
+ */
+static void
+ForEachCoinShard(CCoinsViewCache &view, size_t nShards,
+                 const std::function<void(size_t, CCoinsViewCache &)> &fn) {
+    if (nShards <= 1) {
+        fn(0, view);
+        return;
+    }
+
+    const uint256 hashBlock = view.GetBestBlock();
+    std::vector<std::unique_ptr<CCoinsViewCache>> children(nShards);
+    std::vector<std::exception_ptr> errors(nShards);
+    for (auto &child : children) {
+        child.reset(new CCoinsViewCache(&view));
+        child->SetBestBlock(hashBlock);
+    }
+
+    ParallelForRange(nShards, nShards,
+                     [&](size_t begin, size_t end) {
+                         for (size_t shard = begin; shard < end; shard++) {
+                             try {
+                                 fn(shard, *children[shard]);
+                             } catch (...) {
+                                 errors[shard] = std::current_exception();
+                             }
+                         }
+                     },
+                     1);
+
+    for (const std::exception_ptr &error : errors) {
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+    for (auto &child : children) {
+        child->Flush();
+    }
+}
+
+/** Add the outputs of all the transactions in a block to view. */
+static void AddBlockCoins(const CBlock &block, CCoinsViewCache &view,
+                          int nHeight) {
+    size_t nOutputs = 0;
+    for (const auto &ptx : block.vtx) {
+        nOutputs += ptx->vout.size();
+    }
+
+    const size_t nShards = GetCoinShardCount(nOutputs);
+    ForEachCoinShard(view, nShards, [&](size_t shard, CCoinsViewCache &cache) {
+        for (const auto &ptx : block.vtx) {
+            const CTransaction &tx = *ptx;
+            // As in AddCoins, coinbases may overwrite pre-BIP30 duplicates.
+            const bool fCoinbase = tx.IsCoinBase();
+            for (size_t o = 0; o < tx.vout.size(); o++) {
+                const COutPoint out(tx.GetId(), o);
+                if (GetCoinShard(out, nShards) == shard) {
+                    cache.AddCoin(out, Coin(tx.vout[o], nHeight, fCoinbase),
+                                  fCoinbase);
+                }
+            }
+        }
+    });
+}
+
+/**
+ * Spend the inputs of all the transactions in a block from view, recording
+ * the spent coins in blockundo. Every input must already be cached in view.
+ * Returns false if an input is missing or spent twice.
+ */
+static bool SpendBlockCoins(const CBlock &block, CCoinsViewCache &view,
+                            CBlockUndo &blockundo) {
+    size_t nInputs = 0;
+    blockundo.vtxundo.resize(block.vtx.size() - 1);
+    for (size_t i = 1; i < block.vtx.size(); i++) {
+        nInputs += block.vtx[i]->vin.size();
+        blockundo.vtxundo[i - 1].vprevout.resize(block.vtx[i]->vin.size());
+    }
+
+    const size_t nShards = GetCoinShardCount(nInputs);
+    std::atomic<bool> fOk(true);
+    ForEachCoinShard(view, nShards, [&](size_t shard, CCoinsViewCache &cache) {
+        for (size_t i = 1; i < block.vtx.size() && fOk; i++) {
+            const CTransaction &tx = *block.vtx[i];
+            CTxUndo &txundo = blockundo.vtxundo[i - 1];
+            for (size_t j = 0; j < tx.vin.size(); j++) {
+                const COutPoint &out = tx.vin[j].prevout;
+                if (GetCoinShard(out, nShards) != shard) {
+                    continue;
+                }
+                // An outpoint always maps to the same shard, so a second
+                // spend finds the coin already spent in this cache.
+                if (!cache.HaveCoin(out)) {
+                    fOk = false;
+                    return;
+                }
+                cache.SpendCoin(out, &txundo.vprevout[j]);
+            }
+        }
+    });
+
+    return fOk;
+}
+
 bool CScriptCheck::operator()() {
     const CScript &scriptSig = ptxTo->vin[nIn].scriptSig;
     return VerifyScript(scriptSig, scriptPubKey, nFlags,
@@ -1550,6 +1787,8 @@ bool UndoWriteToDisk(const CBlockUndo &blockundo, CDiskBlockPos &pos,
     return true;
 }
 
+} // namespace
+
 bool UndoReadFromDisk(CBlockUndo &blockundo, const CDiskBlockPos &pos,
                       const uint256 &hashBlock) {
     // Open history file to read
@@ -1578,6 +1817,8 @@ bool UndoReadFromDisk(CBlockUndo &blockundo, const CDiskBlockPos &pos,
     return true;
 }
 
+namespace {
+
 /** Abort with a message */
 bool AbortNode(const std::string &strMessage,
                const std::string &userMessage = "") {
@@ -1657,62 +1898,117 @@ static DisconnectResult DisconnectBlock(const CBlock &block,
 }
 
 DisconnectResult ApplyBlockUndo(const CBlockUndo &blockUndo, const CBlock &block, const CBlockIndex *pindex, CCoinsViewCache &view) {
-    bool fClean = true;
-
     if (blockUndo.vtxundo.size() + 1 != block.vtx.size()) {
         error("DisconnectBlock(): block and undo data inconsistent");
         return DISCONNECT_FAILED;
     }
 
-    // Undo transactions in reverse order.
-    size_t i = block.vtx.size();
-    while (i-- > 0) {
+    size_t nInputs = 0;
+    bool fLegacyUndo = false;
+    for (size_t i = 1; i < block.vtx.size(); i++) {
         const CTransaction &tx = *(block.vtx[i]);
-        uint256 txid = tx.GetId();
+        const CTxUndo &txundo = blockUndo.vtxundo[i - 1];
+        if (txundo.vprevout.size() != tx.vin.size()) {
+            error("DisconnectBlock(): transaction and undo data inconsistent");
+            return DISCONNECT_FAILED;
+        }
 
-        // Check that all outputs are available and match the outputs in the
-        // block itself exactly.
-        for (size_t o = 0; o < tx.vout.size(); o++) {
-            if (tx.vout[o].scriptPubKey.IsUnspendable()) {
-                continue;
+        nInputs += tx.vin.size();
+        for (const Coin &undo : txundo.vprevout) {
+            fLegacyUndo = fLegacyUndo || undo.GetHeight() == 0;
+        }
+    }
+
+    // Undo the block in two passes, restoring all the inputs before removing
+    // all the outputs. Coins created and spent within the block are restored
+    // and then removed again, so this does not depend on the order of the
+    // transactions in the block. Each pass is sharded by outpoint.
+    std::atomic<bool> fFailed(false);
+    std::atomic<bool> fUnclean(false);
+
+    // Legacy undo records need to look up other outputs of the spent
+    // transaction, which may not be cached, so they are restored from a
+    // single thread.
+    size_t nShards = fLegacyUndo ? 1 : GetCoinShardCount(nInputs);
+    if (nShards > 1) {
+        for (size_t i = 1; i < block.vtx.size(); i++) {
+            for (const CTxIn &txin : block.vtx[i]->vin) {
+                view.HaveCoin(txin.prevout);
             }
+        }
+    }
 
-            COutPoint out(txid, o);
-            Coin coin;
-            bool is_spent = view.SpendCoin(out, &coin);
-            if (!is_spent || tx.vout[o] != coin.GetTxOut()) {
-                // transaction output mismatch
-                fClean = false;
+    ForEachCoinShard(view, nShards, [&](size_t shard, CCoinsViewCache &cache) {
+        for (size_t i = block.vtx.size(); i-- > 1 && !fFailed;) {
+            const CTransaction &tx = *(block.vtx[i]);
+            const CTxUndo &txundo = blockUndo.vtxundo[i - 1];
+            for (size_t j = tx.vin.size(); j-- > 0;) {
+                const COutPoint &out = tx.vin[j].prevout;
+                if (GetCoinShard(out, nShards) != shard) {
+                    continue;
+                }
+                const Coin &undo = txundo.vprevout[j];
+                DisconnectResult res = UndoCoinSpend(undo, cache, out);
+                if (res == DISCONNECT_FAILED) {
+                    fFailed = true;
+                    return;
+                }
+                if (res == DISCONNECT_UNCLEAN) {
+                    fUnclean = true;
+                }
             }
         }
+    });
 
-        // Restore inputs.
-        if (i < 1) {
-            // Skip the coinbase.
-            continue;
-        }
+    if (fFailed) {
+        return DISCONNECT_FAILED;
+    }
 
-        const CTxUndo &txundo = blockUndo.vtxundo[i - 1];
-        if (txundo.vprevout.size() != tx.vin.size()) {
-            error("DisconnectBlock(): transaction and undo data inconsistent");
-            return DISCONNECT_FAILED;
-        }
+    size_t nOutputs = 0;
+    for (const auto &ptx : block.vtx) {
+        nOutputs += ptx->vout.size();
+    }
 
-        for (size_t j = tx.vin.size(); j-- > 0;) {
-            const COutPoint &out = tx.vin[j].prevout;
-            const Coin &undo = txundo.vprevout[j];
-            DisconnectResult res = UndoCoinSpend(undo, view, out);
-            if (res == DISCONNECT_FAILED) {
-                return DISCONNECT_FAILED;
+    nShards = GetCoinShardCount(nOutputs);
+    if (nShards > 1) {
+        for (const auto &ptx : block.vtx) {
+            for (size_t o = 0; o < ptx->vout.size(); o++) {
+                view.HaveCoin(COutPoint(ptx->GetId(), o));
             }
-            fClean = fClean && res != DISCONNECT_UNCLEAN;
         }
     }
 
+    ForEachCoinShard(view, nShards, [&](size_t shard, CCoinsViewCache &cache) {
+        for (const auto &ptx : block.vtx) {
+            const CTransaction &tx = *ptx;
+            uint256 txid = tx.GetId();
+
+            // Check that all outputs are available and match the outputs in
+            // the block itself exactly.
+            for (size_t o = 0; o < tx.vout.size(); o++) {
+                if (tx.vout[o].scriptPubKey.IsUnspendable()) {
+                    continue;
+                }
+
+                COutPoint out(txid, o);
+                if (GetCoinShard(out, nShards) != shard) {
+                    continue;
+                }
+
+                Coin coin;
+                bool is_spent = cache.SpendCoin(out, &coin);
+                if (!is_spent || tx.vout[o] != coin.GetTxOut()) {
+                    // transaction output mismatch
+                    fUnclean = true;
+                }
+            }
+        }
+    });
+
     // Move best block pointer to previous block.
     view.SetBestBlock(block.hashPrevBlock);
 
-    return fClean ? DISCONNECT_OK : DISCONNECT_UNCLEAN;
+    return fUnclean ? DISCONNECT_UNCLEAN : DISCONNECT_OK;
 }
 
 static void FlushBlockFile(bool fFinalize = false) {
@@ -2031,6 +2327,16 @@ static bool ConnectBlock(const Config &config, const CBlock &block,
     vPos.reserve(block.vtx.size());
     blockundo.vtxundo.reserve(block.vtx.size() - 1);
 
+    // With canonical ordering, a transaction may spend the outputs of any
+    // other transaction in the block, so all the outputs are added before the
+    // transactions are checked and all the inputs are spent once they are.
+    // Both passes are sharded by outpoint across threads.
+    const bool fCanonicalOrder =
+        IsCanonicalTxOrderEnabled(config, pindex->pprev);
+    if (fCanonicalOrder) {
+        AddBlockCoins(block, view, pindex->nHeight);
+    }
+
     for (size_t i = 0; i < block.vtx.size(); i++) {
         const CTransaction &tx = *(block.vtx[i]);
 
@@ -2092,17 +2398,27 @@ static bool ConnectBlock(const Config &config, const CBlock &block,
             control.Add(vChecks);
         }
 
-        CTxUndo undoDummy;
-        if (i > 0) {
-            blockundo.vtxundo.push_back(CTxUndo());
+        if (!fCanonicalOrder) {
+            CTxUndo undoDummy;
+            if (i > 0) {
+                blockundo.vtxundo.push_back(CTxUndo());
+            }
+            UpdateCoins(tx, view,
+                        i == 0 ? undoDummy : blockundo.vtxundo.back(),
+                        pindex->nHeight);
         }
-        UpdateCoins(tx, view, i == 0 ? undoDummy : blockundo.vtxundo.back(),
-                    pindex->nHeight);
 
         vPos.push_back(std::make_pair(tx.GetId(), pos));
         pos.nTxOffset += ::GetSerializeSize(tx, SER_DISK, CLIENT_VERSION);
     }
 
+    // The checks above cached every input. As nothing was spent yet, inputs
+    // spent by several transactions are only caught here.
+    if (fCanonicalOrder && !SpendBlockCoins(block, view, blockundo)) {
+        return state.DoS(100, error("ConnectBlock(): inputs missing/spent"),
+                         REJECT_INVALID, "bad-txns-inputs-missingorspent");
+    }
+
     int64_t nTime3 = GetTimeMicros();
     nTimeConnect += nTime3 - nTime2;
     LogPrint(BCLog::BENCH,
@@ -2164,8 +2480,31 @@ static bool ConnectBlock(const Config &config, const CBlock &block,
         setDirtyBlockIndex.insert(pindex);
     }
 
-    if (fTxIndex && !pblocktree->WriteTxIndex(vPos)) {
-        return AbortNode(state, "Failed to write transaction index");
+    // Entries are written even while the index is being backfilled, but the
+    // sync point only moves once the backfill has caught up.
+    if (fTxIndex) {
+        const bool fSynced = IndexFollowsTip(hashTxIndexBestBlock, pindex);
+        if (!ptxindex->QueueTxIndex(std::move(vPos),
+                                    fSynced ? pindex->GetBlockHash()
+                                            : uint256())) {
+            return AbortNode(state, "Failed to write transaction index");
+        }
+        if (fSynced) {
+            hashTxIndexBestBlock = pindex->GetBlockHash();
+        }
+    }
+
+    // The other indexes follow the tip only once they have been backfilled.
+    if (paddressindex &&
+        IndexFollowsTip(paddressindex->GetBestBlock(), pindex) &&
+        !paddressindex->ConnectBlock(block, blockundo, pindex)) {
+        return AbortNode(state, "Failed to write address index");
+    }
+
+    if (pblockfilterindex &&
+        IndexFollowsTip(pblockfilterindex->GetBestBlock(), pindex) &&
+        !pblockfilterindex->ConnectBlock(block, blockundo, pindex)) {
+        return AbortNode(state, "Failed to write block filter index");
     }
 
     // add this block to the view's block chain
@@ -2433,70 +2772,283 @@ static void UpdateTip(const Config &config, CBlockIndex *pindexNew) {
  * mempool.removeForReorg and manually re-limit mempool size after this, with
  * cs_main held.
  */
-static bool DisconnectTip(const Config &config, CValidationState &state,
-                          bool fBare = false) {
-    CBlockIndex *pindexDelete = chainActive.Tip();
-    assert(pindexDelete);
-
-    // Read block from disk.
-    CBlock block;
-    if (!ReadBlockFromDisk(block, pindexDelete, config)) {
-        return AbortNode(state, "Failed to read block");
+/**
+ * Return the transactions of a block with every transaction placed after the
+ * in-block transactions it spends from, otherwise keeping the block order.
+ */
+static std::vector<CTransactionRef> TopologicalTxOrder(const CBlock &block) {
+    std::unordered_map<uint256, size_t, SaltedTxidHasher> positions;
+    for (size_t i = 0; i < block.vtx.size(); i++) {
+        positions.emplace(block.vtx[i]->GetId(), i);
     }
 
-    // Apply the block atomically to the chain state.
-    int64_t nStart = GetTimeMicros();
-    {
-        CCoinsViewCache view(pcoinsTip);
-        if (DisconnectBlock(block, pindexDelete, view) != DISCONNECT_OK) {
-            return error("DisconnectTip(): DisconnectBlock %s failed",
-                         pindexDelete->GetBlockHash().ToString());
+    std::vector<CTransactionRef> result;
+    result.reserve(block.vtx.size());
+    std::vector<bool> visited(block.vtx.size(), false);
+    // Pairs of transaction position and next input to look at.
+    std::vector<std::pair<size_t, size_t>> stack;
+    for (size_t i = 0; i < block.vtx.size(); i++) {
+        if (visited[i]) {
+            continue;
         }
 
-        bool flushed = view.Flush();
-        assert(flushed);
+        visited[i] = true;
+        stack.emplace_back(i, 0);
+        while (!stack.empty()) {
+            const size_t pos = stack.back().first;
+            const CTransaction &tx = *block.vtx[pos];
+            if (stack.back().second < tx.vin.size()) {
+                const uint256 &parent =
+                    tx.vin[stack.back().second++].prevout.hash;
+                auto it = positions.find(parent);
+                if (it != positions.end() && !visited[it->second]) {
+                    visited[it->second] = true;
+                    stack.emplace_back(it->second, 0);
+                }
+                continue;
+            }
+
+            result.push_back(block.vtx[pos]);
+            stack.pop_back();
+        }
     }
 
-    LogPrint(BCLog::BENCH, "- Disconnect block: %.2fms\n",
-             (GetTimeMicros() - nStart) * 0.001);
+    return result;
+}
 
-    // Write the chain state to disk, if necessary.
-    if (!FlushStateToDisk(state, FLUSH_STATE_IF_NEEDED)) {
-        return false;
+/**
+ * Resurrect the transactions of a disconnected block into the mempool,
+ * appending the ones that made it to vHashUpdate.
+ */
+static void ResurrectMempoolTransactions(const Config &config,
+                                         const CBlock &block,
+                                         std::vector<uint256> &vHashUpdate) {
+    // Canonically ordered blocks may list children before their parents, so
+    // resurrect the transactions in dependency order.
+    for (const auto &it : TopologicalTxOrder(block)) {
+        const CTransaction &tx = *it;
+        // ignore validation errors in resurrected transactions
+        CValidationState stateDummy;
+        if (tx.IsCoinBase() ||
+            !AcceptToMemoryPool(config, mempool, stateDummy, it, false,
+                                nullptr, nullptr, true)) {
+            mempool.removeRecursive(tx, MemPoolRemovalReason::REORG);
+        } else if (mempool.exists(tx.GetId())) {
+            vHashUpdate.push_back(tx.GetId());
+        }
     }
+}
 
-    if (!fBare) {
-        // Resurrect mempool transactions from the disconnected block.
-        std::vector<uint256> vHashUpdate;
-        for (const auto &it : block.vtx) {
-            const CTransaction &tx = *it;
-            // ignore validation errors in resurrected transactions
-            CValidationState stateDummy;
-            if (tx.IsCoinBase() ||
-                !AcceptToMemoryPool(config, mempool, stateDummy, it, false,
-                                    nullptr, nullptr, true)) {
-                mempool.removeRecursive(tx, MemPoolRemovalReason::REORG);
-            } else if (mempool.exists(tx.GetId())) {
-                vHashUpdate.push_back(tx.GetId());
-            }
+/**
+ * Maximum number of blocks DisconnectTipsTo holds in memory at once, along
+ * with their undo data.
+ */
+static const size_t MAX_DISCONNECT_BATCH_BLOCKS = 128;
+
+/**
+ * Maximum serialized size of the blocks and undo data DisconnectTipsTo holds
+ * in memory at once. A batch always holds at least one block.
+ */
+static const uint64_t MAX_DISCONNECT_BATCH_SIZE = 128 * ONE_MEGABYTE;
+
+/**
+ * Read a record size, as written in the header by WriteBlockToDisk and
+ * UndoWriteToDisk, from fileIn. Returns 0 if it cannot be read.
+ */
+static unsigned int ReadRecordSize(FILE *fileIn) {
+    CAutoFile filein(fileIn, SER_DISK, CLIENT_VERSION);
+    unsigned int nSize = 0;
+    if (!filein.IsNull()) {
+        try {
+            filein >> nSize;
+        } catch (const std::exception &) {
+            nSize = 0;
         }
-        // AcceptToMemoryPool/addUnchecked all assume that new mempool entries
-        // have no in-mempool children, which is generally not true when adding
-        // previously-confirmed transactions back to the mempool.
-        // UpdateTransactionsFromBlock finds descendants of any transactions in
-        // this block that were added back and cleans up the mempool state.
-        mempool.UpdateTransactionsFromBlock(vHashUpdate);
     }
+    return nSize;
+}
 
-    // Update chainActive and related variables.
-    UpdateTip(config, pindexDelete->pprev);
-    // Let wallets know transactions went from 1-confirmed to
-    // 0-confirmed or conflicted:
-    for (const auto &tx : block.vtx) {
-        GetMainSignals().SyncTransaction(
-            *tx, pindexDelete->pprev,
-            CMainSignals::SYNC_TRANSACTION_NOT_IN_BLOCK);
+/**
+ * Serialized size of the block and undo data of pindex, or 0 if unknown. Any
+ * actual failure to read the data is reported when it is read in full.
+ */
+static uint64_t GetBlockDataSize(const CBlockIndex *pindex) {
+    CDiskBlockPos pos = pindex->GetBlockPos();
+    CDiskBlockPos posUndo = pindex->GetUndoPos();
+    if (pos.IsNull() || posUndo.IsNull() || pos.nPos < sizeof(unsigned int) ||
+        posUndo.nPos < sizeof(unsigned int)) {
+        return 0;
     }
+    pos.nPos -= sizeof(unsigned int);
+    posUndo.nPos -= sizeof(unsigned int);
+    return uint64_t(ReadRecordSize(OpenBlockFile(pos, true))) +
+           ReadRecordSize(OpenUndoFile(posUndo, true));
+}
+
+/**
+ * Disconnect active blocks until pindexFork, which must be in chainActive, is
+ * the tip. Blocks are disconnected in batches: the block and undo data of a
+ * batch are read in parallel, undone into a single view that is flushed once,
+ * and only then is the tip moved. A batch that fails to disconnect is left
+ * connected. With fMarkFailed, the blocks of each batch are marked
+ * BLOCK_FAILED_CHILD once that batch has been disconnected.
+ */
+static bool DisconnectTipsTo(const Config &config, CValidationState &state,
+                             const CBlockIndex *pindexFork, bool fBare = false,
+                             bool fMarkFailed = false) {
+    AssertLockHeld(cs_main);
+
+    while (chainActive.Tip() != pindexFork) {
+        // Blocks to disconnect, from the tip down.
+        std::vector<CBlockIndex *> vpindexDelete;
+        uint64_t nBatchSize = 0;
+        for (CBlockIndex *pindex = chainActive.Tip();
+             pindex != pindexFork &&
+             vpindexDelete.size() < MAX_DISCONNECT_BATCH_BLOCKS;
+             pindex = pindex->pprev) {
+            assert(pindex);
+            nBatchSize += GetBlockDataSize(pindex);
+            if (!vpindexDelete.empty() &&
+                nBatchSize > MAX_DISCONNECT_BATCH_SIZE) {
+                break;
+            }
+            vpindexDelete.push_back(pindex);
+        }
+
+        // Read blocks and undo data from disk.
+        int64_t nStart = GetTimeMicros();
+        const size_t nBlocks = vpindexDelete.size();
+        std::vector<CBlock> vblock(nBlocks);
+        std::vector<CBlockUndo> vblockUndo(nBlocks);
+        // Not std::vector<bool>, as threads write to neighbouring elements.
+        std::vector<char> vfBlockRead(nBlocks, false);
+        std::vector<char> vfUndoRead(nBlocks, false);
+        ParallelForRange(nBlocks, GetNumCores(),
+                         [&](size_t begin, size_t end) {
+                             for (size_t i = begin; i < end; i++) {
+                                 const CBlockIndex *pindex = vpindexDelete[i];
+                                 vfBlockRead[i] =
+                                     ReadBlockFromDisk(vblock[i], pindex,
+                                                       config);
+                                 CDiskBlockPos pos = pindex->GetUndoPos();
+                                 vfUndoRead[i] =
+                                     !pos.IsNull() &&
+                                     UndoReadFromDisk(
+                                         vblockUndo[i], pos,
+                                         pindex->pprev->GetBlockHash());
+                             }
+                         },
+                         1);
+
+        for (size_t i = 0; i < nBlocks; i++) {
+            if (!vfBlockRead[i]) {
+                return AbortNode(state, "Failed to read block");
+            }
+            if (!vfUndoRead[i]) {
+                return error("DisconnectTipsTo(): failure reading undo data "
+                             "for %s",
+                             vpindexDelete[i]->GetBlockHash().ToString());
+            }
+        }
+
+        int64_t nTime1 = GetTimeMicros();
+        LogPrint(BCLog::BENCH, "- Read %u blocks to disconnect: %.2fms\n",
+                 nBlocks, (nTime1 - nStart) * 0.001);
+
+        // Apply the whole batch atomically to the chain state.
+        {
+            CCoinsViewCache view(pcoinsTip);
+            for (size_t i = 0; i < nBlocks; i++) {
+                const CBlockIndex *pindex = vpindexDelete[i];
+                assert(pindex->GetBlockHash() == view.GetBestBlock());
+                if (ApplyBlockUndo(vblockUndo[i], vblock[i], pindex, view) !=
+                    DISCONNECT_OK) {
+                    return error("DisconnectTipsTo(): DisconnectBlock %s "
+                                 "failed",
+                                 pindex->GetBlockHash().ToString());
+                }
+            }
+
+            bool flushed = view.Flush();
+            assert(flushed);
+        }
+
+        // Transaction index entries stay valid, only the sync point moves.
+        for (size_t i = 0; i < nBlocks; i++) {
+            if (hashTxIndexBestBlock == vpindexDelete[i]->GetBlockHash()) {
+                hashTxIndexBestBlock = vpindexDelete[i]->pprev->GetBlockHash();
+            }
+        }
+
+        for (size_t i = 0; paddressindex && i < nBlocks; i++) {
+            const CBlockIndex *pindex = vpindexDelete[i];
+            if (paddressindex->GetBestBlock() == pindex->GetBlockHash() &&
+                !paddressindex->DisconnectBlock(vblock[i], vblockUndo[i],
+                                                pindex)) {
+                return AbortNode(state, "Failed to write address index");
+            }
+        }
+
+        // Block filters stay valid, only the sync point moves.
+        for (size_t i = 0; pblockfilterindex && i < nBlocks; i++) {
+            const CBlockIndex *pindex = vpindexDelete[i];
+            if (pblockfilterindex->GetBestBlock() == pindex->GetBlockHash() &&
+                !pblockfilterindex->SetBestBlock(
+                    pindex->pprev->GetBlockHash())) {
+                return AbortNode(state, "Failed to write block filter index");
+            }
+        }
+
+        LogPrint(BCLog::BENCH, "- Disconnect %u blocks: %.2fms\n", nBlocks,
+                 (GetTimeMicros() - nTime1) * 0.001);
+
+        // Write the chain state to disk, if necessary.
+        if (!FlushStateToDisk(state, FLUSH_STATE_IF_NEEDED)) {
+            return false;
+        }
+
+        // Update chainActive and related variables.
+        for (CBlockIndex *pindex : vpindexDelete) {
+            UpdateTip(config, pindex->pprev);
+        }
+
+        if (fMarkFailed) {
+            for (CBlockIndex *pindex : vpindexDelete) {
+                pindex->nStatus |= BLOCK_FAILED_CHILD;
+                setDirtyBlockIndex.insert(pindex);
+                setBlockIndexCandidates.erase(pindex);
+            }
+        }
+
+        if (!fBare) {
+            // Resurrect mempool transactions from the disconnected blocks,
+            // lowest block first, so that they follow the transactions they
+            // spend from.
+            std::vector<uint256> vHashUpdate;
+            for (size_t i = nBlocks; i-- > 0;) {
+                ResurrectMempoolTransactions(config, vblock[i], vHashUpdate);
+            }
+            // AcceptToMemoryPool/addUnchecked all assume that new mempool
+            // entries have no in-mempool children, which is generally not
+            // true when adding previously-confirmed transactions back to the
+            // mempool. UpdateTransactionsFromBlock finds descendants of any
+            // transactions in these blocks that were added back and cleans up
+            // the mempool state.
+            mempool.UpdateTransactionsFromBlock(vHashUpdate);
+        }
+
+        // Let wallets know transactions went from 1-confirmed to
+        // 0-confirmed or conflicted:
+        for (size_t i = 0; i < nBlocks; i++) {
+            GetMainSignals().BlockDisconnected(vblock[i], vpindexDelete[i]);
+            for (const auto &tx : vblock[i].vtx) {
+                GetMainSignals().SyncTransaction(
+                    *tx, vpindexDelete[i]->pprev,
+                    CMainSignals::SYNC_TRANSACTION_NOT_IN_BLOCK);
+            }
+        }
+    }
+
     return true;
 }
 
@@ -2531,14 +3083,18 @@ static bool ConnectTip(const Config &config, CValidationState &state,
     assert(pindexNew->pprev == chainActive.Tip());
     // Read block from disk.
     int64_t nTime1 = GetTimeMicros();
-    if (!pblock) {
+    std::shared_ptr<const CBlock> pblockBuffered =
+        blockBuffer.Take(pindexNew->GetBlockHash());
+    if (pblock) {
+        connectTrace.blocksConnected.emplace_back(pindexNew, pblock);
+    } else if (pblockBuffered) {
+        connectTrace.blocksConnected.emplace_back(pindexNew, pblockBuffered);
+    } else {
         std::shared_ptr<CBlock> pblockNew = std::make_shared<CBlock>();
         connectTrace.blocksConnected.emplace_back(pindexNew, pblockNew);
         if (!ReadBlockFromDisk(*pblockNew, pindexNew, config)) {
             return AbortNode(state, "Failed to read block");
         }
-    } else {
-        connectTrace.blocksConnected.emplace_back(pindexNew, pblock);
     }
 
     const CBlock &blockConnecting = *connectTrace.blocksConnected.back().second;
@@ -2581,6 +3137,8 @@ static bool ConnectTip(const Config &config, CValidationState &state,
     mempool.removeForBlock(blockConnecting.vtx, pindexNew->nHeight);
     // Update chainActive & related variables.
     UpdateTip(config, pindexNew);
+    // Anything buffered at or below the new tip is now useless.
+    blockBuffer.RemoveUpTo(pindexNew->nHeight);
 
     int64_t nTime6 = GetTimeMicros();
     nTimePostConnect += nTime6 - nTime5;
@@ -2687,8 +3245,8 @@ static bool ActivateBestChainStep(const Config &config, CValidationState &state,
 
     // Disconnect active blocks which are no longer in the best chain.
     bool fBlocksDisconnected = false;
-    while (chainActive.Tip() && chainActive.Tip() != pindexFork) {
-        if (!DisconnectTip(config, state)) return false;
+    if (chainActive.Tip() && chainActive.Tip() != pindexFork) {
+        if (!DisconnectTipsTo(config, state, pindexFork)) return false;
         fBlocksDisconnected = true;
     }
 
@@ -2859,6 +3417,7 @@ bool ActivateBestChain(const Config &config, CValidationState &state,
             // Transactions in the connnected block are notified
             for (const auto &pair : connectTrace.blocksConnected) {
                 assert(pair.second);
+                GetMainSignals().BlockConnected(pair.second, pair.first);
                 const CBlock &block = *(pair.second);
                 for (size_t i = 0; i < block.vtx.size(); i++) {
                     GetMainSignals().SyncTransaction(*block.vtx[i], pair.first,
@@ -2935,14 +3494,12 @@ bool InvalidateBlock(const Config &config, CValidationState &state,
     setDirtyBlockIndex.insert(pindex);
     setBlockIndexCandidates.erase(pindex);
 
-    while (chainActive.Contains(pindex)) {
-        CBlockIndex *pindexWalk = chainActive.Tip();
-        pindexWalk->nStatus |= BLOCK_FAILED_CHILD;
-        setDirtyBlockIndex.insert(pindexWalk);
-        setBlockIndexCandidates.erase(pindexWalk);
+    if (chainActive.Contains(pindex)) {
         // ActivateBestChain considers blocks already in chainActive
         // unconditionally valid already, so force disconnect away from it.
-        if (!DisconnectTip(config, state)) {
+        // Descendants are marked invalid as they are disconnected, so that
+        // blocks still connected after a failure are not flagged.
+        if (!DisconnectTipsTo(config, state, pindex->pprev, false, true)) {
             mempool.removeForReorg(config, pcoinsTip,
                                    chainActive.Tip()->nHeight + 1,
                                    STANDARD_LOCKTIME_VERIFY_FLAGS);
@@ -3019,15 +3576,13 @@ CBlockIndex *AddToBlockIndex(const CBlockHeader &block) {
     if (it != mapBlockIndex.end()) return it->second;
 
     // Construct new block index object
-    CBlockIndex *pindexNew = new CBlockIndex(block);
-    assert(pindexNew);
+    CBlockIndex *pindexNew =
+        blockIndexArena.Allocate(hash, CBlockIndex(block));
     // We assign the sequence id to blocks only when the full data is available,
     // to avoid miners withholding blocks but broadcasting headers, to get a
     // competitive advantage.
     pindexNew->nSequenceId = 0;
-    BlockMap::iterator mi =
-        mapBlockIndex.insert(std::make_pair(hash, pindexNew)).first;
-    pindexNew->phashBlock = &((*mi).first);
+    mapBlockIndex.insert(std::make_pair(hash, pindexNew));
     BlockMap::iterator miPrev = mapBlockIndex.find(block.hashPrevBlock);
     if (miPrev != mapBlockIndex.end()) {
         pindexNew->pprev = (*miPrev).second;
@@ -3491,6 +4046,23 @@ bool ContextualCheckBlock(const Config &config, const CBlock &block,
         }
     }
 
+    // Once canonical ordering is enforced, transactions other than the
+    // coinbase must be sorted by txid.
+    if (IsCanonicalTxOrderEnabled(config, pindexPrev)) {
+        for (size_t i = 2; i < block.vtx.size(); i++) {
+            const uint256 &prevTxId = block.vtx[i - 1]->GetId();
+            const uint256 &txId = block.vtx[i]->GetId();
+            if (prevTxId == txId) {
+                return state.DoS(100, false, REJECT_INVALID, "tx-duplicate",
+                                 false, "duplicate transaction");
+            }
+            if (!(prevTxId < txId)) {
+                return state.DoS(100, false, REJECT_INVALID, "tx-ordering",
+                                 false, "transaction order is not canonical");
+            }
+        }
+    }
+
     // Enforce rule that the coinbase starts with serialized block height
     if (nHeight >= consensusParams.BIP34Height) {
         CScript expect = CScript() << nHeight;
@@ -3505,13 +4077,17 @@ bool ContextualCheckBlock(const Config &config, const CBlock &block,
     return true;
 }
 
+/**
+ * Accept a header whose hash has already been computed. fCheckPOW can be
+ * false if the proof of work of this header was already successfully checked.
+ */
 static bool AcceptBlockHeader(const Config &config, const CBlockHeader &block,
-                              CValidationState &state, CBlockIndex **ppindex) {
+                              const uint256 &hash, CValidationState &state,
+                              CBlockIndex **ppindex, bool fCheckPOW) {
     AssertLockHeld(cs_main);
     const CChainParams &chainparams = config.GetChainParams();
 
     // Check for duplicate
-    uint256 hash = block.GetHash();
     BlockMap::iterator miSelf = mapBlockIndex.find(hash);
     CBlockIndex *pindex = nullptr;
     if (hash != chainparams.GetConsensus().hashGenesisBlock) {
@@ -3529,7 +4105,7 @@ static bool AcceptBlockHeader(const Config &config, const CBlockHeader &block,
             return true;
         }
 
-        if (!CheckBlockHeader(config, block, state)) {
+        if (!CheckBlockHeader(config, block, state, fCheckPOW)) {
             return error("%s: Consensus::CheckBlockHeader: %s, %s", __func__,
                          hash.ToString(), FormatStateMessage(state));
         }
@@ -3576,17 +4152,39 @@ static bool AcceptBlockHeader(const Config &config, const CBlockHeader &block,
     return true;
 }
 
+static bool AcceptBlockHeader(const Config &config, const CBlockHeader &block,
+                              CValidationState &state, CBlockIndex **ppindex) {
+    return AcceptBlockHeader(config, block, block.GetHash(), state, ppindex,
+                             true);
+}
+
 // Exposed wrapper for AcceptBlockHeader
 bool ProcessNewBlockHeaders(const Config &config,
                             const std::vector<CBlockHeader> &headers,
                             CValidationState &state,
                             const CBlockIndex **ppindex) {
+    // Hashing the headers and checking their proof of work does not depend on
+    // any chain state, so do it in parallel before taking cs_main. Headers
+    // failing the check are checked again in AcceptBlockHeader, which
+    // produces the appropriate rejection, in order.
+    std::vector<uint256> vHashes(headers.size());
+    std::vector<char> vPowValid(headers.size());
+    ParallelForRange(headers.size(), std::max(nScriptCheckThreads, 1),
+                     [&](size_t begin, size_t end) {
+                         for (size_t i = begin; i < end; i++) {
+                             vHashes[i] = headers[i].GetHash();
+                             vPowValid[i] = CheckProofOfWork(
+                                 vHashes[i], headers[i].nBits, config);
+                         }
+                     });
+
     {
         LOCK(cs_main);
-        for (const CBlockHeader &header : headers) {
+        for (size_t i = 0; i < headers.size(); i++) {
             // Use a temp pindex instead of ppindex to avoid a const_cast
             CBlockIndex *pindex = nullptr;
-            if (!AcceptBlockHeader(config, header, state, &pindex)) {
+            if (!AcceptBlockHeader(config, headers[i], vHashes[i], state,
+                                   &pindex, !vPowValid[i])) {
                 return false;
             }
             if (ppindex) {
@@ -3715,6 +4313,12 @@ static bool AcceptBlock(const Config &config,
         return AbortNode(state, std::string("System error: ") + e.what());
     }
 
+    // Keep blocks that can't be connected yet in memory, so that they don't
+    // have to be read back from disk once their parents arrive.
+    if (pindex->nHeight > chainActive.Height()) {
+        blockBuffer.Add(pindex, pblock);
+    }
+
     if (fCheckForPruning) {
         // we just allocated more disk space for block files.
         FlushStateToDisk(state, FLUSH_STATE_NONE);
@@ -4008,18 +4612,22 @@ CBlockIndex *InsertBlockIndex(uint256 hash) {
     if (mi != mapBlockIndex.end()) return (*mi).second;
 
     // Create new
-    CBlockIndex *pindexNew = new CBlockIndex();
-    if (!pindexNew)
-        throw std::runtime_error(std::string(__func__) +
-                                 ": new CBlockIndex failed");
-    mi = mapBlockIndex.insert(std::make_pair(hash, pindexNew)).first;
-    pindexNew->phashBlock = &((*mi).first);
+    CBlockIndex *pindexNew = blockIndexArena.Allocate(hash, CBlockIndex());
+    mapBlockIndex.insert(std::make_pair(hash, pindexNew));
 
     return pindexNew;
 }
 
+static fs::path GetBlockIndexSnapshotPath() {
+    return GetDataDir() / "blocks" / "index.snapshot";
+}
+
 static bool LoadBlockIndexDB(const CChainParams &chainparams) {
-    if (!pblocktree->LoadBlockIndexGuts(InsertBlockIndex)) return false;
+    if (!GetBoolArg("-blockindexsnapshot", DEFAULT_BLOCKINDEX_SNAPSHOT) ||
+        !pblocktree->LoadBlockIndexSnapshot(GetBlockIndexSnapshotPath(),
+                                            InsertBlockIndex)) {
+        if (!pblocktree->LoadBlockIndexGuts(InsertBlockIndex)) return false;
+    }
 
     boost::this_thread::interruption_point();
 
@@ -4031,10 +4639,21 @@ static bool LoadBlockIndexDB(const CChainParams &chainparams) {
         vSortedByHeight.push_back(std::make_pair(pindex->nHeight, pindex));
     }
     sort(vSortedByHeight.begin(), vSortedByHeight.end());
-    for (const std::pair<int, CBlockIndex *> &item : vSortedByHeight) {
-        CBlockIndex *pindex = item.second;
-        pindex->nChainWork = (pindex->pprev ? pindex->pprev->nChainWork : 0) +
-                             GetBlockProof(*pindex);
+
+    // The per-block proof only depends on nBits, so it can be computed in
+    // parallel ahead of the sequential pass below.
+    std::vector<arith_uint256> vBlockProof(vSortedByHeight.size());
+    ParallelForRange(vSortedByHeight.size(), GetNumCores(),
+                     [&](size_t begin, size_t end) {
+                         for (size_t i = begin; i < end; i++) {
+                             vBlockProof[i] =
+                                 GetBlockProof(*vSortedByHeight[i].second);
+                         }
+                     });
+    for (size_t i = 0; i < vSortedByHeight.size(); i++) {
+        CBlockIndex *pindex = vSortedByHeight[i].second;
+        pindex->nChainWork =
+            (pindex->pprev ? pindex->pprev->nChainWork : 0) + vBlockProof[i];
         pindex->nTimeMax =
             (pindex->pprev ? std::max(pindex->pprev->nTimeMax, pindex->nTime)
                            : pindex->nTime);
@@ -4120,8 +4739,22 @@ static bool LoadBlockIndexDB(const CChainParams &chainparams) {
     pblocktree->ReadReindexing(fReindexing);
     fReindex |= fReindexing;
 
-    // Check whether we have a transaction index
-    pblocktree->ReadFlag("txindex", fTxIndex);
+    // Check whether we have a transaction index. It is built in the
+    // background when it gets enabled, and rebuilt when it gets enabled again
+    // after running without it.
+    bool fTxIndexOnDisk = false;
+    pblocktree->ReadFlag("txindex", fTxIndexOnDisk);
+    fTxIndex = GetBoolArg("-txindex", DEFAULT_TXINDEX);
+    if (fTxIndex != fTxIndexOnDisk &&
+        !pblocktree->WriteFlag("txindex", fTxIndex)) {
+        return error("%s: failed to update the transaction index flag",
+                     __func__);
+    }
+    hashTxIndexBestBlock.SetNull();
+    if (fTxIndex && fTxIndexOnDisk &&
+        !ptxindex->ReadBestBlock(hashTxIndexBestBlock)) {
+        hashTxIndexBestBlock.SetNull();
+    }
     LogPrintf("%s: transaction index %s\n", __func__,
               fTxIndex ? "enabled" : "disabled");
 
@@ -4318,24 +4951,25 @@ bool RewindBlockIndex(const Config &config) {
     // nHeight is now the height of the first insufficiently-validated block, or
     // tipheight + 1
     CValidationState state;
-    CBlockIndex *pindex = chainActive.Tip();
-    while (chainActive.Height() >= nHeight) {
-        if (fPruneMode && !(chainActive.Tip()->nStatus & BLOCK_HAVE_DATA)) {
+    CBlockIndex *pindexFork = chainActive.Tip();
+    while (pindexFork && pindexFork->nHeight >= nHeight) {
+        if (fPruneMode && !(pindexFork->nStatus & BLOCK_HAVE_DATA)) {
             // If pruning, don't try rewinding past the HAVE_DATA point; since
             // older blocks can't be served anyway, there's no need to walk
-            // further, and trying to DisconnectTip() will fail (and require a
+            // further, and trying to disconnect will fail (and require a
             // needless reindex/redownload of the blockchain).
             break;
         }
-        if (!DisconnectTip(config, state, true)) {
-            return error(
-                "RewindBlockIndex: unable to disconnect block at height %i",
-                pindex->nHeight);
-        }
-        // Occasionally flush state to disk.
-        if (!FlushStateToDisk(state, FLUSH_STATE_PERIODIC)) {
-            return false;
-        }
+        pindexFork = pindexFork->pprev;
+    }
+    if (!DisconnectTipsTo(config, state, pindexFork, true)) {
+        return error("RewindBlockIndex: unable to disconnect blocks down to "
+                     "height %i",
+                     pindexFork ? pindexFork->nHeight : -1);
+    }
+    // Occasionally flush state to disk.
+    if (!FlushStateToDisk(state, FLUSH_STATE_PERIODIC)) {
+        return false;
     }
 
     // Reduce validity flag and have-data flags.
@@ -4363,6 +4997,32 @@ bool RewindBlockIndex(const Config &config) {
     return true;
 }
 
+bool WriteBlockIndexSnapshot() {
+    AssertLockHeld(cs_main);
+    int64_t nStart = GetTimeMillis();
+
+    // Write entries in height order, so that parents are inserted before
+    // their children when loading.
+    std::vector<const CBlockIndex *> vBlocks;
+    vBlocks.reserve(mapBlockIndex.size());
+    for (const std::pair<uint256, CBlockIndex *> &item : mapBlockIndex) {
+        vBlocks.push_back(item.second);
+    }
+    std::sort(vBlocks.begin(), vBlocks.end(),
+              [](const CBlockIndex *a, const CBlockIndex *b) {
+                  return a->nHeight < b->nHeight;
+              });
+
+    if (!pblocktree->WriteBlockIndexSnapshot(GetBlockIndexSnapshotPath(),
+                                             vBlocks)) {
+        return false;
+    }
+
+    LogPrintf("Wrote block index snapshot with %u entries: %dms\n",
+              vBlocks.size(), GetTimeMillis() - nStart);
+    return true;
+}
+
 // May NOT be used after any connections are up as much of the peer-processing
 // logic assumes a consistent block index state
 void UnloadBlockIndex() {
@@ -4383,13 +5043,17 @@ void UnloadBlockIndex() {
         warningcache[b].clear();
     }
 
-    for (BlockMap::value_type &entry : mapBlockIndex) {
-        delete entry.second;
-    }
     mapBlockIndex.clear();
+    blockIndexArena.Clear();
+    blockBuffer.Clear();
     fHavePruned = false;
 }
 
+void SetBlockBufferSize(size_t nBytes) {
+    LOCK(cs_main);
+    blockBuffer.SetMaxUsage(nBytes);
+}
+
 bool LoadBlockIndex(const CChainParams &chainparams) {
     // Load block index from databases
     if (!fReindex && !LoadBlockIndexDB(chainparams)) {
@@ -4409,6 +5073,7 @@ bool InitBlockIndex(const Config &config) {
     // Use the provided setting for -txindex in the new database
     fTxIndex = GetBoolArg("-txindex", DEFAULT_TXINDEX);
     pblocktree->WriteFlag("txindex", fTxIndex);
+    hashTxIndexBestBlock.SetNull();
     LogPrintf("Initializing databases...\n");
 
     // Only add the genesis block if not reindexing (in which case we reuse the
@@ -5075,9 +5740,7 @@ public:
     CMainCleanup() {}
     ~CMainCleanup() {
         // block headers
-        BlockMap::iterator it1 = mapBlockIndex.begin();
-        for (; it1 != mapBlockIndex.end(); it1++)
-            delete (*it1).second;
         mapBlockIndex.clear();
+        blockIndexArena.Clear();
     }
 } instance_of_cmaincleanup;
@@ -14,6 +14,7 @@
 #include "amount.h"
 #include "chain.h"
 #include "coins.h"
+#include "consensus/consensus.h"
 #include "fs.h"
 #include "protocol.h" // For CMessageHeader::MessageMagic
 #include "script/script_error.h"
@@ -32,6 +33,7 @@
 
 class CBlockIndex;
 class CBlockTreeDB;
+class CTxIndexDB;
 class CBloomFilter;
 class CChainParams;
 class CConnman;
@@ -39,6 +41,7 @@ class CInv;
 class Config;
 class CScriptCheck;
 class CTxMemPool;
+class CBlockUndo;
 class CTxUndo;
 class CValidationInterface;
 class CValidationState;
@@ -87,12 +90,22 @@ static const unsigned int UNDOFILE_CHUNK_SIZE = 0x100000; // 1 MiB
 static const int MAX_SCRIPTCHECK_THREADS = 16;
 /** -par default (number of script-checking threads, 0 = auto) */
 static const int DEFAULT_SCRIPTCHECK_THREADS = 0;
-/** Number of blocks that can be requested at any given time from a single peer.
- */
+/** Number of blocks that can be requested at any given time from a single peer
+ * whose download rate is not known yet. */
 static const int MAX_BLOCKS_IN_TRANSIT_PER_PEER = 16;
+/** Upper bound on the number of blocks in flight from a single peer once its
+ * download rate is known. */
+static const int MAX_ADAPTIVE_BLOCKS_IN_TRANSIT_PER_PEER = 64;
+/** How many seconds worth of data, at the peer's measured download rate, we
+ * aim to keep in flight from each peer. */
+static const int64_t BLOCK_DOWNLOAD_TARGET_INFLIGHT_TIME = 10;
 /** Timeout in seconds during which a peer must stall block download progress
- * before being disconnected. */
+ * before having its blocks requested from other peers. This is extended for
+ * large blocks relative to the peer's download rate. */
 static const unsigned int BLOCK_STALLING_TIMEOUT = 2;
+/** Number of consecutive times a peer can stall block download, and have its
+ * in-flight blocks reassigned, before being disconnected. */
+static const int MAX_BLOCK_STALL_REASSIGNMENTS = 3;
 /** Number of headers sent in one getheaders result. We rely on the assumption
  * that if a peer sends
  *  less than this number, we reached its tip. Changing this value is a protocol
@@ -110,6 +123,14 @@ static const int MAX_BLOCKTXN_DEPTH = 10;
  * (which make reindexing and in the future perhaps pruning harder). We'll
  * probably want to make this a per-peer adaptive value at some point. */
 static const unsigned int BLOCK_DOWNLOAD_WINDOW = 1024;
+/** Amount of block data the download window may span. With large blocks, the
+ * window shrinks so that it covers at most this many bytes, but never less
+ * than MIN_BLOCK_DOWNLOAD_WINDOW blocks. */
+static const uint64_t BLOCK_DOWNLOAD_WINDOW_BYTES = 1024 * ONE_MEGABYTE;
+static const unsigned int MIN_BLOCK_DOWNLOAD_WINDOW = 16;
+/** Default for -blockbuffersize, the memory (in MiB) used to keep blocks that
+ * arrived ahead of the tip until they are connected. */
+static const unsigned int DEFAULT_BLOCK_BUFFER_SIZE = 256;
 /** Time to wait (in seconds) between writing blocks/block index to disk. */
 static const unsigned int DATABASE_WRITE_INTERVAL = 60 * 60;
 /** Time to wait (in seconds) between flushing chainstate to disk. */
@@ -120,6 +141,14 @@ static const unsigned int MAX_REJECT_MESSAGE_LENGTH = 111;
 static const unsigned int AVG_LOCAL_ADDRESS_BROADCAST_INTERVAL = 24 * 24 * 60;
 /** Average delay between peer address broadcasts in seconds. */
 static const unsigned int AVG_ADDRESS_BROADCAST_INTERVAL = 30;
+/** Delay between handing queued addresses to the peers relaying them, in
+ * seconds. */
+static const unsigned int ADDRESS_RELAY_FLUSH_INTERVAL = 5;
+/** Average number of addresses per second we process from a peer, beyond the
+ * ones it sends in reply to our getaddr. */
+static const double MAX_ADDR_RATE_PER_SECOND = 0.1;
+/** Maximum number of addresses a peer can have processed in a burst. */
+static const unsigned int MAX_ADDR_PROCESSING_TOKEN_BUCKET = 1000;
 /** Average delay between trickled inventory transmissions in seconds.
  *  Blocks and whitelisted receivers bypass this, outbound peers get half this
  * delay. */
@@ -291,6 +320,11 @@ bool InitBlockIndex(const Config &config);
 bool LoadBlockIndex(const CChainParams &chainparams);
 /** Unload database information */
 void UnloadBlockIndex();
+/** Write a flat snapshot of the block index, used to speed up next startup */
+bool WriteBlockIndexSnapshot();
+/** Set the memory limit of the buffer of blocks waiting to be connected. 0
+ * disables it. */
+void SetBlockBufferSize(size_t nBytes);
 /** Run an instance of the script checking thread */
 void ThreadScriptCheck();
 /** Check whether we are doing an initial block download (synchronizing from
@@ -311,6 +345,11 @@ std::string GetWarnings(const std::string &strFor);
 bool GetTransaction(const Config &config, const uint256 &hash,
                     CTransactionRef &tx, uint256 &hashBlock,
                     bool fAllowSlow = false);
+/**
+ * Build the transaction index up to the active chain tip, reading blocks
+ * from several threads. Run when -txindex is enabled on an existing chain.
+ */
+void ThreadTxIndexBackfill(const Config &config);
 /** Find the best known block, and make it the tip of the block chain */
 bool ActivateBestChain(
     const Config &config, CValidationState &state,
@@ -370,6 +409,10 @@ bool IsUAHFenabled(const Config &config, const CBlockIndex *pindexPrev);
 /** Check is DAA HF has activated. */
 bool IsDAAEnabled(const Config &config, const CBlockIndex *pindexPrev);
 
+/** Check if canonical transaction ordering is enforced. */
+bool IsCanonicalTxOrderEnabled(const Config &config,
+                               const CBlockIndex *pindexPrev);
+
 /** (try to) add transaction to memory pool
  * plTxnReplaced will be appended to with all transactions replaced from mempool
  * **/
@@ -546,6 +589,8 @@ bool ReadBlockFromDisk(CBlock &block, const CDiskBlockPos &pos,
                        const Config &config);
 bool ReadBlockFromDisk(CBlock &block, const CBlockIndex *pindex,
                        const Config &config);
+bool UndoReadFromDisk(CBlockUndo &blockundo, const CDiskBlockPos &pos,
+                      const uint256 &hashBlock);
 
 /** Functions for validating blocks and updating the block tree */
 
@@ -638,6 +683,10 @@ extern CCoinsViewCache *pcoinsTip;
  */
 extern CBlockTreeDB *pblocktree;
 
+/** Global variable that points to the transaction index, if -txindex is set
+ */
+extern CTxIndexDB *ptxindex;
+
 /**
  * Return the spend height, which is one more than the inputs.GetBestBlock().
  * While checking, GetBestBlock() refers to the parent block. (protected by
@@ -16,6 +16,10 @@ void RegisterValidationInterface(CValidationInterface *pwalletIn) {
         &CValidationInterface::UpdatedBlockTip, pwalletIn, _1, _2, _3));
     g_signals.SyncTransaction.connect(boost::bind(
         &CValidationInterface::SyncTransaction, pwalletIn, _1, _2, _3));
+    g_signals.BlockConnected.connect(
+        boost::bind(&CValidationInterface::BlockConnected, pwalletIn, _1, _2));
+    g_signals.BlockDisconnected.connect(boost::bind(
+        &CValidationInterface::BlockDisconnected, pwalletIn, _1, _2));
     g_signals.UpdatedTransaction.connect(
         boost::bind(&CValidationInterface::UpdatedTransaction, pwalletIn, _1));
     g_signals.SetBestChain.connect(
@@ -49,6 +53,10 @@ void UnregisterValidationInterface(CValidationInterface *pwalletIn) {
         boost::bind(&CValidationInterface::SetBestChain, pwalletIn, _1));
     g_signals.UpdatedTransaction.disconnect(
         boost::bind(&CValidationInterface::UpdatedTransaction, pwalletIn, _1));
+    g_signals.BlockDisconnected.disconnect(boost::bind(
+        &CValidationInterface::BlockDisconnected, pwalletIn, _1, _2));
+    g_signals.BlockConnected.disconnect(
+        boost::bind(&CValidationInterface::BlockConnected, pwalletIn, _1, _2));
     g_signals.SyncTransaction.disconnect(boost::bind(
         &CValidationInterface::SyncTransaction, pwalletIn, _1, _2, _3));
     g_signals.UpdatedBlockTip.disconnect(boost::bind(
@@ -65,6 +73,8 @@ void UnregisterAllValidationInterfaces() {
     g_signals.Inventory.disconnect_all_slots();
     g_signals.SetBestChain.disconnect_all_slots();
     g_signals.UpdatedTransaction.disconnect_all_slots();
+    g_signals.BlockDisconnected.disconnect_all_slots();
+    g_signals.BlockConnected.disconnect_all_slots();
     g_signals.SyncTransaction.disconnect_all_slots();
     g_signals.UpdatedBlockTip.disconnect_all_slots();
     g_signals.NewPoWValidBlock.disconnect_all_slots();
@@ -37,6 +37,10 @@ protected:
                                  bool fInitialDownload) {}
     virtual void SyncTransaction(const CTransaction &tx,
                                  const CBlockIndex *pindex, int posInBlock) {}
+    virtual void BlockConnected(const std::shared_ptr<const CBlock> &block,
+                                const CBlockIndex *pindex) {}
+    virtual void BlockDisconnected(const CBlock &block,
+                                   const CBlockIndex *pindex) {}
     virtual void SetBestChain(const CBlockLocator &locator) {}
     virtual void UpdatedTransaction(const uint256 &hash) {}
     virtual void Inventory(const uint256 &hash) {}
@@ -74,6 +78,21 @@ struct CMainSignals {
     boost::signals2::signal<void(const CTransaction &,
                                  const CBlockIndex *pindex, int posInBlock)>
         SyncTransaction;
+    /**
+     * Notifies listeners of a block connected to the active chain, before the
+     * SyncTransaction calls for its transactions. The block is the one that
+     * was just validated, so listeners can keep it instead of reading it back
+     * from disk.
+     */
+    boost::signals2::signal<void(const std::shared_ptr<const CBlock> &,
+                                 const CBlockIndex *)>
+        BlockConnected;
+    /**
+     * Notifies listeners of a block disconnected from the active chain, tip
+     * first, before the SyncTransaction calls for its transactions.
+     */
+    boost::signals2::signal<void(const CBlock &, const CBlockIndex *)>
+        BlockDisconnected;
     /**
      * Notifies listeners of an updated transaction without new data (for now: a
      * coinbase potentially becoming visible).
@@ -9,11 +9,26 @@ CZMQAbstractNotifier::~CZMQAbstractNotifier() {
     assert(!psocket);
 }
 
-bool CZMQAbstractNotifier::NotifyBlock(const CBlockIndex * /*CBlockIndex*/) {
+bool CZMQAbstractNotifier::NotifyBlock(CZMQBlockNotification & /*block*/) {
     return true;
 }
 
 bool CZMQAbstractNotifier::NotifyTransaction(
-    const CTransaction & /*transaction*/) {
+    CZMQTransactionNotification & /*tx*/) {
+    return true;
+}
+
+bool CZMQAbstractNotifier::NotifyTransactionRemoved(
+    const CZMQRemovalNotification & /*removal*/) {
+    return true;
+}
+
+bool CZMQAbstractNotifier::NotifyBlockConnected(
+    const CZMQBlockDeltaNotification & /*delta*/) {
+    return true;
+}
+
+bool CZMQAbstractNotifier::NotifyBlockDisconnected(
+    const CZMQBlockDeltaNotification & /*delta*/) {
     return true;
 }
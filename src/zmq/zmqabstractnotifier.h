@@ -7,11 +7,55 @@
 
 #include "zmqconfig.h"
 
-class CBlockIndex;
+#include "chain.h"
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
 class CZMQAbstractNotifier;
+enum class MemPoolRemovalReason;
 
 typedef CZMQAbstractNotifier *(*CZMQNotifierFactory)();
 
+/**
+ * Serialized bytes of a message part. Ownership is shared with the ZMQ
+ * messages sending them, so that the payload is neither copied nor freed
+ * before ZMQ is done with it.
+ */
+typedef std::shared_ptr<const std::vector<uint8_t>> CZMQPayload;
+
+/** A block that became the tip, as handed to every notifier in turn. */
+struct CZMQBlockNotification {
+    const CBlockIndex *pindex;
+    //! The block as it was connected, null if it has to be read from disk.
+    std::shared_ptr<const CBlock> pblock;
+    //! Where to read the block from, so that it needs no cs_main.
+    CDiskBlockPos pos;
+    //! Serialized block, filled by the first notifier that needs it.
+    CZMQPayload raw;
+};
+
+/** A transaction, as handed to every notifier in turn. */
+struct CZMQTransactionNotification {
+    CTransactionRef ptx;
+    //! Serialized transaction, filled by the first notifier that needs it.
+    CZMQPayload raw;
+};
+
+/** A transaction removed from the mempool. */
+struct CZMQRemovalNotification {
+    CTransactionRef ptx;
+    MemPoolRemovalReason reason;
+};
+
+/** A block connected to or disconnected from the active chain. */
+struct CZMQBlockDeltaNotification {
+    uint256 hash;
+    int nHeight;
+    std::vector<uint256> vtxid;
+};
+
 class CZMQAbstractNotifier {
 public:
     CZMQAbstractNotifier() : psocket(0) {}
@@ -29,8 +73,14 @@ public:
     virtual bool Initialize(void *pcontext) = 0;
     virtual void Shutdown() = 0;
 
-    virtual bool NotifyBlock(const CBlockIndex *pindex);
-    virtual bool NotifyTransaction(const CTransaction &transaction);
+    // Called from the ZMQ notifier thread only.
+    virtual bool NotifyBlock(CZMQBlockNotification &block);
+    virtual bool NotifyTransaction(CZMQTransactionNotification &tx);
+    virtual bool
+    NotifyTransactionRemoved(const CZMQRemovalNotification &removal);
+    virtual bool NotifyBlockConnected(const CZMQBlockDeltaNotification &delta);
+    virtual bool
+    NotifyBlockDisconnected(const CZMQBlockDeltaNotification &delta);
 
 protected:
     void *psocket;
@@ -6,16 +6,26 @@
 #include "zmqpublishnotifier.h"
 
 #include "streams.h"
+#include "txmempool.h"
 #include "util.h"
 #include "validation.h"
 #include "version.h"
 
+#include <functional>
+
+#include <boost/bind.hpp>
+
+//! Notifications that can be waiting to be published
+static const size_t MAX_ZMQ_QUEUE_SIZE = 10000;
+
 void zmqError(const char *str) {
     LogPrint(BCLog::ZMQ, "zmq: Error: %s, errno=%s\n", str,
              zmq_strerror(errno));
 }
 
-CZMQNotificationInterface::CZMQNotificationInterface() : pcontext(nullptr) {}
+CZMQNotificationInterface::CZMQNotificationInterface()
+    : pcontext(nullptr), fBlockDeltas(false), fRemovals(false), fStop(false),
+      pindexConnected(nullptr) {}
 
 CZMQNotificationInterface::~CZMQNotificationInterface() {
     Shutdown();
@@ -39,6 +49,12 @@ CZMQNotificationInterface *CZMQNotificationInterface::Create() {
         CZMQAbstractNotifier::Create<CZMQPublishRawBlockNotifier>;
     factories["pubrawtx"] =
         CZMQAbstractNotifier::Create<CZMQPublishRawTransactionNotifier>;
+    factories["pubmempoolremoved"] =
+        CZMQAbstractNotifier::Create<CZMQPublishMempoolRemovedNotifier>;
+    factories["pubblockconnected"] =
+        CZMQAbstractNotifier::Create<CZMQPublishBlockConnectedNotifier>;
+    factories["pubblockdisconnected"] =
+        CZMQAbstractNotifier::Create<CZMQPublishBlockDisconnectedNotifier>;
 
     for (std::map<std::string, CZMQNotifierFactory>::const_iterator i =
              factories.begin();
@@ -82,6 +98,9 @@ bool CZMQNotificationInterface::Initialize() {
     std::list<CZMQAbstractNotifier *>::iterator i = notifiers.begin();
     for (; i != notifiers.end(); ++i) {
         CZMQAbstractNotifier *notifier = *i;
+        fBlockDeltas |= notifier->GetType() == "pubblockconnected" ||
+                        notifier->GetType() == "pubblockdisconnected";
+        fRemovals |= notifier->GetType() == "pubmempoolremoved";
         if (notifier->Initialize(pcontext)) {
             LogPrint(BCLog::ZMQ, "  Notifier %s ready (address = %s)\n",
                      notifier->GetType(), notifier->GetAddress());
@@ -96,12 +115,36 @@ bool CZMQNotificationInterface::Initialize() {
         return false;
     }
 
+    threadNotifier = std::thread(&TraceThread<std::function<void()>>, "zmq",
+                                 std::function<void()>(std::bind(
+                                     &CZMQNotificationInterface::ThreadNotifier,
+                                     this)));
+
+    if (fRemovals) {
+        mempool.NotifyEntryRemoved.connect(boost::bind(
+            &CZMQNotificationInterface::TransactionRemovedFromMempool, this,
+            _1, _2));
+    }
+
     return true;
 }
 
 // Called during shutdown sequence
 void CZMQNotificationInterface::Shutdown() {
     LogPrint(BCLog::ZMQ, "zmq: Shutdown notification interface\n");
+    if (threadNotifier.joinable()) {
+        if (fRemovals) {
+            mempool.NotifyEntryRemoved.disconnect(boost::bind(
+                &CZMQNotificationInterface::TransactionRemovedFromMempool,
+                this, _1, _2));
+        }
+        {
+            std::lock_guard<std::mutex> lock(cs);
+            fStop = true;
+        }
+        cond.notify_all();
+        threadNotifier.join();
+    }
     if (pcontext) {
         for (std::list<CZMQAbstractNotifier *>::iterator i = notifiers.begin();
              i != notifiers.end(); ++i) {
@@ -116,16 +159,70 @@ void CZMQNotificationInterface::Shutdown() {
     }
 }
 
-void CZMQNotificationInterface::UpdatedBlockTip(const CBlockIndex *pindexNew,
-                                                const CBlockIndex *pindexFork,
-                                                bool fInitialDownload) {
-    // In IBD or blocks were disconnected without any new ones
-    if (fInitialDownload || pindexNew == pindexFork) return;
+// Only the txids are kept, so that queued deltas do not hold whole blocks.
+static void SetBlockDelta(CZMQBlockDeltaNotification &delta,
+                          const CBlock &block, const CBlockIndex *pindex) {
+    delta.hash = pindex->GetBlockHash();
+    delta.nHeight = pindex->nHeight;
+    delta.vtxid.reserve(block.vtx.size());
+    for (const auto &tx : block.vtx) {
+        delta.vtxid.push_back(tx->GetId());
+    }
+}
+
+void CZMQNotificationInterface::Enqueue(Notification &&notification) {
+    std::unique_lock<std::mutex> lock(cs);
+    cond.wait(lock, [this] { return queue.size() < MAX_ZMQ_QUEUE_SIZE; });
+    queue.push_back(std::move(notification));
+    cond.notify_all();
+}
+
+void CZMQNotificationInterface::ThreadNotifier() {
+    std::unique_lock<std::mutex> lock(cs);
+    while (true) {
+        cond.wait(lock, [this] { return fStop || !queue.empty(); });
+        if (queue.empty()) {
+            // Only stop once everything queued has been published.
+            return;
+        }
+
+        // Publish everything queued so far without holding the lock.
+        std::deque<Notification> publishing;
+        publishing.swap(queue);
+        cond.notify_all();
+        lock.unlock();
+
+        for (Notification &notification : publishing) {
+            Publish(notification);
+        }
 
+        lock.lock();
+    }
+}
+
+void CZMQNotificationInterface::Publish(Notification &notification) {
     for (std::list<CZMQAbstractNotifier *>::iterator i = notifiers.begin();
          i != notifiers.end();) {
         CZMQAbstractNotifier *notifier = *i;
-        if (notifier->NotifyBlock(pindexNew)) {
+        bool fOk = true;
+        switch (notification.type) {
+            case Notification::BLOCK:
+                fOk = notifier->NotifyBlock(notification.block);
+                break;
+            case Notification::TRANSACTION:
+                fOk = notifier->NotifyTransaction(notification.tx);
+                break;
+            case Notification::TRANSACTION_REMOVED:
+                fOk = notifier->NotifyTransactionRemoved(notification.removal);
+                break;
+            case Notification::BLOCK_CONNECTED:
+                fOk = notifier->NotifyBlockConnected(notification.delta);
+                break;
+            case Notification::BLOCK_DISCONNECTED:
+                fOk = notifier->NotifyBlockDisconnected(notification.delta);
+                break;
+        }
+        if (fOk) {
             i++;
         } else {
             notifier->Shutdown();
@@ -134,17 +231,85 @@ void CZMQNotificationInterface::UpdatedBlockTip(const CBlockIndex *pindexNew,
     }
 }
 
+void CZMQNotificationInterface::BlockConnected(
+    const std::shared_ptr<const CBlock> &block, const CBlockIndex *pindex) {
+    {
+        std::lock_guard<std::mutex> lock(cs);
+        pblockConnected = block;
+        pindexConnected = pindex;
+    }
+
+    if (fBlockDeltas) {
+        Notification notification;
+        notification.type = Notification::BLOCK_CONNECTED;
+        SetBlockDelta(notification.delta, *block, pindex);
+        Enqueue(std::move(notification));
+    }
+}
+
+void CZMQNotificationInterface::BlockDisconnected(const CBlock &block,
+                                                  const CBlockIndex *pindex) {
+    if (fBlockDeltas) {
+        Notification notification;
+        notification.type = Notification::BLOCK_DISCONNECTED;
+        SetBlockDelta(notification.delta, block, pindex);
+        Enqueue(std::move(notification));
+    }
+}
+
+void CZMQNotificationInterface::TransactionRemovedFromMempool(
+    CTransactionRef ptx, MemPoolRemovalReason reason) {
+    Notification notification;
+    notification.type = Notification::TRANSACTION_REMOVED;
+    notification.removal.ptx = ptx;
+    notification.removal.reason = reason;
+    Enqueue(std::move(notification));
+}
+
+void CZMQNotificationInterface::UpdatedBlockTip(const CBlockIndex *pindexNew,
+                                                const CBlockIndex *pindexFork,
+                                                bool fInitialDownload) {
+    Notification notification;
+    notification.type = Notification::BLOCK;
+    notification.block.pindex = pindexNew;
+    {
+        std::lock_guard<std::mutex> lock(cs);
+        if (pindexConnected == pindexNew) {
+            notification.block.pblock = pblockConnected;
+        }
+        pblockConnected.reset();
+        pindexConnected = nullptr;
+    }
+
+    // In IBD or blocks were disconnected without any new ones
+    if (fInitialDownload || pindexNew == pindexFork) return;
+
+    if (!notification.block.pblock) {
+        // The notifier thread must not take cs_main: it would deadlock with
+        // a caller holding it while waiting for room in the queue.
+        LOCK(cs_main);
+        notification.block.pos = pindexNew->GetBlockPos();
+    }
+
+    Enqueue(std::move(notification));
+}
+
 void CZMQNotificationInterface::SyncTransaction(const CTransaction &tx,
                                                 const CBlockIndex *pindex,
                                                 int posInBlock) {
-    for (std::list<CZMQAbstractNotifier *>::iterator i = notifiers.begin();
-         i != notifiers.end();) {
-        CZMQAbstractNotifier *notifier = *i;
-        if (notifier->NotifyTransaction(tx)) {
-            i++;
-        } else {
-            notifier->Shutdown();
-            i = notifiers.erase(i);
+    Notification notification;
+    notification.type = Notification::TRANSACTION;
+    {
+        // Share the transaction with the connected block when it is from it.
+        std::lock_guard<std::mutex> lock(cs);
+        if (pindex && pindex == pindexConnected && posInBlock >= 0 &&
+            size_t(posInBlock) < pblockConnected->vtx.size()) {
+            notification.tx.ptx = pblockConnected->vtx[posInBlock];
         }
     }
+    if (!notification.tx.ptx) {
+        notification.tx.ptx = MakeTransactionRef(tx);
+    }
+
+    Enqueue(std::move(notification));
 }
@@ -6,12 +6,17 @@
 #define BITCOIN_ZMQ_ZMQNOTIFICATIONINTERFACE_H
 
 #include "validationinterface.h"
+#include "zmqabstractnotifier.h"
 
+#include <condition_variable>
+#include <deque>
+#include <list>
 #include <map>
+#include <mutex>
 #include <string>
+#include <thread>
 
 class CBlockIndex;
-class CZMQAbstractNotifier;
 
 class CZMQNotificationInterface : public CValidationInterface {
 public:
@@ -26,6 +31,14 @@ protected:
     // CValidationInterface
     void SyncTransaction(const CTransaction &tx, const CBlockIndex *pindex,
                          int posInBlock) override;
+    void BlockConnected(const std::shared_ptr<const CBlock> &block,
+                        const CBlockIndex *pindex) override;
+    void BlockDisconnected(const CBlock &block,
+                           const CBlockIndex *pindex) override;
+
+    // CTxMemPool::NotifyEntryRemoved
+    void TransactionRemovedFromMempool(CTransactionRef ptx,
+                                       MemPoolRemovalReason reason);
     void UpdatedBlockTip(const CBlockIndex *pindexNew,
                          const CBlockIndex *pindexFork,
                          bool fInitialDownload) override;
@@ -34,7 +47,45 @@ private:
     CZMQNotificationInterface();
 
     void *pcontext;
+    //! Only used from the notifier thread once it is started.
     std::list<CZMQAbstractNotifier *> notifiers;
+
+    //! Whether any notifier publishes block deltas or mempool removals.
+    bool fBlockDeltas;
+    bool fRemovals;
+
+    struct Notification {
+        enum Type {
+            BLOCK,
+            TRANSACTION,
+            TRANSACTION_REMOVED,
+            BLOCK_CONNECTED,
+            BLOCK_DISCONNECTED,
+        } type;
+        CZMQBlockNotification block;
+        CZMQTransactionNotification tx;
+        CZMQRemovalNotification removal;
+        CZMQBlockDeltaNotification delta;
+    };
+
+    /**
+     * Notifications are published from their own thread so that serializing
+     * and sending large blocks does not hold up the validation signals. The
+     * queue is bounded: callers wait while it is full.
+     */
+    std::mutex cs;
+    std::condition_variable cond;
+    std::deque<Notification> queue;
+    bool fStop;
+    std::thread threadNotifier;
+
+    //! Last connected block, reused for the tip notification.
+    std::shared_ptr<const CBlock> pblockConnected;
+    const CBlockIndex *pindexConnected;
+
+    void Enqueue(Notification &&notification);
+    void ThreadNotifier();
+    void Publish(Notification &notification);
 };
 
 #endif // BITCOIN_ZMQ_ZMQNOTIFICATIONINTERFACE_H
@@ -6,10 +6,12 @@
 #include "config.h"
 #include "rpc/server.h"
 #include "streams.h"
+#include "txmempool.h"
 #include "util.h"
 #include "validation.h"
 
-#include <cstdarg>
+#include <algorithm>
+
 
 static std::multimap<std::string, CZMQAbstractPublishNotifier *>
     mapPublishNotifiers;
@@ -18,40 +20,74 @@ static const char *MSG_HASHBLOCK = "hashblock";
 static const char *MSG_HASHTX = "hashtx";
 static const char *MSG_RAWBLOCK = "rawblock";
 static const char *MSG_RAWTX = "rawtx";
+static const char *MSG_MEMPOOLREMOVED = "mempoolremoved";
+static const char *MSG_BLOCKCONNECTED = "blockconnected";
+static const char *MSG_BLOCKDISCONNECTED = "blockdisconnected";
+
+// Internal function to send one part of a multipart message, copying it
+static bool zmq_send_part(void *sock, const void *data, size_t size,
+                          bool fMore) {
+    zmq_msg_t msg;
+
+    int rc = zmq_msg_init_size(&msg, size);
+    if (rc != 0) {
+        zmqError("Unable to initialize ZMQ msg");
+        return false;
+    }
 
-// Internal function to send multipart message
-static int zmq_send_multipart(void *sock, const void *data, size_t size, ...) {
-    va_list args;
-    va_start(args, size);
-
-    while (1) {
-        zmq_msg_t msg;
+    memcpy(zmq_msg_data(&msg), data, size);
 
-        int rc = zmq_msg_init_size(&msg, size);
-        if (rc != 0) {
-            zmqError("Unable to initialize ZMQ msg");
-            return -1;
-        }
+    rc = zmq_msg_send(&msg, sock, fMore ? ZMQ_SNDMORE : 0);
+    if (rc == -1) {
+        zmqError("Unable to send ZMQ msg");
+        zmq_msg_close(&msg);
+        return false;
+    }
 
-        void *buf = zmq_msg_data(&msg);
-        memcpy(buf, data, size);
+    zmq_msg_close(&msg);
+    return true;
+}
 
-        data = va_arg(args, const void *);
+// Release the reference a ZMQ message held on its payload, called by ZMQ
+// once the message has been sent or dropped
+static void zmq_free_payload(void * /*data*/, void *hint) {
+    delete static_cast<CZMQPayload *>(hint);
+}
 
-        rc = zmq_msg_send(&msg, sock, data ? ZMQ_SNDMORE : 0);
-        if (rc == -1) {
-            zmqError("Unable to send ZMQ msg");
-            zmq_msg_close(&msg);
-            return -1;
-        }
+// Internal function to send one part of a multipart message without copying
+// it: the message keeps a reference to the payload until ZMQ releases it
+static bool zmq_send_part(void *sock, const CZMQPayload &payload,
+                          bool fMore) {
+    zmq_msg_t msg;
+
+    CZMQPayload *pref = new CZMQPayload(payload);
+    int rc =
+        zmq_msg_init_data(&msg, const_cast<uint8_t *>(payload->data()),
+                          payload->size(), zmq_free_payload, pref);
+    if (rc != 0) {
+        zmqError("Unable to initialize ZMQ msg");
+        delete pref;
+        return false;
+    }
 
+    rc = zmq_msg_send(&msg, sock, fMore ? ZMQ_SNDMORE : 0);
+    if (rc == -1) {
+        zmqError("Unable to send ZMQ msg");
         zmq_msg_close(&msg);
+        return false;
+    }
 
-        if (!data) break;
+    zmq_msg_close(&msg);
+    return true;
+}
 
-        size = va_arg(args, size_t);
-    }
-    return 0;
+template <typename T> static CZMQPayload SerializePayload(const T &obj) {
+    int nVersion = PROTOCOL_VERSION | RPCSerializationFlags();
+    std::vector<uint8_t> *pdata = new std::vector<uint8_t>();
+    CZMQPayload payload(pdata);
+    pdata->reserve(GetSerializeSize(obj, SER_NETWORK, nVersion));
+    CVectorWriter(SER_NETWORK, nVersion, *pdata, 0) << obj;
+    return payload;
 }
 
 bool CZMQAbstractPublishNotifier::Initialize(void *pcontext) {
@@ -124,9 +160,11 @@ bool CZMQAbstractPublishNotifier::SendMessage(const char *command,
     /* send three parts, command & data & a LE 4byte sequence number */
     uint8_t msgseq[sizeof(uint32_t)];
     WriteLE32(&msgseq[0], nSequence);
-    int rc = zmq_send_multipart(psocket, command, strlen(command), data, size,
-                                msgseq, (size_t)sizeof(uint32_t), (void *)0);
-    if (rc == -1) return false;
+    if (!zmq_send_part(psocket, command, strlen(command), true) ||
+        !zmq_send_part(psocket, data, size, true) ||
+        !zmq_send_part(psocket, msgseq, sizeof(msgseq), false)) {
+        return false;
+    }
 
     /* increment memory only sequence number after sending */
     nSequence++;
@@ -134,8 +172,25 @@ bool CZMQAbstractPublishNotifier::SendMessage(const char *command,
     return true;
 }
 
-bool CZMQPublishHashBlockNotifier::NotifyBlock(const CBlockIndex *pindex) {
-    uint256 hash = pindex->GetBlockHash();
+bool CZMQAbstractPublishNotifier::SendMessage(const char *command,
+                                              const CZMQPayload &payload) {
+    assert(psocket);
+
+    uint8_t msgseq[sizeof(uint32_t)];
+    WriteLE32(&msgseq[0], nSequence);
+    if (!zmq_send_part(psocket, command, strlen(command), true) ||
+        !zmq_send_part(psocket, payload, true) ||
+        !zmq_send_part(psocket, msgseq, sizeof(msgseq), false)) {
+        return false;
+    }
+
+    nSequence++;
+
+    return true;
+}
+
+bool CZMQPublishHashBlockNotifier::NotifyBlock(CZMQBlockNotification &block) {
+    uint256 hash = block.pindex->GetBlockHash();
     LogPrint(BCLog::ZMQ, "zmq: Publish hashblock %s\n", hash.GetHex());
     char data[32];
     for (unsigned int i = 0; i < 32; i++)
@@ -144,8 +199,8 @@ bool CZMQPublishHashBlockNotifier::NotifyBlock(const CBlockIndex *pindex) {
 }
 
 bool CZMQPublishHashTransactionNotifier::NotifyTransaction(
-    const CTransaction &transaction) {
-    uint256 txid = transaction.GetId();
+    CZMQTransactionNotification &tx) {
+    uint256 txid = tx.ptx->GetId();
     LogPrint(BCLog::ZMQ, "zmq: Publish hashtx %s\n", txid.GetHex());
     char data[32];
     for (unsigned int i = 0; i < 32; i++)
@@ -153,31 +208,76 @@ bool CZMQPublishHashTransactionNotifier::NotifyTransaction(
     return SendMessage(MSG_HASHTX, data, 32);
 }
 
-bool CZMQPublishRawBlockNotifier::NotifyBlock(const CBlockIndex *pindex) {
+bool CZMQPublishRawBlockNotifier::NotifyBlock(CZMQBlockNotification &block) {
     LogPrint(BCLog::ZMQ, "zmq: Publish rawblock %s\n",
-             pindex->GetBlockHash().GetHex());
-
-    const Config &config = GetConfig();
-    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION | RPCSerializationFlags());
-    {
-        LOCK(cs_main);
-        CBlock block;
-        if (!ReadBlockFromDisk(block, pindex, config)) {
-            zmqError("Can't read block from disk");
-            return false;
+             block.pindex->GetBlockHash().GetHex());
+
+    if (!block.raw) {
+        if (block.pblock) {
+            block.raw = SerializePayload(*block.pblock);
+        } else {
+            // The block was not handed over when it was connected.
+            CBlock blockRead;
+            if (!ReadBlockFromDisk(blockRead, block.pos, GetConfig()) ||
+                blockRead.GetHash() != block.pindex->GetBlockHash()) {
+                zmqError("Can't read block from disk");
+                return false;
+            }
+            block.raw = SerializePayload(blockRead);
         }
-
-        ss << block;
     }
 
-    return SendMessage(MSG_RAWBLOCK, &(*ss.begin()), ss.size());
+    return SendMessage(MSG_RAWBLOCK, block.raw);
 }
 
 bool CZMQPublishRawTransactionNotifier::NotifyTransaction(
-    const CTransaction &transaction) {
-    uint256 txid = transaction.GetId();
+    CZMQTransactionNotification &tx) {
+    uint256 txid = tx.ptx->GetId();
     LogPrint(BCLog::ZMQ, "zmq: Publish rawtx %s\n", txid.GetHex());
-    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION | RPCSerializationFlags());
-    ss << transaction;
-    return SendMessage(MSG_RAWTX, &(*ss.begin()), ss.size());
+    if (!tx.raw) {
+        tx.raw = SerializePayload(*tx.ptx);
+    }
+    return SendMessage(MSG_RAWTX, tx.raw);
+}
+
+bool CZMQPublishMempoolRemovedNotifier::NotifyTransactionRemoved(
+    const CZMQRemovalNotification &removal) {
+    uint256 txid = removal.ptx->GetId();
+    LogPrint(BCLog::ZMQ, "zmq: Publish mempoolremoved %s\n", txid.GetHex());
+    /* the transaction hash followed by the removal reason */
+    uint8_t data[33];
+    for (unsigned int i = 0; i < 32; i++)
+        data[31 - i] = txid.begin()[i];
+    data[32] = uint8_t(removal.reason);
+    return SendMessage(MSG_MEMPOOLREMOVED, data, sizeof(data));
+}
+
+// Block hash, LE 4byte height and the hash of every transaction in the block.
+static CZMQPayload SerializeBlockDelta(const CZMQBlockDeltaNotification &delta) {
+    std::vector<uint8_t> *pdata =
+        new std::vector<uint8_t>(36 + 32 * delta.vtxid.size());
+    CZMQPayload payload(pdata);
+    uint8_t *p = pdata->data();
+    std::reverse_copy(delta.hash.begin(), delta.hash.end(), p);
+    WriteLE32(p + 32, delta.nHeight);
+    p += 36;
+    for (const uint256 &txid : delta.vtxid) {
+        std::reverse_copy(txid.begin(), txid.end(), p);
+        p += 32;
+    }
+    return payload;
+}
+
+bool CZMQPublishBlockConnectedNotifier::NotifyBlockConnected(
+    const CZMQBlockDeltaNotification &delta) {
+    LogPrint(BCLog::ZMQ, "zmq: Publish blockconnected %s\n",
+             delta.hash.GetHex());
+    return SendMessage(MSG_BLOCKCONNECTED, SerializeBlockDelta(delta));
+}
+
+bool CZMQPublishBlockDisconnectedNotifier::NotifyBlockDisconnected(
+    const CZMQBlockDeltaNotification &delta) {
+    LogPrint(BCLog::ZMQ, "zmq: Publish blockdisconnected %s\n",
+             delta.hash.GetHex());
+    return SendMessage(MSG_BLOCKDISCONNECTED, SerializeBlockDelta(delta));
 }
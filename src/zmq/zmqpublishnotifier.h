@@ -22,6 +22,8 @@ public:
           * message sequence number
     */
     bool SendMessage(const char *command, const void *data, size_t size);
+    //! Send a payload without copying it.
+    bool SendMessage(const char *command, const CZMQPayload &payload);
 
     bool Initialize(void *pcontext) override;
     void Shutdown() override;
@@ -29,22 +31,40 @@ public:
 
 class CZMQPublishHashBlockNotifier : public CZMQAbstractPublishNotifier {
 public:
-    bool NotifyBlock(const CBlockIndex *pindex) override;
+    bool NotifyBlock(CZMQBlockNotification &block) override;
 };
 
 class CZMQPublishHashTransactionNotifier : public CZMQAbstractPublishNotifier {
 public:
-    bool NotifyTransaction(const CTransaction &transaction) override;
+    bool NotifyTransaction(CZMQTransactionNotification &tx) override;
 };
 
 class CZMQPublishRawBlockNotifier : public CZMQAbstractPublishNotifier {
 public:
-    bool NotifyBlock(const CBlockIndex *pindex) override;
+    bool NotifyBlock(CZMQBlockNotification &block) override;
 };
 
 class CZMQPublishRawTransactionNotifier : public CZMQAbstractPublishNotifier {
 public:
-    bool NotifyTransaction(const CTransaction &transaction) override;
+    bool NotifyTransaction(CZMQTransactionNotification &tx) override;
+};
+
+class CZMQPublishMempoolRemovedNotifier : public CZMQAbstractPublishNotifier {
+public:
+    bool
+    NotifyTransactionRemoved(const CZMQRemovalNotification &removal) override;
+};
+
+class CZMQPublishBlockConnectedNotifier : public CZMQAbstractPublishNotifier {
+public:
+    bool NotifyBlockConnected(const CZMQBlockDeltaNotification &delta) override;
+};
+
+class CZMQPublishBlockDisconnectedNotifier
+    : public CZMQAbstractPublishNotifier {
+public:
+    bool
+    NotifyBlockDisconnected(const CZMQBlockDeltaNotification &delta) override;
 };
 
 #endif // BITCOIN_ZMQ_ZMQPUBLISHNOTIFIER_H
@@ -70,6 +70,17 @@ class InvalidateTest(BitcoinTestFramework):
             raise AssertionError(
                 "Node 1 reorged to a lower height: %d" % node1height)
 
+        self.log.info(
+            "Invalidate more blocks than are disconnected in one batch")
+        disconnect_nodes(self.nodes[2], 1)
+        self.nodes[2].generate(300)
+        assert_equal(self.nodes[2].getblockcount(), 303)
+        hash4 = self.nodes[2].getblockhash(4)
+        self.nodes[2].invalidateblock(hash4)
+        assert_equal(self.nodes[2].getblockcount(), 3)
+        self.nodes[2].reconsiderblock(hash4)
+        assert_equal(self.nodes[2].getblockcount(), 303)
+
 
 if __name__ == '__main__':
     InvalidateTest().main()
@@ -0,0 +1,81 @@
+#!/usr/bin/env python3
+# Copyright (c) 2018 The Bitcoin developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+from test_framework.mininode import *
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import *
+import time
+
+'''
+AddrRateLimitTest -- test that addresses sent by inbound peers are rate
+limited by a token bucket, unless the peer is whitelisted.
+'''
+
+
+class TestNode(SingleNodeConnCB):
+
+    def __init__(self):
+        SingleNodeConnCB.__init__(self)
+
+    def send_addrs(self, first, count):
+        msg = msg_addr()
+        now = int(time.time())
+        for i in range(first, first + count):
+            addr = CAddress()
+            addr.time = now
+            addr.nServices = NODE_NETWORK
+            addr.ip = "123.%i.%i.1" % (i // 256, i % 256)
+            addr.port = 8333
+            msg.addrs.append(addr)
+        self.send_message(msg)
+        self.sync_with_ping()
+
+
+class AddrRateLimitTest(BitcoinTestFramework):
+
+    def __init__(self):
+        super().__init__()
+        self.num_nodes = 2
+        self.setup_clean_chain = True
+        self.extra_args = [[], ["-whitelist=127.0.0.1"]]
+
+    def setup_network(self):
+        # The nodes are not connected to each other.
+        self.setup_nodes()
+
+    def get_addr_stats(self, node):
+        peerinfo = node.getpeerinfo()
+        assert_equal(len(peerinfo), 1)
+        return peerinfo[0]["addr_processed"], peerinfo[0]["addr_rate_limited"]
+
+    def run_test(self):
+        test_nodes = [TestNode(), TestNode()]
+        connect_time = time.time()
+        for i in range(self.num_nodes):
+            connection = NodeConn(
+                '127.0.0.1', p2p_port(i), self.nodes[i], test_nodes[i])
+            test_nodes[i].add_connection(connection)
+        NetworkThread().start()
+        for test_node in test_nodes:
+            test_node.wait_for_verack()
+
+        self.log.info("Check that addresses beyond the bucket are dropped")
+        test_nodes[0].send_addrs(0, 1000)
+        processed, rate_limited = self.get_addr_stats(self.nodes[0])
+        assert_equal(processed + rate_limited, 1000)
+        # One token to start with, and 0.1 more per second since the peer
+        # connected.
+        assert_greater_than_or_equal(
+            1 + 0.1 * (time.time() - connect_time), processed)
+        assert_greater_than_or_equal(processed, 1)
+
+        self.log.info("Check that whitelisted peers are not rate limited")
+        test_nodes[1].send_addrs(0, 1000)
+        test_nodes[1].send_addrs(1000, 1000)
+        assert_equal(self.get_addr_stats(self.nodes[1]), (2000, 0))
+
+
+if __name__ == '__main__':
+    AddrRateLimitTest().main()
@@ -0,0 +1,169 @@
+#!/usr/bin/env python3
+# Copyright (c) 2018 The Bitcoin developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+from test_framework.mininode import *
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import *
+
+import http.client
+import json
+import urllib.parse
+
+'''
+BlockFiltersTest -- test that getcfilters, getcfheaders and getcfcheckpt are
+answered from the block filter index, and that peers asking for a filter type
+or a range of blocks that can't be served are disconnected.
+'''
+
+
+class TestNode(SingleNodeConnCB):
+
+    def __init__(self):
+        SingleNodeConnCB.__init__(self)
+        self.cfilters = []
+        self.last_cfheaders = None
+        self.last_cfcheckpt = None
+        self.disconnected = False
+
+    def on_cfilter(self, conn, message):
+        self.cfilters.append(message)
+
+    def on_cfheaders(self, conn, message):
+        self.last_cfheaders = message
+
+    def on_cfcheckpt(self, conn, message):
+        self.last_cfcheckpt = message
+
+    def on_close(self, conn):
+        self.disconnected = True
+
+    def wait_for_disconnect(self, timeout=60):
+        def test_function(): return self.disconnected
+        assert(wait_until(test_function, timeout=timeout))
+
+
+class BlockFiltersTest(BitcoinTestFramework):
+
+    def __init__(self):
+        super().__init__()
+        self.num_nodes = 2
+        self.setup_clean_chain = True
+        self.extra_args = [["-blockfilterindex", "-peerblockfilters"], []]
+
+    def setup_network(self):
+        # The nodes are not connected to each other.
+        self.setup_nodes()
+
+    def rest_get(self, path):
+        url = urllib.parse.urlparse(self.nodes[0].url)
+        conn = http.client.HTTPConnection(url.hostname, url.port)
+        conn.request('GET', path)
+        response = conn.getresponse()
+        assert_equal(response.status, 200)
+        return response.read()
+
+    def get_filter(self, block_hash):
+        return self.rest_get("/rest/blockfilter/basic/%s.bin" % block_hash)
+
+    def get_filter_headers(self, block_hash, count):
+        return [int(h, 16) for h in json.loads(self.rest_get(
+            "/rest/blockfilterheaders/basic/%i/%s.json" % (count, block_hash)).decode('utf-8'))]
+
+    def connect_peer(self, node_index=0):
+        peer = TestNode()
+        connection = NodeConn('127.0.0.1', p2p_port(node_index),
+                              self.nodes[node_index], peer,
+                              services=NODE_NETWORK | NODE_COMPACT_FILTERS)
+        peer.add_connection(connection)
+        return peer
+
+    def check_disconnect(self, message, node_index=0):
+        peer = self.connect_peer(node_index)
+        peer.wait_for_verack()
+        peer.send_message(message)
+        peer.wait_for_disconnect()
+
+    def run_test(self):
+        node = self.nodes[0]
+        # Enough blocks for a checkpoint, and for a getcfilters range that is
+        # too large.
+        node.generate(1010)
+        tip_hash = node.getbestblockhash()
+        assert(wait_until(lambda: len(self.get_filter_headers(
+            tip_hash, 1)) == 1, timeout=60))
+        genesis_hash = node.getblockhash(0)
+        headers = self.get_filter_headers(genesis_hash, 2000)
+        assert_equal(len(headers), 1011)
+
+        peer = self.connect_peer()
+        NetworkThread().start()
+        peer.wait_for_verack()
+
+        self.log.info("Check that cfilter messages match the index")
+        stop_hash = node.getblockhash(1000)
+        peer.send_message(msg_getcfilters(0, 990, int(stop_hash, 16)))
+        peer.sync_with_ping()
+        with mininode_lock:
+            cfilters = peer.cfilters
+            peer.cfilters = []
+        assert_equal(len(cfilters), 11)
+        for height, cfilter in enumerate(cfilters, 990):
+            block_hash = node.getblockhash(height)
+            assert_equal(cfilter.filter_type, 0)
+            assert_equal(cfilter.block_hash, int(block_hash, 16))
+            assert_equal(cfilter.filter, self.get_filter(block_hash))
+
+        self.log.info("Check that cfheaders chain up to the index headers")
+        peer.send_message(msg_getcfheaders(0, 1, int(tip_hash, 16)))
+        peer.sync_with_ping()
+        with mininode_lock:
+            cfheaders = peer.last_cfheaders
+        assert_equal(cfheaders.filter_type, 0)
+        assert_equal(cfheaders.stop_hash, int(tip_hash, 16))
+        assert_equal(cfheaders.prev_header, headers[0])
+        assert_equal(len(cfheaders.filter_hashes), 1010)
+        prev_header = cfheaders.prev_header
+        for height, filter_hash in enumerate(cfheaders.filter_hashes, 1):
+            prev_header = uint256_from_str(hash256(
+                ser_uint256(filter_hash) + ser_uint256(prev_header)))
+            assert_equal(prev_header, headers[height])
+        for height, cfilter in enumerate(cfilters, 990):
+            assert_equal(cfheaders.filter_hashes[height - 1],
+                         uint256_from_str(hash256(cfilter.filter)))
+
+        self.log.info("Check that cfcheckpt has one header per 1000 blocks")
+        peer.send_message(msg_getcfcheckpt(0, int(tip_hash, 16)))
+        peer.sync_with_ping()
+        with mininode_lock:
+            cfcheckpt = peer.last_cfcheckpt
+        assert_equal(cfcheckpt.filter_type, 0)
+        assert_equal(cfcheckpt.stop_hash, int(tip_hash, 16))
+        assert_equal(cfcheckpt.headers, [headers[1000]])
+
+        self.log.info("Check that bad requests disconnect the peer")
+        self.check_disconnect(msg_getcfilters(1, 0, int(stop_hash, 16)))
+        self.check_disconnect(msg_getcfheaders(0, 0, 0x1234))
+        self.check_disconnect(msg_getcfcheckpt(0, 0x1234))
+        # The start height is above the stop block.
+        self.check_disconnect(msg_getcfilters(0, 1001, int(stop_hash, 16)))
+        self.check_disconnect(msg_getcfheaders(0, 1001, int(stop_hash, 16)))
+        # 1001 filters are more than a single request may ask for.
+        self.check_disconnect(msg_getcfilters(0, 0, int(stop_hash, 16)))
+        # The stop block left the active chain.
+        node.invalidateblock(tip_hash)
+        self.check_disconnect(msg_getcfcheckpt(0, int(tip_hash, 16)))
+        node.reconsiderblock(tip_hash)
+        assert_equal(node.getbestblockhash(), tip_hash)
+        # The node does not serve filters without -peerblockfilters.
+        self.check_disconnect(msg_getcfilters(
+            0, 0, int(self.nodes[1].getblockhash(0), 16)), node_index=1)
+
+        # The well-behaved peer is still connected.
+        assert(not peer.disconnected)
+        assert(peer.sync_with_ping())
+
+
+if __name__ == '__main__':
+    BlockFiltersTest().main()
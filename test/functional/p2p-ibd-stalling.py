@@ -0,0 +1,105 @@
+#!/usr/bin/env python3
+# Copyright (c) 2018 The Bitcoin developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+from test_framework.mininode import *
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import *
+from test_framework.blocktools import create_block, create_coinbase
+
+'''
+IBDStallingTest -- test that when a peer holds up the block download window
+during initial block download, the blocks it was asked for are requested from
+other peers, and not handed back to the stalling peer.
+'''
+
+# More blocks than the download window, so that the window fills up.
+NUM_BLOCKS = 1100
+
+
+class TestNode(SingleNodeConnCB):
+
+    def __init__(self, blocks, serve_blocks):
+        SingleNodeConnCB.__init__(self)
+        self.blocks = blocks
+        self.serve_blocks = serve_blocks
+        self.block_requests = {}
+
+    def on_getdata(self, conn, message):
+        for inv in message.inv:
+            if inv.type != 2:
+                continue
+            self.block_requests[inv.hash] = self.block_requests.get(
+                inv.hash, 0) + 1
+            if self.serve_blocks:
+                conn.send_message(msg_block(self.blocks[inv.hash]))
+
+    def send_headers(self, blocks):
+        msg = msg_headers()
+        msg.headers = [CBlockHeader(b) for b in blocks]
+        self.send_message(msg)
+        self.sync_with_ping()
+
+
+class IBDStallingTest(BitcoinTestFramework):
+
+    def __init__(self):
+        super().__init__()
+        self.num_nodes = 1
+        self.setup_clean_chain = True
+
+    def run_test(self):
+        node = self.nodes[0]
+
+        # The blocks are timestamped in the past, so the node stays in
+        # initial block download.
+        tip = int(node.getbestblockhash(), 16)
+        block_time = node.getblock(node.getbestblockhash())['time'] + 1
+        blocks = []
+        for height in range(1, NUM_BLOCKS + 1):
+            block = create_block(tip, create_coinbase(height), block_time)
+            block.solve()
+            blocks.append(block)
+            tip = block.sha256
+            block_time += 1
+        blocks_by_hash = {b.sha256: b for b in blocks}
+        stall_block = blocks[0].sha256
+
+        staller = TestNode(blocks_by_hash, False)
+        helpers = [TestNode(blocks_by_hash, True) for _ in range(2)]
+        for peer in [staller] + helpers:
+            connection = NodeConn('127.0.0.1', p2p_port(0), node, peer)
+            peer.add_connection(connection)
+        NetworkThread().start()
+        for peer in [staller] + helpers:
+            peer.wait_for_verack()
+
+        self.log.info("Check that the first blocks are requested from the "
+                      "first peer to announce them")
+        staller.send_headers(blocks)
+        assert(wait_until(lambda: len(staller.block_requests) == 16,
+                          timeout=30))
+        with mininode_lock:
+            assert(stall_block in staller.block_requests)
+
+        self.log.info("Check that the stalled blocks are requested from the "
+                      "other peers once the window is full")
+        for peer in helpers:
+            peer.send_headers(blocks)
+        assert(wait_until(lambda: any(
+            stall_block in peer.block_requests for peer in helpers),
+            timeout=60))
+
+        self.log.info("Check that the node syncs without asking the staller "
+                      "for its blocks again")
+        assert(wait_until(
+            lambda: node.getbestblockhash() == blocks[-1].hash, timeout=120))
+        with mininode_lock:
+            assert_equal(staller.block_requests[stall_block], 1)
+            assert_equal(sum(peer.block_requests.get(stall_block, 0)
+                             for peer in helpers), 1)
+
+
+if __name__ == '__main__':
+    IBDStallingTest().main()
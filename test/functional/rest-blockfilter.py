@@ -0,0 +1,120 @@
+#!/usr/bin/env python3
+# Copyright (c) 2018 The Bitcoin developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#
+# Test the /rest/blockfilter and /rest/blockfilterheaders endpoints.
+#
+from test_framework.mininode import hash256, ser_uint256, uint256_from_str
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import (
+    assert_equal,
+    hex_str_to_bytes,
+)
+
+import http.client
+import json
+import time
+import urllib.parse
+
+
+class RESTBlockFilterTest(BitcoinTestFramework):
+
+    def __init__(self):
+        super().__init__()
+        self.setup_clean_chain = True
+        self.num_nodes = 2
+        self.extra_args = [["-blockfilterindex", "-peerblockfilters"], []]
+
+    def setup_network(self):
+        # The nodes are not connected to each other.
+        self.setup_nodes()
+
+    def http_get(self, node, path, status=200):
+        url = urllib.parse.urlparse(node.url)
+        conn = http.client.HTTPConnection(url.hostname, url.port)
+        conn.request('GET', path)
+        response = conn.getresponse()
+        assert_equal(response.status, status)
+        return response.read()
+
+    def get_json(self, path):
+        return json.loads(self.http_get(self.nodes[0], path).decode('utf-8'))
+
+    def run_test(self):
+        node = self.nodes[0]
+        node.generate(200)
+        # Spend a coinbase, so that the filters hold spent outputs too.
+        node.sendtoaddress(node.getnewaddress(), 1)
+        node.generate(1)
+        tip_hash = node.getbestblockhash()
+        genesis_hash = node.getblockhash(0)
+
+        for _ in range(300):
+            if len(self.get_json("/rest/blockfilterheaders/basic/1/%s.json" %
+                                 tip_hash)) == 1:
+                break
+            time.sleep(0.1)
+
+        self.log.info("Check that the filter formats agree")
+        for height in [0, 100, 201]:
+            block_hash = node.getblockhash(height)
+            path = "/rest/blockfilter/basic/%s" % block_hash
+            json_filter = self.get_json(path + ".json")
+            assert_equal(json_filter["blockhash"], block_hash)
+            bin_filter = self.http_get(node, path + ".bin")
+            hex_filter = self.http_get(node, path + ".hex").decode('utf-8')
+            assert_equal(hex_str_to_bytes(json_filter["filter"]), bin_filter)
+            assert_equal(hex_filter, json_filter["filter"] + "\n")
+
+        self.log.info("Check that the headers chain the filters")
+        headers = [int(h, 16) for h in self.get_json(
+            "/rest/blockfilterheaders/basic/2000/%s.json" % genesis_hash)]
+        assert_equal(len(headers), 202)
+        prev_header = 0
+        for height, header in enumerate(headers):
+            block_filter = self.http_get(
+                node, "/rest/blockfilter/basic/%s.bin" %
+                node.getblockhash(height))
+            prev_header = uint256_from_str(hash256(
+                hash256(block_filter) + ser_uint256(prev_header)))
+            assert_equal(header, prev_header)
+
+        # The headers stop at the tip, and start at the given block.
+        path = "/rest/blockfilterheaders/basic/5/%s" % node.getblockhash(199)
+        assert_equal([int(h, 16) for h in self.get_json(path + ".json")],
+                     headers[199:])
+        bin_headers = self.http_get(node, path + ".bin")
+        assert_equal(bin_headers,
+                     b"".join(ser_uint256(h) for h in headers[199:]))
+        assert_equal(self.http_get(node, path + ".hex").decode('utf-8'),
+                     bin_headers.hex() + "\n")
+
+        self.log.info("Check bad requests")
+        self.http_get(node, "/rest/blockfilter/basic/%s.json" % ("ab" * 32),
+                      404)
+        self.http_get(node, "/rest/blockfilter/extended/%s.json" % tip_hash,
+                      400)
+        self.http_get(node, "/rest/blockfilter/basic/nothex.json", 400)
+        self.http_get(node, "/rest/blockfilter/basic.json", 400)
+        self.http_get(
+            node, "/rest/blockfilterheaders/basic/0/%s.json" % tip_hash, 400)
+        self.http_get(
+            node, "/rest/blockfilterheaders/basic/2001/%s.json" % tip_hash,
+            400)
+        self.http_get(node, "/rest/blockfilterheaders/basic/%s.json" %
+                      tip_hash, 400)
+        # Headers of an unknown block are empty.
+        assert_equal(self.get_json(
+            "/rest/blockfilterheaders/basic/1/%s.json" % ("ab" * 32)), [])
+
+        self.log.info("Check that the index must be enabled")
+        self.http_get(self.nodes[1], "/rest/blockfilter/basic/%s.json" %
+                      self.nodes[1].getblockhash(0), 404)
+        self.http_get(self.nodes[1], "/rest/blockfilterheaders/basic/1/%s.json"
+                      % self.nodes[1].getblockhash(0), 404)
+
+
+if __name__ == '__main__':
+    RESTBlockFilterTest().main()
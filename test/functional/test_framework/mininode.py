@@ -55,6 +55,7 @@ NODE_BLOOM = (1 << 2)
 NODE_WITNESS = (1 << 3)
 NODE_XTHIN = (1 << 4)
 NODE_BITCOIN_CASH = (1 << 5)
+NODE_COMPACT_FILTERS = (1 << 6)
 
 # Howmuch data will be read from the network at once
 READ_BUFFER_SIZE = 8192
@@ -241,11 +242,19 @@ def ToHex(obj):
 class CAddress(object):
 
     def __init__(self):
+        self.time = 0
         self.nServices = 1
         self.pchReserved = b"\x00" * 10 + b"\xff" * 2
         self.ip = "0.0.0.0"
         self.port = 0
 
+    def deserialize_with_time(self, f):
+        self.time = struct.unpack("<I", f.read(4))[0]
+        self.deserialize(f)
+
+    def serialize_with_time(self):
+        return struct.pack("<I", self.time) + self.serialize()
+
     def deserialize(self, f):
         self.nServices = struct.unpack("<Q", f.read(8))[0]
         self.pchReserved = f.read(12)
@@ -1086,10 +1095,15 @@ class msg_addr(object):
         self.addrs = []
 
     def deserialize(self, f):
-        self.addrs = deser_vector(f, CAddress)
+        # Addresses in addr messages are prefixed with their time.
+        self.addrs = []
+        for i in range(deser_compact_size(f)):
+            addr = CAddress()
+            addr.deserialize_with_time(f)
+            self.addrs.append(addr)
 
     def serialize(self):
-        return ser_vector(self.addrs)
+        return ser_vector(self.addrs, "serialize_with_time")
 
     def __repr__(self):
         return "msg_addr(addrs=%s)" % (repr(self.addrs))
@@ -1536,6 +1550,133 @@ class msg_witness_blocktxn(msg_blocktxn):
         r += self.block_transactions.serialize(with_witness=True)
         return r
 
+
+class msg_getcfilters(object):
+    command = b"getcfilters"
+
+    def __init__(self, filter_type=0, start_height=0, stop_hash=0):
+        self.filter_type = filter_type
+        self.start_height = start_height
+        self.stop_hash = stop_hash
+
+    def deserialize(self, f):
+        self.filter_type = struct.unpack("<B", f.read(1))[0]
+        self.start_height = struct.unpack("<I", f.read(4))[0]
+        self.stop_hash = deser_uint256(f)
+
+    def serialize(self):
+        r = b""
+        r += struct.pack("<B", self.filter_type)
+        r += struct.pack("<I", self.start_height)
+        r += ser_uint256(self.stop_hash)
+        return r
+
+    def __repr__(self):
+        return "msg_getcfilters(filter_type=%i, start_height=%i, stop_hash=%064x)" % (self.filter_type, self.start_height, self.stop_hash)
+
+
+class msg_cfilter(object):
+    command = b"cfilter"
+
+    def __init__(self):
+        self.filter_type = 0
+        self.block_hash = 0
+        self.filter = b""
+
+    def deserialize(self, f):
+        self.filter_type = struct.unpack("<B", f.read(1))[0]
+        self.block_hash = deser_uint256(f)
+        self.filter = deser_string(f)
+
+    def serialize(self):
+        r = b""
+        r += struct.pack("<B", self.filter_type)
+        r += ser_uint256(self.block_hash)
+        r += ser_string(self.filter)
+        return r
+
+    def __repr__(self):
+        return "msg_cfilter(filter_type=%i, block_hash=%064x, filter=%s)" % (self.filter_type, self.block_hash, bytes_to_hex_str(self.filter))
+
+
+class msg_getcfheaders(msg_getcfilters):
+    command = b"getcfheaders"
+
+    def __repr__(self):
+        return "msg_getcfheaders(filter_type=%i, start_height=%i, stop_hash=%064x)" % (self.filter_type, self.start_height, self.stop_hash)
+
+
+class msg_cfheaders(object):
+    command = b"cfheaders"
+
+    def __init__(self):
+        self.filter_type = 0
+        self.stop_hash = 0
+        self.prev_header = 0
+        self.filter_hashes = []
+
+    def deserialize(self, f):
+        self.filter_type = struct.unpack("<B", f.read(1))[0]
+        self.stop_hash = deser_uint256(f)
+        self.prev_header = deser_uint256(f)
+        self.filter_hashes = deser_uint256_vector(f)
+
+    def serialize(self):
+        r = b""
+        r += struct.pack("<B", self.filter_type)
+        r += ser_uint256(self.stop_hash)
+        r += ser_uint256(self.prev_header)
+        r += ser_uint256_vector(self.filter_hashes)
+        return r
+
+    def __repr__(self):
+        return "msg_cfheaders(filter_type=%i, stop_hash=%064x, prev_header=%064x, filter_hashes=%s)" % (self.filter_type, self.stop_hash, self.prev_header, repr(self.filter_hashes))
+
+
+class msg_getcfcheckpt(object):
+    command = b"getcfcheckpt"
+
+    def __init__(self, filter_type=0, stop_hash=0):
+        self.filter_type = filter_type
+        self.stop_hash = stop_hash
+
+    def deserialize(self, f):
+        self.filter_type = struct.unpack("<B", f.read(1))[0]
+        self.stop_hash = deser_uint256(f)
+
+    def serialize(self):
+        r = b""
+        r += struct.pack("<B", self.filter_type)
+        r += ser_uint256(self.stop_hash)
+        return r
+
+    def __repr__(self):
+        return "msg_getcfcheckpt(filter_type=%i, stop_hash=%064x)" % (self.filter_type, self.stop_hash)
+
+
+class msg_cfcheckpt(object):
+    command = b"cfcheckpt"
+
+    def __init__(self):
+        self.filter_type = 0
+        self.stop_hash = 0
+        self.headers = []
+
+    def deserialize(self, f):
+        self.filter_type = struct.unpack("<B", f.read(1))[0]
+        self.stop_hash = deser_uint256(f)
+        self.headers = deser_uint256_vector(f)
+
+    def serialize(self):
+        r = b""
+        r += struct.pack("<B", self.filter_type)
+        r += ser_uint256(self.stop_hash)
+        r += ser_uint256_vector(self.headers)
+        return r
+
+    def __repr__(self):
+        return "msg_cfcheckpt(filter_type=%i, stop_hash=%064x, headers=%s)" % (self.filter_type, self.stop_hash, repr(self.headers))
+
 # This is what a callback should look like for NodeConn
 # Reimplement the on_* functions to provide handling for events
 
@@ -1645,6 +1786,18 @@ class NodeConnCB(object):
 
     def on_blocktxn(self, conn, message): pass
 
+    def on_getcfilters(self, conn, message): pass
+
+    def on_cfilter(self, conn, message): pass
+
+    def on_getcfheaders(self, conn, message): pass
+
+    def on_cfheaders(self, conn, message): pass
+
+    def on_getcfcheckpt(self, conn, message): pass
+
+    def on_cfcheckpt(self, conn, message): pass
+
 # More useful callbacks and functions for NodeConnCB's which have a single
 # NodeConn
 
@@ -1707,7 +1860,13 @@ class NodeConn(asyncore.dispatcher):
         b"sendcmpct": msg_sendcmpct,
         b"cmpctblock": msg_cmpctblock,
         b"getblocktxn": msg_getblocktxn,
-        b"blocktxn": msg_blocktxn
+        b"blocktxn": msg_blocktxn,
+        b"getcfilters": msg_getcfilters,
+        b"cfilter": msg_cfilter,
+        b"getcfheaders": msg_getcfheaders,
+        b"cfheaders": msg_cfheaders,
+        b"getcfcheckpt": msg_getcfcheckpt,
+        b"cfcheckpt": msg_cfcheckpt
     }
 
     MAGIC_BYTES = {
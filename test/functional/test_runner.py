@@ -50,6 +50,7 @@ BASE_SCRIPTS = [
     'listtransactions.py',
     # vv Tests less than 60s vv
     'sendheaders.py',
+    'p2p-ibd-stalling.py',
     'zapwallettxes.py',
     'importmulti.py',
     'mempool_limit.py',
@@ -59,12 +60,15 @@ BASE_SCRIPTS = [
     'bip68-112-113-p2p.py',
     'rawtransactions.py',
     'reindex.py',
+    'txindex.py',
+    'p2p-blockfilters.py',
     # vv Tests less than 30s vv
     'mempool_resurrect_test.py',
     'txn_doublespend.py --mineblock',
     'txn_clone.py',
     'getchaintips.py',
     'rest.py',
+    'rest-blockfilter.py',
     'mempool_spendcoinbase.py',
     'mempool_reorg.py',
     'httpbasics.py',
@@ -77,6 +81,7 @@ BASE_SCRIPTS = [
     'disablewallet.py',
     'keypool.py',
     'p2p-mempool.py',
+    'p2p-addr-ratelimit.py',
     'prioritise_transaction.py',
     'high_priority_transaction.py',
     'invalidblockrequest.py',
@@ -0,0 +1,73 @@
+#!/usr/bin/env python3
+# Copyright (c) 2018 The Bitcoin developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#
+# Test enabling -txindex on an existing chain builds the index in the
+# background, without -reindex.
+#
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import (
+    assert_equal,
+    assert_raises_jsonrpc,
+    start_node,
+    stop_node,
+)
+from decimal import Decimal
+import time
+
+
+class TxIndexTest(BitcoinTestFramework):
+
+    def __init__(self):
+        super().__init__()
+        self.setup_clean_chain = True
+        self.num_nodes = 1
+
+    def run_test(self):
+        node = self.nodes[0]
+        node.generate(101)
+
+        # Fully spend the first coinbase, so that it can only be found
+        # through the transaction index.
+        block = node.getblock(node.getblockhash(1))
+        txid = block["tx"][0]
+        rawtx = node.createrawtransaction(
+            [{"txid": txid, "vout": 0}],
+            {node.getnewaddress(): Decimal("49.99")})
+        signed = node.signrawtransaction(rawtx)
+        node.sendrawtransaction(signed["hex"])
+        node.generate(1)
+        assert_raises_jsonrpc(-5, "No such mempool transaction",
+                              node.getrawtransaction, txid)
+
+        self.log.info("Restart with -txindex")
+        blockcount = node.getblockcount()
+        stop_node(node, 0)
+        self.nodes[0] = start_node(0, self.options.tmpdir, ["-txindex"])
+        node = self.nodes[0]
+        assert_equal(node.getblockcount(), blockcount)
+
+        for _ in range(300):
+            try:
+                node.getrawtransaction(txid)
+                break
+            except Exception:
+                time.sleep(0.1)
+        assert_equal(node.getrawtransaction(txid, True)["txid"], txid)
+
+        self.log.info("New blocks are indexed")
+        node.generate(1)
+        newtxid = node.getblock(node.getbestblockhash())["tx"][0]
+        assert_equal(node.getrawtransaction(newtxid, True)["txid"], newtxid)
+
+        self.log.info("Restart without -txindex")
+        stop_node(node, 0)
+        self.nodes[0] = start_node(0, self.options.tmpdir)
+        assert_raises_jsonrpc(-5, "No such mempool transaction",
+                              self.nodes[0].getrawtransaction, txid)
+
+
+if __name__ == '__main__':
+    TxIndexTest().main()
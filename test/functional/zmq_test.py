@@ -28,8 +28,17 @@ class ZMQTest (BitcoinTestFramework):
         self.zmqSubSocket.setsockopt(zmq.SUBSCRIBE, b"hashtx")
         ip_address = "tcp://127.0.0.1:28332"
         self.zmqSubSocket.connect(ip_address)
+        self.zmqDeltaSocket = self.zmqContext.socket(zmq.SUB)
+        self.zmqDeltaSocket.set(zmq.RCVTIMEO, 60000)
+        self.zmqDeltaSocket.setsockopt(zmq.SUBSCRIBE, b"block")
+        self.zmqDeltaSocket.setsockopt(zmq.SUBSCRIBE, b"mempoolremoved")
+        delta_address = "tcp://127.0.0.1:28333"
+        self.zmqDeltaSocket.connect(delta_address)
         extra_args = [
-            ['-zmqpubhashtx=%s' % ip_address, '-zmqpubhashblock=%s' % ip_address], []]
+            ['-zmqpubhashtx=%s' % ip_address, '-zmqpubhashblock=%s' % ip_address,
+             '-zmqpubblockconnected=%s' % delta_address,
+             '-zmqpubblockdisconnected=%s' % delta_address,
+             '-zmqpubmempoolremoved=%s' % delta_address], []]
         self.nodes = start_nodes(
             self.num_nodes, self.options.tmpdir, extra_args)
 
@@ -102,6 +111,61 @@ class ZMQTest (BitcoinTestFramework):
         # txid from sendtoaddress must be equal to the hash received over zmq
         assert_equal(hashRPC, hashZMQ)
 
+        self._zmq_delta_test(genhashes, hashRPC)
+
+    def recv_delta(self, expected_topic, expected_sequence):
+        msg = self.zmqDeltaSocket.recv_multipart()
+        assert_equal(msg[0], expected_topic)
+        assert_equal(struct.unpack('<I', msg[-1])[-1], expected_sequence)
+        return msg[1]
+
+    def recv_block_delta(self, topic, sequence):
+        body = self.recv_delta(topic, sequence)
+        blockhash = bytes_to_hex_str(body[:32])
+        height = struct.unpack('<I', body[32:36])[0]
+        txids = [bytes_to_hex_str(body[i:i + 32])
+                 for i in range(36, len(body), 32)]
+        return blockhash, height, txids
+
+    def _zmq_delta_test(self, genhashes, txid):
+        # Every block connected so far was published, in order.
+        tipheight = self.nodes[0].getblockcount()
+        for x in range(len(genhashes) + 1):
+            blockhash, height, txids = self.recv_block_delta(
+                b"blockconnected", x)
+            assert_equal(height, tipheight - len(genhashes) + x)
+            assert_equal(blockhash, self.nodes[0].getblockhash(height))
+            assert_equal(txids, self.nodes[0].getblock(blockhash)["tx"])
+
+        # Confirming the transaction removes it from the mempool.
+        blockhash = self.nodes[1].generate(1)[0]
+        self.sync_all()
+        body = self.recv_delta(b"mempoolremoved", 0)
+        assert_equal(bytes_to_hex_str(body[:32]), txid)
+        # MemPoolRemovalReason::BLOCK
+        assert_equal(body[32], 4)
+        zmqhash, height, txids = self.recv_block_delta(
+            b"blockconnected", len(genhashes) + 1)
+        assert_equal(zmqhash, blockhash)
+        assert_equal(height, tipheight + 1)
+        assert(txid in txids)
+
+        # Disconnecting the block puts the transaction back, reconnecting it
+        # removes it again.
+        self.nodes[0].invalidateblock(blockhash)
+        zmqhash, height, txids = self.recv_block_delta(
+            b"blockdisconnected", 0)
+        assert_equal(zmqhash, blockhash)
+        assert(txid in txids)
+        assert(txid in self.nodes[0].getrawmempool())
+
+        self.nodes[0].reconsiderblock(blockhash)
+        body = self.recv_delta(b"mempoolremoved", 1)
+        assert_equal(bytes_to_hex_str(body[:32]), txid)
+        zmqhash, height, txids = self.recv_block_delta(
+            b"blockconnected", len(genhashes) + 2)
+        assert_equal(zmqhash, blockhash)
+
 
 if __name__ == '__main__':
     ZMQTest().main()